@@ -0,0 +1,285 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "abtest.h"
+#include "common.h"
+#include "ddr_domain.h"
+#include "log.h"
+
+#define TAG "ABTEST"
+
+// Running mean and variance of the per-epoch values, Welford
+struct abtest_stat_s {
+	int n;
+	double mean;
+	double m2;
+};
+
+int abtest_enabled;
+
+static struct abtest_stat_s abtest_stat[ABTEST_SIDES][ABTEST_METRICS];
+static int abtest_order;
+static int abtest_epoch_intervals;
+static unsigned int abtest_seed;
+static int abtest_pair_first;	// side of the first epoch of a random pair
+static int abtest_ddr;		// DDR traffic can be sampled
+
+// Running epoch
+static int abtest_epoch;
+static int abtest_side;
+static int abtest_pos;		// intervals done
+static uint64_t abtest_last_ns;
+static uint64_t abtest_last_ddr;
+static uint64_t abtest_ddr_samples;
+static uint64_t abtest_ns;	// counted intervals only
+static uint64_t abtest_instructions;
+static uint64_t abtest_cycles;
+static uint64_t abtest_ddr_bytes;
+
+static const char *abtest_side_names[ABTEST_SIDES] = { "baseline", "tuned" };
+
+static const char *abtest_metric_names[ABTEST_METRICS] = {
+	"G instr/s", "IPC", "DDR MB/s",
+};
+
+static uint64_t abtest_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Bytes read and written by all domains so far
+static uint64_t abtest_ddr_total(void)
+{
+	uint64_t bytes = 0;
+
+	for (int d = 0; d < num_ddr_domains; d++)
+		bytes += ddr_domain[d].rd_bytes + ddr_domain[d].wr_bytes;
+
+	return bytes;
+}
+
+static int abtest_side_of(int epoch)
+{
+	switch (abtest_order) {
+	case ABTEST_ORDER_ABBA:
+		return epoch % 4 == 1 || epoch % 4 == 2 ?
+		       ABTEST_TUNED : ABTEST_BASELINE;
+	case ABTEST_ORDER_RANDOM:
+		if (epoch % 2 == 0)
+			abtest_pair_first = rand_r(&abtest_seed) & 1;
+		return abtest_pair_first ^ (epoch % 2);
+	default:
+		return epoch % 2;
+	}
+}
+
+int abtest_parse_order(const char *name)
+{
+	if (strcmp(name, "alternate") == 0)
+		return ABTEST_ORDER_ALTERNATE;
+	if (strcmp(name, "abba") == 0)
+		return ABTEST_ORDER_ABBA;
+	if (strcmp(name, "random") == 0)
+		return ABTEST_ORDER_RANDOM;
+
+	return -1;
+}
+
+// Sets up the first epoch, see abtest.h
+int abtest_init(float epoch_s, int order)
+{
+	abtest_epoch_intervals = lroundf(epoch_s / time_intervall);
+	if (abtest_epoch_intervals < ABTEST_SETTLE + 1) {
+		loge(TAG, "Epochs of %.1f s are shorter than %d intervals\n",
+		     epoch_s, ABTEST_SETTLE + 1);
+		return -1;
+	}
+
+	memset(abtest_stat, 0, sizeof(abtest_stat));
+	abtest_order = order;
+	abtest_seed = time(NULL) ^ getpid();
+	abtest_ddr = 1;
+	abtest_epoch = 0;
+	abtest_side = abtest_side_of(0);
+	abtest_pos = 0;
+	abtest_last_ns = abtest_now_ns();
+	abtest_last_ddr = abtest_ddr_total();
+	abtest_ddr_samples = num_ddr_samples;
+	abtest_enabled = 1;
+
+	logi(TAG, "A/B test, epochs of %d intervals, starting %s\n",
+	     abtest_epoch_intervals, abtest_side_names[abtest_side]);
+
+	return 0;
+}
+
+int abtest_baseline(void)
+{
+	return abtest_enabled && abtest_side == ABTEST_BASELINE;
+}
+
+// Two-sided 95% quantile of Student's t distribution. A table for few
+// degrees of freedom, above it the Cornish-Fisher expansion around the
+// normal quantile, which is within 0.1% there.
+static double abtest_t95(double df)
+{
+	static const double table[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+	};
+	const double z = 1.959964;
+	double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z;
+
+	if (df < 1.0)
+		df = 1.0;
+	if (df < 10.0)
+		return table[(int)df - 1];
+
+	return z + (z3 + z) / (4 * df) +
+	       (5 * z5 + 16 * z3 + 3 * z) / (96 * df * df) +
+	       (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / (384 * df * df * df);
+}
+
+// Logs tuned against baseline for one metric, Welch's t-test
+static void abtest_compare(int metric)
+{
+	struct abtest_stat_s *a = &abtest_stat[ABTEST_BASELINE][metric];
+	struct abtest_stat_s *b = &abtest_stat[ABTEST_TUNED][metric];
+	double va, vb, se, df, diff, half;
+
+	if (a->n < 2 || b->n < 2 || a->mean == 0.0)
+		return;
+
+	va = a->m2 / (a->n - 1) / a->n;
+	vb = b->m2 / (b->n - 1) / b->n;
+	se = sqrt(va + vb);
+	diff = b->mean - a->mean;
+
+	// Welch-Satterthwaite, rounded down to be conservative
+	if (va + vb > 0.0)
+		df = floor((va + vb) * (va + vb) /
+			   (va * va / (a->n - 1) + vb * vb / (b->n - 1)));
+	else
+		df = a->n + b->n - 2;
+
+	half = abtest_t95(df) * se;
+
+	logi(TAG, "%-10s %12.3f %12.3f %+8.2f%% [%+7.2f%% %+7.2f%%] %s\n",
+	     abtest_metric_names[metric], a->mean, b->mean,
+	     diff * 100.0 / a->mean, (diff - half) * 100.0 / a->mean,
+	     (diff + half) * 100.0 / a->mean,
+	     diff - half > 0.0 || diff + half < 0.0 ? "significant" : "-");
+}
+
+// Logs the comparison, see abtest.h
+void abtest_report(void)
+{
+	int na = abtest_stat[ABTEST_BASELINE][ABTEST_IPC].n;
+	int nb = abtest_stat[ABTEST_TUNED][ABTEST_IPC].n;
+
+	if (!abtest_enabled)
+		return;
+
+	logi(TAG, "%d baseline and %d tuned epochs\n", na, nb);
+	if (na < 2 || nb < 2) {
+		logi(TAG, "At least two epochs of each side are needed\n");
+		return;
+	}
+
+	logi(TAG, "%-10s %12s %12s %9s %19s\n", "metric", "baseline", "tuned",
+	     "change", "95% CI");
+
+	for (int m = 0; m < ABTEST_METRICS; m++)
+		abtest_compare(m);
+}
+
+static void abtest_end_epoch(void)
+{
+	double value[ABTEST_METRICS];
+
+	if (abtest_ns == 0 || abtest_cycles == 0)
+		return;
+
+	value[ABTEST_INSTR_RATE] = (double)abtest_instructions / abtest_ns;
+	value[ABTEST_IPC] = (double)abtest_instructions / abtest_cycles;
+	value[ABTEST_DDR_MBPS] = abtest_ddr_bytes * 1e9 / abtest_ns /
+				 (1024 * 1024);
+
+	for (int m = 0; m < ABTEST_METRICS; m++) {
+		struct abtest_stat_s *s = &abtest_stat[abtest_side][m];
+		double delta;
+
+		if (m == ABTEST_DDR_MBPS && !abtest_ddr)
+			continue;
+
+		s->n++;
+		delta = value[m] - s->mean;
+		s->mean += delta / s->n;
+		s->m2 += delta * (value[m] - s->mean);
+	}
+
+	logv(TAG, "Epoch %d %s: %.3f G instr/s, IPC %.3f, DDR %.0f MB/s\n",
+	     abtest_epoch, abtest_side_names[abtest_side],
+	     value[ABTEST_INSTR_RATE], value[ABTEST_IPC],
+	     abtest_ddr ? value[ABTEST_DDR_MBPS] : 0.0);
+}
+
+// Counts one interval, see abtest.h
+void abtest_interval(void)
+{
+	uint64_t now_ns, ddr;
+
+	if (!abtest_enabled)
+		return;
+
+	now_ns = abtest_now_ns();
+
+	// The basic tuners sample the DDR PMU themselves, in baseline epochs
+	// and with MAB no one else does. RDT has no byte counts.
+	if (abtest_ddr && ddr_domain_update(&abtest_ddr_samples) < 0) {
+		logi(TAG, "No DDR PMU, DDR traffic is not compared\n");
+		abtest_ddr = 0;
+	}
+	ddr = abtest_ddr_total();
+
+	if (abtest_pos >= ABTEST_SETTLE) {
+		for (int i = 0; i < ACTIVE_THREADS; i++) {
+			abtest_instructions += gtinfo[i].instructions_retired;
+			abtest_cycles += gtinfo[i].cpu_cycles;
+		}
+		abtest_ns += now_ns - abtest_last_ns;
+		abtest_ddr_bytes += ddr - abtest_last_ddr;
+	}
+	abtest_last_ns = now_ns;
+	abtest_last_ddr = ddr;
+
+	if (++abtest_pos < abtest_epoch_intervals)
+		return;
+
+	abtest_end_epoch();
+
+	// A report after every pair of epochs
+	if (abtest_epoch % 2 == 1)
+		abtest_report();
+
+	abtest_epoch++;
+	abtest_side = abtest_side_of(abtest_epoch);
+	abtest_pos = 0;
+	abtest_ns = 0;
+	abtest_instructions = 0;
+	abtest_cycles = 0;
+	abtest_ddr_bytes = 0;
+
+	logd(TAG, "Epoch %d: %s\n", abtest_epoch,
+	     abtest_side_names[abtest_side]);
+
+	// Module leaders write the MSRs of the new side after this interval
+	for (int i = 0; i < ACTIVE_THREADS; i++)
+		gtinfo[i].hwpf_msr_dirty = 1;
+}
@@ -0,0 +1,703 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "cJSON.h"
+#include "coreset.h"
+#include "log.h"
+#include "topology.h"
+
+#define TAG "BENCH"
+
+#define BENCH_MB (1024 * 1024)
+#define BENCH_MAX_CONFIGS (16)
+#define BENCH_MAX_KERNELS (32)
+#define BENCH_MAX_DPF_ARGS (32)
+#define BENCH_MAB_ARM_CONFIGS (5) // arm_configuration 0 to 4, create_arms()
+#define BENCH_STOP_TIMEOUT_MS (5000)
+
+// One column of the table: no tuner, or dPF with one tuning algorithm
+struct bench_config_s {
+	char name[16];
+	int alg;		// --alg, -1 for the untuned baseline
+	int arm_configuration;	// MAB arms, -1 for the primitive tuners
+};
+
+struct bench_result_s {
+	int valid;
+	double mbps;		// all threads
+	double ns_per_access;	// average of the threads
+};
+
+// Threads of one run wait here until all of them are created, so the
+// barrier can be sized to the threads that actually started
+struct bench_gate_s {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int open;
+	int abort;		// a thread could not be started, give up
+	pthread_barrier_t barrier;
+};
+
+struct bench_thread_s {
+	pthread_t thread;
+	int core;
+	const struct bench_kernel_s *kernel;
+	const struct bench_args_s *args;
+	double run_s;
+	struct bench_gate_s *gate;
+	int failed;
+	struct bench_work_s work;
+	uint64_t elapsed_ns;
+};
+
+static struct bench_config_s configs[BENCH_MAX_CONFIGS];
+static int num_configs;
+static const struct bench_kernel_s *kernels[BENCH_MAX_KERNELS];
+static int num_kernels;
+static struct bench_result_s results[BENCH_MAX_CONFIGS][BENCH_MAX_KERNELS];
+
+static uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Runs passes of the kernel on one core until run_s has passed. Setup and a
+// warm-up pass are done before the barrier, so all threads measure the
+// same time window.
+static void *bench_thread(void *arg)
+{
+	struct bench_thread_s *t = arg;
+	struct bench_work_s warm = {0};
+	uint64_t start, deadline, now;
+	cpu_set_t set;
+	void *state;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->core, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		loge(TAG, "Could not pin to core %d\n", t->core);
+
+	state = t->kernel->setup(t->args);
+	if (state != NULL)
+		t->kernel->pass(state, &warm);
+
+	pthread_mutex_lock(&t->gate->lock);
+	while (!t->gate->open)
+		pthread_cond_wait(&t->gate->cond, &t->gate->lock);
+	pthread_mutex_unlock(&t->gate->lock);
+
+	if (t->gate->abort) {
+		if (state != NULL)
+			t->kernel->teardown(state);
+		t->failed = 1;
+		return NULL;
+	}
+
+	pthread_barrier_wait(&t->gate->barrier);
+
+	if (state == NULL) {
+		loge(TAG, "Out of memory on core %d\n", t->core);
+		t->failed = 1;
+		return NULL;
+	}
+
+	start = bench_now_ns();
+	deadline = start + (uint64_t)(t->run_s * 1e9);
+	do {
+		t->kernel->pass(state, &t->work);
+		now = bench_now_ns();
+	} while (now < deadline);
+
+	t->elapsed_ns = now - start;
+	t->kernel->teardown(state);
+
+	return NULL;
+}
+
+// Runs a kernel with one thread per core
+// Returns: 0, -1 on failure
+static int bench_run_kernel(const struct bench_kernel_s *kernel,
+			    const struct bench_args_s *args,
+			    const cpu_set_t *cores, double run_s,
+			    struct bench_result_s *result)
+{
+	struct bench_thread_s threads[MAX_NUM_CORES];
+	struct bench_gate_s gate;
+	int num = 0;
+	int ret = 0;
+
+	memset(result, 0, sizeof(*result));
+	memset(&gate, 0, sizeof(gate));
+	pthread_mutex_init(&gate.lock, NULL);
+	pthread_cond_init(&gate.cond, NULL);
+
+	for (int core = 0; core < MAX_NUM_CORES; core++) {
+		struct bench_thread_s *t = &threads[num];
+
+		if (!CPU_ISSET(core, cores))
+			continue;
+
+		memset(t, 0, sizeof(*t));
+		t->core = core;
+		t->kernel = kernel;
+		t->args = args;
+		t->run_s = run_s;
+		t->gate = &gate;
+		if (pthread_create(&t->thread, NULL, bench_thread, t) != 0) {
+			loge(TAG, "Could not start a thread on core %d\n", core);
+			gate.abort = 1;
+			break;
+		}
+		num++;
+	}
+
+	if (!gate.abort)
+		pthread_barrier_init(&gate.barrier, NULL, num);
+
+	pthread_mutex_lock(&gate.lock);
+	gate.open = 1;
+	pthread_cond_broadcast(&gate.cond);
+	pthread_mutex_unlock(&gate.lock);
+
+	for (int i = 0; i < num; i++) {
+		struct bench_thread_s *t = &threads[i];
+
+		pthread_join(t->thread, NULL);
+		if (t->failed || t->elapsed_ns == 0 || t->work.accesses == 0) {
+			ret = -1;
+			continue;
+		}
+
+		result->mbps += (double)t->work.bytes * 1e9 / t->elapsed_ns /
+				BENCH_MB;
+		result->ns_per_access += (double)t->elapsed_ns /
+					 t->work.accesses / num;
+	}
+
+	if (gate.abort)
+		ret = -1;
+	else
+		pthread_barrier_destroy(&gate.barrier);
+	pthread_cond_destroy(&gate.cond);
+	pthread_mutex_destroy(&gate.lock);
+	result->valid = ret == 0;
+
+	return ret;
+}
+
+// Writes mab_config.json into dir, the base config with another set of arms
+// Returns: 0, -1 on failure
+static int bench_write_mab_config(const char *base, const char *dir,
+				  int arm_configuration)
+{
+	char path[PATH_MAX];
+	char *text = NULL;
+	cJSON *root = NULL;
+	long size;
+	FILE *fp;
+	int ret = -1;
+
+	fp = fopen(base, "rb");
+	if (fp == NULL) {
+		loge(TAG, "Could not read the MAB config %s\n", base);
+		return -1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	text = size > 0 ? calloc(1, size + 1) : NULL;
+	if (text != NULL && fread(text, 1, size, fp) == (size_t)size)
+		root = cJSON_Parse(text);
+	fclose(fp);
+	free(text);
+
+	if (root == NULL) {
+		loge(TAG, "Could not parse the MAB config %s\n", base);
+		return -1;
+	}
+
+	cJSON_DeleteItemFromObject(root, "arm_configuration");
+	cJSON_AddNumberToObject(root, "arm_configuration", arm_configuration);
+	text = cJSON_Print(root);
+	cJSON_Delete(root);
+
+	snprintf(path, sizeof(path), "%s/mab_config.json", dir);
+	fp = text ? fopen(path, "w") : NULL;
+	if (fp != NULL) {
+		if (fputs(text, fp) >= 0)
+			ret = 0;
+		fclose(fp);
+	}
+	free(text);
+
+	if (ret < 0)
+		loge(TAG, "Could not write %s\n", path);
+
+	return ret;
+}
+
+// Starts dPF tuning the bench cores with the algorithm of a config, in dir
+// so MAB reads its own mab_config.json. Output goes to dir/<name>.log.
+// Returns: pid, -1 on failure
+static pid_t bench_dpf_start(const char *dpf, const char *dir,
+			     const struct bench_config_s *cfg,
+			     const char *core_list, char **extra, int num_extra)
+{
+	char *argv[BENCH_MAX_DPF_ARGS + 8];
+	char log_path[PATH_MAX];
+	char alg[8];
+	int argc = 0;
+	pid_t pid;
+
+	snprintf(alg, sizeof(alg), "%d", cfg->alg);
+	snprintf(log_path, sizeof(log_path), "%s/%s.log", dir, cfg->name);
+
+	argv[argc++] = (char *)dpf;
+	argv[argc++] = "--core";
+	argv[argc++] = (char *)core_list;
+	argv[argc++] = "--alg";
+	argv[argc++] = alg;
+	for (int i = 0; i < num_extra; i++)
+		argv[argc++] = extra[i];
+	argv[argc] = NULL;
+
+	pid = fork();
+	if (pid < 0) {
+		loge(TAG, "fork() failed\n");
+		return -1;
+	}
+
+	if (pid == 0) {
+		int fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		if (chdir(dir) < 0)
+			_exit(127);
+		execv(dpf, argv);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+// Stops dPF like Ctrl-C does, killed if it doesn't exit in time
+static void bench_dpf_stop(pid_t pid)
+{
+	kill(pid, SIGINT);
+
+	for (int ms = 0; ms < BENCH_STOP_TIMEOUT_MS; ms += 10) {
+		if (waitpid(pid, NULL, WNOHANG) == pid)
+			return;
+		usleep(10000);
+	}
+
+	loge(TAG, "dPF did not stop, killing it\n");
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+
+// The tuners write prefetcher MSRs of Atom E-cores, they run only if every
+// bench core is one, the MSRs can be opened and dPF is there
+// Returns: 1 if the tuners can run, 0 if not
+static int bench_tuners_usable(const cpu_set_t *cores, const char *dpf)
+{
+	char path[64];
+
+	for (int core = 0; core < topology.num_cpus; core++) {
+		int fd;
+
+		if (!CPU_ISSET(core, cores))
+			continue;
+
+		if (topology.cpu[core].type != TOPO_TYPE_ECORE) {
+			logi(TAG, "Core %d is no Atom E-core, tuners skipped\n",
+			     core);
+			return 0;
+		}
+
+		snprintf(path, sizeof(path), "/dev/cpu/%d/msr", core);
+		fd = open(path, O_RDWR);
+		if (fd < 0) {
+			logi(TAG, "No MSR access on core %d (%s), tuners "
+			     "skipped\n", core, strerror(errno));
+			return 0;
+		}
+		close(fd);
+	}
+
+	if (access(dpf, X_OK) < 0) {
+		logi(TAG, "No dPF binary %s, tuners skipped\n", dpf);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void bench_add_config(const char *name, int alg, int arm_configuration)
+{
+	struct bench_config_s *cfg = &configs[num_configs++];
+
+	snprintf(cfg->name, sizeof(cfg->name), "%s", name);
+	cfg->alg = alg;
+	cfg->arm_configuration = arm_configuration;
+}
+
+static void bench_print_table(int latency)
+{
+	printf("\n%s\n", latency ? "Time per access, ns (change vs baseline)" :
+	       "Throughput, MB/s (change vs baseline)");
+
+	printf("%-12s", "kernel");
+	for (int c = 0; c < num_configs; c++)
+		printf(" %18s", configs[c].name);
+	printf("\n");
+
+	for (int k = 0; k < num_kernels; k++) {
+		struct bench_result_s *base = &results[0][k];
+
+		printf("%-12s", kernels[k]->name);
+		for (int c = 0; c < num_configs; c++) {
+			struct bench_result_s *r = &results[c][k];
+			double value = latency ? r->ns_per_access : r->mbps;
+			double ref = latency ? base->ns_per_access : base->mbps;
+			char cell[32];
+
+			if (!r->valid)
+				snprintf(cell, sizeof(cell), "-");
+			else if (c == 0 || !base->valid || ref == 0.0)
+				snprintf(cell, sizeof(cell), "%.1f", value);
+			else
+				snprintf(cell, sizeof(cell), "%.1f %+5.1f%%",
+					 value, (value - ref) * 100.0 / ref);
+
+			printf(" %18s", cell);
+		}
+		printf("\n");
+	}
+}
+
+static int bench_write_csv(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (fp == NULL) {
+		loge(TAG, "Could not write %s\n", path);
+		return -1;
+	}
+
+	fprintf(fp, "kernel,config,mbps,ns_per_access\n");
+	for (int k = 0; k < num_kernels; k++)
+		for (int c = 0; c < num_configs; c++)
+			if (results[c][k].valid)
+				fprintf(fp, "%s,%s,%.1f,%.3f\n",
+					kernels[k]->name, configs[c].name,
+					results[c][k].mbps,
+					results[c][k].ns_per_access);
+	fclose(fp);
+
+	return 0;
+}
+
+static void print_usage(void)
+{
+	printf("dPF prefetcher benchmark. Runs memory kernels untuned and "
+	       "under every dPF tuner.\n");
+	printf(" -c --core - cores to run on, one thread each, default the "
+	       "first Atom E-core.\n");
+	printf("   --core 8-11\n");
+	printf(" -k --kernel - kernels to run, default all:\n");
+	for (int i = 0; i < bench_num_kernels; i++)
+		printf("   %-12s %s\n", bench_kernels[i].name,
+		       bench_kernels[i].description);
+	printf("   --kernel stream,chase\n");
+	printf(" -s --size - memory per thread in MB, default 64.\n");
+	printf(" -S --stride - stream kernel stride in bytes, a multiple of "
+	       "8, default 64.\n");
+	printf(" -n --streams - multistream kernel streams, 1 to %d, "
+	       "default 8.\n", BENCH_MAX_STREAMS);
+	printf(" -t --time - seconds per kernel and configuration, "
+	       "default 3.\n");
+	printf(" -w --warmup - seconds dPF tunes before the kernels start, "
+	       "default 5.\n");
+	printf(" -d --dpf - dPF binary, default ./dpf.\n");
+	printf(" -m --mab-config - MAB config the arm configurations are "
+	       "applied to, default mab_config.json.\n");
+	printf(" -x --dpf-arg - extra dPF argument, repeatable.\n");
+	printf("   -x --ddrbw-set -x 46000\n");
+	printf(" -b --baseline - only the untuned run.\n");
+	printf(" -o --csv - also write the results to a CSV file.\n");
+	printf(" -l --log - log level 1 - 5, default 3.\n");
+	printf(" -h --help - lists these arguments.\n");
+}
+
+// Adds the kernels of a comma separated list
+// Returns: 0, -1 on an unknown kernel
+static int bench_parse_kernels(char *list)
+{
+	for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+		const struct bench_kernel_s *k = bench_kernel(name);
+
+		if (k == NULL) {
+			loge(TAG, "Unknown kernel '%s'\n", name);
+			return -1;
+		}
+		if (num_kernels == BENCH_MAX_KERNELS) {
+			loge(TAG, "Too many kernels, max is %d\n",
+			     BENCH_MAX_KERNELS);
+			return -1;
+		}
+		kernels[num_kernels++] = k;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_args_s args = {
+		.bytes = 64UL * BENCH_MB,
+		.stride = BENCH_LINE,
+		.streams = 8,
+		.seed = 0x9e3779b97f4a7c15ULL,
+	};
+	char dpf_arg[PATH_MAX] = "./dpf";
+	char dpf[PATH_MAX];
+	char mab_arg[PATH_MAX] = "mab_config.json";
+	char mab_config[PATH_MAX];
+	char dir[] = "/tmp/dpf-bench-XXXXXX";
+	char *extra[BENCH_MAX_DPF_ARGS];
+	char core_list[256];
+	char *csv_path = NULL;
+	double run_s = 3.0, warmup_s = 5.0;
+	int baseline_only = 0;
+	int num_extra = 0;
+	cpu_set_t cores;
+
+	CPU_ZERO(&cores);
+	log_setlevel(3);
+
+	while (1) {
+		static struct option long_options[] = {
+		    {"core", required_argument, 0, 'c'},
+		    {"kernel", required_argument, 0, 'k'},
+		    {"size", required_argument, 0, 's'},
+		    {"stride", required_argument, 0, 'S'},
+		    {"streams", required_argument, 0, 'n'},
+		    {"time", required_argument, 0, 't'},
+		    {"warmup", required_argument, 0, 'w'},
+		    {"dpf", required_argument, 0, 'd'},
+		    {"mab-config", required_argument, 0, 'm'},
+		    {"dpf-arg", required_argument, 0, 'x'},
+		    {"baseline", no_argument, 0, 'b'},
+		    {"csv", required_argument, 0, 'o'},
+		    {"log", required_argument, 0, 'l'},
+		    {"help", no_argument, 0, 'h'},
+		    {NULL, no_argument, 0, 0},
+		};
+		int option_index = 0;
+		int c;
+
+		c = getopt_long(argc, argv, "c:k:s:S:n:t:w:d:m:x:bo:l:h",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'c': // core
+			if (coreset_parse(optarg, &cores) <= 0) {
+				loge(TAG, "Invalid core list '%s'\n", optarg);
+				return -1;
+			}
+			break;
+
+		case 'k': // kernel
+			if (bench_parse_kernels(optarg) < 0)
+				return -1;
+			break;
+
+		case 's': // size
+			args.bytes = strtoul(optarg, NULL, 10) * BENCH_MB;
+			break;
+
+		case 'S': // stride
+			args.stride = strtol(optarg, NULL, 10);
+			break;
+
+		case 'n': // streams
+			args.streams = strtol(optarg, NULL, 10);
+			break;
+
+		case 't': // time
+			run_s = strtod(optarg, NULL);
+			break;
+
+		case 'w': // warmup
+			warmup_s = strtod(optarg, NULL);
+			break;
+
+		case 'd': // dpf
+			snprintf(dpf_arg, sizeof(dpf_arg), "%s", optarg);
+			break;
+
+		case 'm': // mab-config
+			snprintf(mab_arg, sizeof(mab_arg), "%s", optarg);
+			break;
+
+		case 'x': // dpf-arg
+			if (num_extra == BENCH_MAX_DPF_ARGS) {
+				loge(TAG, "Too many dPF arguments\n");
+				return -1;
+			}
+			extra[num_extra++] = optarg;
+			break;
+
+		case 'b': // baseline
+			baseline_only = 1;
+			break;
+
+		case 'o': // csv
+			csv_path = optarg;
+			break;
+
+		case 'l': // log
+			log_setlevel(strtol(optarg, 0, 10));
+			break;
+
+		case '?':
+		case 'h': // help
+		default:
+			print_usage();
+			return c == 'h' ? 0 : -1;
+		}
+	}
+
+	if (args.bytes < BENCH_MB || args.stride < 8 || args.stride % 8 ||
+	    args.streams < 1 || args.streams > BENCH_MAX_STREAMS ||
+	    run_s <= 0.0 || warmup_s < 0.0) {
+		loge(TAG, "Invalid size, stride, streams or time\n");
+		return -1;
+	}
+
+	if (num_kernels == 0)
+		for (int i = 0; i < bench_num_kernels; i++)
+			kernels[num_kernels++] = &bench_kernels[i];
+
+	if (topology_init() < 0)
+		return -1;
+
+	// One thread per core, on cores that can run it
+	for (int core = 0; core < CPU_SETSIZE; core++) {
+		if (!CPU_ISSET(core, &cores))
+			continue;
+
+		if (core >= topology.num_cpus || core >= MAX_NUM_CORES ||
+		    !topology.cpu[core].online) {
+			loge(TAG, "Core %d is not online\n", core);
+			return -1;
+		}
+	}
+
+	if (CPU_COUNT(&cores) == 0) {
+		int core = topology_first(TOPO_TYPE_ECORE);
+
+		if (core < 0)
+			core = topology_first(TOPO_TYPE_UNKNOWN);
+		CPU_SET(core, &cores);
+	}
+	coreset_format(&cores, core_list, sizeof(core_list));
+
+	bench_add_config("baseline", -1, -1);
+	if (!baseline_only && bench_tuners_usable(&cores, dpf_arg)) {
+		char name[16];
+
+		if (realpath(dpf_arg, dpf) == NULL ||
+		    realpath(mab_arg, mab_config) == NULL ||
+		    mkdtemp(dir) == NULL) {
+			loge(TAG, "Could not resolve %s or %s\n", dpf_arg,
+			     mab_arg);
+			return -1;
+		}
+
+		bench_add_config("alg0", 0, -1);
+		bench_add_config("alg1", 1, -1);
+		for (int arms = 0; arms < BENCH_MAB_ARM_CONFIGS; arms++) {
+			snprintf(name, sizeof(name), "mab-arms%d", arms);
+			bench_add_config(name, 2, arms);
+		}
+		logi(TAG, "dPF output goes to %s\n", dir);
+	}
+
+	logi(TAG, "%d kernels, %d configurations on cores %s, %lu MB per "
+	     "core\n", num_kernels, num_configs, core_list,
+	     (unsigned long)(args.bytes / BENCH_MB));
+
+	for (int c = 0; c < num_configs; c++) {
+		struct bench_config_s *cfg = &configs[c];
+		pid_t pid = -1;
+
+		if (cfg->alg >= 0) {
+			if (cfg->arm_configuration >= 0 &&
+			    bench_write_mab_config(mab_config, dir,
+						   cfg->arm_configuration) < 0)
+				continue;
+
+			pid = bench_dpf_start(dpf, dir, cfg, core_list, extra,
+					      num_extra);
+			if (pid < 0)
+				continue;
+
+			usleep((useconds_t)(warmup_s * 1e6));
+			if (waitpid(pid, NULL, WNOHANG) == pid) {
+				loge(TAG, "dPF exited, see %s/%s.log\n", dir,
+				     cfg->name);
+				continue;
+			}
+		}
+
+		for (int k = 0; k < num_kernels; k++) {
+			struct bench_result_s *r = &results[c][k];
+
+			if (bench_run_kernel(kernels[k], &args, &cores, run_s,
+					     r) < 0)
+				continue;
+
+			logi(TAG, "%-10s %-12s %10.1f MB/s %8.2f ns\n",
+			     cfg->name, kernels[k]->name, r->mbps,
+			     r->ns_per_access);
+		}
+
+		if (pid > 0)
+			bench_dpf_stop(pid);
+	}
+
+	bench_print_table(0);
+	bench_print_table(1);
+
+	if (csv_path != NULL && bench_write_csv(csv_path) < 0)
+		return -1;
+
+	return 0;
+}
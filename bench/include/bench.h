@@ -0,0 +1,46 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Synthetic memory kernels with access patterns the hardware prefetchers
+// react to differently. Every thread runs its own instance on its own
+// memory, first touched on the core it runs on. Kernels are plain C and run
+// on any x86 machine.
+
+#define BENCH_MAX_STREAMS (64)
+#define BENCH_LINE (64)
+
+struct bench_args_s {
+	size_t bytes;		// memory per thread
+	int stride;		// stream kernel, bytes between loads
+	int streams;		// multistream kernel, concurrent streams
+	uint64_t seed;		// chase and gather order
+};
+
+// Work done by passes of a kernel
+struct bench_work_s {
+	uint64_t bytes;		// moved to or from memory, see the kernels
+	uint64_t accesses;	// loads and stores issued
+};
+
+struct bench_kernel_s {
+	const char *name;
+	const char *description;
+	// Allocates and first touches the memory of one thread
+	// Returns: kernel state, NULL on failure
+	void *(*setup)(const struct bench_args_s *args);
+	// One pass, a few ms to a few 100 ms, adds its work to work
+	void (*pass)(void *state, struct bench_work_s *work);
+	void (*teardown)(void *state);
+};
+
+extern const struct bench_kernel_s bench_kernels[];
+extern const int bench_num_kernels;
+
+// Kernel by name
+// Returns: the kernel, NULL if unknown
+const struct bench_kernel_s *bench_kernel(const char *name);
+
+#endif
@@ -0,0 +1,422 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define BENCH_PAGE (4096)
+#define BENCH_CHASE_LOADS (256 * 1024) // per pass
+
+// Aligned memory of at least size bytes, first touched by the caller
+static void *bench_alloc(size_t size)
+{
+	size = (size + BENCH_PAGE - 1) / BENCH_PAGE * BENCH_PAGE;
+
+	return aligned_alloc(BENCH_PAGE, size);
+}
+
+static uint64_t bench_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+
+	return x;
+}
+
+// stream: one sequential stream of loads, stride bytes apart. Below a cache
+// line every line is moved, above only the ones loaded.
+struct stream_s {
+	uint64_t *a;
+	size_t n;
+	size_t step;
+	int line_bytes;
+	uint64_t sink;
+};
+
+static void *stream_setup(const struct bench_args_s *args)
+{
+	struct stream_s *s = calloc(1, sizeof(*s));
+
+	if (s == NULL)
+		return NULL;
+
+	s->n = args->bytes / sizeof(uint64_t);
+	s->step = args->stride / sizeof(uint64_t);
+	s->line_bytes = args->stride < BENCH_LINE ? args->stride : BENCH_LINE;
+	s->a = bench_alloc(s->n * sizeof(uint64_t));
+	if (s->a == NULL) {
+		free(s);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < s->n; i++)
+		s->a[i] = i;
+
+	return s;
+}
+
+static void stream_pass(void *state, struct bench_work_s *work)
+{
+	struct stream_s *s = state;
+	uint64_t sum = 0, loads = 0;
+
+	for (size_t i = 0; i < s->n; i += s->step) {
+		sum += s->a[i];
+		loads++;
+	}
+
+	s->sink += sum;
+	work->accesses += loads;
+	work->bytes += loads * s->line_bytes;
+}
+
+static void stream_teardown(void *state)
+{
+	struct stream_s *s = state;
+
+	free(s->a);
+	free(s);
+}
+
+// chase: dependent loads through the lines in random order, no prefetcher
+// can follow, the time per access is the load-to-use latency
+struct chase_line_s {
+	struct chase_line_s *next;
+	char pad[BENCH_LINE - sizeof(void *)];
+};
+
+struct chase_s {
+	struct chase_line_s *lines;
+	struct chase_line_s *pos;
+};
+
+static void *chase_setup(const struct bench_args_s *args)
+{
+	struct chase_s *c = calloc(1, sizeof(*c));
+	size_t n = args->bytes / sizeof(struct chase_line_s);
+	uint64_t rnd = args->seed | 1;
+	uint32_t *order;
+
+	if (c == NULL)
+		return NULL;
+
+	c->lines = bench_alloc(n * sizeof(struct chase_line_s));
+	order = malloc(n * sizeof(*order));
+	if (c->lines == NULL || order == NULL) {
+		free(order);
+		free(c->lines);
+		free(c);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		order[i] = i;
+
+	for (size_t i = n - 1; i > 0; i--) {
+		size_t j = bench_rand(&rnd) % (i + 1);
+		uint32_t tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		c->lines[order[i]].next = &c->lines[order[(i + 1) % n]];
+
+	c->pos = &c->lines[order[0]];
+	free(order);
+
+	return c;
+}
+
+static void chase_pass(void *state, struct bench_work_s *work)
+{
+	struct chase_s *c = state;
+	struct chase_line_s *p = c->pos;
+
+	for (int i = 0; i < BENCH_CHASE_LOADS; i++)
+		p = p->next;
+
+	c->pos = p;
+	work->accesses += BENCH_CHASE_LOADS;
+	work->bytes += (uint64_t)BENCH_CHASE_LOADS * BENCH_LINE;
+}
+
+static void chase_teardown(void *state)
+{
+	struct chase_s *c = state;
+
+	free(c->lines);
+	free(c);
+}
+
+// mixed: c[i] = a[i] + 3 * b[i], two read streams and one write stream
+struct mixed_s {
+	double *a, *b, *c;
+	size_t n;
+};
+
+static void *mixed_setup(const struct bench_args_s *args)
+{
+	struct mixed_s *m = calloc(1, sizeof(*m));
+
+	if (m == NULL)
+		return NULL;
+
+	m->n = args->bytes / (3 * sizeof(double));
+	m->a = bench_alloc(m->n * sizeof(double));
+	m->b = bench_alloc(m->n * sizeof(double));
+	m->c = bench_alloc(m->n * sizeof(double));
+	if (m->a == NULL || m->b == NULL || m->c == NULL) {
+		free(m->a);
+		free(m->b);
+		free(m->c);
+		free(m);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < m->n; i++) {
+		m->a[i] = 1.0;
+		m->b[i] = 2.0;
+		m->c[i] = 0.0;
+	}
+
+	return m;
+}
+
+static void mixed_pass(void *state, struct bench_work_s *work)
+{
+	struct mixed_s *m = state;
+
+	for (size_t i = 0; i < m->n; i++)
+		m->c[i] = m->a[i] + 3.0 * m->b[i];
+
+	work->accesses += 3 * m->n;
+	work->bytes += 3 * m->n * sizeof(double);
+}
+
+static void mixed_teardown(void *state)
+{
+	struct mixed_s *m = state;
+
+	free(m->a);
+	free(m->b);
+	free(m->c);
+	free(m);
+}
+
+// multistream: streams sequential read streams interleaved on one core, each
+// over its own part of the memory, as many streams as the prefetcher can
+// track or more
+struct multi_s {
+	uint64_t *a;
+	size_t len;		// elements per stream
+	int streams;
+	uint64_t sink;
+};
+
+static void *multi_setup(const struct bench_args_s *args)
+{
+	struct multi_s *m = calloc(1, sizeof(*m));
+
+	if (m == NULL)
+		return NULL;
+
+	m->streams = args->streams;
+	m->len = args->bytes / sizeof(uint64_t) / m->streams;
+	m->a = bench_alloc(m->len * m->streams * sizeof(uint64_t));
+	if (m->a == NULL) {
+		free(m);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < m->len * m->streams; i++)
+		m->a[i] = i;
+
+	return m;
+}
+
+static void multi_pass(void *state, struct bench_work_s *work)
+{
+	struct multi_s *m = state;
+	const uint64_t *base[BENCH_MAX_STREAMS];
+	uint64_t sum = 0;
+
+	for (int s = 0; s < m->streams; s++)
+		base[s] = m->a + s * m->len;
+
+	for (size_t i = 0; i < m->len; i++)
+		for (int s = 0; s < m->streams; s++)
+			sum += base[s][i];
+
+	m->sink += sum;
+	work->accesses += m->len * m->streams;
+	work->bytes += m->len * m->streams * sizeof(uint64_t);
+}
+
+static void multi_teardown(void *state)
+{
+	struct multi_s *m = state;
+
+	free(m->a);
+	free(m);
+}
+
+// stencil: 5-point Jacobi sweep over a square grid, three rows of the input
+// are live at once. Every point reads one element and writes one.
+struct stencil_s {
+	double *in, *out;
+	size_t dim;
+};
+
+static void *stencil_setup(const struct bench_args_s *args)
+{
+	struct stencil_s *s = calloc(1, sizeof(*s));
+
+	if (s == NULL)
+		return NULL;
+
+	s->dim = (size_t)sqrt((double)args->bytes / (2 * sizeof(double)));
+	if (s->dim < 3)
+		s->dim = 3;
+
+	s->in = bench_alloc(s->dim * s->dim * sizeof(double));
+	s->out = bench_alloc(s->dim * s->dim * sizeof(double));
+	if (s->in == NULL || s->out == NULL) {
+		free(s->in);
+		free(s->out);
+		free(s);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < s->dim * s->dim; i++) {
+		s->in[i] = (double)(i % 7);
+		s->out[i] = 0.0;
+	}
+
+	return s;
+}
+
+static void stencil_pass(void *state, struct bench_work_s *work)
+{
+	struct stencil_s *s = state;
+	size_t dim = s->dim;
+	double *tmp;
+
+	for (size_t i = 1; i < dim - 1; i++) {
+		for (size_t j = 1; j < dim - 1; j++) {
+			size_t c = i * dim + j;
+
+			s->out[c] = 0.2 * (s->in[c] + s->in[c - 1] +
+					   s->in[c + 1] + s->in[c - dim] +
+					   s->in[c + dim]);
+		}
+	}
+
+	tmp = s->in;
+	s->in = s->out;
+	s->out = tmp;
+
+	work->accesses += 6 * (dim - 2) * (dim - 2);
+	work->bytes += 2 * (dim - 2) * (dim - 2) * sizeof(double);
+}
+
+static void stencil_teardown(void *state)
+{
+	struct stencil_s *s = state;
+
+	free(s->in);
+	free(s->out);
+	free(s);
+}
+
+// gather: sum += v[idx[i]], a sequential index stream steering random loads,
+// each of them moves a line. The indices take another 1/16 of the memory.
+struct gather_s {
+	double *v;
+	uint32_t *idx;
+	size_t num_idx;
+	double sink;
+};
+
+static void *gather_setup(const struct bench_args_s *args)
+{
+	struct gather_s *g = calloc(1, sizeof(*g));
+	size_t n = args->bytes / sizeof(double);
+	uint64_t rnd = args->seed | 1;
+
+	if (g == NULL)
+		return NULL;
+
+	if (n > UINT32_MAX)
+		n = UINT32_MAX;
+	g->num_idx = n / (BENCH_LINE / sizeof(double));
+
+	g->v = bench_alloc(n * sizeof(double));
+	g->idx = bench_alloc(g->num_idx * sizeof(uint32_t));
+	if (g->v == NULL || g->idx == NULL) {
+		free(g->v);
+		free(g->idx);
+		free(g);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		g->v[i] = 1.0;
+	for (size_t i = 0; i < g->num_idx; i++)
+		g->idx[i] = bench_rand(&rnd) % n;
+
+	return g;
+}
+
+static void gather_pass(void *state, struct bench_work_s *work)
+{
+	struct gather_s *g = state;
+	double sum = 0.0;
+
+	for (size_t i = 0; i < g->num_idx; i++)
+		sum += g->v[g->idx[i]];
+
+	g->sink += sum;
+	work->accesses += 2 * g->num_idx;
+	work->bytes += g->num_idx * (BENCH_LINE + sizeof(uint32_t));
+}
+
+static void gather_teardown(void *state)
+{
+	struct gather_s *g = state;
+
+	free(g->v);
+	free(g->idx);
+	free(g);
+}
+
+const struct bench_kernel_s bench_kernels[] = {
+	{ "stream", "sequential loads, --stride apart",
+	  stream_setup, stream_pass, stream_teardown },
+	{ "chase", "random pointer chase",
+	  chase_setup, chase_pass, chase_teardown },
+	{ "mixed", "c = a + 3b, two read streams, one write",
+	  mixed_setup, mixed_pass, mixed_teardown },
+	{ "multistream", "--streams interleaved read streams",
+	  multi_setup, multi_pass, multi_teardown },
+	{ "stencil", "5-point Jacobi sweep",
+	  stencil_setup, stencil_pass, stencil_teardown },
+	{ "gather", "random loads from a sequential index",
+	  gather_setup, gather_pass, gather_teardown },
+};
+
+const int bench_num_kernels = sizeof(bench_kernels) / sizeof(bench_kernels[0]);
+
+const struct bench_kernel_s *bench_kernel(const char *name)
+{
+	for (int i = 0; i < bench_num_kernels; i++)
+		if (strcmp(bench_kernels[i].name, name) == 0)
+			return &bench_kernels[i];
+
+	return NULL;
+}
@@ -0,0 +1,535 @@
+#define _GNU_SOURCE
+
+#include <immintrin.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bwprobe.h"
+#include "log.h"
+#include "topology.h"
+
+#define TAG "BWPROBE"
+
+#define BWPROBE_MB (1024 * 1024)
+#define BWPROBE_ALIGN (64)
+#define BWPROBE_UNROLL (8) // doubles per loop iteration, one cache line
+#define BWPROBE_LOAD_CHUNK (1024 * 1024 / sizeof(double)) // counted at once
+
+// Shared by the threads of one probe
+struct bwprobe_s {
+	pthread_barrier_t barrier;
+	pthread_mutex_t lock;
+	pthread_cond_t go;
+	int started;			// barrier and n are set, threads may run
+	int num_threads;
+	size_t n;			// doubles per array and thread
+	volatile int failed;
+	uint64_t start_ns;
+	uint64_t best_ns[BWPROBE_KERNELS];
+};
+
+struct bwprobe_thread_s {
+	pthread_t thread;
+	struct bwprobe_s *probe;
+	int index;
+	int core;
+	double sum;			// keeps the read kernel alive
+};
+
+typedef double (*bwprobe_fn)(double *a, double *b, double *c, size_t n);
+
+static uint64_t bwprobe_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// SSE2 kernels, always available on x86-64
+
+static double read_sse2(double *a, double *b, double *c, size_t n)
+{
+	__m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+	double out[2];
+
+	(void)b;
+	(void)c;
+
+	for (size_t i = 0; i < n; i += BWPROBE_UNROLL) {
+		s0 = _mm_add_pd(s0, _mm_load_pd(&a[i]));
+		s1 = _mm_add_pd(s1, _mm_load_pd(&a[i + 2]));
+		s0 = _mm_add_pd(s0, _mm_load_pd(&a[i + 4]));
+		s1 = _mm_add_pd(s1, _mm_load_pd(&a[i + 6]));
+	}
+
+	_mm_storeu_pd(out, _mm_add_pd(s0, s1));
+
+	return out[0] + out[1];
+}
+
+static double write_sse2(double *a, double *b, double *c, size_t n)
+{
+	__m128d s = _mm_set1_pd(3.0);
+
+	(void)b;
+	(void)c;
+
+	for (size_t i = 0; i < n; i += BWPROBE_UNROLL) {
+		_mm_stream_pd(&a[i], s);
+		_mm_stream_pd(&a[i + 2], s);
+		_mm_stream_pd(&a[i + 4], s);
+		_mm_stream_pd(&a[i + 6], s);
+	}
+	_mm_sfence();
+
+	return 0;
+}
+
+static double copy_sse2(double *a, double *b, double *c, size_t n)
+{
+	(void)c;
+
+	for (size_t i = 0; i < n; i += BWPROBE_UNROLL) {
+		_mm_stream_pd(&b[i], _mm_load_pd(&a[i]));
+		_mm_stream_pd(&b[i + 2], _mm_load_pd(&a[i + 2]));
+		_mm_stream_pd(&b[i + 4], _mm_load_pd(&a[i + 4]));
+		_mm_stream_pd(&b[i + 6], _mm_load_pd(&a[i + 6]));
+	}
+	_mm_sfence();
+
+	return 0;
+}
+
+static double triad_sse2(double *a, double *b, double *c, size_t n)
+{
+	__m128d s = _mm_set1_pd(3.0);
+
+	for (size_t i = 0; i < n; i += 2)
+		_mm_stream_pd(&a[i], _mm_add_pd(_mm_load_pd(&b[i]),
+				_mm_mul_pd(s, _mm_load_pd(&c[i]))));
+	_mm_sfence();
+
+	return 0;
+}
+
+// AVX kernels, used when the cores support it
+
+__attribute__((target("avx")))
+static double read_avx(double *a, double *b, double *c, size_t n)
+{
+	__m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+	double out[4];
+
+	(void)b;
+	(void)c;
+
+	for (size_t i = 0; i < n; i += BWPROBE_UNROLL) {
+		s0 = _mm256_add_pd(s0, _mm256_load_pd(&a[i]));
+		s1 = _mm256_add_pd(s1, _mm256_load_pd(&a[i + 4]));
+	}
+
+	_mm256_storeu_pd(out, _mm256_add_pd(s0, s1));
+
+	return out[0] + out[1] + out[2] + out[3];
+}
+
+__attribute__((target("avx")))
+static double write_avx(double *a, double *b, double *c, size_t n)
+{
+	__m256d s = _mm256_set1_pd(3.0);
+
+	(void)b;
+	(void)c;
+
+	for (size_t i = 0; i < n; i += BWPROBE_UNROLL) {
+		_mm256_stream_pd(&a[i], s);
+		_mm256_stream_pd(&a[i + 4], s);
+	}
+	_mm_sfence();
+
+	return 0;
+}
+
+__attribute__((target("avx")))
+static double copy_avx(double *a, double *b, double *c, size_t n)
+{
+	(void)c;
+
+	for (size_t i = 0; i < n; i += BWPROBE_UNROLL) {
+		_mm256_stream_pd(&b[i], _mm256_load_pd(&a[i]));
+		_mm256_stream_pd(&b[i + 4], _mm256_load_pd(&a[i + 4]));
+	}
+	_mm_sfence();
+
+	return 0;
+}
+
+__attribute__((target("avx")))
+static double triad_avx(double *a, double *b, double *c, size_t n)
+{
+	__m256d s = _mm256_set1_pd(3.0);
+
+	for (size_t i = 0; i < n; i += 4)
+		_mm256_stream_pd(&a[i], _mm256_add_pd(_mm256_load_pd(&b[i]),
+				_mm256_mul_pd(s, _mm256_load_pd(&c[i]))));
+	_mm_sfence();
+
+	return 0;
+}
+
+static bwprobe_fn kernels_sse2[BWPROBE_KERNELS] = {
+	read_sse2, write_sse2, copy_sse2, triad_sse2
+};
+
+static bwprobe_fn kernels_avx[BWPROBE_KERNELS] = {
+	read_avx, write_avx, copy_avx, triad_avx
+};
+
+// Bytes moved per element, loads plus stores
+static const int kernel_bytes[BWPROBE_KERNELS] = { 8, 8, 16, 24 };
+
+static void *bwprobe_thread(void *arg)
+{
+	struct bwprobe_thread_s *t = arg;
+	struct bwprobe_s *probe = t->probe;
+	bwprobe_fn *kernels;
+	double *a, *b, *c;
+	size_t bytes;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->core, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		loge(TAG, "Could not pin probe thread to core %d\n", t->core);
+		probe->failed = 1;
+	}
+
+	// The barrier is sized to the threads that could be created
+	pthread_mutex_lock(&probe->lock);
+	while (!probe->started)
+		pthread_cond_wait(&probe->go, &probe->lock);
+	pthread_mutex_unlock(&probe->lock);
+
+	bytes = probe->n * sizeof(double);
+
+	kernels = __builtin_cpu_supports("avx") ? kernels_avx : kernels_sse2;
+
+	// First touch by the pinned thread places the pages on its node
+	a = aligned_alloc(BWPROBE_ALIGN, bytes);
+	b = aligned_alloc(BWPROBE_ALIGN, bytes);
+	c = aligned_alloc(BWPROBE_ALIGN, bytes);
+	if (a == NULL || b == NULL || c == NULL) {
+		loge(TAG, "Could not allocate probe arrays on core %d\n",
+		     t->core);
+		probe->failed = 1;
+	} else {
+		for (size_t i = 0; i < probe->n; i++) {
+			a[i] = 1.0;
+			b[i] = 2.0;
+			c[i] = 0.0;
+		}
+	}
+
+	pthread_barrier_wait(&probe->barrier);
+
+	for (int k = 0; k < BWPROBE_KERNELS && !probe->failed; k++) {
+		for (int rep = 0; rep < BWPROBE_NTIMES; rep++) {
+			pthread_barrier_wait(&probe->barrier);
+			if (t->index == 0)
+				probe->start_ns = bwprobe_now_ns();
+
+			t->sum += kernels[k](a, b, c, probe->n);
+
+			pthread_barrier_wait(&probe->barrier);
+			if (t->index == 0) {
+				uint64_t ns = bwprobe_now_ns() - probe->start_ns;
+
+				if (probe->best_ns[k] == 0 || ns < probe->best_ns[k])
+					probe->best_ns[k] = ns;
+			}
+		}
+	}
+
+	free(a);
+	free(b);
+	free(c);
+
+	return NULL;
+}
+
+// Orders the cores of set for placement, see bwprobe.h
+int bwprobe_order(const cpu_set_t *set, int placement, int *order)
+{
+	int rank[MAX_NUM_CORES];
+	int num = 0, max_rank = 0;
+
+	for (int core = 0; core < topology.num_cpus; core++) {
+		if (!CPU_ISSET(core, set) || !topology.cpu[core].online)
+			continue;
+
+		// Position of the core within its module
+		rank[core] = 0;
+		for (int prev = 0; prev < core; prev++)
+			if (CPU_ISSET(prev, set) && topology.cpu[prev].online &&
+			    topology.cpu[prev].cluster == topology.cpu[core].cluster)
+				rank[core]++;
+
+		if (rank[core] > max_rank)
+			max_rank = rank[core];
+	}
+
+	if (placement == BWPROBE_PLACE_COMPACT)
+		max_rank = 0;
+
+	for (int r = 0; r <= max_rank; r++) {
+		for (int core = 0; core < topology.num_cpus; core++) {
+			if (!CPU_ISSET(core, set) || !topology.cpu[core].online)
+				continue;
+			if (placement == BWPROBE_PLACE_SPREAD && rank[core] != r)
+				continue;
+
+			order[num++] = core;
+		}
+	}
+
+	return num;
+}
+
+// Runs the probe, see bwprobe.h
+int bwprobe_run(const cpu_set_t *cores, int num_threads, int placement,
+		struct bwprobe_result_s *result)
+{
+	struct bwprobe_thread_s *threads;
+	struct bwprobe_s probe;
+	int order[MAX_NUM_CORES];
+	cpu_set_t affinity;
+	int num_cores;
+	int started;
+
+	if (topology_init() < 0)
+		return -1;
+
+	num_cores = bwprobe_order(cores, placement, order);
+	if (num_cores == 0) {
+		loge(TAG, "No online cores to probe on\n");
+		return -1;
+	}
+
+	if (num_threads <= 0 || num_threads > num_cores)
+		num_threads = num_cores;
+
+	memset(&probe, 0, sizeof(probe));
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (threads == NULL) {
+		loge(TAG, "Memory allocation failed\n");
+		return -1;
+	}
+
+	pthread_mutex_init(&probe.lock, NULL);
+	pthread_cond_init(&probe.go, NULL);
+
+	for (int i = 0; i < num_threads; i++) {
+		threads[i].probe = &probe;
+		threads[i].index = i;
+		threads[i].core = order[i];
+	}
+
+	// Thread 0 runs here. It is pinned like the others, the affinity is
+	// restored after.
+	sched_getaffinity(0, sizeof(affinity), &affinity);
+
+	// The created threads wait until the barrier is set up, so a failed
+	// create only makes the probe run with fewer threads
+	for (started = 1; started < num_threads; started++) {
+		if (pthread_create(&threads[started].thread, NULL,
+				   bwprobe_thread, &threads[started]) != 0) {
+			loge(TAG, "Could not start probe thread %d, probing "
+			     "with %d threads\n", started, started);
+			break;
+		}
+	}
+
+	probe.num_threads = started;
+	probe.n = BWPROBE_ARRAY_BYTES / sizeof(double) / started;
+	probe.n -= probe.n % BWPROBE_UNROLL;
+	pthread_barrier_init(&probe.barrier, NULL, started);
+
+	pthread_mutex_lock(&probe.lock);
+	probe.started = 1;
+	pthread_cond_broadcast(&probe.go);
+	pthread_mutex_unlock(&probe.lock);
+
+	bwprobe_thread(&threads[0]);
+
+	for (int i = 1; i < started; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	sched_setaffinity(0, sizeof(affinity), &affinity);
+
+	pthread_barrier_destroy(&probe.barrier);
+	pthread_cond_destroy(&probe.go);
+	pthread_mutex_destroy(&probe.lock);
+	free(threads);
+
+	if (probe.failed)
+		return -1;
+
+	result->threads = started;
+	for (int k = 0; k < BWPROBE_KERNELS; k++) {
+		double bytes = (double)kernel_bytes[k] * probe.n * started;
+
+		result->mbps[k] = (int)(bytes * 1e9 / probe.best_ns[k] /
+					BWPROBE_MB);
+	}
+
+	return 0;
+}
+
+struct bwprobe_load_thread_s {
+	pthread_t thread;
+	struct bwprobe_load_s *load;
+	int core;
+	size_t n;			// doubles in the array
+	volatile int ready;		// 1 running, -1 failed
+	volatile uint64_t bytes;	// read so far, written by the thread only
+	double sum;
+};
+
+static void *bwprobe_load_thread(void *arg)
+{
+	struct bwprobe_load_thread_s *t = arg;
+	bwprobe_fn read;
+	cpu_set_t set;
+	double *a;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->core, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	read = __builtin_cpu_supports("avx") ? read_avx : read_sse2;
+
+	a = aligned_alloc(BWPROBE_ALIGN, t->n * sizeof(double));
+	if (a == NULL) {
+		t->ready = -1;
+		return NULL;
+	}
+
+	for (size_t i = 0; i < t->n; i++)
+		a[i] = 1.0;
+
+	t->ready = 1;
+
+	while (!t->load->stop) {
+		for (size_t i = 0; i < t->n && !t->load->stop;
+		     i += BWPROBE_LOAD_CHUNK) {
+			t->sum += read(&a[i], NULL, NULL, BWPROBE_LOAD_CHUNK);
+			t->bytes += BWPROBE_LOAD_CHUNK * sizeof(double);
+		}
+	}
+
+	free(a);
+
+	return NULL;
+}
+
+// Starts the load, see bwprobe.h
+int bwprobe_load_start(struct bwprobe_load_s *load, const int *cores,
+		       int num_threads)
+{
+	size_t n;
+	int ret = 0;
+
+	memset(load, 0, sizeof(*load));
+	if (num_threads == 0)
+		return 0;
+
+	load->threads = calloc(num_threads, sizeof(*load->threads));
+	if (load->threads == NULL) {
+		loge(TAG, "Memory allocation failed\n");
+		return -1;
+	}
+
+	// Same footprint as the probe, whole chunks per thread
+	n = BWPROBE_ARRAY_BYTES / sizeof(double) / num_threads;
+	n -= n % BWPROBE_LOAD_CHUNK;
+	if (n == 0)
+		n = BWPROBE_LOAD_CHUNK;
+
+	for (int i = 0; i < num_threads; i++) {
+		struct bwprobe_load_thread_s *t = &load->threads[i];
+
+		t->load = load;
+		t->core = cores[i];
+		t->n = n;
+
+		if (pthread_create(&t->thread, NULL, bwprobe_load_thread, t) != 0) {
+			loge(TAG, "Could not start load thread %d\n", i);
+			bwprobe_load_stop(load);
+			return -1;
+		}
+		load->num_threads++;
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		while (load->threads[i].ready == 0)
+			usleep(1000);
+		if (load->threads[i].ready < 0)
+			ret = -1;
+	}
+
+	if (ret < 0) {
+		loge(TAG, "Could not allocate load arrays\n");
+		bwprobe_load_stop(load);
+	}
+
+	return ret;
+}
+
+uint64_t bwprobe_load_bytes(struct bwprobe_load_s *load)
+{
+	uint64_t bytes = 0;
+
+	for (int i = 0; i < load->num_threads; i++)
+		bytes += load->threads[i].bytes;
+
+	return bytes;
+}
+
+void bwprobe_load_stop(struct bwprobe_load_s *load)
+{
+	load->stop = 1;
+
+	for (int i = 0; i < load->num_threads; i++)
+		pthread_join(load->threads[i].thread, NULL);
+
+	free(load->threads);
+	load->threads = NULL;
+	load->num_threads = 0;
+}
+
+int bwprobe_parse_placement(const char *name)
+{
+	if (strcmp(name, "spread") == 0)
+		return BWPROBE_PLACE_SPREAD;
+	if (strcmp(name, "compact") == 0)
+		return BWPROBE_PLACE_COMPACT;
+
+	return -1;
+}
+
+const char *bwprobe_kernel_name(int kernel)
+{
+	static const char *names[BWPROBE_KERNELS] = {
+		"read", "write", "copy", "triad"
+	};
+
+	return kernel >= 0 && kernel < BWPROBE_KERNELS ? names[kernel] : "?";
+}
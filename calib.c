@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "basicalg_core.h"
+#include "bwprobe.h"
+#include "cJSON.h"
+#include "calib.h"
+#include "ddr_domain.h"
+#include "log.h"
+#include "topology.h"
+
+#define TAG "CALIB"
+
+#define CALIB_MB (1024 * 1024)
+#define CALIB_SETTLE_US (100000) // load runs this long before a point
+#define CALIB_HUGEPAGE (2 * 1024 * 1024)
+
+// One cache line of the chase, next is the only field read
+struct calib_line_s {
+	struct calib_line_s *next;
+	char pad[64 - sizeof(void *)];
+};
+
+static uint64_t calib_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Links the lines into one cycle in random order, so no prefetcher can
+// follow the chase
+// Returns: first line of the cycle, NULL on failure
+static struct calib_line_s *calib_chase_init(struct calib_line_s *lines,
+					     size_t num)
+{
+	struct calib_line_s *first;
+	uint64_t rnd = 0x9e3779b97f4a7c15ULL;
+	uint32_t *order;
+
+	order = malloc(num * sizeof(*order));
+	if (order == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < num; i++)
+		order[i] = i;
+
+	for (size_t i = num - 1; i > 0; i--) {
+		size_t j;
+		uint32_t tmp;
+
+		// xorshift64, good enough to defeat stride detection
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 7;
+		rnd ^= rnd << 17;
+		j = rnd % (i + 1);
+
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (size_t i = 0; i < num; i++)
+		lines[order[i]].next = &lines[order[(i + 1) % num]];
+
+	first = &lines[order[0]];
+	free(order);
+
+	return first;
+}
+
+// Follows the chase for loads dependent loads
+// Returns: average latency in ns
+static double calib_chase(struct calib_line_s **pos, size_t loads)
+{
+	struct calib_line_s *p = *pos;
+	uint64_t start;
+
+	start = calib_now_ns();
+	for (size_t i = 0; i < loads; i++)
+		p = p->next;
+
+	// The chase must finish before the clock is read again
+	__asm__ __volatile__("" : : "r"(p) : "memory");
+	*pos = p;
+
+	return (double)(calib_now_ns() - start) / loads;
+}
+
+// Knee: highest bandwidth point before latency passes CALIB_KNEE_RATIO times
+// the idle latency
+static int calib_knee(const struct calib_curve_s *curve)
+{
+	double limit = curve->point[0].latency_ns * CALIB_KNEE_RATIO;
+	int knee = 0;
+
+	for (int i = 1; i < curve->num_points; i++) {
+		if (curve->point[i].latency_ns > limit)
+			break;
+		if (curve->point[i].mbps > curve->point[knee].mbps)
+			knee = i;
+	}
+
+	return knee;
+}
+
+// Records the curve of one domain. The chase runs on the first core, pinned,
+// load on the others spread over the modules.
+// Returns: 0 on success, 1 if the domain has no cores for load, -1 on failure
+static int calib_domain(int index, int steps, struct calib_curve_s *curve)
+{
+	struct ddr_domain_s *d = &ddr_domain[index];
+	struct calib_line_s *lines, *pos;
+	int order[MAX_NUM_CORES];
+	cpu_set_t affinity, set;
+	int num_cores, max_load;
+	int prev_load = -1;
+	int ret = 0;
+
+	memset(curve, 0, sizeof(*curve));
+	curve->socket = d->socket;
+	curve->node = d->node;
+
+	num_cores = bwprobe_order(&d->cores, BWPROBE_PLACE_SPREAD, order);
+	if (num_cores == 0) {
+		loge(TAG, "Domain %d has no online cores\n", index);
+		return -1;
+	}
+	if (num_cores < 2) {
+		logi(TAG, "Domain %d has no cores to load it, not calibrated\n",
+		     index);
+		return 1;
+	}
+
+	sched_getaffinity(0, sizeof(affinity), &affinity);
+	CPU_ZERO(&set);
+	CPU_SET(order[0], &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	// Huge pages keep page walks out of the measured latency
+	lines = aligned_alloc(CALIB_HUGEPAGE, CALIB_CHASE_BYTES);
+	if (lines == NULL) {
+		loge(TAG, "Memory allocation failed\n");
+		sched_setaffinity(0, sizeof(affinity), &affinity);
+		return -1;
+	}
+	madvise(lines, CALIB_CHASE_BYTES, MADV_HUGEPAGE);
+
+	pos = calib_chase_init(lines, CALIB_CHASE_BYTES / sizeof(*lines));
+	if (pos == NULL) {
+		loge(TAG, "Memory allocation failed\n");
+		ret = -1;
+		goto out;
+	}
+	calib_chase(&pos, CALIB_CHASE_LOADS / 4); // warm up TLBs and pages
+
+	max_load = num_cores - 1;
+	if (steps > max_load + 1)
+		steps = max_load + 1;
+
+	for (int s = 0; s < steps; s++) {
+		struct calib_point_s *p = &curve->point[curve->num_points];
+		struct bwprobe_load_s load;
+		uint64_t bytes, start;
+		int num_load;
+
+		num_load = steps > 1 ? s * max_load / (steps - 1) : 0;
+		if (num_load == prev_load)
+			continue;
+		prev_load = num_load;
+
+		if (bwprobe_load_start(&load, &order[1], num_load) < 0) {
+			ret = -1;
+			goto out;
+		}
+		usleep(CALIB_SETTLE_US);
+
+		bytes = bwprobe_load_bytes(&load);
+		start = calib_now_ns();
+		p->latency_ns = calib_chase(&pos, CALIB_CHASE_LOADS);
+		bytes = bwprobe_load_bytes(&load) - bytes;
+		p->mbps = (int)((double)bytes * 1e9 /
+				(calib_now_ns() - start) / CALIB_MB);
+		p->load_threads = num_load;
+
+		bwprobe_load_stop(&load);
+
+		logi(TAG, "Domain %d: %3d load threads, %6d MB/s, %6.1f ns\n",
+		     index, p->load_threads, p->mbps, p->latency_ns);
+
+		curve->num_points++;
+	}
+
+	curve->knee = calib_knee(curve);
+
+	logi(TAG, "Domain %d: idle %.1f ns, knee at %d MB/s, %.1f ns\n", index,
+	     curve->point[0].latency_ns, curve->point[curve->knee].mbps,
+	     curve->point[curve->knee].latency_ns);
+
+out:
+	free(lines);
+	sched_setaffinity(0, sizeof(affinity), &affinity);
+
+	return ret;
+}
+
+static cJSON *calib_curve_json(const struct calib_curve_s *curve)
+{
+	cJSON *domain = cJSON_CreateObject();
+	cJSON *points = cJSON_AddArrayToObject(domain, "curve");
+
+	cJSON_AddNumberToObject(domain, "socket", curve->socket);
+	cJSON_AddNumberToObject(domain, "node", curve->node);
+	cJSON_AddNumberToObject(domain, "idle_latency_ns",
+				curve->point[0].latency_ns);
+	cJSON_AddNumberToObject(domain, "knee_mbps",
+				curve->point[curve->knee].mbps);
+	cJSON_AddNumberToObject(domain, "knee_latency_ns",
+				curve->point[curve->knee].latency_ns);
+
+	for (int i = 0; i < curve->num_points; i++) {
+		cJSON *point = cJSON_CreateObject();
+
+		cJSON_AddNumberToObject(point, "load_threads",
+					curve->point[i].load_threads);
+		cJSON_AddNumberToObject(point, "mbps", curve->point[i].mbps);
+		cJSON_AddNumberToObject(point, "latency_ns",
+					curve->point[i].latency_ns);
+		cJSON_AddItemToArray(points, point);
+	}
+
+	return domain;
+}
+
+// Calibrates every domain, see calib.h
+int calib_run(const char *path, int steps)
+{
+	struct calib_curve_s curve;
+	cJSON *root, *domains;
+	char *text;
+	FILE *fp;
+	int calibrated = 0;
+	int ret = 0;
+
+	if (steps < 2 || steps > CALIB_MAX_STEPS) {
+		loge(TAG, "Steps must be 2 to %d\n", CALIB_MAX_STEPS);
+		return -1;
+	}
+
+	root = cJSON_CreateObject();
+	domains = cJSON_AddArrayToObject(root, "domains");
+
+	for (int i = 0; i < num_ddr_domains; i++) {
+		ret = calib_domain(i, steps, &curve);
+		if (ret < 0) {
+			cJSON_Delete(root);
+			return -1;
+		}
+		if (ret > 0)
+			continue;
+
+		cJSON_AddItemToArray(domains, calib_curve_json(&curve));
+		calibrated++;
+	}
+	ret = 0;
+
+	if (calibrated == 0) {
+		loge(TAG, "No domain could be calibrated\n");
+		cJSON_Delete(root);
+		return -1;
+	}
+
+	text = cJSON_Print(root);
+	cJSON_Delete(root);
+	if (text == NULL)
+		return -1;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		loge(TAG, "Could not write %s\n", path);
+		free(text);
+		return -1;
+	}
+
+	if (fputs(text, fp) < 0 || fputc('\n', fp) < 0)
+		ret = -1;
+	fclose(fp);
+	free(text);
+
+	if (ret == 0)
+		logi(TAG, "Calibration written to %s\n", path);
+
+	return ret;
+}
+
+// Reads the whole file into a string
+// Returns: the text, to be freed, NULL on failure
+static char *calib_read_file(const char *path)
+{
+	char *text;
+	long size;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		loge(TAG, "Could not open %s\n", path);
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	text = size > 0 ? malloc(size + 1) : NULL;
+	if (text != NULL) {
+		if (fread(text, 1, size, fp) != (size_t)size) {
+			free(text);
+			text = NULL;
+		} else {
+			text[size] = '\0';
+		}
+	}
+	fclose(fp);
+
+	return text;
+}
+
+// Targets the calibrated knees, see calib.h
+// The primitive tuners start to throttle at BASICALG_CONGESTED_PERCENT of
+// the target, so the target is set for that level to fall on the knee.
+int calib_load(const char *path)
+{
+	cJSON *root, *domains, *item;
+	int calibrated = 0;
+	char *text;
+
+	text = calib_read_file(path);
+	if (text == NULL)
+		return -1;
+
+	root = cJSON_Parse(text);
+	free(text);
+
+	domains = root ? cJSON_GetObjectItem(root, "domains") : NULL;
+	if (!cJSON_IsArray(domains)) {
+		loge(TAG, "No domains in %s\n", path);
+		cJSON_Delete(root);
+		return -1;
+	}
+
+	cJSON_ArrayForEach(item, domains) {
+		cJSON *socket = cJSON_GetObjectItem(item, "socket");
+		cJSON *node = cJSON_GetObjectItem(item, "node");
+		cJSON *knee = cJSON_GetObjectItem(item, "knee_mbps");
+
+		if (!cJSON_IsNumber(socket) || !cJSON_IsNumber(node) ||
+		    !cJSON_IsNumber(knee) || knee->valueint <= 0) {
+			logi(TAG, "Skipping a domain without a knee in %s\n",
+			     path);
+			continue;
+		}
+
+		for (int i = 0; i < num_ddr_domains; i++) {
+			struct ddr_domain_s *d = &ddr_domain[i];
+
+			if (d->socket != socket->valueint ||
+			    d->node != node->valueint)
+				continue;
+
+			d->bw_target = (int)((int64_t)knee->valueint * 100 /
+					     BASICALG_CONGESTED_PERCENT);
+			logv(TAG, "Domain %d: knee %d MB/s, DDR BW target "
+			     "%d MB/s\n", i, knee->valueint, d->bw_target);
+			calibrated++;
+		}
+	}
+
+	cJSON_Delete(root);
+
+	return calibrated;
+}
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "coreset.h"
+#include "log.h"
+
+#define TAG "CORESET"
+
+// Longest CPU list file read, "0-1023" style lists stay far below
+#define CORESET_MAX_LIST (8192)
+
+// Parses a CPU list into set, see coreset.h
+int coreset_parse(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+
+	while (*p) {
+		char *end;
+		long first, last;
+
+		while (isspace((unsigned char)*p) || *p == ',')
+			p++;
+		if (*p == '\0')
+			break;
+
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return -1;
+		p = end;
+
+		last = first;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+			p = end;
+		}
+
+		if (last >= CPU_SETSIZE) {
+			loge(TAG, "Core %ld out of range, max is %d\n", last,
+			     CPU_SETSIZE - 1);
+			return -1;
+		}
+
+		for (long core = first; core <= last; core++)
+			CPU_SET(core, set);
+
+		if (*p != ',' && *p != '\0' && !isspace((unsigned char)*p))
+			return -1;
+	}
+
+	return CPU_COUNT(set);
+}
+
+// Reads a CPU list file, see coreset.h
+int coreset_read(const char *path, cpu_set_t *set)
+{
+	char file[PATH_MAX];
+	char list[CORESET_MAX_LIST];
+	struct stat st;
+	size_t len;
+	FILE *fp;
+
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		snprintf(file, sizeof(file), "%s/%s", path, CORESET_CGROUP_FILE);
+	else
+		snprintf(file, sizeof(file), "%s", path);
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		loge(TAG, "Could not open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	len = fread(list, 1, sizeof(list) - 1, fp);
+	fclose(fp);
+	list[len] = '\0';
+
+	if (coreset_parse(list, set) < 0) {
+		loge(TAG, "Could not parse CPU list in %s\n", file);
+		return -1;
+	}
+
+	return CPU_COUNT(set);
+}
+
+// Formats set as a CPU list, see coreset.h
+char *coreset_format(const cpu_set_t *set, char *buf, size_t size)
+{
+	size_t pos = 0;
+	int core = 0;
+
+	buf[0] = '\0';
+
+	while (core < CPU_SETSIZE && pos < size) {
+		int first;
+
+		if (!CPU_ISSET(core, set)) {
+			core++;
+			continue;
+		}
+
+		first = core;
+		while (core + 1 < CPU_SETSIZE && CPU_ISSET(core + 1, set))
+			core++;
+
+		if (first == core)
+			pos += snprintf(buf + pos, size - pos, "%s%d",
+					pos ? "," : "", first);
+		else
+			pos += snprintf(buf + pos, size - pos, "%s%d-%d",
+					pos ? "," : "", first, core);
+		core++;
+	}
+
+	return buf;
+}
+
+int coreset_first(const cpu_set_t *set)
+{
+	for (int core = 0; core < CPU_SETSIZE; core++)
+		if (CPU_ISSET(core, set))
+			return core;
+
+	return -1;
+}
+
+int coreset_last(const cpu_set_t *set)
+{
+	for (int core = CPU_SETSIZE - 1; core >= 0; core--)
+		if (CPU_ISSET(core, set))
+			return core;
+
+	return -1;
+}
+
+// Copies set to a bitmask, see coreset.h
+void coreset_to_mask(const cpu_set_t *set, uint64_t *mask, int num_cores)
+{
+	memset(mask, 0, ((num_cores + 63) / 64) * sizeof(uint64_t));
+
+	for (int core = 0; core < num_cores && core < CPU_SETSIZE; core++)
+		if (CPU_ISSET(core, set))
+			mask[core / 64] |= 1ULL << (core % 64);
+}
+
@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bwprobe.h"
+#include "coreset.h"
+#include "ddr_domain.h"
+#include "log.h"
+#include "topology.h"
+
+#define TAG "DDR_DOMAIN"
+
+struct ddr_s ddr_socket[MAX_DDR_SOCKETS];
+int num_ddr_sockets;
+struct ddr_domain_s ddr_domain[MAX_DDR_DOMAINS];
+int num_ddr_domains;
+uint64_t num_ddr_samples;
+
+// NUMA nodes with online cores in a socket, in ascending order
+// Returns: number of nodes
+static int socket_nodes(int socket, int *nodes, int max_nodes)
+{
+	int num = 0;
+
+	for (int core = 0; core < topology.num_cpus; core++) {
+		struct topo_cpu_s *c = &topology.cpu[core];
+		int i;
+
+		if (!c->online || c->socket != socket || c->node < 0)
+			continue;
+
+		for (i = 0; i < num && nodes[i] < c->node; i++)
+			;
+		if (i < num && nodes[i] == c->node)
+			continue;
+		if (num == max_nodes)
+			break;
+
+		memmove(&nodes[i + 1], &nodes[i], (num - i) * sizeof(int));
+		nodes[i] = c->node;
+		num++;
+	}
+
+	return num;
+}
+
+// Adds a domain over the online cores of a socket, or of one of its nodes
+static struct ddr_domain_s *add_domain(int socket, int node)
+{
+	struct ddr_domain_s *d = &ddr_domain[num_ddr_domains++];
+
+	memset(d, 0, sizeof(*d));
+	d->socket = socket;
+	d->node = node;
+	d->ddr_index = -1;
+
+	for (int core = 0; core < topology.num_cpus; core++) {
+		struct topo_cpu_s *c = &topology.cpu[core];
+
+		if (c->online && (socket < 0 || c->socket == socket) &&
+		    (node < 0 || c->node == node))
+			CPU_SET(core, &d->cores);
+	}
+
+	return d;
+}
+
+static void log_domains(void)
+{
+	char list[256];
+
+	for (int i = 0; i < num_ddr_domains; i++) {
+		struct ddr_domain_s *d = &ddr_domain[i];
+
+		logv(TAG, "Domain %d: socket %d node %d, %d DDR channels, "
+		     "cores %s\n", i, d->socket, d->node, d->num_channels,
+		     coreset_format(&d->cores, list, sizeof(list)));
+	}
+}
+
+// Builds the domains over the sockets in ddr_socket[]
+// Under SNC the controllers of a socket are split evenly between its nodes,
+// in order. The node of a controller isn't exposed, this follows the layout
+// of the BIOS where each node owns a contiguous range of controllers.
+static int build_domains(void)
+{
+	num_ddr_domains = 0;
+
+	for (int s = 0; s < num_ddr_sockets; s++) {
+		struct ddr_s *ddr = &ddr_socket[s];
+		int nodes[MAX_DDR_DOMAINS];
+		int num_nodes;
+
+		num_nodes = socket_nodes(ddr->socket, nodes, MAX_DDR_DOMAINS);
+
+		// Clients and sockets without SNC are a single domain
+		if (ddr->ddr_interface_type == DDR_CLIENT || num_nodes < 2 ||
+		    ddr->num_ddr_controllers < num_nodes) {
+			nodes[0] = -1;
+			num_nodes = 1;
+		}
+
+		for (int n = 0; n < num_nodes; n++) {
+			struct ddr_domain_s *d;
+
+			if (num_ddr_domains == MAX_DDR_DOMAINS) {
+				loge(TAG, "Too many domains, max is %d\n",
+				     MAX_DDR_DOMAINS);
+				break;
+			}
+
+			d = add_domain(ddr->socket, nodes[n]);
+			d->ddr_index = s;
+			d->first_channel = ddr->num_ddr_controllers * n /
+					   num_nodes;
+			d->num_channels = ddr->num_ddr_controllers * (n + 1) /
+					  num_nodes - d->first_channel;
+		}
+	}
+
+	if (num_ddr_domains > 0)
+		log_domains();
+
+	return num_ddr_domains;
+}
+
+// Finds the DDR controllers and builds the domains, see ddr_domain.h
+int ddr_domain_init(int kernel_mode)
+{
+	num_ddr_sockets = pmu_ddr_init_sockets(ddr_socket, MAX_DDR_SOCKETS,
+					       kernel_mode);
+
+	return build_domains();
+}
+
+// Builds the domains over known controllers, see ddr_domain.h
+int ddr_domain_init_known(const struct ddr_s *sockets, int num,
+			  int kernel_mode)
+{
+	num_ddr_sockets = 0;
+
+	for (int s = 0; s < num && num_ddr_sockets < MAX_DDR_SOCKETS; s++) {
+		struct ddr_s *ddr = &ddr_socket[num_ddr_sockets];
+
+		memset(ddr, 0, sizeof(*ddr));
+		ddr->socket = sockets[s].socket;
+		ddr->bar_address = sockets[s].bar_address;
+		memcpy(ddr->bar_dev, sockets[s].bar_dev, sizeof(ddr->bar_dev));
+		ddr->ddr_interface_type = sockets[s].ddr_interface_type;
+		ddr->num_ddr_controllers = sockets[s].num_ddr_controllers;
+
+		if (ddr->num_ddr_controllers <= 0 ||
+		    ddr->num_ddr_controllers > MAX_NUM_DDR_CONTROLLERS)
+			continue;
+		if (kernel_mode != 1 && pmu_ddr_map(ddr) < 0)
+			continue;
+
+		num_ddr_sockets++;
+	}
+
+	return build_domains();
+}
+
+// One domain with RDT MBM, see ddr_domain.h
+void ddr_domain_init_rdt(void)
+{
+	struct ddr_domain_s *d;
+
+	num_ddr_domains = 0;
+	d = add_domain(-1, -1);
+	d->num_channels = 1;
+
+	log_domains();
+}
+
+void ddr_domain_deinit(void)
+{
+	for (int s = 0; s < num_ddr_sockets; s++)
+		if (ddr_socket[s].mem_file > 0)
+			close(ddr_socket[s].mem_file);
+
+	num_ddr_sockets = 0;
+	num_ddr_domains = 0;
+}
+
+int ddr_domain_of_core(int core)
+{
+	for (int i = 0; i < num_ddr_domains; i++)
+		if (CPU_ISSET(core, &ddr_domain[i].cores))
+			return i;
+
+	return 0;
+}
+
+// Splits the target by channels, see ddr_domain.h
+void ddr_domain_set_target(int total_mbps)
+{
+	int channels = 0;
+
+	for (int i = 0; i < num_ddr_domains; i++)
+		channels += ddr_domain[i].num_channels;
+
+	for (int i = 0; i < num_ddr_domains; i++) {
+		struct ddr_domain_s *d = &ddr_domain[i];
+
+		d->bw_target = channels ?
+			(int)((int64_t)total_mbps * d->num_channels / channels) :
+			total_mbps;
+
+		logv(TAG, "Domain %d: DDR BW target %d MB/s\n", i,
+		     d->bw_target);
+	}
+}
+
+// Probes every domain, see ddr_domain.h
+int ddr_domain_probe(int num_threads, int placement)
+{
+	struct bwprobe_result_s result;
+	int total = 0;
+
+	for (int i = 0; i < num_ddr_domains; i++) {
+		struct ddr_domain_s *d = &ddr_domain[i];
+
+		if (bwprobe_run(&d->cores, num_threads, placement, &result) < 0) {
+			loge(TAG, "Bandwidth probe of domain %d failed\n", i);
+			return -1;
+		}
+
+		logi(TAG, "Domain %d, %d threads: read %d, write %d, copy %d, "
+		     "triad %d MB/s\n", i, result.threads,
+		     result.mbps[BWPROBE_READ], result.mbps[BWPROBE_WRITE],
+		     result.mbps[BWPROBE_COPY], result.mbps[BWPROBE_TRIAD]);
+
+		d->probe_rd_mbps = result.mbps[BWPROBE_READ];
+		d->probe_wr_mbps = result.mbps[BWPROBE_WRITE];
+		d->bw_target = d->probe_rd_mbps;
+		total += d->bw_target;
+	}
+
+	return total;
+}
+
+// Samples all sockets and splits them by domain, see ddr_domain.h
+int ddr_domain_sample(struct ddr_sample_s sample[MAX_DDR_DOMAINS])
+{
+	struct ddr_sample_s socket_sample[MAX_DDR_SOCKETS];
+
+	for (int s = 0; s < num_ddr_sockets; s++)
+		if (pmu_ddr_sample(&ddr_socket[s], &socket_sample[s]) < 0)
+			return -1;
+
+	for (int i = 0; i < num_ddr_domains; i++) {
+		struct ddr_domain_s *d = &ddr_domain[i];
+		struct ddr_sample_s *from;
+
+		if (d->ddr_index < 0)
+			return -1;
+
+		from = &socket_sample[d->ddr_index];
+
+		sample[i].timestamp_ns = from->timestamp_ns;
+		sample[i].time_delta_ns = from->time_delta_ns;
+		sample[i].num_channels = d->num_channels;
+		sample[i].rd_total = 0;
+		sample[i].wr_total = 0;
+
+		for (int ch = 0; ch < d->num_channels; ch++) {
+			sample[i].rd_bytes[ch] = from->rd_bytes[d->first_channel + ch];
+			sample[i].wr_bytes[ch] = from->wr_bytes[d->first_channel + ch];
+			sample[i].rd_total += sample[i].rd_bytes[ch];
+			sample[i].wr_total += sample[i].wr_bytes[ch];
+		}
+
+		d->rd_bytes += sample[i].rd_total;
+		d->wr_bytes += sample[i].wr_total;
+	}
+
+	num_ddr_samples++;
+
+	return 0;
+}
+
+// Samples unless someone else did, see ddr_domain.h
+int ddr_domain_update(uint64_t *samples)
+{
+	struct ddr_sample_s sample[MAX_DDR_DOMAINS];
+
+	if (*samples == num_ddr_samples &&
+	    ddr_domain_sample(sample) < 0)
+		return -1;
+
+	*samples = num_ddr_samples;
+
+	return 0;
+}
@@ -0,0 +1,699 @@
+#define _GNU_SOURCE
+
+#include <cpuid.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cJSON.h"
+#include "ddr_domain.h"
+#include "hwcache.h"
+#include "log.h"
+#include "pcie.h"
+#include "sysdetect.h"
+#include "topology.h"
+
+#define TAG "HWCACHE"
+
+#define HWCACHE_MICROCODE TOPO_SYSFS_CPU "/cpu0/microcode/version"
+
+struct hwcache_s hwcache = {
+	.dmi_mbps = -1,
+	.num_sockets = -1,
+};
+
+static char hwcache_path[PATH_MAX];
+static struct hwcache_id_s hwcache_id;
+static long long hwcache_created;
+
+// Reads the first line of a file, without the newline
+// Returns: 0 on success, -1 on failure with buf empty
+static int hwcache_read_line(const char *path, char *buf, size_t size)
+{
+	FILE *fp;
+
+	buf[0] = '\0';
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	if (fgets(buf, size, fp) == NULL)
+		buf[0] = '\0';
+	fclose(fp);
+
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return buf[0] ? 0 : -1;
+}
+
+// Microcode revision of core 0, from sysfs or /proc/cpuinfo
+static uint32_t hwcache_microcode(void)
+{
+	char line[256];
+	uint32_t rev = 0;
+	FILE *fp;
+
+	if (hwcache_read_line(HWCACHE_MICROCODE, line, sizeof(line)) == 0)
+		return strtoul(line, NULL, 0);
+
+	fp = fopen("/proc/cpuinfo", "r");
+	if (fp == NULL)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *value = strchr(line, ':');
+
+		if (strncmp(line, "microcode", 9) == 0 && value != NULL) {
+			rev = strtoul(value + 1, NULL, 0);
+			break;
+		}
+	}
+	fclose(fp);
+
+	return rev;
+}
+
+// FNV-1a of the SMBIOS table, the BIOS version and the DIMMs are in there,
+// most BIOS setup options are not
+// Returns: hash, 0 if the table can't be read
+static uint64_t hwcache_dmi_hash(void)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned char buf[4096];
+	size_t len, total = 0;
+	FILE *fp;
+
+	fp = fopen(DMI_FILE, "rb");
+	if (fp == NULL)
+		return 0;
+
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		for (size_t i = 0; i < len; i++) {
+			hash ^= buf[i];
+			hash *= 0x100000001b3ULL;
+		}
+		total += len;
+	}
+	fclose(fp);
+
+	return total ? hash : 0;
+}
+
+// Identity of the running system, see hwcache.h
+static void hwcache_identity(struct hwcache_id_s *id)
+{
+	unsigned int eax, ebx, ecx, edx;
+	struct utsname uts;
+
+	memset(id, 0, sizeof(*id));
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		id->cpuid_sig = eax;
+	id->microcode = hwcache_microcode();
+	id->dmi_hash = hwcache_dmi_hash();
+
+	if (uname(&uts) == 0)
+		snprintf(id->kernel, sizeof(id->kernel), "%s", uts.release);
+
+	hwcache_read_line(TOPO_SYSFS_CPU "/online", id->cpus, sizeof(id->cpus));
+	hwcache_read_line(TOPO_SYSFS_NODE "/online", id->nodes,
+			  sizeof(id->nodes));
+}
+
+// Reads the whole file into a string
+// Returns: the text, to be freed, NULL on failure
+static char *hwcache_read_file(const char *path)
+{
+	char *text;
+	long size;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	text = size > 0 ? malloc(size + 1) : NULL;
+	if (text != NULL) {
+		if (fread(text, 1, size, fp) != (size_t)size) {
+			free(text);
+			text = NULL;
+		} else {
+			text[size] = '\0';
+		}
+	}
+	fclose(fp);
+
+	return text;
+}
+
+// 64 bit values are kept as hex strings, a JSON number is a double
+static void hwcache_add_hex(cJSON *obj, const char *name, uint64_t value)
+{
+	char hex[19];
+
+	snprintf(hex, sizeof(hex), "0x%lx", (unsigned long)value);
+	cJSON_AddStringToObject(obj, name, hex);
+}
+
+static int hwcache_get_hex(const cJSON *obj, const char *name, uint64_t *value)
+{
+	cJSON *item = cJSON_GetObjectItem(obj, name);
+
+	if (!cJSON_IsString(item))
+		return -1;
+
+	*value = strtoull(item->valuestring, NULL, 16);
+
+	return 0;
+}
+
+static int hwcache_get_int(const cJSON *obj, const char *name, int *value)
+{
+	cJSON *item = cJSON_GetObjectItem(obj, name);
+
+	if (!cJSON_IsNumber(item))
+		return -1;
+
+	*value = item->valueint;
+
+	return 0;
+}
+
+static const char *hwcache_get_string(const cJSON *obj, const char *name)
+{
+	cJSON *item = cJSON_GetObjectItem(obj, name);
+
+	return cJSON_IsString(item) ? item->valuestring : "";
+}
+
+// Compares the file against the running system
+// Returns: NULL if it matches, else what differs
+static const char *hwcache_check(const cJSON *root)
+{
+	cJSON *id = cJSON_GetObjectItem(root, "id");
+	cJSON *created = cJSON_GetObjectItem(root, "created");
+	uint64_t value;
+	int version;
+
+	if (hwcache_get_int(root, "version", &version) < 0 ||
+	    version != HWCACHE_VERSION)
+		return "version";
+	if (!cJSON_IsObject(id) || !cJSON_IsNumber(created))
+		return "format";
+
+	hwcache_created = (long long)created->valuedouble;
+	if (time(NULL) - hwcache_created > HWCACHE_MAX_AGE_S ||
+	    hwcache_created > time(NULL))
+		return "age";
+
+	if (hwcache_get_hex(id, "cpuid", &value) < 0 ||
+	    value != hwcache_id.cpuid_sig)
+		return "CPUID signature";
+	if (hwcache_get_hex(id, "microcode", &value) < 0 ||
+	    value != hwcache_id.microcode)
+		return "microcode";
+	if (hwcache_get_hex(id, "dmi_hash", &value) < 0 ||
+	    value != hwcache_id.dmi_hash)
+		return "SMBIOS table";
+	if (strcmp(hwcache_get_string(id, "kernel"), hwcache_id.kernel))
+		return "kernel";
+	if (strcmp(hwcache_get_string(id, "cpus"), hwcache_id.cpus))
+		return "online CPUs";
+	if (strcmp(hwcache_get_string(id, "nodes"), hwcache_id.nodes))
+		return "online nodes";
+
+	return NULL;
+}
+
+// Topology from the file, one [online, type, cluster, die, socket, node]
+// array per core
+// Returns: 0, -1 if it is incomplete
+static int hwcache_restore_topology(const cJSON *topo)
+{
+	static struct topology_s t;
+	cJSON *cpus = cJSON_GetObjectItem(topo, "cpus");
+	cJSON *cpu;
+	int core = 0;
+
+	memset(&t, 0, sizeof(t));
+
+	if (hwcache_get_int(topo, "hybrid", &t.hybrid) < 0 ||
+	    hwcache_get_int(topo, "num_cpus", &t.num_cpus) < 0 ||
+	    hwcache_get_int(topo, "num_online", &t.num_online) < 0 ||
+	    hwcache_get_int(topo, "num_ecores", &t.num_ecores) < 0 ||
+	    hwcache_get_int(topo, "num_clusters", &t.num_clusters) < 0 ||
+	    hwcache_get_int(topo, "num_dies", &t.num_dies) < 0 ||
+	    hwcache_get_int(topo, "num_sockets", &t.num_sockets) < 0 ||
+	    hwcache_get_int(topo, "num_nodes", &t.num_nodes) < 0 ||
+	    !cJSON_IsArray(cpus))
+		return -1;
+
+	if (t.num_cpus <= 0 || t.num_cpus > MAX_NUM_CORES ||
+	    cJSON_GetArraySize(cpus) != t.num_cpus)
+		return -1;
+
+	cJSON_ArrayForEach(cpu, cpus) {
+		struct topo_cpu_s *c = &t.cpu[core++];
+		int f[6];
+
+		if (!cJSON_IsArray(cpu) || cJSON_GetArraySize(cpu) != 6)
+			return -1;
+
+		for (int i = 0; i < 6; i++) {
+			cJSON *item = cJSON_GetArrayItem(cpu, i);
+
+			if (!cJSON_IsNumber(item))
+				return -1;
+			f[i] = item->valueint;
+		}
+
+		c->online = f[0];
+		c->type = f[1];
+		c->cluster = f[2];
+		c->die = f[3];
+		c->socket = f[4];
+		c->node = f[5];
+	}
+
+	t.initialized = 1;
+	topology = t;
+
+	return 0;
+}
+
+// Fills hwcache from the file, the topology last, so nothing is restored
+// from an incomplete file
+// Returns: 0, -1 if an entry is malformed
+static int hwcache_restore(const cJSON *root)
+{
+	cJSON *sockets = cJSON_GetObjectItem(root, "ddr");
+	cJSON *probes = cJSON_GetObjectItem(root, "probe");
+	cJSON *topo = cJSON_GetObjectItem(root, "topology");
+	cJSON *item;
+
+	if (hwcache_get_int(root, "dmi_mbps", &hwcache.dmi_mbps) < 0)
+		hwcache.dmi_mbps = -1;
+
+	// The scan has run if the array is there, even if it found nothing
+	if (cJSON_IsArray(sockets)) {
+		hwcache.num_sockets = 0;
+
+		cJSON_ArrayForEach(item, sockets) {
+			struct ddr_s *ddr = &hwcache.sockets[hwcache.num_sockets];
+
+			if (hwcache.num_sockets == MAX_DDR_SOCKETS)
+				return -1;
+
+			memset(ddr, 0, sizeof(*ddr));
+			if (hwcache_get_int(item, "socket", &ddr->socket) < 0 ||
+			    hwcache_get_int(item, "type",
+					    &ddr->ddr_interface_type) < 0 ||
+			    hwcache_get_int(item, "controllers",
+					    &ddr->num_ddr_controllers) < 0 ||
+			    hwcache_get_hex(item, "bar", &ddr->bar_address) < 0)
+				return -1;
+			snprintf(ddr->bar_dev, sizeof(ddr->bar_dev), "%s",
+				 hwcache_get_string(item, "bar_dev"));
+
+			hwcache.num_sockets++;
+		}
+	}
+
+	if (cJSON_IsArray(probes)) {
+		cJSON_ArrayForEach(item, probes) {
+			struct hwcache_probe_s *p = &hwcache.probe[hwcache.num_probes];
+
+			if (hwcache.num_probes == MAX_DDR_DOMAINS)
+				return -1;
+
+			if (hwcache_get_int(item, "socket", &p->socket) < 0 ||
+			    hwcache_get_int(item, "node", &p->node) < 0 ||
+			    hwcache_get_int(item, "threads", &p->threads) < 0 ||
+			    hwcache_get_int(item, "placement", &p->placement) < 0 ||
+			    hwcache_get_int(item, "read_mbps", &p->rd_mbps) < 0 ||
+			    hwcache_get_int(item, "write_mbps", &p->wr_mbps) < 0)
+				return -1;
+
+			hwcache.num_probes++;
+		}
+	}
+
+	if (!cJSON_IsObject(topo) || hwcache_restore_topology(topo) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void hwcache_reset(void)
+{
+	memset(&hwcache, 0, sizeof(hwcache));
+	hwcache.dmi_mbps = -1;
+	hwcache.num_sockets = -1;
+}
+
+// Loads the cache, see hwcache.h
+int hwcache_load(const char *path, int rebuild)
+{
+	const char *mismatch;
+	cJSON *root;
+	char *text;
+
+	hwcache_reset();
+	hwcache_path[0] = '\0';
+
+	if (path == NULL || path[0] == '\0')
+		return -1;
+
+	snprintf(hwcache_path, sizeof(hwcache_path), "%s", path);
+	hwcache_identity(&hwcache_id);
+	hwcache_created = time(NULL);
+	hwcache.dirty = 1;
+
+	if (rebuild) {
+		logi(TAG, "Rebuilding the hardware cache %s\n", path);
+		return -1;
+	}
+
+	text = hwcache_read_file(path);
+	if (text == NULL) {
+		logv(TAG, "No hardware cache %s, detecting\n", path);
+		return -1;
+	}
+
+	root = cJSON_Parse(text);
+	free(text);
+
+	if (root == NULL) {
+		logi(TAG, "Hardware cache %s is corrupt, detecting\n", path);
+		return -1;
+	}
+
+	mismatch = hwcache_check(root);
+	if (mismatch == NULL && hwcache_restore(root) < 0)
+		mismatch = "format";
+	cJSON_Delete(root);
+
+	if (mismatch != NULL) {
+		logi(TAG, "Hardware cache %s is stale (%s), detecting\n", path,
+		     mismatch);
+		hwcache_reset();
+		hwcache_created = time(NULL);
+		hwcache.dirty = 1;
+		return -1;
+	}
+
+	hwcache.loaded = 1;
+	hwcache.dirty = 0;
+	logi(TAG, "Using hardware cache %s\n", path);
+
+	return 0;
+}
+
+static cJSON *hwcache_topology_json(void)
+{
+	cJSON *topo = cJSON_CreateObject();
+	cJSON *cpus = cJSON_CreateArray();
+
+	cJSON_AddNumberToObject(topo, "hybrid", topology.hybrid);
+	cJSON_AddNumberToObject(topo, "num_cpus", topology.num_cpus);
+	cJSON_AddNumberToObject(topo, "num_online", topology.num_online);
+	cJSON_AddNumberToObject(topo, "num_ecores", topology.num_ecores);
+	cJSON_AddNumberToObject(topo, "num_clusters", topology.num_clusters);
+	cJSON_AddNumberToObject(topo, "num_dies", topology.num_dies);
+	cJSON_AddNumberToObject(topo, "num_sockets", topology.num_sockets);
+	cJSON_AddNumberToObject(topo, "num_nodes", topology.num_nodes);
+
+	for (int core = 0; core < topology.num_cpus; core++) {
+		struct topo_cpu_s *c = &topology.cpu[core];
+		int f[6] = { c->online, c->type, c->cluster, c->die, c->socket,
+			     c->node };
+
+		cJSON_AddItemToArray(cpus, cJSON_CreateIntArray(f, 6));
+	}
+	cJSON_AddItemToObject(topo, "cpus", cpus);
+
+	return topo;
+}
+
+static cJSON *hwcache_json(void)
+{
+	cJSON *root = cJSON_CreateObject();
+	cJSON *id = cJSON_AddObjectToObject(root, "id");
+
+	cJSON_AddNumberToObject(root, "version", HWCACHE_VERSION);
+	cJSON_AddNumberToObject(root, "created", (double)hwcache_created);
+
+	hwcache_add_hex(id, "cpuid", hwcache_id.cpuid_sig);
+	hwcache_add_hex(id, "microcode", hwcache_id.microcode);
+	hwcache_add_hex(id, "dmi_hash", hwcache_id.dmi_hash);
+	cJSON_AddStringToObject(id, "kernel", hwcache_id.kernel);
+	cJSON_AddStringToObject(id, "cpus", hwcache_id.cpus);
+	cJSON_AddStringToObject(id, "nodes", hwcache_id.nodes);
+
+	cJSON_AddNumberToObject(root, "dmi_mbps", hwcache.dmi_mbps);
+
+	if (hwcache.num_sockets >= 0) {
+		cJSON *sockets = cJSON_AddArrayToObject(root, "ddr");
+
+		for (int s = 0; s < hwcache.num_sockets; s++) {
+			struct ddr_s *ddr = &hwcache.sockets[s];
+			cJSON *item = cJSON_CreateObject();
+
+			cJSON_AddNumberToObject(item, "socket", ddr->socket);
+			cJSON_AddNumberToObject(item, "type",
+						ddr->ddr_interface_type);
+			cJSON_AddNumberToObject(item, "controllers",
+						ddr->num_ddr_controllers);
+			hwcache_add_hex(item, "bar", ddr->bar_address);
+			cJSON_AddStringToObject(item, "bar_dev", ddr->bar_dev);
+			cJSON_AddItemToArray(sockets, item);
+		}
+	}
+
+	if (hwcache.num_probes > 0) {
+		cJSON *probes = cJSON_AddArrayToObject(root, "probe");
+
+		for (int i = 0; i < hwcache.num_probes; i++) {
+			struct hwcache_probe_s *p = &hwcache.probe[i];
+			cJSON *item = cJSON_CreateObject();
+
+			cJSON_AddNumberToObject(item, "socket", p->socket);
+			cJSON_AddNumberToObject(item, "node", p->node);
+			cJSON_AddNumberToObject(item, "threads", p->threads);
+			cJSON_AddNumberToObject(item, "placement", p->placement);
+			cJSON_AddNumberToObject(item, "read_mbps", p->rd_mbps);
+			cJSON_AddNumberToObject(item, "write_mbps", p->wr_mbps);
+			cJSON_AddItemToArray(probes, item);
+		}
+	}
+
+	cJSON_AddItemToObject(root, "topology", hwcache_topology_json());
+
+	return root;
+}
+
+// Writes the cache, see hwcache.h
+// The file is written next to its final name and renamed, so a dPF starting
+// at the same time reads either the old or the new cache, never a part.
+int hwcache_save(void)
+{
+	char tmp[PATH_MAX + 8];
+	char dir[PATH_MAX];
+	char *slash, *text;
+	cJSON *root;
+	FILE *fp;
+	int ret = 0;
+
+	if (hwcache_path[0] == '\0' || !hwcache.dirty || !topology.initialized)
+		return 0;
+
+	snprintf(dir, sizeof(dir), "%s", hwcache_path);
+	slash = strrchr(dir, '/');
+	if (slash != NULL && slash != dir) {
+		*slash = '\0';
+		if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+			logv(TAG, "Could not create %s\n", dir);
+	}
+
+	root = hwcache_json();
+	text = cJSON_Print(root);
+	cJSON_Delete(root);
+	if (text == NULL)
+		return -1;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", hwcache_path, (int)getpid());
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		loge(TAG, "Could not write %s\n", tmp);
+		free(text);
+		return -1;
+	}
+
+	if (fputs(text, fp) < 0 || fputc('\n', fp) < 0)
+		ret = -1;
+	if (fclose(fp) != 0)
+		ret = -1;
+	free(text);
+
+	if (ret == 0 && rename(tmp, hwcache_path) < 0)
+		ret = -1;
+
+	if (ret < 0) {
+		loge(TAG, "Could not write %s\n", hwcache_path);
+		unlink(tmp);
+		return -1;
+	}
+
+	hwcache.dirty = 0;
+	logv(TAG, "Hardware cache written to %s\n", hwcache_path);
+
+	return 0;
+}
+
+// DMI peak bandwidth, see hwcache.h
+int hwcache_dmi_bandwidth(void)
+{
+	int mbps;
+
+	if (hwcache.dmi_mbps > 0)
+		return hwcache.dmi_mbps;
+
+	mbps = dmi_get_bandwidth();
+	if (mbps > 0) {
+		hwcache.dmi_mbps = mbps;
+		hwcache.dirty = 1;
+	}
+
+	return mbps;
+}
+
+// Reads every cached BAR again from its PCI device. A stale BAR would still
+// map, /dev/mem doesn't tell, so the counters would read garbage.
+// Returns: 0 if all match, -1 otherwise
+static int hwcache_check_bars(void)
+{
+	for (int s = 0; s < hwcache.num_sockets; s++) {
+		struct ddr_s *ddr = &hwcache.sockets[s];
+		uint64_t bar;
+
+		if (pmu_ddr_read_bar(ddr, &bar) < 0) {
+			logi(TAG, "BAR of socket %d can't be read from %s, "
+			     "scanning PCI\n", ddr->socket,
+			     ddr->bar_dev[0] ? ddr->bar_dev : "its device");
+			return -1;
+		}
+
+		if (bar != ddr->bar_address) {
+			logi(TAG, "BAR of socket %d moved from 0x%lx to 0x%lx, "
+			     "scanning PCI\n", ddr->socket,
+			     (unsigned long)ddr->bar_address, (unsigned long)bar);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Memory domains, see hwcache.h
+int hwcache_ddr_domain_init(int kernel_mode)
+{
+	int num;
+
+	if (hwcache.num_sockets >= 0 && hwcache_check_bars() == 0) {
+		num = ddr_domain_init_known(hwcache.sockets,
+					    hwcache.num_sockets, kernel_mode);
+		if (num > 0 || hwcache.num_sockets == 0)
+			return num;
+
+		logi(TAG, "Cached DDR controllers could not be mapped, "
+		     "scanning PCI\n");
+	}
+
+	if (pcie_init() < 0)
+		return 0;
+
+	num = ddr_domain_init(kernel_mode);
+
+	hwcache.num_sockets = num_ddr_sockets;
+	for (int s = 0; s < num_ddr_sockets; s++)
+		hwcache.sockets[s] = ddr_socket[s];
+	hwcache.dirty = 1;
+
+	return num;
+}
+
+static struct hwcache_probe_s *hwcache_find_probe(const struct ddr_domain_s *d,
+						  int num_threads, int placement)
+{
+	for (int i = 0; i < hwcache.num_probes; i++) {
+		struct hwcache_probe_s *p = &hwcache.probe[i];
+
+		if (p->socket == d->socket && p->node == d->node &&
+		    p->threads == num_threads && p->placement == placement)
+			return p;
+	}
+
+	return NULL;
+}
+
+// Bandwidth probe, see hwcache.h
+// Only the last probe is kept, a probe with other threads or placement
+// replaces it.
+int hwcache_ddr_domain_probe(int num_threads, int placement)
+{
+	int total = 0;
+	int i;
+
+	for (i = 0; i < num_ddr_domains; i++)
+		if (hwcache_find_probe(&ddr_domain[i], num_threads,
+				       placement) == NULL)
+			break;
+
+	if (num_ddr_domains > 0 && i == num_ddr_domains) {
+		for (i = 0; i < num_ddr_domains; i++) {
+			struct ddr_domain_s *d = &ddr_domain[i];
+			struct hwcache_probe_s *p;
+
+			p = hwcache_find_probe(d, num_threads, placement);
+			d->probe_rd_mbps = p->rd_mbps;
+			d->probe_wr_mbps = p->wr_mbps;
+			d->bw_target = d->probe_rd_mbps;
+			total += d->bw_target;
+
+			logi(TAG, "Domain %d: read %d, write %d MB/s, cached\n",
+			     i, d->probe_rd_mbps, d->probe_wr_mbps);
+		}
+
+		return total;
+	}
+
+	total = ddr_domain_probe(num_threads, placement);
+	if (total <= 0)
+		return total;
+
+	hwcache.num_probes = 0;
+	for (i = 0; i < num_ddr_domains; i++) {
+		struct hwcache_probe_s *p = &hwcache.probe[hwcache.num_probes++];
+
+		p->socket = ddr_domain[i].socket;
+		p->node = ddr_domain[i].node;
+		p->threads = num_threads;
+		p->placement = placement;
+		p->rd_mbps = ddr_domain[i].probe_rd_mbps;
+		p->wr_mbps = ddr_domain[i].probe_wr_mbps;
+	}
+	hwcache.dirty = 1;
+
+	return total;
+}
@@ -0,0 +1,58 @@
+#ifndef __ABTEST_H
+#define __ABTEST_H
+
+#include <stdint.h>
+
+// A/B evaluation of the user space tuner. Time is split into epochs that
+// either run the prefetcher MSRs read at start (A, baseline) or let the
+// tuner set them (B, tuned). Instructions, IPC and DDR traffic of the tuned
+// cores are recorded per epoch, and the means of both sides are compared
+// with a Welch t-test and a 95% confidence interval of the difference.
+// The first interval of every epoch lets the prefetchers settle and is not
+// counted.
+
+#define ABTEST_EPOCH_S (60)	// default epoch length
+#define ABTEST_SETTLE (1)	// intervals not counted after a switch
+
+#define ABTEST_ORDER_ALTERNATE (0)	// A B A B ...
+#define ABTEST_ORDER_ABBA (1)		// A B B A ..., cancels linear drift
+#define ABTEST_ORDER_RANDOM (2)		// random order within every pair
+
+enum abtest_side {
+	ABTEST_BASELINE = 0,
+	ABTEST_TUNED,
+	ABTEST_SIDES
+};
+
+enum abtest_metric {
+	ABTEST_INSTR_RATE = 0,	// instructions retired per second, all cores
+	ABTEST_IPC,		// instructions per cycle, all cores
+	ABTEST_DDR_MBPS,	// DDR reads and writes, all domains
+	ABTEST_METRICS
+};
+
+extern int abtest_enabled;
+
+// Sets up the first epoch, baseline unless the order is random
+// epoch_s: epoch length in seconds, at least two intervals
+// order: ABTEST_ORDER_*
+// Returns: 0, -1 on invalid arguments
+int abtest_init(float epoch_s, int order);
+
+// Order from its name, alternate, abba or random
+// Returns: ABTEST_ORDER_*, -1 if unknown
+int abtest_parse_order(const char *name);
+
+// 1 while the hardware defaults are to be written instead of the tuned
+// values, always 0 without an A/B test
+int abtest_baseline(void);
+
+// Called by the first core once per interval after the decision. Counts the
+// interval into the running epoch and switches to the next epoch at its end,
+// marking the prefetcher MSRs of all cores dirty.
+void abtest_interval(void);
+
+// Logs the comparison of all completed epochs
+void abtest_report(void);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef __BASICALG_CORE_H
+#define __BASICALG_CORE_H
+
+// Decision core of the primitive tuners (--alg 0 and 1), shared by
+// tuners/primitive.c and kernelmod/kernel_primitive.c. Everything is
+// integer / Q16.16 so dpf and dpf.ko take identical decisions from the
+// same counter values.
+
+#include "fixedpoint.h"
+#include "atom_msr.h"
+
+// Tune algorithms
+#define BASICALG_XQ (0)		// L2/L3 XQ thresholds
+#define BASICALG_MAXDIST (1)	// L2/L3 max prefetch distance
+
+#define BASICALG_LEVELS (11)
+
+// Utilization, in percent of the target, from which the tuners throttle
+#define BASICALG_CONGESTED_PERCENT (80)
+
+// Upper bounds of the utilization levels, as fraction of the DDR target
+static const fp_t basicalg_thresholds[BASICALG_LEVELS] = {
+	FP_FROM_RATIO(10, 100), FP_FROM_RATIO(20, 100), FP_FROM_RATIO(30, 100),
+	FP_FROM_RATIO(40, 100), FP_FROM_RATIO(50, 100), FP_FROM_RATIO(60, 100),
+	FP_FROM_RATIO(70, 100), FP_FROM_RATIO(BASICALG_CONGESTED_PERCENT, 100),
+	FP_FROM_RATIO(90, 100), FP_FROM_RATIO(93, 100), FP_FROM_RATIO(96, 100),
+};
+
+// Step for each level, the last entry is used above the highest threshold.
+// Below 10% the system is considered idle and nothing is changed.
+static const int basicalg_steps[BASICALG_LEVELS + 1] = {
+	0, -8, -4, -2, -1, -1, -1, -1, 1, 2, 4, 8,
+};
+
+// DDR utilization in Q16.16 (1.0 = at target)
+// bytes transferred during time_ns, compared to target_mbps (MB/s)
+static inline fp_t basicalg_ddr_util(uint64_t bytes, uint64_t time_ns,
+				     uint32_t target_mbps)
+{
+	// target bytes for the period, MB/s * us * 2^20 / 10^6
+	uint64_t target = fp_udiv64((uint64_t)target_mbps *
+				    fp_udiv64(time_ns, 1000) * 1048576ULL, 1000000);
+
+	if (target == 0)
+		return 0;
+
+	return (fp_t)fp_udiv64(bytes << FP_SHIFT, target);
+}
+
+// Utilization the tuner acts on, the larger of the average over all
+// channels and the hottest channel against its even share of the target
+static inline fp_t basicalg_ddr_util_channels(uint64_t total_bytes,
+					      uint64_t hot_bytes, int num_channels,
+					      uint64_t time_ns, uint32_t target_mbps)
+{
+	fp_t util = basicalg_ddr_util(total_bytes, time_ns, target_mbps);
+	fp_t hot;
+
+	if (num_channels <= 1)
+		return util;
+
+	hot = basicalg_ddr_util(hot_bytes * num_channels, time_ns, target_mbps);
+
+	return hot > util ? hot : util;
+}
+
+// Change to apply for a given utilization
+// aggr10: aggressiveness * 10, the step is scaled by aggr10 / 10 and
+// rounded half away from zero
+// sign: 1 for parameters that should shrink at low utilization, -1 otherwise
+static inline int basicalg_delta(fp_t util, int aggr10, int sign)
+{
+	int level = 0;
+	int step, delta;
+
+	while (level < BASICALG_LEVELS && util >= basicalg_thresholds[level])
+		level++;
+
+	step = basicalg_steps[level] * sign;
+	delta = ((step < 0 ? -step : step) * aggr10 + 5) / 10;
+
+	return step < 0 ? -delta : delta;
+}
+
+static inline int basicalg_clamp(int value, int max)
+{
+	if (value <= 0)
+		value = 1;
+	if (value > max)
+		value = max;
+
+	return value;
+}
+
+// Applies one tuning step to the prefetch MSRs of one core
+// msr: MSR values, 0x1320 first (union msr_u layout)
+// Returns 1 if any value changed, 0 otherwise
+static inline int basicalg_tune(int tunealg, fp_t util, int aggr10,
+				union msr_u msr[])
+{
+	int changed = 0;
+	int v;
+
+	if (tunealg == BASICALG_XQ) {
+		int delta = basicalg_delta(util, aggr10, 1);
+
+		v = basicalg_clamp(msr[0].msr1320.L2_STREAM_AMP_XQ_THRESHOLD + delta, L2XQ_MAX);
+		if (v != (int)msr[0].msr1320.L2_STREAM_AMP_XQ_THRESHOLD) {
+			msr[0].msr1320.L2_STREAM_AMP_XQ_THRESHOLD = v;
+			changed = 1;
+		}
+
+		v = basicalg_clamp(msr[0].msr1320.LLC_STREAM_XQ_THRESHOLD + delta, L3XQ_MAX);
+		if (v != (int)msr[0].msr1320.LLC_STREAM_XQ_THRESHOLD) {
+			msr[0].msr1320.LLC_STREAM_XQ_THRESHOLD = v;
+			changed = 1;
+		}
+	} else if (tunealg == BASICALG_MAXDIST) {
+		int delta = basicalg_delta(util, aggr10, -1);
+
+		v = basicalg_clamp(msr[0].msr1320.L2_STREAM_MAX_DISTANCE + delta, L2MAXDIST_MAX);
+		if (v != (int)msr[0].msr1320.L2_STREAM_MAX_DISTANCE) {
+			msr[0].msr1320.L2_STREAM_MAX_DISTANCE = v;
+			changed = 1;
+		}
+
+		v = basicalg_clamp(msr[0].msr1320.LLC_STREAM_MAX_DISTANCE + delta, L3MAXDIST_MAX);
+		if (v != (int)msr[0].msr1320.LLC_STREAM_MAX_DISTANCE) {
+			msr[0].msr1320.LLC_STREAM_MAX_DISTANCE = v;
+			changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+#endif /* __BASICALG_CORE_H */
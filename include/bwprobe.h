@@ -0,0 +1,65 @@
+#ifndef __BWPROBE_H
+#define __BWPROBE_H
+
+#include <sched.h>
+#include <stdint.h>
+
+// STREAM style DDR bandwidth probe. Threads are pinned to the given cores
+// and first touch their own arrays, so memory is local to the NUMA node of
+// the cores. Stores are non-temporal and time is wall clock.
+
+#define BWPROBE_ARRAY_BYTES (256UL * 1024 * 1024) // per array, far above LLC
+#define BWPROBE_NTIMES (5) // best of
+
+#define BWPROBE_PLACE_SPREAD (0)  // one thread per module before the next
+#define BWPROBE_PLACE_COMPACT (1) // cores in order, modules filled up
+
+enum bwprobe_kernel {
+	BWPROBE_READ = 0,	// sum += a[i]
+	BWPROBE_WRITE,		// a[i] = s
+	BWPROBE_COPY,		// b[i] = a[i]
+	BWPROBE_TRIAD,		// a[i] = b[i] + s * c[i]
+	BWPROBE_KERNELS
+};
+
+struct bwprobe_result_s {
+	int threads;
+	int mbps[BWPROBE_KERNELS]; // MB/s of the fastest run
+};
+
+// Background read load, runs until stopped
+struct bwprobe_load_thread_s;
+struct bwprobe_load_s {
+	int num_threads;
+	volatile int stop;
+	struct bwprobe_load_thread_s *threads;
+};
+
+// Runs all kernels with num_threads threads on the cores of cores, 0 for one
+// per core
+// Returns: 0 on success, -1 on failure
+int bwprobe_run(const cpu_set_t *cores, int num_threads, int placement,
+		struct bwprobe_result_s *result);
+
+// Orders the online cores of cores for a placement
+// Returns: number of cores written to order
+int bwprobe_order(const cpu_set_t *cores, int placement, int *order);
+
+// Starts read load threads on cores[0 .. num_threads - 1], returns once
+// every thread has touched its memory and is loading
+// Returns: 0 on success, -1 on failure
+int bwprobe_load_start(struct bwprobe_load_s *load, const int *cores,
+		       int num_threads);
+
+// Bytes read by the load threads since they started
+uint64_t bwprobe_load_bytes(struct bwprobe_load_s *load);
+
+void bwprobe_load_stop(struct bwprobe_load_s *load);
+
+// Placement from its name, spread or compact
+// Returns: BWPROBE_PLACE_*, -1 if unknown
+int bwprobe_parse_placement(const char *name);
+
+const char *bwprobe_kernel_name(int kernel);
+
+#endif
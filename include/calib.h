@@ -0,0 +1,40 @@
+#ifndef __CALIB_H
+#define __CALIB_H
+
+// Loaded-latency calibration. A pointer chase measures memory latency on one
+// core of a memory domain while read load on the other cores is stepped up.
+// The knee of the latency-vs-bandwidth curve is where queuing starts, the
+// tuners target it instead of a percentage of the DMI peak.
+
+#define CALIB_FILE "calibration.json"
+#define CALIB_MAX_STEPS (32)
+#define CALIB_DEFAULT_STEPS (8)
+#define CALIB_KNEE_RATIO (2.0)	// knee: last point below twice idle latency
+#define CALIB_CHASE_BYTES (256UL * 1024 * 1024)
+#define CALIB_CHASE_LOADS (2 * 1024 * 1024) // dependent loads per point
+
+struct calib_point_s {
+	int load_threads;
+	int mbps;		// background read bandwidth
+	double latency_ns;	// average dependent load latency
+};
+
+struct calib_curve_s {
+	int socket;		// domain, matched against ddr_domain[]
+	int node;
+	int num_points;		// by increasing load
+	int knee;		// index of the knee point
+	struct calib_point_s point[CALIB_MAX_STEPS];
+};
+
+// Records the curve of every memory domain and writes them to path, domains
+// with a single online core have no load cores and are left out
+// steps: number of load levels, 2 to CALIB_MAX_STEPS
+// Returns: 0 on success, -1 on failure
+int calib_run(const char *path, int steps);
+
+// Reads a calibration file and targets the knee of every domain in it
+// Returns: number of domains calibrated, -1 if the file can't be used
+int calib_load(const char *path);
+
+#endif
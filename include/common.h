@@ -16,14 +16,16 @@
 #define MAX_PRIORITY (99)
 #define MAX_WEIGHT_STR_LEN (MAX_THREADS * 3)
 
-#define CORE_IN_MODULE ((tstate->core_id - core_first) % 4)
-#define ACTIVE_THREADS (core_last - core_first + 1)
+#define ACTIVE_THREADS (active_threads)
 
 struct thread_state {
 	pthread_t thread_id; // from pthread_create()
 	int core_id;
+	int module_leader; //1 writes the prefetch MSRs of its module
+	int domain; //memory domain, index of ddr_domain[]
 	int hwpf_msr_dirty; //0 not updated, 1 updated
 	union msr_u hwpf_msr_value[HWPF_MSR_FIELDS]; //0... -> 0x1320...
+	union msr_u hwpf_msr_default[HWPF_MSR_FIELDS]; //read at start
 	uint64_t pmu_result[PMU_COUNTERS]; //delta since last read
     uint64_t instructions_retired; // delta since last read
     uint64_t cpu_cycles; // delta since last read
@@ -35,11 +37,11 @@ uint64_t time_ms(void);
 extern struct thread_state gtinfo[MAX_THREADS]; //global thread state
 extern int core_last;
 extern int core_first;
+extern int active_threads;
 extern int tunealg;
 extern float time_intervall;
 
 extern uint32_t rdt_enabled;
-extern struct ddr_s ddr;
 extern int ddr_bw_target;
 extern float aggr; //alg retuning aggressiveness
 
@@ -0,0 +1,33 @@
+#ifndef __CORESET_H
+#define __CORESET_H
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sets of tuned cores, in the CPU list format of sysfs and cgroup cpusets,
+// e.g. "0-3,8,10-11"
+
+#define CORESET_SYSFS_ONLINE "/sys/devices/system/cpu/online"
+#define CORESET_CGROUP_FILE "cpuset.cpus.effective"
+
+// Parses a CPU list into set
+// Returns: number of cores in set, -1 on syntax errors
+int coreset_parse(const char *list, cpu_set_t *set);
+
+// Reads a CPU list file. A cgroup directory reads its effective cpuset.
+// Returns: number of cores in set, -1 on failure
+int coreset_read(const char *path, cpu_set_t *set);
+
+// Formats set as a CPU list into buf, truncated to size
+// Returns: buf
+char *coreset_format(const cpu_set_t *set, char *buf, size_t size);
+
+// First and last core of set, -1 if empty
+int coreset_first(const cpu_set_t *set);
+int coreset_last(const cpu_set_t *set);
+
+// Copies the first num_cores cores of set to a bitmask, bit n of word n / 64
+void coreset_to_mask(const cpu_set_t *set, uint64_t *mask, int num_cores);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __DDR_DOMAIN_H
+#define __DDR_DOMAIN_H
+
+#include <sched.h>
+#include <stdint.h>
+
+#include "pmu_ddr.h"
+
+// Memory domains, tuned independently: one per socket, or one per NUMA node
+// of a socket in sub-NUMA clustering (SNC) mode. Each domain has its own DDR
+// channels, bandwidth target and cores, so one saturated socket doesn't
+// throttle prefetching on the other.
+
+#define MAX_DDR_DOMAINS (16)
+
+struct ddr_domain_s {
+	int socket;		// physical package
+	int node;		// NUMA node under SNC, -1 for the whole socket
+	int ddr_index;		// entry of ddr_socket[], -1 with RDT
+	int first_channel;	// channels of the socket used by the domain
+	int num_channels;
+	int bw_target;		// MB/s
+	int probe_rd_mbps;	// achievable, measured by ddr_domain_probe()
+	int probe_wr_mbps;
+	uint64_t rd_bytes;	// summed over all ddr_domain_sample() calls
+	uint64_t wr_bytes;
+	cpu_set_t cores;	// online cores of the domain
+};
+
+extern struct ddr_s ddr_socket[MAX_DDR_SOCKETS];
+extern int num_ddr_sockets;
+extern struct ddr_domain_s ddr_domain[MAX_DDR_DOMAINS];
+extern int num_ddr_domains;
+extern uint64_t num_ddr_samples;	// ddr_domain_sample() calls so far
+
+// Finds the DDR controllers of every socket and splits them into domains
+// Returns: number of domains, 0 if no DDR PMU was found
+int ddr_domain_init(int kernel_mode);
+
+// As ddr_domain_init(), with the BAR, type and controllers of every socket
+// already known, no PCI scan
+// Returns: number of domains, 0 if none of the sockets could be mapped
+int ddr_domain_init_known(const struct ddr_s *sockets, int num,
+			  int kernel_mode);
+
+// Single domain over all cores, bandwidth is measured with RDT MBM
+void ddr_domain_init_rdt(void);
+
+// Closes the DDR PMUs
+void ddr_domain_deinit(void);
+
+// Domain of a core
+// Returns: domain index, 0 for cores outside all domains
+int ddr_domain_of_core(int core);
+
+// Splits a system wide bandwidth target between the domains by channels
+void ddr_domain_set_target(int total_mbps);
+
+// Measures the achievable bandwidth of every domain with the bandwidth
+// probe on its cores, one domain at a time, and targets the read bandwidth
+// num_threads: threads per domain, 0 for one per core
+// placement: BWPROBE_PLACE_*
+// Returns: sum of the targets in MB/s, -1 on failure
+int ddr_domain_probe(int num_threads, int placement);
+
+// Samples the DDR channels of every socket once, sample[d] gets the traffic
+// of domain d, which is also added to the bytes of the domain
+// Returns: 0, -1 if the DDR PMU is not initialized
+int ddr_domain_sample(struct ddr_sample_s sample[MAX_DDR_DOMAINS]);
+
+// Samples the domains unless ddr_domain_sample() ran since the last call with
+// samples, so readers of the byte counts share the samples of the tuner
+// Returns: 0, -1 if the DDR PMU is not initialized
+int ddr_domain_update(uint64_t *samples);
+
+#endif
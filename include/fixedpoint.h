@@ -0,0 +1,145 @@
+#ifndef __FIXEDPOINT_H
+#define __FIXEDPOINT_H
+
+// Q16.16 fixed point math shared by the user-space tuners and the kernel
+// module. Header only and integer only so the same source compiles into
+// both dpf and dpf.ko and gives bit-identical results.
+
+#ifdef __KERNEL__
+#include <linux/math64.h>
+#include <linux/types.h>
+
+typedef s64 fp_t;
+
+#define fp_sdiv64(a, b) div64_s64((a), (b))
+#define fp_udiv64(a, b) div64_u64((a), (b))
+#else
+#include <stdint.h>
+
+typedef int64_t fp_t;
+
+#define fp_sdiv64(a, b) ((int64_t)(a) / (int64_t)(b))
+#define fp_udiv64(a, b) ((uint64_t)(a) / (uint64_t)(b))
+#endif
+
+#define FP_SHIFT (16)
+#define FP_ONE ((fp_t)1 << FP_SHIFT)
+#define FP_MAX ((fp_t)0x7fffffffffffffffLL)
+
+#define FP_LN2 ((fp_t)45426)	// ln(2)
+#define FP_LOG2E ((fp_t)94548)	// log2(e)
+
+#define FP_FROM_INT(x) ((fp_t)(x) << FP_SHIFT)
+#define FP_TO_INT(x) ((x) >> FP_SHIFT)
+
+// Fixed point value of num / den, e.g. FP_FROM_RATIO(93, 100) for 0.93
+#define FP_FROM_RATIO(num, den) ((fp_t)(((int64_t)(num) << FP_SHIFT) / (den)))
+
+static inline fp_t fp_mul(fp_t a, fp_t b)
+{
+	return (a * b) >> FP_SHIFT;
+}
+
+// Returns 0 on division by zero
+static inline fp_t fp_div(fp_t a, fp_t b)
+{
+	if (b == 0)
+		return 0;
+
+	return fp_sdiv64(a << FP_SHIFT, b);
+}
+
+// Integer log2, x must be non-zero
+static inline int fp_ilog2(uint64_t x)
+{
+	return 63 - __builtin_clzll(x);
+}
+
+// Integer square root, floor(sqrt(x))
+static inline uint64_t fp_isqrt64(uint64_t x)
+{
+	uint64_t res = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit) {
+		if (x >= res + bit) {
+			x -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return res;
+}
+
+// Square root, 0 for a <= 0
+static inline fp_t fp_sqrt(fp_t a)
+{
+	if (a <= 0)
+		return 0;
+
+	return (fp_t)fp_isqrt64((uint64_t)a << FP_SHIFT);
+}
+
+// Base 2 logarithm, one fraction bit per squaring of the mantissa
+// Returns 0 for a <= 0
+static inline fp_t fp_log2(fp_t a)
+{
+	fp_t m, res;
+	int k;
+
+	if (a <= 0)
+		return 0;
+
+	k = fp_ilog2((uint64_t)a) - FP_SHIFT;
+	m = k >= 0 ? a >> k : a << -k; // mantissa in [1, 2)
+	res = (fp_t)k * FP_ONE;
+
+	for (int i = 1; i <= FP_SHIFT; i++) {
+		m = fp_mul(m, m);
+		if (m >= 2 * FP_ONE) {
+			m >>= 1;
+			res += FP_ONE >> i;
+		}
+	}
+
+	return res;
+}
+
+// Natural logarithm, 0 for a <= 0
+static inline fp_t fp_ln(fp_t a)
+{
+	return fp_mul(fp_log2(a), FP_LN2);
+}
+
+// e^a, saturates at FP_MAX
+static inline fp_t fp_exp(fp_t a)
+{
+	fp_t y = fp_mul(a, FP_LOG2E);
+	fp_t n = y >> FP_SHIFT;		// floor
+	fp_t r = fp_mul(y - (n << FP_SHIFT), FP_LN2); // [0, ln2)
+	fp_t term = FP_ONE;
+	fp_t sum = FP_ONE;
+
+	// e^r by Taylor series, converges in a handful of terms for r < ln2
+	for (int i = 1; i < 12 && term; i++) {
+		term = fp_sdiv64(fp_mul(term, r), i);
+		sum += term;
+	}
+
+	if (n >= 62 - FP_SHIFT)
+		return FP_MAX;
+	if (n >= 0)
+		return sum << n;
+	if (n <= -63)
+		return 0;
+
+	return sum >> -n;
+}
+
+#endif /* __FIXEDPOINT_H */
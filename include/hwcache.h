@@ -0,0 +1,83 @@
+#ifndef __HWCACHE_H
+#define __HWCACHE_H
+
+#include <stdint.h>
+
+#include "ddr_domain.h"
+#include "pmu_ddr.h"
+
+// Hardware cache. What dPF detects at start - DDR controllers from the PCI
+// scan, the DMI peak bandwidth, the topology and the probed bandwidth - is
+// kept in a file, so a restart on the same machine skips the detection.
+//
+// The file is used only if all of these match the running system:
+//  - HWCACHE_VERSION, bumped when the layout or a detection changes
+//  - CPUID signature (family, model, stepping) and microcode revision
+//  - hash of the SMBIOS table, changes with the BIOS version and the DIMMs
+//    but not with most BIOS setup options
+//  - kernel release, online CPUs and online NUMA nodes (hotplug, SNC mode)
+//  - age, at most HWCACHE_MAX_AGE_S
+// Otherwise it is rebuilt. Setup options can move the DDR BARs, so every
+// cached BAR is read again from the config space of its PCI device, and any
+// that differs or can't be read or mapped falls back to the PCI scan. Probe
+// results are reused only for the same threads and placement.
+
+#define HWCACHE_FILE "/var/cache/dpf/hwcache.json"
+#define HWCACHE_VERSION (2)
+#define HWCACHE_MAX_AGE_S (30 * 24 * 3600)
+#define HWCACHE_LIST_LEN (256)
+
+struct hwcache_id_s {
+	uint32_t cpuid_sig;	// CPUID leaf 1 EAX
+	uint32_t microcode;	// 0 if unknown
+	uint64_t dmi_hash;	// FNV-1a of the SMBIOS table, 0 if unreadable
+	char kernel[65];
+	char cpus[HWCACHE_LIST_LEN];	// online CPU list
+	char nodes[HWCACHE_LIST_LEN];	// online NUMA node list
+};
+
+struct hwcache_probe_s {
+	int socket;		// domain, matched against ddr_domain[]
+	int node;
+	int threads;		// probe parameters the result is valid for
+	int placement;
+	int rd_mbps;
+	int wr_mbps;
+};
+
+struct hwcache_s {
+	int loaded;		// the file matched, entries below are from it
+	int dirty;		// changed since loaded, to be saved
+	int dmi_mbps;		// DMI peak, -1 if not detected yet
+	int num_sockets;	// -1 if the PCI scan has not run yet
+	struct ddr_s sockets[MAX_DDR_SOCKETS]; // socket, BAR and its device, type, controllers
+	int num_probes;
+	struct hwcache_probe_s probe[MAX_DDR_DOMAINS];
+};
+
+extern struct hwcache_s hwcache;
+
+// Reads the cache file and restores the topology from it if it matches the
+// system, path NULL to run without a cache
+// rebuild: ignore the file, detect everything and save it again
+// Returns: 0 if the cache is used, -1 if everything is detected
+int hwcache_load(const char *path, int rebuild);
+
+// Writes the cache file if anything was detected since hwcache_load()
+// Returns: 0 on success or nothing to write, -1 on failure
+int hwcache_save(void);
+
+// DMI peak bandwidth, from the cache or dmi_get_bandwidth()
+// Returns: MB/s, -1 if not found
+int hwcache_dmi_bandwidth(void);
+
+// ddr_domain_init() with the cached controllers, PCI scan if there are none
+// Returns: number of domains, 0 if no DDR PMU was found
+int hwcache_ddr_domain_init(int kernel_mode);
+
+// ddr_domain_probe() with cached results for domains probed before with the
+// same threads and placement
+// Returns: sum of the targets in MB/s, -1 on failure
+int hwcache_ddr_domain_probe(int num_threads, int placement);
+
+#endif
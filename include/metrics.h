@@ -0,0 +1,37 @@
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <stdint.h>
+
+#include "msr.h"
+
+// Live metrics of the user space tuner in the Prometheus text format on a
+// Unix socket. Every tuning thread publishes its own entry once per
+// interval and the first core the DDR traffic and tuner state, each entry
+// under its own sequence count. Scrapes copy the entries and retry when
+// an update was in progress, so they never block the tuning threads.
+// An HTTP GET gets an HTTP response, any other client the plain text,
+// e.g. curl --unix-socket or socat.
+
+#define METRICS_SOCKET "/run/dpf.sock"
+
+extern int metrics_enabled;
+
+// Listens on a Unix socket, replacing a stale one, and starts the thread
+// answering scrapes
+// Returns: 0, -1 on failure
+int metrics_init(const char *path, int num_threads);
+
+// Called by a tuning thread at the end of every interval
+// msr: prefetcher MSR values last written by a module leader, NULL
+// for the other cores of a module
+void metrics_publish_core(int thread, const union msr_u *msr);
+
+// Called by the first core once per interval after the decision
+// arm: current MAB arm, -1 with the other tuners
+void metrics_publish(int arm);
+
+// Stops the scrape thread and removes the socket
+void metrics_deinit(void);
+
+#endif
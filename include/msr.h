@@ -208,6 +208,12 @@ int msr_get_evtsel(unsigned core, uint64_t *event);
 int msr_set_evtsel(unsigned core, uint64_t event);
 /* Get RDT MBM monitoring count */
 int msr_get_mon_count(int core, uint64_t *val);
+
+/* Read an RDT MBM counter, evtsel is only rewritten on change */
+int msr_get_mon_count_sel(unsigned core, uint64_t evtsel, uint64_t *val);
+
+/* Drop the cached RDT MBM event selection of a core */
+void msr_mon_evtsel_invalidate(unsigned core);
 #endif
 
 
@@ -26,6 +26,7 @@
 #define GRR_SRF_FREE_RUN_CNTR_WRITE (0x1A48)
 
 #define MAX_NUM_DDR_CONTROLLERS (16)
+#define MAX_DDR_SOCKETS (8)
 
 
 //structs for ddr
@@ -37,10 +38,58 @@ struct ddr_s {
 	uint64_t bar_address;
 	int ddr_interface_type;
 	int num_ddr_controllers;
+	// counter registers, resolved once at init
+	volatile uint64_t *rd_cntr[MAX_NUM_DDR_CONTROLLERS];
+	volatile uint64_t *wr_cntr[MAX_NUM_DDR_CONTROLLERS];
+	int socket; // physical package of the controllers
+	char bar_dev[16]; // PCI address of the device the BAR is read from
+	uint64_t last_sample_ns;
 };
 
+// One DDR sample, bytes transferred per channel since the previous sample
+struct ddr_sample_s {
+	uint64_t timestamp_ns; // CLOCK_MONOTONIC
+	uint64_t time_delta_ns; // time since the previous sample
+	int num_channels;
+	uint64_t rd_bytes[MAX_NUM_DDR_CONTROLLERS];
+	uint64_t wr_bytes[MAX_NUM_DDR_CONTROLLERS];
+	uint64_t rd_total;
+	uint64_t wr_total;
+};
+
+// Finds the channel with the most traffic in a sample
+// type: DDR_PMU_RD, DDR_PMU_WR or both or'ed together
+// Returns the channel index (-1 if no channels), bytes of that channel in *bytes
+static inline int ddr_sample_hottest(const struct ddr_sample_s *sample, int type,
+				     uint64_t *bytes)
+{
+	int hot = -1;
+	uint64_t max = 0;
+
+	for (int i = 0; i < sample->num_channels; i++) {
+		uint64_t ch = 0;
+
+		if (type & DDR_PMU_RD)
+			ch += sample->rd_bytes[i];
+		if (type & DDR_PMU_WR)
+			ch += sample->wr_bytes[i];
+
+		if (hot < 0 || ch > max) {
+			hot = i;
+			max = ch;
+		}
+	}
+
+	*bytes = max;
+
+	return hot;
+}
+
 int pmu_ddr_init(struct ddr_s *ddr, int kernel_mode);
-uint64_t pmu_ddr(struct ddr_s *ddr, int type);
+int pmu_ddr_init_sockets(struct ddr_s *ddr, int max_sockets, int kernel_mode);
+int pmu_ddr_map(struct ddr_s *ddr);
+int pmu_ddr_read_bar(const struct ddr_s *ddr, uint64_t *bar);
+int pmu_ddr_sample(struct ddr_s *ddr, struct ddr_sample_s *sample);
 
 
 #endif
@@ -0,0 +1,68 @@
+#ifndef __PROF_H
+#define __PROF_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Overhead profiler of the user space tuner. Every tuning thread records
+// how long each phase of its interval takes into log-linear histograms, and
+// its CPU time, context switches and read/write syscalls. The report gives
+// p50/p99/max per phase and the cost per thread, at exit or on SIGUSR1.
+// Disabled, each probe is one predicted branch.
+
+enum prof_phase {
+	PROF_PMU_READ = 0,	// core PMU counter reads
+	PROF_BARRIER,		// waiting for the other threads or the decision
+	PROF_DECIDE,		// calculate_settings(), first core only
+	PROF_MSR_WRITE,		// prefetcher MSR writes, module leaders only
+	PROF_ACTIVE,		// whole interval except the sleep
+	PROF_PHASES
+};
+
+// 8 buckets per power of two, values below 8 ns exact
+#define PROF_SUB_BITS (3)
+#define PROF_BUCKETS ((64 - PROF_SUB_BITS + 1) << PROF_SUB_BITS)
+
+extern int prof_enabled;
+extern volatile int prof_report_requested;
+
+static inline uint64_t prof_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Start of a phase
+// Returns: timestamp to pass to prof_end(), 0 when disabled
+static inline uint64_t prof_begin(void)
+{
+	return prof_enabled ? prof_now_ns() : 0;
+}
+
+void prof_record(int thread, int phase, uint64_t ns);
+
+// Records the time since start as one sample of phase
+static inline void prof_end(int thread, int phase, uint64_t start)
+{
+	if (prof_enabled)
+		prof_record(thread, phase, prof_now_ns() - start);
+}
+
+// Allocates the histograms of num_threads tuning threads and enables the
+// probes, SIGUSR1 then requests a report
+// Returns: 0, -1 on failure
+int prof_init(int num_threads);
+
+// Called by a tuning thread before its first interval
+void prof_thread_start(int thread, int core);
+
+// Called by a tuning thread at the end of every interval
+void prof_thread_interval(int thread);
+
+// Logs the histograms of all phases and the cost of every thread
+void prof_report(void);
+
+#endif
@@ -13,6 +13,15 @@
 /**<  Measure DDR BW usage of all cores */
 #define DDR_BW_ALL_CORES (1)
 
+/**
+ * RMID grouping policies. All cores of a group share one RMID so a single
+ * IA32_QM_CTR read reports their combined bandwidth. Groups never span
+ * packages, and every package numbers its RMIDs from 1.
+ */
+#define RDT_GROUP_CORE		0	/**< One RMID per core */
+#define RDT_GROUP_MODULE	1	/**< One RMID per module */
+#define RDT_GROUP_ALL		2	/**< One RMID per package */
+
 /**
  * Available types of monitored events
  * (matches CPUID enumeration)
@@ -39,6 +48,15 @@ struct mbm_data_st {
 	uint64_t old_count;
 };
 
+struct mbm_group_st {
+	uint32_t rmid;
+	uint32_t read_core;	/**< Core used to read the group counter */
+	uint32_t num_cores;
+	uint64_t evtsel;	/**< Cached IA32_QM_EVTSEL value */
+	uint64_t delta;
+	uint64_t old_count;
+};
+
 /* Check if memory bandwidth measurement using RDT is supported */
 int rdt_mbm_support_check(void);
 
@@ -53,4 +71,16 @@ uint64_t rdt_mbm_bw_get(void);
 
 /* Set RMID on MSR */
 int rdt_mbm_set_rmid(const unsigned core, const unsigned rmid);
+
+/* RMID used for a core by the active grouping policy */
+unsigned core2rmid(unsigned core);
+
+/* Select RMID grouping policy (RDT_GROUP_*), call before rdt_mbm_init() */
+int rdt_mbm_set_group_policy(int policy);
+
+/* Parse a grouping policy name (core, module, all), -1 if unknown */
+int rdt_mbm_parse_group_policy(const char *name);
+
+/* Benchmark bandwidth read latency versus monitored cores per policy */
+int rdt_mbm_bench(int iterations);
 #endif
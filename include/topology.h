@@ -0,0 +1,60 @@
+#ifndef __TOPOLOGY_H
+#define __TOPOLOGY_H
+
+#include <stdint.h>
+
+#include "msr.h"
+
+// System topology from sysfs, read once without moving any thread between
+// cores. Shared by dPF, the console and the core set sent to the kernel
+// module.
+
+#define TOPO_TYPE_UNKNOWN (0)
+#define TOPO_TYPE_ECORE (1) // Atom efficiency core
+#define TOPO_TYPE_PCORE (2) // Performance core
+
+#define TOPO_SYSFS_CPU "/sys/devices/system/cpu"
+#define TOPO_SYSFS_NODE "/sys/devices/system/node"
+#define TOPO_SYSFS_ATOM_CPUS "/sys/devices/cpu_atom/cpus" // Hybrid parts
+
+struct topo_cpu_s {
+	int online;
+	int type;	// TOPO_TYPE_*
+	int cluster;	// L2 cluster (module), lowest core id sharing the L2
+	int die;	// Die within the socket
+	int socket;	// Physical package
+	int node;	// NUMA node, -1 if unknown
+};
+
+struct topology_s {
+	int initialized;
+	int hybrid;
+	int num_cpus;		// Cores 0 to num_cpus - 1 are described
+	int num_online;
+	int num_ecores;		// Online E-cores
+	int num_clusters;
+	int num_dies;		// Dies of all sockets
+	int num_sockets;
+	int num_nodes;
+	struct topo_cpu_s cpu[MAX_NUM_CORES];
+};
+
+extern struct topology_s topology;
+
+// Fills topology, later calls return at once
+// Returns: 0 on success, -1 if the CPUs could not be read
+int topology_init(void);
+
+// Logs the topology summary and, at debug level, every core
+void topology_log(void);
+
+// First and last online core of a type, TOPO_TYPE_UNKNOWN for any
+// Returns: core id, -1 if there is none
+int topology_first(int type);
+int topology_last(int type);
+
+// Online cores of a type as a bitmask of num_cores bits, bit n of word n / 64
+// Returns: number of cores set
+int topology_mask(int type, uint64_t *mask, int num_cores);
+
+#endif
@@ -3,14 +3,20 @@
 
 #include <stdint.h>
 #define PROC_DEVICE "/proc/dynamicPrefetch"
+#define DPF_DEVICE "/dev/dpf"
 
 struct ddr_s;
+struct dpf_resp_timer_stats_s;
 
 int kernel_mode_init(void);
 int kernel_core_range(uint32_t start, uint32_t end);
+int kernel_core_mask(const uint64_t *mask, int num_cores);
 int kernel_set_core_weights(int count, int *core_priority);
 int kernel_set_ddr_bandwidth(uint32_t bandwidth);
-int kernel_tuning_control(uint32_t tuning_status, uint32_t tunealg, float aggr_factor);
+int kernel_tuning_control(uint32_t tuning_status, uint32_t tunealg, float aggr_factor,
+			  uint64_t sample_period_ns, uint64_t decision_period_ns);
+int kernel_timer_stats(struct dpf_resp_timer_stats_s *stats, int reset);
+int kernel_log_timer_stats(void);
 int kernel_msr_read(uint32_t core_id, uint64_t *msr_values);
 int kernel_pmu_read(uint32_t core_id, uint64_t *pmu_values);
 int kernel_msr_read(uint32_t core_id, uint64_t *msr_values);
@@ -19,9 +25,12 @@ int kernel_log_msr_values(uint32_t core_id);
 int kernel_log_pmu_values(uint32_t core_id);
 int kernel_set_ddr_config(struct ddr_s *ddr);
 int kernel_log_ddr_bw();
+int kernel_mab_config(uint32_t algorithm, uint32_t arm_configuration,
+		      float epsilon, float gamma, float c);
 
 // PMU logging functions
-int kernel_pmu_log_start(size_t buffer_size, int reset);
+int kernel_pmu_log_start(size_t buffer_size, int reset, int policy);
 int kernel_pmu_log_stop(void);
-int kernel_pmu_log_read(char *buffer, size_t max_bytes, uint64_t *bytes_read);
+int kernel_pmu_log_read(char *buffer, size_t max_bytes, uint64_t *bytes_read,
+			uint64_t *lost);
 #endif /* __USER_API_H */
\ No newline at end of file
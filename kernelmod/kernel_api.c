@@ -2,30 +2,31 @@
 #include <linux/slab.h>
 #include <linux/errno.h>
 #include <linux/types.h>
+#include <linux/cpu.h>
 #include <linux/cpumask.h>
+#include <linux/smp.h>
 #include <linux/hrtimer.h>
 #include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
 
-// Global variables for PMU logging
-char *pmu_log_buffer = NULL;
-size_t pmu_log_buffer_size = 0;
-size_t pmu_log_data_size = 0;
+// PMU logging state, the entries are kept in kernel_pmu_log.c
 bool pmu_logging_active = false;
 
-#define TIMER_INTERVAL_SEC 1
 #include <linux/io.h>
 #include <linux/ioport.h>
 
 #include "kernel_common.h"
 #include "kernel_api.h"
 #include "kernel_pmu_ddr.h"
+#include "kernel_pmu_log.h"
+#include "kernel_mab.h"
 
 // External variables from kernel_dpf.c
 extern bool keep_running;
 extern struct hrtimer monitor_timer;
 extern ktime_t kt_period;
-extern char *proc_buffer;
-extern size_t proc_buffer_size;
 extern __u64 ddr_bar_address;
 extern cpumask_t enabled_cpus;
 extern __u32 ddr_cpu_type;
@@ -35,7 +36,7 @@ extern struct ddr_s ddr;
 // Handle initialization request and response to the user space
 // Arguments: None
 // Returns: 0 on success, -ENOMEM on failure
-int api_init(void)
+int api_init(struct dpf_session_s *sess)
 {
 	struct dpf_resp_init_s *resp;
 
@@ -47,10 +48,7 @@ int api_init(void)
 	resp->header.payload_size = sizeof(struct dpf_resp_init_s);
 	resp->version = DPF_API_VERSION;
 
-	kfree(proc_buffer);
-
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_init_s);
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_init_s));
 
 	pr_info("%s: Initialized with version %d\n",
 	       __func__, resp->version);
@@ -61,10 +59,11 @@ int api_init(void)
 // Handle core range configuration request and response to the user space
 // It accepts a request to specify the range of cores to monitor
 // returns 0 on success, -ENOMEM on failure, -EINVAL on invalid input
-int api_core_range(struct dpf_core_range_s *req_data)
+int api_core_range(struct dpf_session_s *sess, struct dpf_core_range_s *req_data)
 {
 	struct dpf_core_range_s *req = req_data;
 	struct dpf_resp_core_range_s *resp;
+	struct cpumask *mask;
 	int core_id;
 
 	// Range checks to validate input parameters
@@ -103,42 +102,31 @@ int api_core_range(struct dpf_core_range_s *req_data)
 	if (!resp)
 		return -ENOMEM;
 
+	mask = kzalloc(cpumask_size(), GFP_KERNEL);
+	if (!mask) {
+		kfree(resp);
+		return -ENOMEM;
+	}
+
+	// dpf_set_cores() keeps the cores this system can have
+	for (core_id = req->core_start; core_id <= req->core_end; core_id++)
+		if (core_id < nr_cpu_ids)
+			cpumask_set_cpu(core_id, mask);
+
 	resp->header.type = DPF_MSG_CORE_RANGE;
 	resp->header.payload_size = sizeof(struct dpf_resp_core_range_s);
 	resp->core_start = req->core_start;
 	resp->core_end = req->core_end;
-	resp->thread_count = req->core_end - req->core_start + 1;
-
-	sys_first_core = req->core_start;
-	sys_active_cores = (req->core_end + 1) - req->core_start;
-
-	cpumask_clear(&enabled_cpus); 
-	pr_info("api_core_range: cleared enabled_cpus mask");
-
-	// Only process cores within the valid range to avoid unnecessary iterations
-	for (core_id = 0; core_id < MAX_NUM_CORES; core_id++) {
-		// Mark cores as enabled/disabled based on range
-		corestate[core_id].core_disabled =
-		    (core_id < req->core_start || core_id > req->core_end);
-
-		// Configure and enable valid cores
-		if (!corestate[core_id].core_disabled) {
-			// Verify the core exists on the system before configuring
-			if (cpu_online(core_id)) {
-				configure_pmu(core_id);
-				cpumask_set_cpu(core_id, &enabled_cpus);
-				pr_info("api_core_range: added core %d to enabled_cpus mask", core_id);
-			} else {
-				// Core doesn't exist, mark it as disabled
-				corestate[core_id].core_disabled = 1;
-				pr_warn("api_core_range: core %d not available on this system", core_id);
-			}
-		}
-	}
-	kfree(proc_buffer);
 
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_core_range_s);
+	cpus_read_lock();
+	mutex_lock(&dpf_mutex);
+	resp->thread_count = dpf_set_cores(mask);
+	mutex_unlock(&dpf_mutex);
+	cpus_read_unlock();
+
+	kfree(mask);
+
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_core_range_s));
 
 	pr_info("%s: Processed core range request: start=%d, end=%d, thread_count=%d\n",
 	       __func__, resp->core_start, resp->core_end, resp->thread_count);
@@ -146,10 +134,57 @@ int api_core_range(struct dpf_core_range_s *req_data)
 	return 0;
 }
 
+// Handle core set configuration request and response to the user space
+// Replaces the core range or set with the cores of the request mask, offline
+// cores are tuned when they come online
+// returns 0 on success, -ENOMEM on failure
+int api_core_mask(struct dpf_session_s *sess, struct dpf_core_mask_s *req_data)
+{
+	struct dpf_core_mask_s *req = req_data;
+	struct dpf_resp_core_mask_s *resp;
+	struct cpumask *mask;
+	int core_id;
+
+	resp = kzalloc(sizeof(struct dpf_resp_core_mask_s), GFP_KERNEL);
+	if (!resp)
+		return -ENOMEM;
+
+	mask = kzalloc(cpumask_size(), GFP_KERNEL);
+	if (!mask) {
+		kfree(resp);
+		return -ENOMEM;
+	}
+
+	for (core_id = 0; core_id < MAX_NUM_CORES && core_id < nr_cpu_ids; core_id++)
+		if (req->mask[core_id / 64] & (1ULL << (core_id % 64)))
+			cpumask_set_cpu(core_id, mask);
+
+	resp->header.type = DPF_MSG_CORE_MASK;
+	resp->header.payload_size = sizeof(struct dpf_resp_core_mask_s);
+	resp->requested = cpumask_weight(mask);
+
+	cpus_read_lock();
+	mutex_lock(&dpf_mutex);
+	resp->tuned = dpf_set_cores(mask);
+	for_each_cpu(core_id, &enabled_cpus)
+		resp->mask[core_id / 64] |= 1ULL << (core_id % 64);
+	mutex_unlock(&dpf_mutex);
+	cpus_read_unlock();
+
+	kfree(mask);
+
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_core_mask_s));
+
+	pr_info("%s: %u cores requested, %u tuned\n", __func__,
+		resp->requested, resp->tuned);
+
+	return 0;
+}
+
 // Handle core weight configuration request and response to the user space
 // It accepts a request to specify the weight of each core
 // returns 0 on success, -ENOMEM on failure
-int api_core_weight(void *req_data)
+int api_core_weight(struct dpf_session_s *sess, void *req_data)
 {
 	struct dpf_core_weight_s *req = req_data;
 	struct dpf_resp_core_weight_s *resp;
@@ -173,10 +208,7 @@ int api_core_weight(void *req_data)
 	memcpy(resp->confirmed_weights, req->weights,
 	       req->count * sizeof(__u32));
 
-	kfree(proc_buffer);
-
-	proc_buffer = (char *)resp;
-	proc_buffer_size = resp_size;
+	dpf_session_set_resp(sess, resp, resp_size);
 
 	pr_info("%s: Processed core weight request with count=%d\n",
 	       __func__, resp->count);
@@ -186,12 +218,14 @@ int api_core_weight(void *req_data)
 
 // Handle tuning request and response to the user space
 // It accepts a request to enable or disable the monitoring
-// returns 0 on success, -ENOMEM on failure
-int api_tuning(struct dpf_req_tuning_s *req_data)
+// returns 0 on success, -ENOMEM or -EINVAL (period out of range) on failure
+int api_tuning(struct dpf_session_s *sess, struct dpf_req_tuning_s *req_data)
 {
 	struct dpf_req_tuning_s *req = req_data;
 	struct dpf_resp_tuning_s *resp;
+	struct dpf_resp_timer_stats_s stats;
 	int core_id;
+	int ret;
 
 	resp = kmalloc(sizeof(struct dpf_resp_tuning_s), GFP_KERNEL);
 	if (!resp)
@@ -200,6 +234,7 @@ int api_tuning(struct dpf_req_tuning_s *req_data)
 	resp->header.type = DPF_MSG_TUNING;
 	resp->header.payload_size = sizeof(struct dpf_resp_tuning_s);
 	resp->status = req->enable;
+	resp->reserved = 0;
 
 	// Validate aggressiveness factor range
 	if (req->aggr < MIN_AGGR || req->aggr > MAX_AGGR) {
@@ -209,6 +244,21 @@ int api_tuning(struct dpf_req_tuning_s *req_data)
 		req->aggr = req->aggr < MIN_AGGR ? MIN_AGGR : MAX_AGGR;
 	}
 
+	mutex_lock(&dpf_mutex);
+
+	if (dpf_monitor_set_period(req->sample_period_ns, req->decision_period_ns) < 0) {
+		mutex_unlock(&dpf_mutex);
+		pr_err("%s: Periods must be %llu to %llu ns: sample %llu, decision %llu\n",
+		       __func__, DPF_MIN_PERIOD_NS, DPF_MAX_PERIOD_NS,
+		       req->sample_period_ns, req->decision_period_ns);
+		kfree(resp);
+		return -EINVAL;
+	}
+
+	dpf_monitor_stats(&stats, false);
+	resp->confirmed_sample_period_ns = stats.sample_period_ns;
+	resp->confirmed_decision_period_ns = stats.decision_period_ns;
+
 	// Store tuning algorithm and aggressiveness factor
 	tune_alg = req->tunealg;
 	aggr = req->aggr;
@@ -223,24 +273,27 @@ int api_tuning(struct dpf_req_tuning_s *req_data)
 		// Load current Prefetch MSR settings for enabled
 		// cores before starting tuning
 		for_each_online_cpu(core_id) {
-			if (corestate[core_id].core_disabled == 0 && core_in_module(core_id) == 0) {
+			if (corestate[core_id].core_disabled == 0 && module_leader(core_id)) {
 				msr_load(core_id);
 				pr_info("Loaded MSR for core %d\n", core_id);
 			}
 		}
-		keep_running = true;
-		hrtimer_start(&monitor_timer, kt_period, HRTIMER_MODE_REL);
+		ret = dpf_monitor_start();
+		if (ret < 0) {
+			mutex_unlock(&dpf_mutex);
+			pr_err("%s: Failed to start monitoring: %d\n", __func__, ret);
+			kfree(resp);
+			return ret;
+		}
 		pr_info("Monitoring enabled\n");
 	} else {
-		keep_running = false;
-		hrtimer_cancel(&monitor_timer);
+		dpf_monitor_stop();
 		pr_info("Monitoring disabled\n");
 	}
 
-	kfree(proc_buffer);
+	mutex_unlock(&dpf_mutex);
 
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_tuning_s);
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_tuning_s));
 
 	return 0;
 }
@@ -248,7 +301,7 @@ int api_tuning(struct dpf_req_tuning_s *req_data)
 // Handle DDR bandwidth set request and response to the user space
 // It accepts a request to set the DDR bandwidth target
 // returns 0 on success, -ENOMEM on failure
-int api_ddrbw_set(struct dpf_ddrbw_set_s *req_data)
+int api_ddrbw_set(struct dpf_session_s *sess, struct dpf_ddrbw_set_s *req_data)
 {
 	struct dpf_ddrbw_set_s *req = req_data;
 	struct dpf_resp_ddrbw_set_s *resp;
@@ -263,12 +316,11 @@ int api_ddrbw_set(struct dpf_ddrbw_set_s *req_data)
 	resp->header.payload_size = sizeof(struct dpf_resp_ddrbw_set_s);
 	resp->confirmed_value = req->set_value;
 
+	mutex_lock(&dpf_mutex);
 	ddr_bw_target = req->set_value;
+	mutex_unlock(&dpf_mutex);
 
-	kfree(proc_buffer);
-
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_ddrbw_set_s);
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_ddrbw_set_s));
 
 	pr_info("DDR bandwidth target set to %u MB/s\n", ddr_bw_target);
 
@@ -277,7 +329,7 @@ int api_ddrbw_set(struct dpf_ddrbw_set_s *req_data)
 
 // Handles MSR read request, retrieves MSR values for a core
 // returns 0 on success, -ENOMEM on failure
-int api_msr_read(struct dpf_msr_read_s *req_data)
+int api_msr_read(struct dpf_session_s *sess, struct dpf_msr_read_s *req_data)
 {
 	struct dpf_msr_read_s *req = req_data;
 	struct dpf_resp_msr_read_s *resp;
@@ -297,23 +349,31 @@ int api_msr_read(struct dpf_msr_read_s *req_data)
 	resp->header.type = DPF_MSG_MSR_READ;
 	resp->header.payload_size = sizeof(struct dpf_resp_msr_read_s);
 
+	mutex_lock(&dpf_mutex);
+
 	if (corestate[req->core_id].pf_msr[MSR_1320_INDEX].v == 0)
 		msr_load(req->core_id);
 
 	for (int i = 0; i < NR_OF_MSR; i++)
 		resp->msr_values[i] = corestate[req->core_id].pf_msr[i].v;
 
-	kfree(proc_buffer);
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_msr_read_s);
+	mutex_unlock(&dpf_mutex);
+
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_msr_read_s));
 
 	pr_info("MSR values retrieved for core %u\n", req->core_id);
 	return 0;
 }
 
+// Runs on the core being read, perf counters can only be read locally
+static void pmu_update_on_core(void *info)
+{
+	pmu_update(smp_processor_id());
+}
+
 // Handles PMU read request, retrieves PMU counter values for a core
 // returns 0 on success, -ENOMEM on failure
-int api_pmu_read(struct dpf_pmu_read_s *req_data)
+int api_pmu_read(struct dpf_session_s *sess, struct dpf_pmu_read_s *req_data)
 {
 	struct dpf_pmu_read_s *req = req_data;
 	struct dpf_resp_pmu_read_s *resp;
@@ -332,7 +392,9 @@ int api_pmu_read(struct dpf_pmu_read_s *req_data)
 	resp->header.type = DPF_MSG_PMU_READ;
 	resp->header.payload_size = sizeof(struct dpf_resp_pmu_read_s);
 
-	pmu_update(req->core_id);
+	mutex_lock(&dpf_mutex);
+
+	smp_call_function_single(req->core_id, pmu_update_on_core, NULL, 1);
 
 	for (int i = 0; i < PMU_COUNTERS; i++) {
 		resp->pmu_values[i] = corestate[req->core_id].pmu_raw[i];
@@ -340,9 +402,9 @@ int api_pmu_read(struct dpf_pmu_read_s *req_data)
 			 resp->pmu_values[i]);
 	}
 
-	kfree(proc_buffer);
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_pmu_read_s);
+	mutex_unlock(&dpf_mutex);
+
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_pmu_read_s));
 
 	pr_info("PMU values retrieved for core %u\n", req->core_id);
 	return 0;
@@ -350,7 +412,7 @@ int api_pmu_read(struct dpf_pmu_read_s *req_data)
 
 // Handle DDR configuration request
 // returns 0 on success, -ENOMEM on failure
-int api_ddr_config(struct dpf_ddr_config_s *req_data)
+int api_ddr_config(struct dpf_session_s *sess, struct dpf_ddr_config_s *req_data)
 {
 	struct dpf_ddr_config_s *req = req_data;
 	struct dpf_resp_ddr_config_s *resp;
@@ -373,6 +435,8 @@ int api_ddr_config(struct dpf_ddr_config_s *req_data)
 	if (!resp)
 		return -ENOMEM;
 
+	mutex_lock(&dpf_mutex);
+
 	// Clean up prior mappings
 	for (int i = 0; i < MAX_NUM_DDR_CONTROLLERS; i++) {
 		if (ddr.mmap[i]) {
@@ -396,12 +460,12 @@ int api_ddr_config(struct dpf_ddr_config_s *req_data)
 		ret = kernel_pmu_ddr_init_grr_srf(&ddr, ddr_bar_address);
 	} else {
 		pr_err("Unknown DDR type detected (%u)\n", ddr_cpu_type);
-		kfree(resp);
-		return -EINVAL;
+		ret = -EINVAL;
 	}
 
 	if (ret < 0) {
 		pr_err("DDR init failed (type %d, ret %d)\n", ddr_cpu_type, ret);
+		mutex_unlock(&dpf_mutex);
 		kfree(resp);
 		return -EINVAL;
 	}
@@ -411,9 +475,9 @@ int api_ddr_config(struct dpf_ddr_config_s *req_data)
 	resp->confirmed_bar = ddr_bar_address;
 	resp->confirmed_type = ddr_cpu_type;
 
-	kfree(proc_buffer);
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_ddr_config_s);
+	mutex_unlock(&dpf_mutex);
+
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_ddr_config_s));
 
 	pr_info("%s: DDR config set - BAR=0x%llx, Type=%u\n",
 	       __func__, ddr_bar_address, ddr_cpu_type);
@@ -423,7 +487,7 @@ int api_ddr_config(struct dpf_ddr_config_s *req_data)
 
 // Handles DDR bandwidth read request, retrieves read_bw and write_bw
 // returns 0 on success, -ENOMEM on failure
-int api_ddr_bw_read(struct dpf_ddr_bw_read_s *req_data)
+int api_ddr_bw_read(struct dpf_session_s *sess, struct dpf_ddr_bw_read_s *req_data)
 {
 	struct dpf_resp_ddr_bw_read_s *resp;
 	uint64_t read_bw, write_bw;
@@ -434,16 +498,16 @@ int api_ddr_bw_read(struct dpf_ddr_bw_read_s *req_data)
 	if (!resp)
 		return -ENOMEM;
 
+	mutex_lock(&dpf_mutex);
 	read_ddr_counters(&read_bw, &write_bw);
+	mutex_unlock(&dpf_mutex);
 
 	resp->header.type = DPF_MSG_DDR_BW_READ;
 	resp->header.payload_size = sizeof(struct dpf_resp_ddr_bw_read_s);
 	resp->read_bw = read_bw;
 	resp->write_bw = write_bw;
 
-	kfree(proc_buffer);
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_ddr_bw_read_s);
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_ddr_bw_read_s));
 
 	pr_info("%s: Retrieved DDR bandwidth: Read=%llu bytes, Write=%llu bytes\n",
 	       __func__, resp->read_bw, resp->write_bw);
@@ -456,64 +520,52 @@ int api_ddr_bw_read(struct dpf_ddr_bw_read_s *req_data)
 // Handle PMU logging control request
 // It initializes or configures PMU metrics logging with options for buffer size and mode
 // returns 0 on success, negative error code on failure
-int api_pmu_log_control(struct dpf_pmu_log_control_s *req_data)
+int api_pmu_log_control(struct dpf_session_s *sess, struct dpf_pmu_log_control_s *req_data)
 {
 	struct dpf_pmu_log_control_s *req = req_data;
 	struct dpf_resp_pmu_log_control_s *resp;
-	size_t requested_buffer_size;
-	char *new_buffer = NULL;
 	__u32 mode;
-	__s32 status = 0;
+	int ret;
 
-	pr_info("%s: Received PMU log control request: buffer_size=%u, mode=%u\n",
-	       __func__, req->buffer_size, req->mode);
-
-	resp = kmalloc(sizeof(struct dpf_resp_pmu_log_control_s), GFP_KERNEL);
-	if (!resp)
-		return -ENOMEM;
+	pr_info("%s: Received PMU log control request: buffer_size=%u, mode=%u, policy=%u\n",
+	       __func__, req->buffer_size, req->mode, req->policy);
 
 	// Process request parameters
-	requested_buffer_size = req->buffer_size;
 	mode = req->mode;
 
-	// Validate mode (0=reset, 1=append)
-	if (mode > 1) {
-		pr_err("%s: Invalid mode %u, must be 0 (reset) or 1 (append)\n", 
-		       __func__, mode);
-		kfree(resp);
+	// Validate mode (0=reset, 1=append) and policy
+	if (mode > 1 || req->policy > DPF_PMU_LOG_OVERWRITE) {
+		pr_err("%s: Invalid mode %u or policy %u\n",
+		       __func__, mode, req->policy);
 		return -EINVAL;
 	}
 
-	// For the first time or reset mode, allocate or reallocate the buffer
-	if (!pmu_log_buffer || mode == 0) {
-		// Free existing buffer if any
-		if (pmu_log_buffer) {
-			kfree(pmu_log_buffer);
-			pmu_log_buffer = NULL;
-		}
+	if (req->buffer_size == 0) {
+		pr_err("%s: Buffer size must be greater than zero\n", __func__);
+		return -EINVAL;
+	}
 
-		// Allocate new buffer
-		if (requested_buffer_size > 0) {
-			new_buffer = kmalloc(requested_buffer_size, GFP_KERNEL);
-			if (!new_buffer) {
-				pr_err("%s: Failed to allocate %zu bytes for PMU log buffer\n",
-				       __func__, requested_buffer_size);
-				kfree(resp);
-				return -ENOMEM;
-			}
-			memset(new_buffer, 0, requested_buffer_size);
-			pmu_log_buffer = new_buffer;
-			pmu_log_buffer_size = requested_buffer_size;
-			pmu_log_data_size = 0; // Reset data size for new buffer
-		} else {
-			// Zero buffer size is invalid
-			pr_err("%s: Buffer size must be greater than zero\n", __func__);
+	resp = kmalloc(sizeof(struct dpf_resp_pmu_log_control_s), GFP_KERNEL);
+	if (!resp)
+		return -ENOMEM;
+
+	mutex_lock(&dpf_mutex);
+
+	// For the first time or reset mode, allocate or reallocate the rings
+	if (!pmu_log_ring_entries() || mode == 0) {
+		// No producer may touch the rings while they are replaced
+		WRITE_ONCE(pmu_logging_active, false);
+		synchronize_rcu();
+
+		ret = pmu_log_alloc(req->buffer_size / PMU_ENTRY_SIZE_BYTES,
+				    req->policy);
+		if (ret < 0) {
+			mutex_unlock(&dpf_mutex);
 			kfree(resp);
-			return -EINVAL;
+			return ret;
 		}
-	} else if (mode == 0 && pmu_log_buffer) {
-		// Reset mode with existing buffer, just reset data size
-		pmu_log_data_size = 0;
+	} else {
+		pmu_log_set_policy(req->policy);
 	}
 
 	// Initialize PMU counters on all cores
@@ -530,29 +582,33 @@ int api_pmu_log_control(struct dpf_pmu_log_control_s *req_data)
 	}
 
 	// Start monitoring timer if not already running
-	if (!keep_running) {
-		keep_running = true;
-		kt_period = ktime_set(0, TIMER_INTERVAL_SEC * NSEC_PER_SEC);
-		hrtimer_start(&monitor_timer, kt_period, HRTIMER_MODE_REL);
+	ret = dpf_monitor_start();
+	if (ret < 0) {
+		mutex_unlock(&dpf_mutex);
+		pr_err("%s: Failed to start monitoring: %d\n", __func__, ret);
+		kfree(resp);
+		return ret;
 	}
 
 	// Enable logging
-	pmu_logging_active = true;
+	WRITE_ONCE(pmu_logging_active, true);
 
 	// Prepare response
 	resp->header.type = DPF_MSG_PMU_LOG_CONTROL;
 	resp->header.payload_size = sizeof(struct dpf_resp_pmu_log_control_s);
-	resp->confirmed_buffer_size = pmu_log_buffer_size;
+	resp->confirmed_buffer_size = pmu_log_ring_entries() * PMU_ENTRY_SIZE_BYTES;
 	resp->confirmed_mode = mode;
-	resp->status = status;
+	resp->confirmed_policy = req->policy;
+	resp->status = 0;
 
-	// Set response in proc buffer
-	kfree(proc_buffer);
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_pmu_log_control_s);
+	mutex_unlock(&dpf_mutex);
 
-	pr_info("%s: PMU logging %s with buffer size %zu bytes\n",
-	       __func__, (mode == 0) ? "reset" : "configured", pmu_log_buffer_size);
+	pr_info("%s: PMU logging %s with %u entries per CPU\n",
+	       __func__, (mode == 0) ? "reset" : "configured",
+	       resp->confirmed_buffer_size / (__u32)PMU_ENTRY_SIZE_BYTES);
+
+	// Set response in session buffer
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_pmu_log_control_s));
 
 	return 0;
 }
@@ -560,7 +616,7 @@ int api_pmu_log_control(struct dpf_pmu_log_control_s *req_data)
 // Handle PMU logging stop request
 // Stops or pauses the ongoing PMU metrics logging session
 // returns 0 on success, negative error code on failure
-int api_pmu_log_stop(struct dpf_pmu_log_stop_s *req_data)
+int api_pmu_log_stop(struct dpf_session_s *sess, struct dpf_pmu_log_stop_s *req_data)
 {
 	struct dpf_resp_pmu_log_stop_s *resp;
 	__s32 status = 0;
@@ -571,21 +627,21 @@ int api_pmu_log_stop(struct dpf_pmu_log_stop_s *req_data)
 	if (!resp)
 		return -ENOMEM;
 
+	mutex_lock(&dpf_mutex);
+
 	// Check if logging is already stopped
 	if (!pmu_logging_active) {
+		mutex_unlock(&dpf_mutex);
 		pr_info("%s: PMU logging already stopped\n", __func__);
 		resp->status = -EINVAL;
 		goto cleanup;
 	}
 
-	// Disable logging
-	pmu_logging_active = false;
+	// Disable logging, entries stay in the rings until read
+	WRITE_ONCE(pmu_logging_active, false);
 
 	// Stop monitoring timer
-	keep_running = false;
-	if (hrtimer_active(&monitor_timer)) {
-		hrtimer_cancel(&monitor_timer);
-	}
+	dpf_monitor_stop();
 
 	// Disable PMU counters on all cores
 	for (int i = 0; i < MAX_NUM_CORES; i++) {
@@ -595,15 +651,15 @@ int api_pmu_log_stop(struct dpf_pmu_log_stop_s *req_data)
 		}
 	}
 
+	mutex_unlock(&dpf_mutex);
+
 	// Prepare response
 	resp->header.type = DPF_MSG_PMU_LOG_STOP;
 	resp->header.payload_size = sizeof(struct dpf_resp_pmu_log_stop_s);
 	resp->status = status;
 
-	// Set response in proc buffer
-	kfree(proc_buffer);
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_pmu_log_stop_s);
+	// Set response in session buffer
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_pmu_log_stop_s));
 
 	pr_info("%s: PMU logging stopped\n", __func__);
 
@@ -617,139 +673,136 @@ cleanup:
 	resp->header.type = DPF_MSG_PMU_LOG_STOP;
 	resp->header.payload_size = sizeof(struct dpf_resp_pmu_log_stop_s);
 	resp->status = -EINVAL;
-	kfree(proc_buffer);
-	proc_buffer = (char *)resp;
-	proc_buffer_size = sizeof(struct dpf_resp_pmu_log_stop_s);
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_pmu_log_stop_s));
 	return -EINVAL;
 }
 
 // Handle PMU log read request
-// Reads the contents of the PMU metrics buffer
+// Moves the logged entries out of the per-CPU rings into the response
 // returns 0 on success, negative error code on failure
-int api_pmu_log_read(struct dpf_pmu_log_read_s *req_data)
+int api_pmu_log_read(struct dpf_session_s *sess, struct dpf_pmu_log_read_s *req_data)
 {
 	struct dpf_pmu_log_read_s *req = req_data;
-	struct dpf_resp_pmu_log_read_s *resp = NULL;
+	struct dpf_resp_pmu_log_read_s *resp;
 	__u32 max_bytes;
-	__u64 bytes_to_read = 0;
+	__u32 max_entries;
+	__u32 entries;
 	size_t resp_size;
 
-	pr_info("%s: Received PMU log read request: max_bytes=%u\n",
-	       __func__, req ? req->max_bytes : 0);
+	pr_debug("%s: Received PMU log read request: max_bytes=%u\n",
+		 __func__, req->max_bytes);
+
+	// The rings are replaced by api_pmu_log_control()
+	mutex_lock(&dpf_mutex);
 
-	// Check if buffer exists
-	if (!pmu_log_buffer || pmu_log_buffer_size == 0) {
+	if (!pmu_log_ring_entries()) {
+		mutex_unlock(&dpf_mutex);
 		pr_err("%s: PMU log buffer not allocated\n", __func__);
 		return -ENODATA;
 	}
 
-	// Check if we have data
-	if (pmu_log_data_size == 0) {
-		pr_info("%s: PMU log buffer is empty\n", __func__);
-		// Return success but with zero data size
-		resp_size = sizeof(struct dpf_resp_pmu_log_read_s);
-		resp = kmalloc(resp_size, GFP_KERNEL);
-		if (!resp) {
-			pr_err("%s: Failed to allocate empty response buffer\n", __func__);
-			return -ENOMEM;
-		}
-		resp->header.type = DPF_MSG_PMU_LOG_READ;
-		resp->header.payload_size = resp_size;
-		resp->data_size = 0;
-		
-		kfree(proc_buffer);
-		proc_buffer = (char *)resp;
-		proc_buffer_size = resp_size;
-		return 0;
-	}
+	// One read is bounded, max_bytes 0 reads as much as allowed
+	max_bytes = req->max_bytes;
+	if (max_bytes == 0 || max_bytes > DPF_PMU_LOG_READ_MAX)
+		max_bytes = DPF_PMU_LOG_READ_MAX;
 
-	// Determine how much data to read
-	max_bytes = req ? req->max_bytes : 0;
-	if (max_bytes == 0) {
-		// If max_bytes is 0, read all available data
-		bytes_to_read = pmu_log_data_size;
-	} else {
-		// Otherwise, read up to max_bytes
-		bytes_to_read = min_t(__u64, max_bytes, pmu_log_data_size);
-	}
+	max_entries = min_t(__u32, pmu_log_pending(),
+			    max_bytes / PMU_ENTRY_SIZE_BYTES);
 
-	// Calculate response size including flexible array
-	resp_size = sizeof(struct dpf_resp_pmu_log_read_s) + bytes_to_read;
-
-	// Allocate response with enough space for data
-	resp = kmalloc(resp_size, GFP_KERNEL);
+	resp_size = sizeof(struct dpf_resp_pmu_log_read_s) +
+		    (size_t)max_entries * PMU_ENTRY_SIZE_BYTES;
+	resp = kvmalloc(resp_size, GFP_KERNEL);
 	if (!resp) {
-		pr_err("%s: Failed to allocate response buffer of size %zu\n", 
+		mutex_unlock(&dpf_mutex);
+		pr_err("%s: Failed to allocate response buffer of size %zu\n",
 		       __func__, resp_size);
 		return -ENOMEM;
 	}
 
-	// Prepare response header
-	memset(resp, 0, resp_size);
+	entries = pmu_log_drain((dpf_pmu_log_entry_t *)resp->data, max_entries);
+	resp->lost = pmu_log_lost();
+
+	mutex_unlock(&dpf_mutex);
+
+	resp->data_size = (__u64)entries * PMU_ENTRY_SIZE_BYTES;
+	resp_size = sizeof(struct dpf_resp_pmu_log_read_s) + resp->data_size;
 	resp->header.type = DPF_MSG_PMU_LOG_READ;
 	resp->header.payload_size = resp_size;
-	resp->data_size = bytes_to_read;
-
-	// Copy data if any
-	if (bytes_to_read > 0) {
-		memcpy(resp->data, pmu_log_buffer, bytes_to_read);
-		pr_info("%s: Copied %llu bytes of PMU data to response (first entry: core=%u, ts=%llu)\n", 
-		       __func__, bytes_to_read, 
-		       ((dpf_pmu_log_entry_t *)resp->data)->core_id,
-		       ((dpf_pmu_log_entry_t *)resp->data)->timestamp);
-	} else {
-		pr_info("%s: No data to copy (bytes_to_read=%llu)\n", 
-		       __func__, bytes_to_read);
-	}
 
-	// Set response in proc buffer
-	kfree(proc_buffer);
-	proc_buffer = (char *)resp;
-	proc_buffer_size = resp_size;
+	dpf_session_set_resp(sess, resp, resp_size);
 
-	pr_info("%s: Read %llu/%zu bytes from PMU log buffer\n", 
-	       __func__, bytes_to_read, pmu_log_data_size);
+	pr_debug("%s: Read %u entries, %llu lost\n", __func__, entries, resp->lost);
 
 	return 0;
 }
 
-// Function to append data to the PMU log buffer
-// Called during monitoring to collect PMU metrics
-int api_pmu_log_append_data(void *data, size_t data_size)
+// Appends one PMU log entry for core_id, called from per_core_work()
+// on that core inside an RCU read-side section
+// returns 0 on success, -ENOSPC if the entry was dropped
+int api_pmu_log_append_data(int core_id, dpf_pmu_log_entry_t *entry)
 {
-	// Check if logging is enabled and buffer exists
-	if (!pmu_logging_active) {
-		pr_debug("%s: PMU logging not active\n", __func__);
+	if (!READ_ONCE(pmu_logging_active))
 		return -EINVAL;
-	}
 
-	if (!pmu_log_buffer || pmu_log_buffer_size == 0) {
-		pr_err("%s: PMU log buffer not initialized\n", __func__);
-		return -EINVAL;
-	}
+	return pmu_log_append(core_id, entry);
+}
 
-	if (!data || data_size == 0) {
-		pr_err("%s: Invalid data or data size\n", __func__);
-		return -EINVAL;
-	}
 
-	// Check if there's enough space in the buffer
-	if (pmu_log_data_size + data_size > pmu_log_buffer_size) {
-		pr_warn("%s: PMU log buffer full (%zu + %zu > %zu), dropping data\n",
-		       __func__, pmu_log_data_size, data_size, pmu_log_buffer_size);
-		return -ENOSPC;
+// Handles MAB configuration request, resets the kernel MAB tuner
+// returns 0 on success, -ENOMEM on failure, -EINVAL on invalid config
+int api_mab_config(struct dpf_session_s *sess, struct dpf_mab_config_s *req_data)
+{
+	struct dpf_mab_config_s *req = req_data;
+	struct dpf_resp_mab_config_s *resp;
+	int ret;
+
+	mutex_lock(&dpf_mutex);
+	ret = kernel_mab_config(req->algorithm, req->arm_configuration,
+				req->epsilon, req->gamma, req->c);
+	mutex_unlock(&dpf_mutex);
+	if (ret < 0) {
+		pr_err("%s: Invalid MAB config alg=%u arms=%u\n", __func__,
+		       req->algorithm, req->arm_configuration);
+		return ret;
 	}
 
-	// Debug: Print first few bytes of the data being appended
-	dpf_pmu_log_entry_t *entry = (dpf_pmu_log_entry_t *)data;
-	pr_debug("%s: Appending %zu bytes (core %u, ts %llu)\n",
-	       __func__, data_size, entry->core_id, entry->timestamp);
+	resp = kmalloc(sizeof(struct dpf_resp_mab_config_s), GFP_KERNEL);
+	if (!resp)
+		return -ENOMEM;
 
-	// Append data to buffer
-	memcpy(pmu_log_buffer + pmu_log_data_size, data, data_size);
-	pmu_log_data_size += data_size;
+	resp->header.type = DPF_MSG_MAB_CONFIG;
+	resp->header.payload_size = sizeof(struct dpf_resp_mab_config_s);
+	resp->confirmed_algorithm = req->algorithm;
+	resp->confirmed_arm_configuration = req->arm_configuration;
+	resp->status = 0;
+
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_mab_config_s));
 
-	pr_debug("%s: New buffer size: %zu bytes\n", __func__, pmu_log_data_size);
 	return 0;
 }
 
+// Handle timer statistics request
+// Reports the sampling periods, timer jitter and overruns since the module
+// was loaded or the last reset
+// returns 0 on success, -ENOMEM on failure
+int api_timer_stats(struct dpf_session_s *sess, struct dpf_timer_stats_s *req_data)
+{
+	struct dpf_timer_stats_s *req = req_data;
+	struct dpf_resp_timer_stats_s *resp;
+
+	resp = kmalloc(sizeof(struct dpf_resp_timer_stats_s), GFP_KERNEL);
+	if (!resp)
+		return -ENOMEM;
+
+	resp->header.type = DPF_MSG_TIMER_STATS;
+	resp->header.payload_size = sizeof(struct dpf_resp_timer_stats_s);
+	resp->reserved = 0;
+
+	mutex_lock(&dpf_mutex);
+	dpf_monitor_stats(resp, req->reset != 0);
+	mutex_unlock(&dpf_mutex);
+
+	dpf_session_set_resp(sess, resp, sizeof(struct dpf_resp_timer_stats_s));
+
+	return 0;
+}
@@ -1,6 +1,7 @@
 #ifndef __KERNEL_API_H__
 #define __KERNEL_API_H__
 
+#include <linux/ioctl.h>
 #include <linux/types.h>
 
 
@@ -44,6 +45,23 @@ struct dpf_resp_core_range_s {
     __u32 thread_count; // Number of threads (cores) in range
 };
 
+#define DPF_CORE_MASK_WORDS (MAX_NUM_CORES / 64)
+
+// Request structure for a core set of any shape, replaces the core range.
+// Offline cores of the set are tuned when they come online.
+struct dpf_core_mask_s {
+    struct dpf_msg_header_s header;
+    __u64 mask[DPF_CORE_MASK_WORDS]; // Bit n of word n / 64 selects core n
+};
+
+// Response structure for a core set
+struct dpf_resp_core_mask_s {
+    struct dpf_msg_header_s header;
+    __u32 requested;    // Cores in the requested set
+    __u32 tuned;        // Cores of the set online and tuned now
+    __u64 mask[DPF_CORE_MASK_WORDS]; // Tuned cores
+};
+
 // Request structure for core weights
 struct dpf_core_weight_s {
     struct dpf_msg_header_s header;
@@ -58,12 +76,22 @@ struct dpf_resp_core_weight_s {
     __u32 confirmed_weights[]; // Flexible array of confirmed weights
 };
 
+// Sampling and decision periods, DPF_DEFAULT_PERIOD_NS until set
+#define DPF_MIN_PERIOD_NS (100000ULL)		// 100 us
+#define DPF_MAX_PERIOD_NS (60000000000ULL)	// 60 s
+#define DPF_DEFAULT_PERIOD_NS (1000000000ULL)	// 1 s
+
 // Request structure for tuning
+// The decision period is rounded to a multiple of the sample period. A
+// period of 0 keeps the current value.
 struct dpf_req_tuning_s {
     struct dpf_msg_header_s header;
     __u32 enable;       // Enable tuning (non-zero) or disable (0)
     __u32 tunealg;      // Tuning algorithm selection
     __u32 aggr;         // Aggressiveness factor (scaled)
+    __u32 reserved;
+    __u64 sample_period_ns;   // PMU sampling period
+    __u64 decision_period_ns; // Tuning step period
 };
 
 // Response structure for tuning
@@ -72,6 +100,9 @@ struct dpf_resp_tuning_s {
     __u32 status;       // Tuning status (e.g., enabled/disabled)
     __u32 confirmed_tunealg;  // Confirmed tuning algorithm
     __u32 confirmed_aggr;     // Confirmed aggressiveness factor
+    __u32 reserved;
+    __u64 confirmed_sample_period_ns;
+    __u64 confirmed_decision_period_ns;
 };
 
 // Request structure for DDR bandwidth setting
@@ -138,18 +169,24 @@ struct dpf_resp_ddr_bw_read_s {
 };
 
 
+// PMU log policies when a per-CPU ring is full
+#define DPF_PMU_LOG_DROP (0)      // Keep the oldest entries, drop new ones
+#define DPF_PMU_LOG_OVERWRITE (1) // Keep the newest entries
+
 // Request structure for PMU logging control
 struct dpf_pmu_log_control_s {
 	struct dpf_msg_header_s header;
-	__u32 buffer_size;   // Size of the kernel buffer in bytes
+	__u32 buffer_size;   // Size of each per-CPU ring in bytes
 	__u32 mode;         // 0 for Reset mode, 1 for Append mode
+	__u32 policy;       // DPF_PMU_LOG_DROP or DPF_PMU_LOG_OVERWRITE
 };
 
 // Response structure for PMU logging control
 struct dpf_resp_pmu_log_control_s {
 	struct dpf_msg_header_s header;
-	__u32 confirmed_buffer_size;  // The actual buffer size allocated
+	__u32 confirmed_buffer_size;  // Per-CPU ring size allocated in bytes
 	__u32 confirmed_mode;        // The logging mode applied
+	__u32 confirmed_policy;      // The full ring policy applied
 	__s32 status;               // Success (0) or error code
 };
 
@@ -164,19 +201,102 @@ struct dpf_resp_pmu_log_stop_s {
 	__s32 status;               // Success (0) or error code
 };
 
+// Largest amount of PMU log data returned by one read, larger logs are
+// drained with several reads
+#define DPF_PMU_LOG_READ_MAX (1024 * 1024)
+
 // Request structure for reading PMU log buffer
+// Entries returned are removed from the per-CPU rings
 struct dpf_pmu_log_read_s {
 	struct dpf_msg_header_s header;
-	__u32 max_bytes;    // Maximum number of bytes to read (0 for all)
+	__u32 max_bytes;    // Maximum number of bytes to read (0 for DPF_PMU_LOG_READ_MAX)
 };
 
 // Response structure for reading PMU log buffer
 struct dpf_resp_pmu_log_read_s {
 	struct dpf_msg_header_s header;
 	__u64 data_size;    // Number of bytes of PMU metrics data
+	__u64 lost;         // Entries dropped or overwritten since log start
 	__u8 data[];        // Flexible array for the actual PMU metrics data
 };
 
+// Request structure for MAB tuner configuration
+// epsilon, gamma and c are Q16.16 fixed point (65536 = 1.0)
+struct dpf_mab_config_s {
+	struct dpf_msg_header_s header;
+	__u32 algorithm;         // E_GREEDY, UCB, DUCB or RANDOM
+	__u32 arm_configuration; // Arm set, see README
+	__u32 epsilon;           // E-greedy exploration probability
+	__u32 gamma;             // DUCB discount factor
+	__u32 c;                 // UCB/DUCB exploration scale
+};
+
+// Response structure for MAB tuner configuration
+struct dpf_resp_mab_config_s {
+	struct dpf_msg_header_s header;
+	__u32 confirmed_algorithm;
+	__u32 confirmed_arm_configuration;
+	__s32 status;            // Success (0) or error code
+};
+
+// Request structure for sampling timer statistics
+struct dpf_timer_stats_s {
+	struct dpf_msg_header_s header;
+	__u32 reset;             // Clear the statistics after reading them
+};
+
+// Response structure for sampling timer statistics, summed over all cores
+// Jitter is how late a timer callback ran after its expiry time. An
+// overrun is a period skipped because a callback ran a full period late.
+// In event mode ticks are trigger overflows and overruns the overflows
+// skipped because they came within a sample period of the previous one.
+struct dpf_resp_timer_stats_s {
+	struct dpf_msg_header_s header;
+	__u32 sampling_mode;     // DPF_SAMPLING_IPI or DPF_SAMPLING_PERCPU
+	__u32 reserved;
+	__u64 sample_period_ns;
+	__u64 decision_period_ns;
+	__u64 ticks;             // Timer callbacks
+	__u64 overruns;
+	__u64 jitter_avg_ns;
+	__u64 jitter_max_ns;
+};
+
+// Character device, /dev/dpf
+// DPF_IOC_REQUEST takes any of the request structures above and copies the
+// response straight into resp_ptr. resp_size is updated to the full
+// response size, a response larger than the buffer is truncated.
+#define DPF_DEVICE_NAME "dpf"
+#define DPF_IOC_MAGIC 'D'
+
+struct dpf_ioctl_s {
+	__u64 req_ptr;      // User pointer to the request
+	__u64 resp_ptr;     // User pointer to the response buffer
+	__u32 req_size;     // Request size in bytes
+	__u32 resp_size;    // In: buffer size, out: response size
+};
+
+#define DPF_IOC_REQUEST _IOWR(DPF_IOC_MAGIC, 1, struct dpf_ioctl_s)
+
+// Read-only shared area, mmap() of /dev/dpf at offset 0
+// Every enabled core publishes its PMU and MSR values each monitor tick.
+// seq is odd while an update is in progress, readers retry until they
+// see the same even value before and after copying.
+#define DPF_SHARED_VERSION (1)
+
+struct dpf_shared_core_s {
+	__u32 seq;          // Update sequence, 0 = never published
+	__u32 enabled;      // Core was enabled at the last update
+	__u64 timestamp;    // ktime_get_ns() of the last update
+	__u64 pmu_values[PMU_COUNTERS];
+	__u64 msr_values[NR_OF_MSR];
+};
+
+struct dpf_shared_s {
+	__u32 version;      // DPF_SHARED_VERSION
+	__u32 num_cores;    // Number of entries in core[]
+	struct dpf_shared_core_s core[MAX_NUM_CORES];
+};
 
 // Global tuning algorithm settings, these should be set through
 // the dpf_tuning_control API.
@@ -185,22 +305,63 @@ extern int aggr;
 
 // PMU logging state
 extern bool pmu_logging_active;
-extern char *pmu_log_buffer;
-extern size_t pmu_log_buffer_size;
-extern size_t pmu_log_data_size;
+
+// Per open file state of /proc/dynamicPrefetch and /dev/dpf, holds the
+// response to the last request made on that file
+struct dpf_session_s;
+struct cpumask;
+
+// Serializes changes to the module state (core range, tuning, DDR and
+// PMU log configuration). Responses are built outside of it.
+struct mutex;
+extern struct mutex dpf_mutex;
+
+// Replaces the session response, takes ownership of resp (kmalloc'd or
+// kvmalloc'd)
+void dpf_session_set_resp(struct dpf_session_s *sess, void *resp, size_t size);
+
+// sampling_mode module parameter
+#define DPF_SAMPLING_IPI (0)	// One timer, per-core work through IPIs
+#define DPF_SAMPLING_PERCPU (1)	// One pinned timer per enabled core
+#define DPF_SAMPLING_EVENT (2)	// PMU overflow of a trigger event
+
+// Held around the tuning step, which runs in hard IRQ context. Take it
+// with raw_spin_lock_irqsave() to change tuner state while tuning.
+struct raw_spinlock;
+extern struct raw_spinlock dpf_msr_lock;
+
+// Start and stop sampling the enabled cores every kt_period, with
+// dpf_mutex held. Starting returns 0 or a negative error code.
+int dpf_monitor_start(void);
+void dpf_monitor_stop(void);
+
+// Replaces the tuned core set, called with cpus_read_lock() and dpf_mutex
+// held. Returns the number of cores tuned now
+int dpf_set_cores(const struct cpumask *mask);
+
+// Sets the sampling and decision periods, 0 keeps a period. Takes effect
+// at the next tick. Called with dpf_mutex held
+// Returns 0 or -EINVAL
+int dpf_monitor_set_period(__u64 sample_period_ns, __u64 decision_period_ns);
+
+// Fills the period and timer fields of resp, optionally clearing them
+void dpf_monitor_stats(struct dpf_resp_timer_stats_s *resp, bool reset);
 
 // Kernel API function prototypes
-int api_init(void);
-int api_core_range(struct dpf_core_range_s *req_data);
-int api_core_weight(void *req_data);
-int api_tuning(struct dpf_req_tuning_s *req_data);
-int api_ddrbw_set(struct dpf_ddrbw_set_s *req_data);
-int api_msr_read(struct dpf_msr_read_s *req_data);
-int api_pmu_read(struct dpf_pmu_read_s *req_data);
-int api_ddr_config(struct dpf_ddr_config_s *req_data);
-int api_ddr_bw_read(struct dpf_ddr_bw_read_s *req_data);
-int api_pmu_log_control(struct dpf_pmu_log_control_s *req_data);
-int api_pmu_log_stop(struct dpf_pmu_log_stop_s *req_data);
-int api_pmu_log_read(struct dpf_pmu_log_read_s *req_data);
-int api_pmu_log_append_data(void *data, size_t data_size);
+int api_init(struct dpf_session_s *sess);
+int api_core_range(struct dpf_session_s *sess, struct dpf_core_range_s *req_data);
+int api_core_weight(struct dpf_session_s *sess, void *req_data);
+int api_tuning(struct dpf_session_s *sess, struct dpf_req_tuning_s *req_data);
+int api_ddrbw_set(struct dpf_session_s *sess, struct dpf_ddrbw_set_s *req_data);
+int api_msr_read(struct dpf_session_s *sess, struct dpf_msr_read_s *req_data);
+int api_pmu_read(struct dpf_session_s *sess, struct dpf_pmu_read_s *req_data);
+int api_ddr_config(struct dpf_session_s *sess, struct dpf_ddr_config_s *req_data);
+int api_ddr_bw_read(struct dpf_session_s *sess, struct dpf_ddr_bw_read_s *req_data);
+int api_pmu_log_control(struct dpf_session_s *sess, struct dpf_pmu_log_control_s *req_data);
+int api_pmu_log_stop(struct dpf_session_s *sess, struct dpf_pmu_log_stop_s *req_data);
+int api_pmu_log_read(struct dpf_session_s *sess, struct dpf_pmu_log_read_s *req_data);
+int api_pmu_log_append_data(int core_id, dpf_pmu_log_entry_t *entry);
+int api_mab_config(struct dpf_session_s *sess, struct dpf_mab_config_s *req_data);
+int api_timer_stats(struct dpf_session_s *sess, struct dpf_timer_stats_s *req_data);
+int api_core_mask(struct dpf_session_s *sess, struct dpf_core_mask_s *req_data);
 #endif // __KERNEL_API_H__
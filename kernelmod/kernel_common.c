@@ -1,12 +1,11 @@
 #define _GNU_SOURCE
 
+#include <linux/string.h>
 #include <linux/timekeeping.h>
 
 //#include "../include/atom_msr.h"
 #include "kernel_common.h"
-
-int sys_first_core = 0; //set by core_range API
-int sys_active_cores = 0; //set by core_range API
+#include "kernel_perf.h"
 
 struct core_state_s corestate[MAX_NUM_CORES];
 int ddr_bw_target;
@@ -17,6 +16,8 @@ int ddr_bw_target;
 
 int pmu_update(int core_id)
 {
+	int ret;
+
 	if (core_id < 0 || core_id >= MAX_NUM_CORES || corestate[core_id].core_disabled)
 		return -EINVAL;
 
@@ -24,6 +25,12 @@ int pmu_update(int core_id)
 		corestate[core_id].pmu_old[i] = corestate[core_id].pmu_raw[i];
 	}
 
+	// Tuned cores count with perf events, raw PMCs only with raw_pmu=1 or
+	// where perf can't count on the core
+	ret = kperf_read(core_id, corestate[core_id].pmu_raw);
+	if (ret != -ENODEV)
+		return ret;
+
 	// Update PMU counters using the defined indices from kernel_common.h
 	corestate[core_id].pmu_raw[PERF_MEM_UOPS_RETIRED_ALL_LOADS] = native_read_pmc(0);
 	corestate[core_id].pmu_raw[PERF_MEM_LOAD_UOPS_RETIRED_L2_HIT] = native_read_pmc(1);
@@ -36,6 +43,29 @@ int pmu_update(int core_id)
 	return 0;
 }
 
+// PMU counts of a core since the last decision step, the same window the
+// DDR traffic of the decision covers. All 0 for a core that joined since.
+void pmu_decision_delta(int core_id, uint64_t *delta)
+{
+	for (int i = 0; i < PMU_COUNTERS; i++)
+		delta[i] = corestate[core_id].pmu_decision_valid ?
+			   corestate[core_id].pmu_raw[i] -
+			   corestate[core_id].pmu_decision[i] : 0;
+}
+
+// Starts the next decision window on all tuned cores, called after every
+// decision step under dpf_msr_lock
+void pmu_decision_snapshot(void)
+{
+	int core_id;
+
+	for_each_cpu(core_id, &enabled_cpus) {
+		memcpy(corestate[core_id].pmu_decision, corestate[core_id].pmu_raw,
+		       sizeof(corestate[core_id].pmu_decision));
+		corestate[core_id].pmu_decision_valid = 1;
+	}
+}
+
 //returns the msr dirty indicator, 0 if not dirty, 1 if dirty
 int inline is_msr_dirty(int core_id)
 {
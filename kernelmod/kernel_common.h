@@ -90,7 +90,10 @@ enum dpf_msg_type {
 	DPF_MSG_DDR_BW_READ = 8,	 //DDR BW READ
 	DPF_MSG_PMU_LOG_CONTROL = 9, // PMU logging control
 	DPF_MSG_PMU_LOG_STOP = 10,   // Stop PMU logging
-	DPF_MSG_PMU_LOG_READ = 11    // Read PMU log buffer
+	DPF_MSG_PMU_LOG_READ = 11,   // Read PMU log buffer
+	DPF_MSG_MAB_CONFIG = 12,     // MAB tuner configuration
+	DPF_MSG_TIMER_STATS = 13,    // Sampling timer statistics
+	DPF_MSG_CORE_MASK = 14       // Core set configuration
 };
 
 // Note: Struct definitions have been moved to kernel_api.h
@@ -120,34 +123,50 @@ struct dpf_pmu_log_stop_s;
 struct dpf_resp_pmu_log_stop_s;
 struct dpf_pmu_log_read_s;
 struct dpf_resp_pmu_log_read_s;
+struct dpf_mab_config_s;
+struct dpf_resp_mab_config_s;
+struct dpf_timer_stats_s;
+struct dpf_resp_timer_stats_s;
+struct dpf_core_mask_s;
+struct dpf_resp_core_mask_s;
 
 // Core state structure
 struct core_state_s {
     uint64_t pmu_raw[PMU_COUNTERS]; 	// Raw value from last PMU read (mapped to pmu_metrics)
     uint64_t pmu_old[PMU_COUNTERS];	// Prev. raw last PMU read (mapped to pmu_metrics)
+    uint64_t pmu_decision[PMU_COUNTERS];	// Raw values at the last decision step
+    int pmu_decision_valid;		// 0 until the first decision after configure_pmu()
     union msr_u pf_msr[NR_OF_MSR];	// MSR values (0x1320...0x1A4)
     int pf_msr_dirty;			// 0 = no update needed, 1 = update needed
     int core_disabled;			// 1 = core disabled, 0 = enabled
 };
 
-extern int sys_first_core;
-extern int sys_active_cores;
+#ifdef __KERNEL__
+#include <linux/cpumask.h>
+#include <linux/topology.h>
 
-static inline int first_core(void) {
-    return sys_first_core;
-}
+// Tuned cores, the online cores of the requested core set
+extern cpumask_t enabled_cpus;
 
-static inline int active_cores(void) {
-    return sys_active_cores;
+// Core set requested by user space, including cores not online yet
+extern cpumask_t requested_cpus;
+
+// Core running the decision step, >= nr_cpu_ids if no core is tuned
+static inline int first_core(void) {
+    return cpumask_first(&enabled_cpus);
 }
 
-static inline int core_in_module(int core_id) {
-    return (core_id - sys_first_core) % 4;
+// The prefetch MSRs are shared by the cores of a module (L2 cluster), the
+// first tuned core of each module writes them
+static inline bool module_leader(int core_id) {
+    return cpumask_first_and(topology_cluster_cpumask(core_id),
+                             &enabled_cpus) == core_id;
 }
 
 static inline int module_id(int core_id) {
-    return (core_id - sys_first_core) / 4;
+    return topology_cluster_id(core_id);
 }
+#endif
 
 // External declarations
 extern struct core_state_s corestate[MAX_NUM_CORES];
@@ -159,6 +178,8 @@ int msr_set_dirty(int core_id);
 int msr_load(int core_id);
 int msr_update(int core_id);
 int pmu_update(int core_id);
+void pmu_decision_delta(int core_id, uint64_t *delta);
+void pmu_decision_snapshot(void);
 
 // Functions for reading and writing MSRs
 int msr_set_l2xq(int core_id, int value);
@@ -168,5 +189,6 @@ int msr_get_l3xq(int core_id);
 
 // PMU configuration functions
 int configure_pmu(int core_id);
+void release_pmu(int core_id);
 
 #endif /* __KERNEL_COMMON_H__ */
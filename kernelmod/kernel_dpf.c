@@ -1,10 +1,13 @@
 // SPDX-License-Identifier: Dual BSD/GPL
 #include <asm/msr.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
 #include <linux/cpumask.h>
 #include <linux/delay.h>
 #include <linux/hrtimer.h>
 #include <linux/init.h>
 #include <linux/io.h>
+#include <linux/irq_work.h>
 #include <linux/ioport.h>
 #include <linux/workqueue.h>
 
@@ -12,35 +15,111 @@
 #include <linux/kernel.h>
 #include <linux/kthread.h>
 #include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/printk.h>
 #include <linux/proc_fs.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 
 #include "../include/pmu_ddr.h"
 #include "kernel_common.h"
 #include "kernel_pmu_ddr.h"
+#include "kernel_pmu_log.h"
 #include "kernel_primitive.h"
+#include "kernel_mab.h"
 #include "kernel_api.h"
+#include "kernel_perf.h"
 
-#define TIMER_INTERVAL_SEC 1
 #define PROC_FILE_NAME "dynamicPrefetch"
-#define PROC_BUFFER_SIZE (1024)
 
 bool keep_running;
 struct hrtimer monitor_timer;
 ktime_t kt_period;
-char *proc_buffer;
-size_t proc_buffer_size;
 __u64 ddr_bar_address;
-static DEFINE_MUTEX(dpf_mutex);
+DEFINE_MUTEX(dpf_mutex);
 cpumask_t enabled_cpus;
 
+// Core set requested by user space, enabled_cpus follows its online cores
+cpumask_t requested_cpus;
+static enum cpuhp_state dpf_cpuhp_state;
+
+// Per open file state, see kernel_api.h
+struct dpf_session_s {
+	struct mutex lock;	// One request at a time per file
+	char *resp;		// Response to the last request
+	size_t resp_size;
+};
+
+// Shared PMU/MSR area mapped by /dev/dpf users
+static struct dpf_shared_s *dpf_shared;
+
 // Workqueue for deferring SMP calls from timer to task context
 static struct work_struct monitor_work;
 
+// DPF_SAMPLING_IPI: monitor_timer queues monitor_work, which runs
+// per_core_work() on every enabled core through smp_call_function_many().
+// DPF_SAMPLING_PERCPU: every enabled core samples itself from its own pinned
+// sample_timer, no IPIs. The decision step still runs on first_core() and
+// sees the latest sample of every core.
+// DPF_SAMPLING_EVENT: a core samples itself when its event_trigger counter
+// overflows after event_period events, at most once per sample period. The
+// decision step runs on whichever core samples once the decision period has
+// passed, so idle cores cost nothing. Needs the perf_event counters, as perf
+// owns the overflow interrupt.
+static int sampling_mode = DPF_SAMPLING_IPI;
+module_param(sampling_mode, int, 0444);
+MODULE_PARM_DESC(sampling_mode, "0: timer and IPIs (default), 1: per-CPU timers, 2: PMU overflow events");
+
+// The PMU counters are in-kernel perf_event counters (kernel_perf.c) that
+// coexist with perf and other profilers. raw_pmu, or a core perf has no
+// counters for, falls back to programming PERFEVTSEL0-6 directly, which
+// takes the PMU over from everyone else.
+static bool raw_pmu;
+module_param(raw_pmu, bool, 0444);
+MODULE_PARM_DESC(raw_pmu, "Program the PMCs directly instead of using perf_event counters");
+
+// The trigger is armed when the counters are created, see configure_pmu()
+static int event_trigger = PERF_MEM_LOAD_UOPS_RETIRED_DRAM_HIT;
+module_param(event_trigger, int, 0444);
+MODULE_PARM_DESC(event_trigger, "Event mode trigger counter, index in enum pmu_metrics (default: DRAM hits)");
+
+static ulong event_period = 100000;
+module_param(event_period, ulong, 0444);
+MODULE_PARM_DESC(event_period, "Event mode trigger events per sample");
+
+static DEFINE_PER_CPU(struct hrtimer, sample_timer);
+static DEFINE_PER_CPU(struct irq_work, event_work);
+static DEFINE_PER_CPU(u64, event_last_ns);
+
+// The decision step runs every decision_every samples of first_core(), or
+// in event mode decision_every sample periods after the previous one
+static u32 decision_every = 1;
+static u32 decision_tick;
+static u64 decision_last_ns;
+
+// Timer statistics, updated by the callbacks on their own core
+struct dpf_timer_stats_pcpu_s {
+	u64 ticks;
+	u64 overruns;
+	u64 jitter_sum_ns;
+	u64 jitter_max_ns;
+};
+
+static DEFINE_PER_CPU(struct dpf_timer_stats_pcpu_s, timer_stats);
+
+// Orders the decision step, which writes pf_msr of all cores, against
+// msr_update() of each core when the cores sample independently, and
+// against tuner resets
+DEFINE_RAW_SPINLOCK(dpf_msr_lock);
+
 
 // Global tuning algorithm settings, these should be set through the dpf_tuning_control API.
 int tune_alg;
@@ -81,161 +160,340 @@ static void configure_pmu_on_core(void *info)
 	native_write_msr(MSR_IA32_PERF_GLOBAL_CTRL, PMC_ENABLE_ALL, 0);
 }
 
+static void event_overflow(struct perf_event *event,
+			   struct perf_sample_data *data, struct pt_regs *regs);
+
 // Configures PMU for a core, sets up performance counters
 // core_id: The CPU core to configure
 int configure_pmu(int core_id)
 {
-	cpumask_t *target_cpu;
-	int ret = 0;
+	int ret;
 
-	// Allocate cpumask on heap instead of stack to reduce frame size
-	target_cpu = kmalloc(sizeof(cpumask_t), GFP_KERNEL);
-	if (!target_cpu)
-		return -ENOMEM;
+	// The counters may restart, the next decision window starts fresh
+	corestate[core_id].pmu_decision_valid = 0;
 
-	cpumask_clear(target_cpu);
-	cpumask_set_cpu(core_id, target_cpu);
+	if (!raw_pmu) {
+		if (sampling_mode == DPF_SAMPLING_EVENT)
+			ret = kperf_create(core_id, event_trigger, event_period,
+					   event_overflow);
+		else
+			ret = kperf_create(core_id, -1, 0, NULL);
 
-	// Execute the configuration function on the specified core
-	// smp_call_function_many returns void, not an int
-	smp_call_function_many(target_cpu, configure_pmu_on_core, NULL, 1);
+		// A full PMU belongs to someone else, leave it alone
+		if (ret == 0 || ret == -EBUSY || sampling_mode == DPF_SAMPLING_EVENT)
+			return ret;
 
-	kfree(target_cpu);
-	return ret;
+		pr_warn("%s: No perf counters on core %d (%d), using raw PMCs\n",
+			__func__, core_id, ret);
+	}
+
+	// Execute the configuration function on the specified core, also
+	// when that is the calling core (CPU hotplug callbacks)
+	return smp_call_function_single(core_id, configure_pmu_on_core, NULL, 1);
 }
 
+// Releases the perf counters of a core leaving the core range
+// Process context, no-op for cores on raw PMCs
+void release_pmu(int core_id)
+{
+	if (core_id < 0 || !cpu_possible(core_id))
+		return;
+
+	kperf_release(core_id);
+	// No more overflows, wait for a sample already queued
+	irq_work_sync(per_cpu_ptr(&event_work, core_id));
+}
+
+
+// Replaces the session response, takes ownership of resp (kmalloc'd or
+// kvmalloc'd)
+void dpf_session_set_resp(struct dpf_session_s *sess, void *resp, size_t size)
+{
+	kvfree(sess->resp);
+	sess->resp = resp;
+	sess->resp_size = size;
+}
+
+// Allocates the session of a newly opened /proc or /dev file
+static int dpf_session_open(struct inode *inode, struct file *file)
+{
+	struct dpf_session_s *sess;
+
+	sess = kzalloc(sizeof(*sess), GFP_KERNEL);
+	if (!sess)
+		return -ENOMEM;
+
+	mutex_init(&sess->lock);
+	file->private_data = sess;
+
+	return 0;
+}
+
+static int dpf_session_release(struct inode *inode, struct file *file)
+{
+	struct dpf_session_s *sess = file->private_data;
+
+	kvfree(sess->resp);
+	kfree(sess);
+
+	return 0;
+}
 
 // Handles the read request from the user space
+// Returns the response to the last request written on this file
 static ssize_t proc_read(struct file *file, char __user *buffer,
 	size_t count, loff_t *pos)
 {
+	struct dpf_session_s *sess = file->private_data;
 	size_t bytes_to_copy;
+	ssize_t ret;
 
-	pr_info("%s: Enter: count=%zu, pos=%lld, proc_buffer_size=%zu\n",
-	       __func__, count, *pos, proc_buffer_size);
+	mutex_lock(&sess->lock);
 
-	// Check if we have data to read
-	if (!proc_buffer || proc_buffer_size == 0) {
-		pr_info("%s: No data available to read\n", __func__);
-		return 0;
-	}
+	pr_debug("%s: count=%zu, pos=%lld, resp_size=%zu\n",
+		 __func__, count, *pos, sess->resp_size);
 
-	// Check if we've already read everything
-	if (*pos >= proc_buffer_size) {
-		pr_info("%s: Reached end of data\n", __func__);
-		return 0;
+	// Nothing left of the response
+	if (!sess->resp || *pos >= sess->resp_size) {
+		ret = 0;
+		goto out;
 	}
 
-	// Calculate how much we can copy
-	bytes_to_copy = min(count, proc_buffer_size - *pos);
-
-	pr_info("%s: Attempting to copy %zu bytes from offset %lld\n",
-	       __func__, bytes_to_copy, *pos);
+	bytes_to_copy = min(count, sess->resp_size - (size_t)*pos);
 
 	// Copy data to user space
-	if (copy_to_user(buffer, proc_buffer + *pos, bytes_to_copy)) {
+	if (copy_to_user(buffer, sess->resp + *pos, bytes_to_copy)) {
 		pr_err("%s: Failed to copy %zu bytes to user buffer\n",
 		      __func__, bytes_to_copy);
-		return -EFAULT;
+		ret = -EFAULT;
+		goto out;
 	}
 
-	// Update position
 	*pos += bytes_to_copy;
-	pr_info("%s: Successfully copied %zu bytes (new pos: %lld)\n",
-	       __func__, bytes_to_copy, *pos);
-
-	return bytes_to_copy;
+	ret = bytes_to_copy;
+out:
+	mutex_unlock(&sess->lock);
+	return ret;
 }
 
-// Handles the write request from the user space
-// returns 0 on success, -EINVAL on failure
-static ssize_t dpf_proc_write(struct file *file, const char __user *buffer,
-			      size_t count, loff_t *ppos)
+// Copies a request into a zeroed MAX_MSG_SIZE buffer, so fields that an
+// older, shorter request doesn't have read as 0
+// Returns the buffer or an ERR_PTR
+static void *dpf_copy_request(const void __user *buffer, size_t count)
 {
-	struct dpf_msg_header_s header;
-	void *msg_data = NULL;
-	int ret = -EINVAL;
-
-	if (count < sizeof(struct dpf_msg_header_s) || count > MAX_MSG_SIZE)
-		return -EINVAL;
+	void *msg_data;
 
-	mutex_lock(&dpf_mutex);
-
-	kfree(proc_buffer);
-	proc_buffer = NULL;
-	proc_buffer_size = 0;
-
-	if (copy_from_user(&header, buffer, sizeof(header))) {
-		mutex_unlock(&dpf_mutex);
-		return -EFAULT;
-	}
-
-	msg_data = kmalloc(count, GFP_KERNEL);
-	if (!msg_data) {
-		mutex_unlock(&dpf_mutex);
-		return -ENOMEM;
-	}
+	msg_data = kzalloc(MAX_MSG_SIZE, GFP_KERNEL);
+	if (!msg_data)
+		return ERR_PTR(-ENOMEM);
 
 	if (copy_from_user(msg_data, buffer, count)) {
 		kfree(msg_data);
-		mutex_unlock(&dpf_mutex);
-		return -EFAULT;
+		return ERR_PTR(-EFAULT);
 	}
 
-	switch (header.type) {
+	return msg_data;
+}
+
+// Runs the handler for one request, the response is left in the session
+// Called with sess->lock held, handlers take dpf_mutex themselves
+// returns 0 on success, negative error code on failure
+static int dpf_dispatch(struct dpf_session_s *sess, void *msg_data)
+{
+	struct dpf_msg_header_s *header = msg_data;
+
+	dpf_session_set_resp(sess, NULL, 0);
+
+	switch (header->type) {
 	case DPF_MSG_INIT:
-		ret = api_init();
-		break;
+		return api_init(sess);
 	case DPF_MSG_CORE_RANGE:
-		ret = api_core_range(msg_data);
-		break;
+		return api_core_range(sess, msg_data);
 	case DPF_MSG_CORE_WEIGHT:
-		ret = api_core_weight(msg_data);
-		break;
+		return api_core_weight(sess, msg_data);
 	case DPF_MSG_TUNING:
-		ret = api_tuning(msg_data);
-		break;
+		return api_tuning(sess, msg_data);
 	case DPF_MSG_DDRBW_SET:
-		ret = api_ddrbw_set(msg_data);
-		break;
+		return api_ddrbw_set(sess, msg_data);
 	case DPF_MSG_PMU_READ:
-		ret = api_pmu_read(msg_data);
-		break;
+		return api_pmu_read(sess, msg_data);
 	case DPF_MSG_MSR_READ:
-		ret = api_msr_read(msg_data);
-		break;
+		return api_msr_read(sess, msg_data);
 	case DPF_MSG_DDR_CONFIG:
-		ret = api_ddr_config(msg_data);
-		break;
+		return api_ddr_config(sess, msg_data);
 	case DPF_MSG_DDR_BW_READ:
-		ret = api_ddr_bw_read(msg_data);
-		break;
-		case DPF_MSG_PMU_LOG_CONTROL:
-		ret = api_pmu_log_control(msg_data);
-		break;
+		return api_ddr_bw_read(sess, msg_data);
+	case DPF_MSG_PMU_LOG_CONTROL:
+		return api_pmu_log_control(sess, msg_data);
 	case DPF_MSG_PMU_LOG_STOP:
-		ret = api_pmu_log_stop(msg_data);
-		break;
+		return api_pmu_log_stop(sess, msg_data);
 	case DPF_MSG_PMU_LOG_READ:
-		ret = api_pmu_log_read(msg_data);
-		break;
+		return api_pmu_log_read(sess, msg_data);
+	case DPF_MSG_MAB_CONFIG:
+		return api_mab_config(sess, msg_data);
+	case DPF_MSG_TIMER_STATS:
+		return api_timer_stats(sess, msg_data);
+	case DPF_MSG_CORE_MASK:
+		return api_core_mask(sess, msg_data);
 	default:
-		ret = -EINVAL;
-		break;
+		return -EINVAL;
 	}
+}
+
+// Handles the write request from the user space
+// returns 0 on success, -EINVAL on failure
+static ssize_t dpf_proc_write(struct file *file, const char __user *buffer,
+			      size_t count, loff_t *ppos)
+{
+	struct dpf_session_s *sess = file->private_data;
+	void *msg_data;
+	int ret;
+
+	if (count < sizeof(struct dpf_msg_header_s) || count > MAX_MSG_SIZE)
+		return -EINVAL;
+
+	msg_data = dpf_copy_request(buffer, count);
+	if (IS_ERR(msg_data))
+		return PTR_ERR(msg_data);
+
+	mutex_lock(&sess->lock);
+	ret = dpf_dispatch(sess, msg_data);
+	// The next read returns the new response from the start
+	*ppos = 0;
+	mutex_unlock(&sess->lock);
 
 	kfree(msg_data);
-	mutex_unlock(&dpf_mutex);
 
 	return ret < 0 ? ret : count;
 }
 
 // proc file operations
 static const struct proc_ops proc_fops = {
+	.proc_open = dpf_session_open,
+	.proc_release = dpf_session_release,
 	.proc_read = proc_read,
 	.proc_write = dpf_proc_write,
 };
 
+// Handles DPF_IOC_REQUEST, one request and its response in a single call
+// returns 0 on success, negative error code on failure
+static long dpf_dev_ioctl(struct file *file, unsigned int cmd,
+			  unsigned long arg)
+{
+	struct dpf_session_s *sess = file->private_data;
+	struct dpf_ioctl_s __user *uio = (struct dpf_ioctl_s __user *)arg;
+	struct dpf_ioctl_s io;
+	void *msg_data;
+	size_t len;
+	int ret;
+
+	if (cmd != DPF_IOC_REQUEST)
+		return -ENOTTY;
+
+	if (copy_from_user(&io, uio, sizeof(io)))
+		return -EFAULT;
+
+	if (io.req_size < sizeof(struct dpf_msg_header_s) ||
+	    io.req_size > MAX_MSG_SIZE)
+		return -EINVAL;
+
+	msg_data = dpf_copy_request(u64_to_user_ptr(io.req_ptr), io.req_size);
+	if (IS_ERR(msg_data))
+		return PTR_ERR(msg_data);
+
+	mutex_lock(&sess->lock);
+
+	ret = dpf_dispatch(sess, msg_data);
+	if (ret >= 0) {
+		len = min_t(size_t, io.resp_size, sess->resp_size);
+		if (len && copy_to_user(u64_to_user_ptr(io.resp_ptr),
+					sess->resp, len))
+			ret = -EFAULT;
+		io.resp_size = sess->resp_size;
+	}
+
+	mutex_unlock(&sess->lock);
+	kfree(msg_data);
+
+	if (ret < 0)
+		return ret;
+
+	if (put_user(io.resp_size, &uio->resp_size))
+		return -EFAULT;
+
+	return 0;
+}
+
+// Maps the shared PMU/MSR area read-only into the caller
+static int dpf_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	return remap_vmalloc_range(vma, dpf_shared, vma->vm_pgoff);
+}
+
+static const struct file_operations dpf_dev_fops = {
+	.owner = THIS_MODULE,
+	.open = dpf_session_open,
+	.release = dpf_session_release,
+	.unlocked_ioctl = dpf_dev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.mmap = dpf_dev_mmap,
+};
+
+static struct miscdevice dpf_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = DPF_DEVICE_NAME,
+	.fops = &dpf_dev_fops,
+	.mode = 0600,
+};
+
+// Publishes the PMU and MSR values of a core to the shared area
+// Only called on the core itself, so there is a single writer per entry
+static void dpf_shared_publish(int core_id)
+{
+	struct dpf_shared_core_s *sc = &dpf_shared->core[core_id];
+	int i;
+
+	WRITE_ONCE(sc->seq, sc->seq + 1);
+	smp_wmb();
+
+	sc->enabled = !corestate[core_id].core_disabled;
+	sc->timestamp = ktime_get_ns();
+	for (i = 0; i < PMU_COUNTERS; i++)
+		sc->pmu_values[i] = corestate[core_id].pmu_raw[i];
+	for (i = 0; i < NR_OF_MSR; i++)
+		sc->msr_values[i] = corestate[core_id].pf_msr[i].v;
+
+	smp_wmb();
+	WRITE_ONCE(sc->seq, sc->seq + 1);
+}
+
+// Whether core_id runs the tuning step now, called under dpf_msr_lock
+static bool dpf_decision_due(int core_id)
+{
+	u64 now;
+
+	if (sampling_mode == DPF_SAMPLING_EVENT) {
+		now = ktime_get_ns();
+		if (now - decision_last_ns <
+		    ktime_to_ns(READ_ONCE(kt_period)) * READ_ONCE(decision_every))
+			return false;
+
+		decision_last_ns = now;
+		return true;
+	}
+
+	if (core_id != first_core() || ++decision_tick < READ_ONCE(decision_every))
+		return false;
+
+	decision_tick = 0;
+	return true;
+}
+
 // Per-core work function executed on each CPU core
 // info: Pointer to data passed via smp_call_function_many; NULL if no data is
 // provided
@@ -243,14 +501,17 @@ static void per_core_work(void *info)
 {
 	// Get the ID of the current CPU core
 	int core_id = smp_processor_id();
+	unsigned long flags;
 
 	//pr_debug("Core %d tuning\n", core_id);
 
 	if (corestate[core_id].core_disabled == 0) {
 		pmu_update(core_id);
 
-		// Log PMU data if logging is active
-		if (pmu_logging_active && pmu_log_buffer) {
+		// Log PMU data if logging is active, the RCU section keeps the
+		// rings alive while api_pmu_log_control() replaces them
+		rcu_read_lock();
+		if (READ_ONCE(pmu_logging_active)) {
 			// Create a log entry with core_id and PMU values
 			dpf_pmu_log_entry_t log_entry;
 
@@ -261,33 +522,34 @@ static void per_core_work(void *info)
 			// Copy PMU values from corestate to log entry
 			memcpy(log_entry.pmu_values, corestate[core_id].pmu_raw, sizeof(log_entry.pmu_values));
 
-			// Debug: Print first few PMU values
-			pr_info("Core %d: PMU values[0]=%llu, [1]=%llu, [2]=%llu, [3]=%llu\n",
-			       core_id,
-			       log_entry.pmu_values[0],
-			       log_entry.pmu_values[1],
-			       log_entry.pmu_values[2],
-			       log_entry.pmu_values[3]);
-
-			// Append to log buffer
-			int ret = api_pmu_log_append_data(&log_entry, sizeof(log_entry));
-			if (ret < 0) {
-				pr_err("Failed to append PMU data for core %d: %d\n", core_id, ret);
-			}
+			// Full rings are accounted in the lost counter
+			api_pmu_log_append_data(core_id, &log_entry);
 		}
+		rcu_read_unlock();
 
-		if (core_id == first_core()) {
+		// Taken in hard IRQ context (IPIs, timers, irq_work) and from
+		// the kworker with interrupts on
+		raw_spin_lock_irqsave(&dpf_msr_lock, flags);
+
+		if (dpf_decision_due(core_id)) {
 			if((tune_alg == 0) || (tune_alg == 1))kernel_basicalg(tune_alg, aggr);
-			//else if ()  //Multi-Armed Bandit (MAB) goes here
+			else if (tune_alg == TUNEALG_MAB) kernel_mab();
 			else pr_err("First Core ready but tune alg %d has not been defined\n", tune_alg);
 
+			// PMU deltas of the next decision cover the same
+			// window as its DDR traffic
+			pmu_decision_snapshot();
 		}
 
-		if (core_in_module(core_id) == 0 && is_msr_dirty(core_id) == 1) {
+		if (module_leader(core_id) && is_msr_dirty(core_id) == 1) {
 			pr_debug("Core %d update MSR\n", core_id);
 
 			msr_update(core_id);
 		}
+
+		raw_spin_unlock_irqrestore(&dpf_msr_lock, flags);
+
+		dpf_shared_publish(core_id);
 	}
 }
 
@@ -315,6 +577,27 @@ static void monitor_work_func(struct work_struct *work)
 	}
 }
 
+// Accounts the lateness of a timer callback and moves the timer to its
+// next period, periods that already passed are counted as overruns
+static void dpf_timer_forward(struct hrtimer *timer)
+{
+	struct dpf_timer_stats_pcpu_s *st = this_cpu_ptr(&timer_stats);
+	s64 late = ktime_to_ns(ktime_sub(ktime_get(), hrtimer_get_expires(timer)));
+	u64 periods;
+
+	if (late < 0)
+		late = 0;
+
+	WRITE_ONCE(st->ticks, st->ticks + 1);
+	WRITE_ONCE(st->jitter_sum_ns, st->jitter_sum_ns + late);
+	if ((u64)late > st->jitter_max_ns)
+		WRITE_ONCE(st->jitter_max_ns, late);
+
+	periods = hrtimer_forward_now(timer, READ_ONCE(kt_period));
+	if (periods > 1)
+		WRITE_ONCE(st->overruns, st->overruns + periods - 1);
+}
+
 // Lightweight timer callback - only schedules work, no SMP calls
 static enum hrtimer_restart monitor_callback(struct hrtimer *timer)
 {
@@ -325,64 +608,363 @@ static enum hrtimer_restart monitor_callback(struct hrtimer *timer)
 	// schedule_work() is safe from IRQ context and prevents duplicate queuing
 	schedule_work(&monitor_work);
 
-	hrtimer_forward_now(timer, kt_period);
+	dpf_timer_forward(timer);
+	return HRTIMER_RESTART;
+}
+
+// Per-CPU sampling timer, samples the core it is pinned to
+static enum hrtimer_restart sample_callback(struct hrtimer *timer)
+{
+	if (!READ_ONCE(keep_running))
+		return HRTIMER_NORESTART;
+
+	per_core_work(NULL);
+
+	dpf_timer_forward(timer);
 	return HRTIMER_RESTART;
 }
 
+// Runs on each enabled core, a pinned timer must be started on its core
+static void sample_timer_start(void *info)
+{
+	hrtimer_start(this_cpu_ptr(&sample_timer), kt_period,
+		      HRTIMER_MODE_REL_PINNED_HARD);
+}
+
+// Runs in hard IRQ context on the core whose trigger counter overflowed,
+// samples it unless the previous sample is less than a period ago
+static void event_work_func(struct irq_work *work)
+{
+	struct dpf_timer_stats_pcpu_s *st = this_cpu_ptr(&timer_stats);
+	u64 *last = this_cpu_ptr(&event_last_ns);
+	u64 now = ktime_get_ns();
+
+	if (!READ_ONCE(keep_running))
+		return;
+
+	if (now - *last < ktime_to_ns(READ_ONCE(kt_period))) {
+		WRITE_ONCE(st->overruns, st->overruns + 1);
+		return;
+	}
+
+	*last = now;
+	WRITE_ONCE(st->ticks, st->ticks + 1);
+
+	per_core_work(NULL);
+}
+
+// Trigger counter overflow, NMI context, defers the sample to an irq_work
+static void event_overflow(struct perf_event *event,
+			   struct perf_sample_data *data, struct pt_regs *regs)
+{
+	irq_work_queue(this_cpu_ptr(&event_work));
+}
+
+// Starts sampling the enabled cores every kt_period
+// Called with dpf_mutex held, does nothing if already running
+// Returns 0 or a negative error code
+int dpf_monitor_start(void)
+{
+	int cpu;
+
+	if (keep_running)
+		return 0;
+
+	// The trigger counters run since configure_pmu(), overflows count
+	// once keep_running is set
+	if (sampling_mode == DPF_SAMPLING_EVENT) {
+		for_each_cpu(cpu, &enabled_cpus)
+			per_cpu(event_last_ns, cpu) = 0;
+		decision_last_ns = ktime_get_ns();
+		keep_running = true;
+		return 0;
+	}
+
+	keep_running = true;
+
+	if (sampling_mode == DPF_SAMPLING_PERCPU)
+		on_each_cpu_mask(&enabled_cpus, sample_timer_start, NULL, true);
+	else
+		hrtimer_start(&monitor_timer, kt_period, HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+// Stops sampling and waits for running timer callbacks
+// Called with dpf_mutex held
+void dpf_monitor_stop(void)
+{
+	int cpu;
+
+	keep_running = false;
+
+	if (sampling_mode == DPF_SAMPLING_EVENT) {
+		for_each_possible_cpu(cpu)
+			irq_work_sync(per_cpu_ptr(&event_work, cpu));
+	} else if (sampling_mode == DPF_SAMPLING_PERCPU) {
+		for_each_possible_cpu(cpu)
+			hrtimer_cancel(per_cpu_ptr(&sample_timer, cpu));
+	} else {
+		hrtimer_cancel(&monitor_timer);
+	}
+}
+
+// Replaces the tuned core set, offline cores of mask are tuned once they
+// come online. Called with cpus_read_lock() and dpf_mutex held
+// Returns the number of tuned cores
+int dpf_set_cores(const struct cpumask *mask)
+{
+	bool running = keep_running;
+	int core_id;
+
+	// Per-CPU sampling timers follow enabled_cpus, restart them on the
+	// new set
+	if (running)
+		dpf_monitor_stop();
+
+	cpumask_and(&requested_cpus, mask, cpu_possible_mask);
+	cpumask_clear(&enabled_cpus);
+
+	for (core_id = 0; core_id < MAX_NUM_CORES; core_id++) {
+		corestate[core_id].core_disabled = 1;
+
+		// Give the counters of cores leaving the set back to perf
+		if (!cpumask_test_cpu(core_id, &requested_cpus)) {
+			release_pmu(core_id);
+			continue;
+		}
+
+		if (!cpu_online(core_id)) {
+			pr_info("%s: core %d offline, tuned once online\n",
+				__func__, core_id);
+			continue;
+		}
+
+		configure_pmu(core_id);
+		corestate[core_id].core_disabled = 0;
+		cpumask_set_cpu(core_id, &enabled_cpus);
+	}
+
+	if (running && dpf_monitor_start() < 0)
+		pr_err("%s: Failed to restart monitoring\n", __func__);
+
+	return cpumask_weight(&enabled_cpus);
+}
+
+// CPU hotplug callbacks, both run on the core going on- or offline. A core
+// of requested_cpus joins the tuned set with its current MSR values, and
+// leaves it with its timer and counters released.
+static int dpf_cpu_online(unsigned int cpu)
+{
+	if (cpu >= MAX_NUM_CORES)
+		return 0;
+
+	mutex_lock(&dpf_mutex);
+
+	if (cpumask_test_cpu(cpu, &requested_cpus)) {
+		configure_pmu(cpu);
+		msr_load(cpu);
+		per_cpu(event_last_ns, cpu) = 0;
+		corestate[cpu].core_disabled = 0;
+		cpumask_set_cpu(cpu, &enabled_cpus);
+
+		if (keep_running && sampling_mode == DPF_SAMPLING_PERCPU)
+			sample_timer_start(NULL);
+
+		pr_info("%s: core %d online, tuning it\n", __func__, cpu);
+	}
+
+	mutex_unlock(&dpf_mutex);
+
+	return 0;
+}
+
+static int dpf_cpu_offline(unsigned int cpu)
+{
+	if (cpu >= MAX_NUM_CORES)
+		return 0;
+
+	mutex_lock(&dpf_mutex);
+
+	if (cpumask_test_and_clear_cpu(cpu, &enabled_cpus)) {
+		corestate[cpu].core_disabled = 1;
+		hrtimer_cancel(per_cpu_ptr(&sample_timer, cpu));
+		release_pmu(cpu);
+
+		pr_info("%s: core %d offline, %u cores tuned\n", __func__,
+			cpu, cpumask_weight(&enabled_cpus));
+	}
+
+	mutex_unlock(&dpf_mutex);
+
+	return 0;
+}
+
+// Sets the sampling and decision periods, 0 keeps a period
+// Called with dpf_mutex held, returns 0 or -EINVAL
+int dpf_monitor_set_period(__u64 sample_period_ns, __u64 decision_period_ns)
+{
+	u64 sample = ktime_to_ns(kt_period);
+	u64 decision = sample * decision_every;
+	u64 every;
+
+	if (sample_period_ns)
+		sample = sample_period_ns;
+	if (decision_period_ns)
+		decision = decision_period_ns;
+
+	if (sample < DPF_MIN_PERIOD_NS || sample > DPF_MAX_PERIOD_NS ||
+	    decision < DPF_MIN_PERIOD_NS || decision > DPF_MAX_PERIOD_NS)
+		return -EINVAL;
+
+	every = max_t(u64, DIV64_U64_ROUND_CLOSEST(decision, sample), 1);
+
+	WRITE_ONCE(kt_period, ns_to_ktime(sample));
+	WRITE_ONCE(decision_every, every);
+
+	pr_info("Sampling every %llu ns, tuning every %llu samples\n",
+		sample, every);
+
+	return 0;
+}
+
+// Sums the timer statistics of all cores. A reset races with running
+// timers and may lose the update of a tick in progress.
+void dpf_monitor_stats(struct dpf_resp_timer_stats_s *resp, bool reset)
+{
+	u64 jitter_sum = 0;
+	int cpu;
+
+	resp->sampling_mode = sampling_mode;
+	resp->sample_period_ns = ktime_to_ns(kt_period);
+	resp->decision_period_ns = resp->sample_period_ns * decision_every;
+	resp->ticks = 0;
+	resp->overruns = 0;
+	resp->jitter_max_ns = 0;
+
+	for_each_possible_cpu(cpu) {
+		struct dpf_timer_stats_pcpu_s *st = per_cpu_ptr(&timer_stats, cpu);
+
+		resp->ticks += READ_ONCE(st->ticks);
+		resp->overruns += READ_ONCE(st->overruns);
+		jitter_sum += READ_ONCE(st->jitter_sum_ns);
+		resp->jitter_max_ns = max_t(u64, resp->jitter_max_ns,
+					    READ_ONCE(st->jitter_max_ns));
+
+		if (reset) {
+			WRITE_ONCE(st->ticks, 0);
+			WRITE_ONCE(st->overruns, 0);
+			WRITE_ONCE(st->jitter_sum_ns, 0);
+			WRITE_ONCE(st->jitter_max_ns, 0);
+		}
+	}
+
+	resp->jitter_avg_ns = resp->ticks ? div64_u64(jitter_sum, resp->ticks) : 0;
+}
+
 // Module initialization
 static int __init dpf_module_init(void)
 {
 	struct proc_dir_entry *entry;
 	int core_id;
+	int cpu;
+	int ret;
 
 	pr_info("dPF Module Loaded\n");
 
+	if (sampling_mode < DPF_SAMPLING_IPI || sampling_mode > DPF_SAMPLING_EVENT) {
+		pr_err("Invalid sampling_mode %d\n", sampling_mode);
+		return -EINVAL;
+	}
+
+	if (sampling_mode == DPF_SAMPLING_EVENT &&
+	    (raw_pmu || event_trigger < 0 || event_trigger >= PMU_COUNTERS ||
+	     event_period == 0)) {
+		pr_err("Event sampling needs perf counters, event_trigger 0-%d and event_period > 0\n",
+		       PMU_COUNTERS - 1);
+		return -EINVAL;
+	}
+
 	for (core_id = 0; core_id < MAX_NUM_CORES; core_id++)
 		corestate[core_id].core_disabled = 1;
 
-	proc_buffer = kmalloc(PROC_BUFFER_SIZE, GFP_KERNEL);
-	if (!proc_buffer)
+	// Initialize workqueue for deferred SMP calls
+	INIT_WORK(&monitor_work, monitor_work_func);
+
+	kt_period = ns_to_ktime(DPF_DEFAULT_PERIOD_NS);
+	hrtimer_init(&monitor_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	monitor_timer.function = monitor_callback;
+
+	for_each_possible_cpu(cpu) {
+		struct hrtimer *timer = per_cpu_ptr(&sample_timer, cpu);
+
+		hrtimer_init(timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED_HARD);
+		timer->function = sample_callback;
+
+		init_irq_work(per_cpu_ptr(&event_work, cpu), event_work_func);
+	}
+
+	dpf_shared = vmalloc_user(sizeof(struct dpf_shared_s));
+	if (!dpf_shared)
 		return -ENOMEM;
+	dpf_shared->version = DPF_SHARED_VERSION;
+	dpf_shared->num_cores = MAX_NUM_CORES;
+
+	// Only cores of a requested set are touched, nothing to do for the
+	// cores online now
+	ret = cpuhp_setup_state_nocalls(CPUHP_AP_ONLINE_DYN, "dpf:online",
+					dpf_cpu_online, dpf_cpu_offline);
+	if (ret < 0) {
+		pr_err("Failed to register CPU hotplug callbacks\n");
+		vfree(dpf_shared);
+		return ret;
+	}
+	dpf_cpuhp_state = ret;
 
+	// Requests can arrive as soon as the entries exist
 	entry = proc_create(PROC_FILE_NAME, 0444, NULL, &proc_fops);
 	if (!entry) {
 		pr_err("Failed to create /proc entry\n");
-		kfree(proc_buffer);
+		cpuhp_remove_state_nocalls(dpf_cpuhp_state);
+		vfree(dpf_shared);
 		return -ENOMEM;
 	}
-	// Initialize workqueue for deferred SMP calls
-	INIT_WORK(&monitor_work, monitor_work_func);
 
-	kt_period = ktime_set(TIMER_INTERVAL_SEC, 0);
-	hrtimer_init(&monitor_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	monitor_timer.function = monitor_callback;
+	ret = misc_register(&dpf_miscdev);
+	if (ret) {
+		pr_err("Failed to register /dev/%s\n", DPF_DEVICE_NAME);
+		remove_proc_entry(PROC_FILE_NAME, NULL);
+		cpuhp_remove_state_nocalls(dpf_cpuhp_state);
+		vfree(dpf_shared);
+		return ret;
+	}
 
 	return 0;
 }
 
 // Module cleanup
 static void __exit dpf_module_exit(void) {
+	int cpu;
+
 	pr_info("Stopping dPF monitor thread\n");
 
-	// Stop timer and prevent further work
-	keep_running = false;
-	hrtimer_cancel(&monitor_timer);
+	// Remove /dev and /proc entries first so no request restarts the timer
+	misc_deregister(&dpf_miscdev);
+	remove_proc_entry(PROC_FILE_NAME, NULL);
+	cpuhp_remove_state_nocalls(dpf_cpuhp_state);
+
+	// Stop timers and prevent further work
+	dpf_monitor_stop();
+	for_each_possible_cpu(cpu)
+		release_pmu(cpu);
 	// Wait for any pending work to complete before cleanup
 	cancel_work_sync(&monitor_work);
 
-	// Remove /proc entry and free resources
-	remove_proc_entry(PROC_FILE_NAME, NULL);
-	kfree(proc_buffer);
+	vfree(dpf_shared);
 
 	// Cleanup PMU logging resources
-	if (pmu_log_buffer) {
-		pr_info("Cleaning up PMU logging resources\n");
-		kfree(pmu_log_buffer);
-		pmu_log_buffer = NULL;
-		pmu_log_buffer_size = 0;
-		pmu_log_data_size = 0;
-		pmu_logging_active = false;
-	}
+	pmu_logging_active = false;
+	pmu_log_free();
 
 	// Cleanup DDR mappings
 	for (int i = 0; i < MAX_NUM_DDR_CONTROLLERS; i++) {
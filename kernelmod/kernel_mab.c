@@ -0,0 +1,351 @@
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/printk.h>
+#include <linux/random.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "kernel_api.h"
+#include "kernel_common.h"
+#include "kernel_mab.h"
+#include "../include/fixedpoint.h"
+
+// MAB modes, same as include/mab.h
+#define KMAB_ROUND_ROBIN (0)
+#define KMAB_MAIN_LOOP (1)
+#define KMAB_MAIN_LOOP_TRANSITION (2)
+
+// Kernel port of tuners/mab.c. Rewards, selection counts and
+// hyperparameters are Q16.16 fixed point (include/fixedpoint.h) since the
+// FPU can't be used here.
+// Rewards are normalised once after the initial round robin, SD filtering
+// is not supported.
+static struct {
+	int configured;
+	int arms_ready;
+	int algorithm;
+	int arm_configuration;
+	int mode;
+	int arm;
+	int num_arms;
+	int rr_counter;
+	fp_t epsilon;
+	fp_t gamma;
+	fp_t c;
+	fp_t num_total;
+	fp_t avg_reward;
+	fp_t rewards[KMAB_MAX_ARMS];
+	fp_t ipcs[KMAB_MAX_ARMS];
+	fp_t nums[KMAB_MAX_ARMS];
+	union msr_u arm_msr[KMAB_MAX_ARMS][NR_OF_MSR];
+} kmab;
+
+// Average IPC of all enabled cores since the last decision, Q16.16
+static fp_t kmab_get_ipc(void)
+{
+	u64 delta[PMU_COUNTERS];
+	u64 inst = 0, cycles = 0;
+	int core_id;
+
+	for_each_cpu(core_id, &enabled_cpus) {
+		if (corestate[core_id].core_disabled)
+			continue;
+
+		pmu_decision_delta(core_id, delta);
+		inst += delta[PERF_INST_RETIRED_ANY_P];
+		cycles += delta[PERF_CPU_CLK_UNHALTED_THREAD];
+	}
+
+	if (cycles == 0)
+		return 0;
+
+	return div64_u64(inst << FP_SHIFT, cycles);
+}
+
+// Arms mirror create_arms() in tuners/mab_setup.c but start from the MSR
+// values loaded on the first core when tuning was enabled
+static int kmab_create_arms(void)
+{
+	static const int l2dd_values[] = {0, 16, 64, 255};
+	static const int l2xq_values[] = {0, 4, 8, 16, 31};
+	int first = first_core();
+	int i;
+
+	if (first >= MAX_NUM_CORES)
+		return -EINVAL;
+
+	for (i = 0; i < KMAB_MAX_ARMS; i++)
+		memcpy(kmab.arm_msr[i], corestate[first].pf_msr,
+		       sizeof(kmab.arm_msr[i]));
+
+	switch (kmab.arm_configuration) {
+	case 0: // MLC, AMP, LLC and NLP on/off
+		for (i = 0; i < 16; i++) {
+			kmab.arm_msr[i][MSR_1A4_INDEX].msr1A4.L2_STREAM_DISABLED = (i & 0x1) > 0;
+			kmab.arm_msr[i][MSR_1A4_INDEX].msr1A4.L2_AMP_DISABLED = (i & 0x2) > 0;
+			kmab.arm_msr[i][MSR_1320_INDEX].msr1320.LLC_STREAM_DISABLE = (i & 0x4) > 0;
+			kmab.arm_msr[i][MSR_1321_INDEX].msr1321.L2_DISABLE_NEXT_LINE_PREFETCH = (i & 0x8) > 0;
+		}
+		kmab.num_arms = 16;
+		break;
+	case 1: // MLC and AMP on/off
+		for (i = 0; i < 4; i++) {
+			kmab.arm_msr[i][MSR_1A4_INDEX].msr1A4.L2_STREAM_DISABLED = (i & 0x1) > 0;
+			kmab.arm_msr[i][MSR_1A4_INDEX].msr1A4.L2_AMP_DISABLED = (i & 0x2) > 0;
+		}
+		kmab.num_arms = 4;
+		break;
+	case 2: // L2 demand density, last arm MLC off
+		for (i = 0; i < ARRAY_SIZE(l2dd_values); i++)
+			kmab.arm_msr[i][MSR_1321_INDEX].msr1321.L2_STREAM_DEMAND_DENSITY = l2dd_values[i];
+		kmab.arm_msr[i][MSR_1A4_INDEX].msr1A4.L2_STREAM_DISABLED = 1;
+		kmab.num_arms = ARRAY_SIZE(l2dd_values) + 1;
+		break;
+	case 3: // L2 XQ threshold, last arm MLC off
+		for (i = 0; i < ARRAY_SIZE(l2xq_values); i++)
+			kmab.arm_msr[i][MSR_1320_INDEX].msr1320.L2_STREAM_AMP_XQ_THRESHOLD = l2xq_values[i];
+		kmab.arm_msr[i][MSR_1A4_INDEX].msr1A4.L2_STREAM_DISABLED = 1;
+		kmab.num_arms = ARRAY_SIZE(l2xq_values) + 1;
+		break;
+	case 4: // MLC on/off
+		for (i = 0; i < 2; i++)
+			kmab.arm_msr[i][MSR_1A4_INDEX].msr1A4.L2_STREAM_DISABLED = i;
+		kmab.num_arms = 2;
+		break;
+	default:
+		pr_err("%s: invalid arm configuration %d\n", __func__,
+		       kmab.arm_configuration);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < kmab.num_arms; i++) {
+		kmab.rewards[i] = 0;
+		kmab.nums[i] = 0;
+		kmab.ipcs[i] = FP_ONE;
+	}
+
+	return 0;
+}
+
+// Copies the MSR values of an arm to all enabled cores
+static void kmab_apply_arm(int arm)
+{
+	int core_id;
+
+	for_each_cpu(core_id, &enabled_cpus) {
+		if (corestate[core_id].core_disabled)
+			continue;
+
+		memcpy(corestate[core_id].pf_msr, kmab.arm_msr[arm],
+		       sizeof(corestate[core_id].pf_msr));
+		msr_set_dirty(core_id);
+	}
+}
+
+static int kmab_next_arm_random(void)
+{
+	return get_random_u32() % kmab.num_arms;
+}
+
+static int kmab_next_arm_max(void)
+{
+	fp_t r = get_random_u32() & (FP_ONE - 1);
+	int max_index = 0;
+	int i;
+
+	if (r < kmab.epsilon)
+		return kmab_next_arm_random();
+
+	for (i = 1; i < kmab.num_arms; i++)
+		if (kmab.rewards[i] > kmab.rewards[max_index])
+			max_index = i;
+
+	return max_index;
+}
+
+static int kmab_next_arm_potential(void)
+{
+	fp_t log_num_total = fp_ln(kmab.num_total);
+	fp_t max_reward = 0;
+	int max_index = 0;
+	int i;
+
+	for (i = 0; i < kmab.num_arms; i++) {
+		fp_t reward;
+
+		// fully discounted arm, explore it again
+		if (kmab.nums[i] <= 0)
+			return i;
+
+		reward = kmab.rewards[i] +
+			fp_mul(kmab.c, fp_sqrt(fp_div(log_num_total, kmab.nums[i])));
+
+		if (i == 0 || reward > max_reward) {
+			max_reward = reward;
+			max_index = i;
+		}
+	}
+
+	return max_index;
+}
+
+static void kmab_update_selections(void)
+{
+	int i;
+
+	if (kmab.algorithm == KMAB_DUCB) {
+		for (i = 0; i < kmab.num_arms; i++)
+			kmab.nums[i] = fp_mul(kmab.nums[i], kmab.gamma);
+		kmab.num_total = fp_mul(kmab.num_total, kmab.gamma);
+	}
+
+	kmab.nums[kmab.arm] += FP_ONE;
+	kmab.num_total += FP_ONE;
+}
+
+static void kmab_setup_arm(int next_arm)
+{
+	if (next_arm != kmab.arm) {
+		pr_debug("MAB switching to arm %d\n", next_arm);
+		kmab_apply_arm(next_arm);
+	}
+
+	kmab.arm = next_arm;
+}
+
+static int kmab_next_arm(void)
+{
+	if (kmab.algorithm == KMAB_E_GREEDY)
+		return kmab_next_arm_max();
+
+	return kmab_next_arm_potential();
+}
+
+static void kmab_normalise_rewards(void)
+{
+	fp_t total = 0;
+	int i;
+
+	for (i = 0; i < kmab.num_arms; i++)
+		total += kmab.ipcs[i];
+
+	kmab.avg_reward = div64_s64(total, kmab.num_arms);
+	if (kmab.avg_reward == 0)
+		kmab.avg_reward = FP_ONE;
+
+	for (i = 0; i < kmab.num_arms; i++)
+		kmab.rewards[i] = fp_div(kmab.rewards[i], kmab.avg_reward);
+
+	pr_info("MAB normalising rewards: IPC av. = %lld/65536\n", kmab.avg_reward);
+}
+
+// Set algorithm, arm configuration and hyperparameters (Q16.16)
+// Resets all learned state, returns 0 or -EINVAL
+// kernel_mab() may be running on the first core, the reset is done under
+// dpf_msr_lock so it never sees a half-reset state
+int kernel_mab_config(__u32 algorithm, __u32 arm_configuration,
+		      __u32 epsilon, __u32 gamma, __u32 c)
+{
+	unsigned long flags;
+
+	if (algorithm > KMAB_RANDOM || arm_configuration > 4 ||
+	    epsilon > FP_ONE || gamma > FP_ONE)
+		return -EINVAL;
+
+	raw_spin_lock_irqsave(&dpf_msr_lock, flags);
+
+	memset(&kmab, 0, sizeof(kmab));
+	kmab.algorithm = algorithm;
+	kmab.arm_configuration = arm_configuration;
+	kmab.epsilon = epsilon;
+	kmab.gamma = gamma;
+	kmab.c = c;
+	kmab.mode = KMAB_ROUND_ROBIN;
+	kmab.avg_reward = FP_ONE;
+	kmab.configured = 1;
+
+	raw_spin_unlock_irqrestore(&dpf_msr_lock, flags);
+
+	pr_info("MAB config: alg=%u arms=%u epsilon=%u gamma=%u c=%u (Q16.16)\n",
+		algorithm, arm_configuration, epsilon, gamma, c);
+
+	return 0;
+}
+
+// One MAB step, called on the first core every interval
+// Returns 0, -EINVAL if not configured
+int kernel_mab(void)
+{
+	fp_t ipc;
+
+	if (!kmab.configured) {
+		pr_err("%s: MAB not configured\n", __func__);
+		return -EINVAL;
+	}
+
+	// Arms are based on the MSR values loaded when tuning was enabled
+	if (!kmab.arms_ready) {
+		if (kmab_create_arms() < 0) {
+			kmab.configured = 0;
+			return -EINVAL;
+		}
+		kmab.arms_ready = 1;
+		kmab.arm = -1;
+	}
+
+	if (kmab.num_arms <= 0) {
+		kmab.configured = 0;
+		return -EINVAL;
+	}
+
+	ipc = kmab_get_ipc();
+
+	if (kmab.algorithm == KMAB_RANDOM) {
+		kmab_setup_arm(kmab_next_arm_random());
+		kmab_update_selections();
+		return 0;
+	}
+
+	if (kmab.mode == KMAB_ROUND_ROBIN) {
+		if (kmab.rr_counter != 0) {
+			kmab.rewards[kmab.arm] = ipc;
+			kmab.ipcs[kmab.arm] = ipc;
+		}
+
+		kmab_setup_arm(kmab.rr_counter);
+		kmab.nums[kmab.arm] = FP_ONE;
+		kmab.num_total += FP_ONE;
+		kmab.rr_counter++;
+
+		if (kmab.rr_counter == kmab.num_arms) {
+			kmab.rr_counter = 0;
+			kmab.mode = KMAB_MAIN_LOOP_TRANSITION;
+		}
+	} else if (kmab.mode == KMAB_MAIN_LOOP_TRANSITION) {
+		kmab.rewards[kmab.arm] = ipc;
+		kmab.ipcs[kmab.arm] = ipc;
+		kmab_normalise_rewards();
+
+		kmab_setup_arm(kmab_next_arm());
+		kmab_update_selections();
+		kmab.mode = KMAB_MAIN_LOOP;
+	} else {
+		fp_t n = kmab.nums[kmab.arm];
+		fp_t step = fp_div(ipc, kmab.avg_reward);
+
+		// rolling average of the normalised reward
+		if (n > 0)
+			kmab.rewards[kmab.arm] =
+				fp_div(fp_mul(kmab.rewards[kmab.arm], n - FP_ONE) + step, n);
+
+		pr_debug("MAB arm %d, ipc %lld, reward %lld\n", kmab.arm, ipc,
+			 kmab.rewards[kmab.arm]);
+
+		kmab_setup_arm(kmab_next_arm());
+		kmab_update_selections();
+	}
+
+	return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef __KERNEL_MAB_H__
+#define __KERNEL_MAB_H__
+
+#include <linux/types.h>
+
+#include "kernel_common.h"
+
+// Tuning algorithm id, same as MAB in include/mab.h
+#define TUNEALG_MAB (2)
+
+// MAB variants, same as include/mab.h
+#define KMAB_E_GREEDY (0)
+#define KMAB_UCB (1)
+#define KMAB_DUCB (2)
+#define KMAB_RANDOM (3)
+
+#define KMAB_MAX_ARMS (16)
+
+// Set algorithm, arm configuration and hyperparameters (Q16.16)
+// Resets all learned state, returns 0 or -EINVAL
+int kernel_mab_config(__u32 algorithm, __u32 arm_configuration,
+		      __u32 epsilon, __u32 gamma, __u32 c);
+
+// One MAB step, called on the first core every interval
+int kernel_mab(void);
+
+#endif /* __KERNEL_MAB_H__ */
@@ -0,0 +1,111 @@
+#include <linux/err.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/perf_event.h>
+#include <linux/printk.h>
+#include <linux/types.h>
+
+#include "kernel_common.h"
+#include "kernel_perf.h"
+
+// Event select and unit mask of the EVENT_* codes, perf sets the enable,
+// USR and OS bits itself
+#define KPERF_CONFIG_MASK (0xffffULL)
+
+// Same events as configure_pmu_on_core(), in pmu_metrics order
+static const u64 kperf_events[PMU_COUNTERS] = {
+	[PERF_MEM_UOPS_RETIRED_ALL_LOADS] = EVENT_MEM_UOPS_RETIRED_ALL_LOADS,
+	[PERF_MEM_LOAD_UOPS_RETIRED_L2_HIT] = EVENT_MEM_LOAD_UOPS_RETIRED_L2_HIT,
+	[PERF_MEM_LOAD_UOPS_RETIRED_L3_HIT] = EVENT_MEM_LOAD_UOPS_RETIRED_L3_HIT,
+	[PERF_MEM_LOAD_UOPS_RETIRED_DRAM_HIT] = EVENT_MEM_LOAD_UOPS_RETIRED_DRAM_HIT,
+	[PERF_XQ_PROMOTION_ALL] = EVENT_XQ_PROMOTION_ALL,
+	[PERF_CPU_CLK_UNHALTED_THREAD] = EVENT_CPU_CLK_UNHALTED_THREAD,
+	[PERF_INST_RETIRED_ANY_P] = EVENT_INST_RETIRED_ANY_P,
+};
+
+struct kperf_cpu_s {
+	struct perf_event *events[PMU_COUNTERS];
+};
+
+static DEFINE_PER_CPU(struct kperf_cpu_s, kperf_cpu);
+
+// Releases the counters of cpu, process context only
+void kperf_release(int cpu)
+{
+	struct kperf_cpu_s *kc = per_cpu_ptr(&kperf_cpu, cpu);
+	int i;
+
+	for (i = 0; i < PMU_COUNTERS; i++) {
+		if (kc->events[i]) {
+			perf_event_release_kernel(kc->events[i]);
+			kc->events[i] = NULL;
+		}
+	}
+}
+
+// Creates the counters of cpu, see kernel_perf.h
+int kperf_create(int cpu, int trigger, u64 period,
+		 perf_overflow_handler_t handler)
+{
+	struct kperf_cpu_s *kc = per_cpu_ptr(&kperf_cpu, cpu);
+	int i;
+
+	// Keep running counters, recreating them would restart the counts
+	if (kc->events[0])
+		return 0;
+
+	for (i = 0; i < PMU_COUNTERS; i++) {
+		struct perf_event_attr attr = {
+			.type = PERF_TYPE_RAW,
+			.size = sizeof(struct perf_event_attr),
+			.config = kperf_events[i] & KPERF_CONFIG_MASK,
+			.pinned = 1,
+		};
+		struct perf_event *event;
+
+		if (i == trigger)
+			attr.sample_period = period;
+
+		event = perf_event_create_kernel_counter(&attr, cpu, NULL,
+							 i == trigger ? handler : NULL,
+							 NULL);
+		if (IS_ERR(event)) {
+			pr_err("%s: Failed to create counter %d on core %d: %ld\n",
+			       __func__, i, cpu, PTR_ERR(event));
+			kperf_release(cpu);
+			return PTR_ERR(event);
+		}
+
+		kc->events[i] = event;
+
+		// A pinned counter that does not fit next to the counters of
+		// other users goes to error state instead of multiplexing
+		if (event->state == PERF_EVENT_STATE_ERROR) {
+			pr_err("%s: Counter %d on core %d is not schedulable\n",
+			       __func__, i, cpu);
+			kperf_release(cpu);
+			return -EBUSY;
+		}
+	}
+
+	return 0;
+}
+
+// Reads the counters of the current CPU, see kernel_perf.h
+int kperf_read(int cpu, u64 *values)
+{
+	struct kperf_cpu_s *kc = per_cpu_ptr(&kperf_cpu, cpu);
+	int i, ret;
+
+	if (!kc->events[0])
+		return -ENODEV;
+
+	for (i = 0; i < PMU_COUNTERS; i++) {
+		ret = perf_event_read_local(kc->events[i], &values[i], NULL, NULL);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __KERNEL_PERF_H__
+#define __KERNEL_PERF_H__
+
+#include <linux/perf_event.h>
+#include <linux/types.h>
+
+#include "kernel_common.h"
+
+// In-kernel perf_event counters for the PMU_COUNTERS events of
+// kernel_common.h, one pinned counter per event and CPU. They are the default
+// counter backend of the module and share the PMU with perf and other users.
+// perf_event_create_kernel_counter() has no group leader argument, so every
+// counter is pinned on its own: it counts all the time or, if the PMU is
+// full, fails with -EBUSY instead of being multiplexed.
+
+// Creates the counters of cpu, does nothing if cpu already has counters.
+// The counter of index trigger overflows every period events and calls
+// handler from NMI context, trigger < 0 for none.
+// Process context only. Returns 0, -EBUSY if the PMU has no room or another
+// negative error code
+int kperf_create(int cpu, int trigger, u64 period,
+		 perf_overflow_handler_t handler);
+
+// Releases the counters of cpu, process context only
+void kperf_release(int cpu);
+
+// Reads the counters of the current CPU into values, mapped to pmu_metrics
+// Must run on that CPU with interrupts disabled
+// Returns 0, -ENODEV if the CPU has no counters or another negative error
+int kperf_read(int cpu, u64 *values);
+
+#endif /* __KERNEL_PERF_H__ */
@@ -4,6 +4,7 @@
 #include <linux/printk.h>
 #include <linux/proc_fs.h>
 #include <linux/string.h>
+#include <linux/timekeeping.h>
 #include <linux/types.h>
 
 #include "../include/pmu_ddr.h"
@@ -144,6 +145,59 @@ uint64_t kernel_pmu_ddr(struct ddr_s *ddr, int type)
 	return -EINVAL;
 }
 
+// Reads RD and WR counters of all DDR channels in one pass
+// Accepts: pointer to ddr_s struct (ddr), sample to fill in or NULL
+// Returns: 0 on success, -EINVAL if DDR is not initialized
+int kernel_pmu_ddr_sample(struct ddr_s *ddr, struct ddr_sample_s *sample)
+{
+	static uint64_t last_sample_ns;
+	uint64_t now, rd, wr;
+	int nch = num_ddr_controllers;
+	int i;
+
+	if (ddr_cpu_type != DDR_CLIENT && ddr_cpu_type != DDR_GRR_SRF)
+		return -EINVAL;
+
+	if (nch > MAX_NUM_DDR_CONTROLLERS)
+		nch = MAX_NUM_DDR_CONTROLLERS;
+
+	now = ktime_get_ns();
+
+	if (sample) {
+		sample->timestamp_ns = now;
+		sample->time_delta_ns = last_sample_ns ? now - last_sample_ns : 0;
+		sample->num_channels = nch;
+		sample->rd_total = 0;
+		sample->wr_total = 0;
+	}
+	last_sample_ns = now;
+
+	for (i = 0; i < nch; i++) {
+		if (!ddr->rd_cntr[i]) {
+			if (sample) {
+				sample->rd_bytes[i] = 0;
+				sample->wr_bytes[i] = 0;
+			}
+			continue;
+		}
+
+		rd = readq((void __iomem *)ddr->rd_cntr[i]);
+		wr = readq((void __iomem *)ddr->wr_cntr[i]);
+
+		if (sample) {
+			sample->rd_bytes[i] = (rd - ddr->rd_last_update[i]) * 64;
+			sample->wr_bytes[i] = (wr - ddr->wr_last_update[i]) * 64;
+			sample->rd_total += sample->rd_bytes[i];
+			sample->wr_total += sample->wr_bytes[i];
+		}
+
+		ddr->rd_last_update[i] = rd;
+		ddr->wr_last_update[i] = wr;
+	}
+
+	return 0;
+}
+
 // Initializes DDR performance monitoring for Sierra Forest and Grandridge CPUs
 // Accepts: pointer to ddr_s struct (ddr) and base address for DDR BAR (ddr_bar)
 // Returns: 0 on success, -ENODEV if no controllers, -ENOMEM on mapping failure
@@ -181,10 +235,13 @@ int kernel_pmu_ddr_init_grr_srf(struct ddr_s *ddr, uint64_t ddr_bar)
 		}
 
 		ddr->mmap[i] = (char *)mapping[i];
+		// mapping starts at the read counter
+		ddr->rd_cntr[i] = (volatile uint64_t *)ddr->mmap[i];
+		ddr->wr_cntr[i] = (volatile uint64_t *)(ddr->mmap[i] +
+			(GRR_SRF_FREE_RUN_CNTR_WRITE - GRR_SRF_FREE_RUN_CNTR_READ));
 	}
 
-	kernel_pmu_ddr(ddr, DDR_PMU_RD);
-	kernel_pmu_ddr(ddr, DDR_PMU_WR);
+	kernel_pmu_ddr_sample(ddr, NULL);
 
 	return 0;
 
@@ -230,10 +287,11 @@ int kernel_pmu_ddr_init_client(struct ddr_s *ddr, uint64_t ddr_bar)
 		}
 
 		ddr->mmap[i] = (char *)mapping[i];
+		ddr->rd_cntr[i] = (volatile uint64_t *)(ddr->mmap[i] + CLIENT_DDR_RD_BW);
+		ddr->wr_cntr[i] = (volatile uint64_t *)(ddr->mmap[i] + CLIENT_DDR_WR_BW);
 	}
 
-	kernel_pmu_ddr(ddr, DDR_PMU_RD);
-	kernel_pmu_ddr(ddr, DDR_PMU_WR);
+	kernel_pmu_ddr_sample(ddr, NULL);
 
 	return 0;
 
@@ -17,6 +17,7 @@ extern struct ddr_s ddr;
 
 // Function prototypes
 uint64_t kernel_pmu_ddr(struct ddr_s *ddr, int type);
+int kernel_pmu_ddr_sample(struct ddr_s *ddr, struct ddr_sample_s *sample);
 int kernel_pmu_ddr_init_grr_srf(struct ddr_s *ddr, uint64_t ddr_bar);
 int kernel_pmu_ddr_init_client(struct ddr_s *ddr, uint64_t ddr_bar);
 int read_ddr_counters(uint64_t *read_bw, uint64_t *write_bw);
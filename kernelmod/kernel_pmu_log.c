@@ -0,0 +1,234 @@
+#include <linux/cpumask.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/printk.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "kernel_common.h"
+#include "kernel_api.h"
+#include "kernel_pmu_log.h"
+
+// head and tail are free running entry counters, the slot of an entry is
+// counter & mask. head is only written by the producer, tail and
+// overwritten only by the consumer, dropped only by the producer.
+struct pmu_log_ring_s {
+	dpf_pmu_log_entry_t *entries;
+	u32 mask;
+	u32 head;
+	u32 tail;
+	u64 dropped;
+	u64 overwritten;
+};
+
+static DEFINE_PER_CPU(struct pmu_log_ring_s, pmu_log_ring);
+static u32 pmu_log_entries;
+static u32 pmu_log_policy = DPF_PMU_LOG_DROP;
+static int pmu_log_next_cpu;
+
+// Frees all rings, producers must be stopped
+void pmu_log_free(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct pmu_log_ring_s *ring = per_cpu_ptr(&pmu_log_ring, cpu);
+
+		kvfree(ring->entries);
+		memset(ring, 0, sizeof(*ring));
+	}
+
+	pmu_log_entries = 0;
+}
+
+// Allocates a ring for every requested core, replacing any previous rings.
+// Offline cores get one too, they log once they come online.
+// Producers must be stopped. Returns 0, -EINVAL or -ENOMEM
+int pmu_log_alloc(u32 entries_per_cpu, u32 policy)
+{
+	u32 entries;
+	int cpu;
+
+	if (policy > DPF_PMU_LOG_OVERWRITE)
+		return -EINVAL;
+
+	if (entries_per_cpu < PMU_LOG_MIN_ENTRIES)
+		entries_per_cpu = PMU_LOG_MIN_ENTRIES;
+	entries = rounddown_pow_of_two(entries_per_cpu);
+
+	pmu_log_free();
+
+	for_each_cpu(cpu, &requested_cpus) {
+		struct pmu_log_ring_s *ring = per_cpu_ptr(&pmu_log_ring, cpu);
+
+		if (cpu >= MAX_NUM_CORES)
+			break;
+
+		ring->entries = kvcalloc(entries, sizeof(dpf_pmu_log_entry_t),
+					 GFP_KERNEL);
+		if (!ring->entries) {
+			pr_err("%s: Failed to allocate %u entries for core %d\n",
+			       __func__, entries, cpu);
+			pmu_log_free();
+			return -ENOMEM;
+		}
+		ring->mask = entries - 1;
+	}
+
+	pmu_log_entries = entries;
+	pmu_log_policy = policy;
+	pmu_log_next_cpu = 0;
+
+	return 0;
+}
+
+void pmu_log_set_policy(u32 policy)
+{
+	if (policy <= DPF_PMU_LOG_OVERWRITE)
+		WRITE_ONCE(pmu_log_policy, policy);
+}
+
+u32 pmu_log_ring_entries(void)
+{
+	return pmu_log_entries;
+}
+
+// Appends one entry to the ring of core_id, producer side
+// Returns 0, -ENOSPC if dropped, -EINVAL if no rings are allocated
+int pmu_log_append(int core_id, const dpf_pmu_log_entry_t *entry)
+{
+	struct pmu_log_ring_s *ring;
+	u32 head;
+
+	if (core_id >= nr_cpu_ids || !READ_ONCE(pmu_log_entries))
+		return -EINVAL;
+
+	ring = per_cpu_ptr(&pmu_log_ring, core_id);
+
+	// A core added to the set after the rings were allocated has none,
+	// its entries count as lost
+	if (!ring->entries) {
+		WRITE_ONCE(ring->dropped, ring->dropped + 1);
+		return -ENOSPC;
+	}
+
+	head = ring->head;
+
+	// In drop mode the consumer owns every slot between tail and head
+	if (READ_ONCE(pmu_log_policy) == DPF_PMU_LOG_DROP &&
+	    head - smp_load_acquire(&ring->tail) > ring->mask) {
+		WRITE_ONCE(ring->dropped, ring->dropped + 1);
+		return -ENOSPC;
+	}
+
+	ring->entries[head & ring->mask] = *entry;
+	smp_store_release(&ring->head, head + 1);
+
+	return 0;
+}
+
+// Number of entries waiting in all rings, upper bound
+u32 pmu_log_pending(void)
+{
+	u64 pending = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct pmu_log_ring_s *ring = per_cpu_ptr(&pmu_log_ring, cpu);
+
+		if (ring->entries)
+			pending += min_t(u32, smp_load_acquire(&ring->head) - ring->tail,
+					 ring->mask + 1);
+	}
+
+	return min_t(u64, pending, U32_MAX);
+}
+
+// Moves up to max entries out of one ring, oldest first
+static u32 pmu_log_ring_drain(struct pmu_log_ring_s *ring,
+			      dpf_pmu_log_entry_t *dst, u32 max)
+{
+	u32 size = ring->mask + 1;
+	u32 head = smp_load_acquire(&ring->head);
+	u32 tail = ring->tail;
+	u32 n, i, skip;
+
+	// Entries the producer lapped in overwrite mode are gone
+	if (head - tail > size) {
+		ring->overwritten += head - size - tail;
+		tail = head - size;
+	}
+
+	n = min(head - tail, max);
+	for (i = 0; i < n; i++)
+		dst[i] = ring->entries[(tail + i) & ring->mask];
+
+	// In overwrite mode the producer may have rewritten the oldest
+	// copied slots meanwhile, only entries newer than head - size are
+	// known to be intact
+	if (READ_ONCE(pmu_log_policy) == DPF_PMU_LOG_OVERWRITE) {
+		smp_rmb();
+		head = READ_ONCE(ring->head);
+		if (head - tail >= size) {
+			skip = min(head - size + 1 - tail, n);
+			memmove(dst, dst + skip, (n - skip) * sizeof(*dst));
+			ring->overwritten += skip;
+			tail += skip;
+			n -= skip;
+		}
+	}
+
+	smp_store_release(&ring->tail, tail + n);
+
+	return n;
+}
+
+// Moves up to max entries out of the rings into dst, consumer side
+// The first ring drained rotates so a small max doesn't starve high cores
+u32 pmu_log_drain(dpf_pmu_log_entry_t *dst, u32 max)
+{
+	u32 total = 0;
+	int cpu, i;
+
+	if (!pmu_log_entries)
+		return 0;
+
+	cpu = pmu_log_next_cpu;
+	for (i = 0; i < nr_cpu_ids; i++, cpu++) {
+		struct pmu_log_ring_s *ring;
+
+		if (cpu >= nr_cpu_ids)
+			cpu = 0;
+
+		ring = per_cpu_ptr(&pmu_log_ring, cpu);
+		if (ring->entries)
+			total += pmu_log_ring_drain(ring, dst + total, max - total);
+
+		// Continue with this ring next time
+		if (total == max)
+			break;
+	}
+
+	pmu_log_next_cpu = cpu;
+
+	return total;
+}
+
+// Entries dropped or overwritten since the rings were allocated
+u64 pmu_log_lost(void)
+{
+	u64 lost = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct pmu_log_ring_s *ring = per_cpu_ptr(&pmu_log_ring, cpu);
+
+		lost += READ_ONCE(ring->dropped) + ring->overwritten;
+	}
+
+	return lost;
+}
@@ -0,0 +1,43 @@
+#ifndef __KERNEL_PMU_LOG_H__
+#define __KERNEL_PMU_LOG_H__
+
+#include <linux/types.h>
+
+#include "kernel_common.h"
+
+#define PMU_LOG_MIN_ENTRIES (16)
+
+// Per-CPU PMU log rings. Each ring has a single producer, per_core_work()
+// on its own core, and a single consumer, the PMU log API under dpf_mutex.
+
+// Allocates one ring of at least entries_per_cpu entries (rounded down to a
+// power of two) for every requested core, online or not, replacing any
+// previous rings.
+// Producers must be stopped. Returns 0, -EINVAL or -ENOMEM
+int pmu_log_alloc(u32 entries_per_cpu, u32 policy);
+
+// Frees all rings, producers must be stopped
+void pmu_log_free(void);
+
+// DPF_PMU_LOG_DROP or DPF_PMU_LOG_OVERWRITE, used by the next append
+void pmu_log_set_policy(u32 policy);
+
+// Entries per ring, 0 if not allocated
+u32 pmu_log_ring_entries(void);
+
+// Appends one entry to the ring of core_id, producer side. Entries of a
+// core without a ring are dropped and counted as lost.
+// Returns 0, -ENOSPC if dropped, -EINVAL if no rings are allocated
+int pmu_log_append(int core_id, const dpf_pmu_log_entry_t *entry);
+
+// Number of entries waiting in all rings, upper bound
+u32 pmu_log_pending(void);
+
+// Moves up to max entries out of the rings into dst, consumer side
+// Returns the number of entries copied
+u32 pmu_log_drain(dpf_pmu_log_entry_t *dst, u32 max);
+
+// Entries dropped or overwritten since the rings were allocated
+u64 pmu_log_lost(void);
+
+#endif /* __KERNEL_PMU_LOG_H__ */
@@ -7,16 +7,15 @@
 #include "kernel_common.h"
 #include "kernel_primitive.h"
 #include "kernel_pmu_ddr.h"
+#include "../include/basicalg_core.h"
 
 static int l2_hitr[MAX_NUM_CORES];
 static int l3_hitr[MAX_NUM_CORES];
 static int good_pf[MAX_NUM_CORES];
 static int core_contr_to_ddr[MAX_NUM_CORES];
-static uint64_t pmu_delta[MAX_NUM_CORES][PMU_COUNTERS]; //changes since last PMU readout
-static int first_core_idx;
-static int last_core_idx;
+static uint64_t pmu_delta[MAX_NUM_CORES][PMU_COUNTERS]; //changes since the last decision
 
-//Only tunealg 1 is supported at this time
+//Decisions are taken by the shared core in include/basicalg_core.h
 int kernel_basicalg(int tunealg, int aggr)
 {
 	//Note that ddr_rd_bw,ddr_wr_bw and ddr_bw_target are specified in MB
@@ -24,72 +23,58 @@ int kernel_basicalg(int tunealg, int aggr)
 
 	static uint64_t time_old = 0; // Make static to persist between calls
 	uint64_t time_now;
-	uint64_t time_delta_ms;
-	static int ddr_bw_target_ppms; //ddr_bw_target but *1000 (ms) and /100 (%), i.e. *10
+	uint64_t time_delta_ns;
+	fp_t ddr_rd_util;
 
 	//
 	// Grab all PMU data
 	//
 
-	ddr_rd_bw = kernel_pmu_ddr(&ddr, DDR_PMU_RD) >> 20;
-	ddr_wr_bw = kernel_pmu_ddr(&ddr, DDR_PMU_WR) >> 20;
+	struct ddr_sample_s sample;
+	uint64_t hot_bytes;
+	int hot_channel;
+	int i;
 
-	pr_info("DDR RD BW: %llu MB/s\n", ddr_rd_bw);
-	pr_info("DDR WR BW: %llu MB/s\n", ddr_wr_bw);
-	pr_info("DDR BW target: %u MB/s\n", ddr_bw_target);
-
-	if (ddr_rd_bw == (uint64_t)-EINVAL || ddr_wr_bw == (uint64_t)-EINVAL) {
+	if (kernel_pmu_ddr_sample(&ddr, &sample) < 0) {
 		//Ensure we don't continue next time and get div zero
 		//FIX: Proper handling is to halt all tuning
 
-		pr_err("kernel_basicalg: DDR PMU read zero (RD=%llu, WR=%llu)\n",
-		       ddr_rd_bw, ddr_wr_bw);
+		pr_err("kernel_basicalg: DDR PMU not available\n");
 		return -EINVAL;
 	}
 
+	ddr_rd_bw = sample.rd_total >> 20;
+	ddr_wr_bw = sample.wr_total >> 20;
+	hot_channel = ddr_sample_hottest(&sample, DDR_PMU_RD, &hot_bytes);
+
+	pr_info("DDR RD BW: %llu MB/s\n", ddr_rd_bw);
+	pr_info("DDR WR BW: %llu MB/s\n", ddr_wr_bw);
+	pr_info("DDR BW target: %u MB/s\n", ddr_bw_target);
+
 	if (time_old == 0) {
 		//no selection the first time since all counters will be odd
 		time_old = ktime_get_ns();
-                first_core_idx = first_core();
-		last_core_idx = first_core_idx + active_cores();
-
-		//first time, do some initialization
-
-		//ppms : percent per ms, i.e. samt as ddr_bw_target but in % per ms time
-		//pre-computed so we can reduce number of div and mul at run-time
-		ddr_bw_target_ppms = ddr_bw_target * 10;
-
-		if(ddr_bw_target_ppms == 0) {
-			pr_err("basicalg() div by zero: ddr_bw_target %u (%u)\n",
-				ddr_bw_target_ppms, ddr_bw_target);
-			//Ensure we don't continue next time and get div zero
-			//FIX: Proper handling is to halt all tuning
-			time_old = 0;
-                }
 		return 0;
 	}
 
 	time_now = ktime_get_ns();
-	time_delta_ms = (time_now - time_old) / 1000000; // convert ns to ms
+	time_delta_ns = time_now - time_old;
 	time_old = time_now;
 
-	//check for divide by zero
-	if((ddr_bw_target_ppms == 0) | (time_delta_ms == 0)) {
-		pr_err("basicalg() div by zero: ddr_bw_target %u, time_delta_ms %llu\n",
-			ddr_bw_target, time_delta_ms);
-		return -1;
-	}
+	// Same fixed point utilization as the user-space tuner, the larger of
+	// the total and the hottest channel against its share of the target
+	ddr_rd_util = basicalg_ddr_util_channels(sample.rd_total, hot_bytes,
+			sample.num_channels, time_delta_ns, ddr_bw_target);
 
-	int ddr_bw_percent = ((ddr_rd_bw + ddr_wr_bw) * time_delta_ms) / (ddr_bw_target_ppms); //percent per ms
-	pr_info("DDR BW percent: %u\n", ddr_bw_percent);
+	pr_info("DDR RD BW percent: %lld (hottest channel %d)\n",
+		(ddr_rd_util * 100) >> FP_SHIFT, hot_channel);
 
 	//
 	//Process PMU data
 	//
-	for (int i = first_core_idx; i < last_core_idx; i++) {
-		for (int j = 0; j < PMU_COUNTERS ; j++) {
-			pmu_delta[i][j] = corestate[i].pmu_raw[j] - corestate[i].pmu_old[j];
-		}
+	for_each_cpu(i, &enabled_cpus) {
+		// Since the previous decision, like the DDR sample
+		pmu_decision_delta(i, pmu_delta[i]);
 
 		pr_debug("core %u PMUs: LD %llu  L2hit %llu  L3hit %llu\n  DDRhit %llu  XQprom %llu  clk %llu  ret %llu", i,
 			pmu_delta[i][PERF_MEM_UOPS_RETIRED_ALL_LOADS],
@@ -103,7 +88,7 @@ int kernel_basicalg(int tunealg, int aggr)
 
 	uint64_t total_ddr_hit = 0;
 
-	for (int i = first_core_idx; i < last_core_idx; i++) {
+	for_each_cpu(i, &enabled_cpus) {
 		total_ddr_hit += pmu_delta[i][PERF_MEM_LOAD_UOPS_RETIRED_DRAM_HIT];
 	}
 
@@ -115,7 +100,7 @@ int kernel_basicalg(int tunealg, int aggr)
 
 	pr_info("delta for total_ddr_hit %llu or %llu MB/s\n", total_ddr_hit, (total_ddr_hit*64) >> 20);
 
-	for (int i = first_core_idx; i < last_core_idx; i++) {
+	for_each_cpu(i, &enabled_cpus) {
 		//check for divide by zero
 		if((pmu_delta[i][PERF_MEM_LOAD_UOPS_RETIRED_L2_HIT] == 0) |
 			(pmu_delta[i][PERF_MEM_LOAD_UOPS_RETIRED_L3_HIT] == 0) |
@@ -161,56 +146,17 @@ int kernel_basicalg(int tunealg, int aggr)
 	// All cores are set the same at this time
 	//
 
-	if (tunealg == 0) {
-
-		for (int i = 0; i < active_cores(); i++) {
-			int l2xq = msr_get_l2xq(i);
-
-			int old_l2xq = l2xq;
-
-			if (ddr_bw_percent < 10) {
-				//idle system
-			} else if (ddr_bw_percent < 20)
-				l2xq += -8;
-			else if (ddr_bw_percent < 30)
-				l2xq += -4;
-			else if (ddr_bw_percent < 40)
-				l2xq += -2;
-			else if (ddr_bw_percent < 50)
-				l2xq += -1;
-			else if (ddr_bw_percent < 60)
-				l2xq += -1;
-			else if (ddr_bw_percent < 70)
-				l2xq += 1;
-			else if (ddr_bw_percent < 80)
-				l2xq += 1;
-			else if (ddr_bw_percent < 90)
-				l2xq += 1;
-			else if (ddr_bw_percent < 93)
-				l2xq += 2;
-			else if (ddr_bw_percent < 96)
-				l2xq += 4;
-			else
-				l2xq += 8;
-
-			//jamdle overflow / underflow scnearios
-			if (l2xq <= 0)
-				l2xq = 1;
-			if (l2xq > L2XQ_MAX)
-				l2xq = L2XQ_MAX;
-
-			//should we update the MSR?
-			if (old_l2xq != l2xq) {
-				msr_set_l2xq(i, l2xq);
-				msr_set_dirty(i);
-				if (i == 0)
-					pr_info("Core0 l2xq %d\n", l2xq);
-			}
+	for_each_cpu(i, &enabled_cpus) {
+		if (corestate[i].core_disabled)
+			continue;
 
+		if (basicalg_tune(tunealg, ddr_rd_util, aggr, corestate[i].pf_msr)) {
+			msr_set_dirty(i);
+			if (i == first_core())
+				pr_info("Core%d l2xq %d l3xq %d\n", i,
+					msr_get_l2xq(i), msr_get_l3xq(i));
 		}
-
-
-	} //if (tunealg)...
+	}
 
 	return 0;
 }
@@ -9,6 +9,7 @@
 #include <sys/signal.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <sys/mman.h>
@@ -20,23 +21,29 @@
 #include "mab.h"
 #include "pmu_core.h"
 #include "pmu_ddr.h"
+#include "ddr_domain.h"
+#include "bwprobe.h"
+#include "calib.h"
+#include "hwcache.h"
+#include "prof.h"
+#include "abtest.h"
+#include "metrics.h"
 #include "rdt_mbm.h"
 #include "msr.h"
 #include "log.h"
 #include "sysdetect.h"
 #include "pcie.h"
 #include "user_api.h"
+#include "coreset.h"
+#include "topology.h"
 
 #include "json_parser.h"
 
 #define TAG "MAIN"
 
-//which core is this in the 4 core module? i.e. 0..3
-#define CORE_IN_MODULE ((tstate->core_id - core_first) % 4)
-#define ACTIVE_THREADS (core_last - core_first + 1)
-
 #define DDR_BW_NOT_SET (-1)
 #define DDR_BW_AUTOTEST (-2)
+#define DDR_BW_CALIBRATE (-3)
 
 struct thread_state gtinfo[MAX_THREADS]; // global thread state
 static struct perf_event_attr event_attrs[MAX_EVENTS];
@@ -46,8 +53,11 @@ static struct perf_event_attr event_attrs[MAX_EVENTS];
 int ddr_bw_target = DDR_BW_NOT_SET; //MB/s (yes, bytes). Max _achievable_
 // bandwidth
 float time_intervall = 1.0; //one second by default
+float sample_intervall = 0.0; //kernel mode PMU sampling, 0 = time_intervall
 int core_first = -1;
 int core_last = -1;
+cpu_set_t core_set; //cores to tune, from --core or auto-detected
+int active_threads;
 float aggr = 1.0; //retuning aggressiveness
 int tunealg = 0;
 uint32_t rdt_enabled = 0;
@@ -60,13 +70,11 @@ int enable_msr_msg = 0;
 //global runtime
 volatile int quitflag = 0;
 volatile int syncflag = 0;
-volatile int ddrbwflag = 0;
 volatile int msr_file_id[MAX_NUM_CORES];
 
 int core_priority[MAX_THREADS]; // Array to store the priority values
 int core_count;
 
-struct ddr_s ddr;
 uint64_t ddr_bar = 0;
 
 void sigintHandler(int sig_num)
@@ -102,10 +110,16 @@ uint64_t time_ms(void)
 
 int calculate_settings(void)
 {
-	if (tunealg == 0 || tunealg == 1)
-		basicalg(tunealg);
-	else if (tunealg == MAB)
-		mab(&mstate);
+	// Baseline epochs of an A/B test keep the hardware defaults
+	if (!abtest_baseline()) {
+		if (tunealg == 0 || tunealg == 1)
+			basicalg(tunealg);
+		else if (tunealg == MAB)
+			mab(&mstate);
+	}
+
+	abtest_interval();
+	metrics_publish(tunealg == MAB ? (int)mstate.arm : -1);
 
 	return 0;
 }
@@ -113,6 +127,9 @@ int calculate_settings(void)
 static void *thread_start(void *arg)
 {
 	struct thread_state *tstate = arg;
+	int tnum = tstate - gtinfo;
+	uint64_t t_active, t_phase;
+	union msr_u *msr_written = tstate->hwpf_msr_value;
 	int msr_file;
 	uint64_t pmu_new[MAX_EVENTS] = {0};
 	uint64_t pmu_old[MAX_EVENTS] = {0};
@@ -120,7 +137,7 @@ static void *thread_start(void *arg)
 	uint64_t cpu_cycles_new = 0, cpu_cycles_old = 0;
 	int event_fds[MAX_EVENTS];
 
-	logd(TAG, "Thread running on core %d, this is #%d core in the module\n", tstate->core_id, CORE_IN_MODULE);
+	logd(TAG, "Thread running on core %d, module leader %d\n", tstate->core_id, tstate->module_leader);
 
 	cpu_set_t cpuset;
 
@@ -132,35 +149,9 @@ static void *thread_start(void *arg)
 	if (s != 0)
 		loge(TAG, "Could not set thread affinity for coreid %d, pthread_setaffinity_np()\n", tstate->core_id);
 
-	if (ddr_bw_target == DDR_BW_AUTOTEST) {
-		if (tstate->core_id == core_first) {
-			if (ddrmembw_init() < 0)
-				exit(-1);
-			ddr_bw_target = 0;
-		}
-
-		atomic_fetch_add(&ddrbwflag, 1);
-
-		while (ddrbwflag < ACTIVE_THREADS);
-
-		// BW test assuming idle system. Wiil add ddr PMU counters for
-		// proper measurement
-		atomic_fetch_add(&ddr_bw_target, ddrmembw_measurement());
-
-		atomic_fetch_add(&ddrbwflag, -1);
-
-		while (ddrbwflag != 0);
-
-		if (tstate->core_id == core_first) {
-			logv(TAG, "bandwidth %d MB/s\n", ddr_bw_target);
-			ddrmembw_deinit();
-			if (ddr_bw_target == 0)
-				exit(-1);
-		}
-	}
-
-
 	msr_file = msr_init(tstate->core_id, tstate->hwpf_msr_value);
+	memcpy(tstate->hwpf_msr_default, tstate->hwpf_msr_value,
+	       sizeof(tstate->hwpf_msr_default));
 
 	msr_hwpf_write(msr_file, tstate->hwpf_msr_value);
 
@@ -173,20 +164,21 @@ static void *thread_start(void *arg)
 		perf_init(event_attrs, event_fds, num_events, tstate->core_id);
 	}
 
+	prof_thread_start(tnum, tstate->core_id);
+
 	// Run until end of world...
 	while (quitflag == 0) {
 		usleep(time_intervall * 1000000);
+		t_active = prof_begin();
 		//logd(TAG, "1. Read Core PMU counters and update stats\n");
 
-		if (tunealg != MAB) {
-			for (int i = 0; i < PMU_COUNTERS; i++)
-				pmu_old[i] = pmu_new[i];
-		} else {
-			instructions_old = instructions_new;
-			cpu_cycles_old = cpu_cycles_new;
-		}
+		for (int i = 0; i < PMU_COUNTERS; i++)
+			pmu_old[i] = pmu_new[i];
+		instructions_old = instructions_new;
+		cpu_cycles_old = cpu_cycles_new;
 
 		// Read PMU counters based on method
+		t_phase = prof_begin();
 		if (pmu_method == PMU_RAW) {
 			pmu_core_read(msr_file, pmu_new, &instructions_new, &cpu_cycles_new);
 		} else if (pmu_method == PMU_PERF) {
@@ -196,47 +188,62 @@ static void *thread_start(void *arg)
 			    pmu_new[PERF_INDEX_EVENT_INSTRUCTIONS];
 			cpu_cycles_new = pmu_new[PERF_INDEX_EVENT_CYCLES];
 		}
+		prof_end(tnum, PROF_PMU_READ, t_phase);
 
-		if (tunealg != MAB) {
-			for (int i = 0; i < PMU_COUNTERS; i++)
-				tstate->pmu_result[i] =
-				    pmu_new[i] - pmu_old[i];
-		} else {
-			tstate->instructions_retired =
-			    instructions_new - instructions_old;
-			tstate->cpu_cycles =
-			    cpu_cycles_new - cpu_cycles_old;
-		}
+		for (int i = 0; i < PMU_COUNTERS; i++)
+			tstate->pmu_result[i] = pmu_new[i] - pmu_old[i];
+		tstate->instructions_retired =
+		    instructions_new - instructions_old;
+		tstate->cpu_cycles = cpu_cycles_new - cpu_cycles_old;
 
 		atomic_fetch_add(&syncflag, 1); // sync by increasing syncflag
 
 		//select out the master core
 		if (tstate->core_id == core_first) {
 			//wait for all threads
+			t_phase = prof_begin();
 			while (syncflag < ACTIVE_THREADS);
+			prof_end(tnum, PROF_BARRIER, t_phase);
 
+			t_phase = prof_begin();
 			calculate_settings();
-
+			prof_end(tnum, PROF_DECIDE, t_phase);
 
 			syncflag = 0; //done, release threads
-		} else if (CORE_IN_MODULE == 0) {
+
+			if (prof_report_requested) {
+				prof_report_requested = 0;
+				prof_report();
+			}
+		} else if (tstate->module_leader) {
 			//only the primary core per module needs to sync,
 			// rest can run free
+			t_phase = prof_begin();
 			while (syncflag != 0);
 				//wait for decission to be made by master
+			prof_end(tnum, PROF_BARRIER, t_phase);
 		}
 
 		//logd(TAG, "3. Use decission to update MSRs\n");
-		if (CORE_IN_MODULE == 0 && tstate->hwpf_msr_dirty == 1) {
+		if (tstate->module_leader && tstate->hwpf_msr_dirty == 1) {
 			tstate->hwpf_msr_dirty = 0;
 
-			if (tunealg == MAB)
-				msr_hwpf_write(msr_file,
-					arms.hwpf_msr_values[mstate.arm]);
+			t_phase = prof_begin();
+			if (abtest_baseline())
+				msr_written = tstate->hwpf_msr_default;
+			else if (tunealg == MAB)
+				msr_written = arms.hwpf_msr_values[mstate.arm];
 			else
-				msr_hwpf_write(msr_file,
-					tstate->hwpf_msr_value);
+				msr_written = tstate->hwpf_msr_value;
+			msr_hwpf_write(msr_file, msr_written);
+			prof_end(tnum, PROF_MSR_WRITE, t_phase);
 		}
+
+		metrics_publish_core(tnum,
+			tstate->module_leader ? msr_written : NULL);
+
+		prof_end(tnum, PROF_ACTIVE, t_active);
+		prof_thread_interval(tnum);
 	}
 
         // Before pthread_exit or return
@@ -256,9 +263,12 @@ void print_usage(void)
 	       "and E-core servers are supported.\n");
 	printf("The --core argument can be used to direct dPF on only a "
 	       "specific set of cores.\n");
-	printf(" -c --core - set cores to use dPF. Starting from core id 0, eg."
-	       " 8-15 for the 9th to 16th core.\n");
-	printf("   --core 8-15\n");
+	printf(" -c --core - set cores to use dPF as a CPU list. Starting from "
+	       "core id 0, eg. 8-15 for the 9th to 16th core.\n");
+	printf("   --core 8-15,24-31\n");
+	printf(" -C --cpuset - only tune the cores of a cgroup cpuset, followed "
+	       "live in kernel mode.\n");
+	printf("   --cpuset /sys/fs/cgroup/workload\n");
 	printf("\nDDR Bandwith is by default auto-detected based on DMI/BIOS"
 	       "information and target is set to 70%% of\n");
 	printf("theorethical max bandwidth which is typically the achivable "
@@ -266,14 +276,40 @@ void print_usage(void)
 	printf(" -d --ddrbw-auto - set DDR bandwith from DMI/BIOS to a specific"
 	       "percentage of max. Default is 0.70 (70%%).\n");
 	printf("   --ddrbw-auto 0.65\n");
-	printf(" -t --ddrbw-test - set DDR bandwidth by performing a quick "
-	       "bandwidth test.\n");
+	printf(" -t --ddrbw-test - set DDR bandwidth by measuring the read "
+	       "bandwidth of every memory domain.\n");
 	printf("   --ddrbw-test\n");
 	printf("   Note that this gives a short but high load on the memory "
 	       "subsystem.\n");
+	printf(" -T --ddrbw-threads - threads per memory domain for "
+	       "--ddrbw-test, default one per core.\n");
+	printf("   --ddrbw-threads 16\n");
+	printf(" -L --ddrbw-place - placement of the --ddrbw-test threads, "
+	       "spread (one per module first,\n");
+	printf("   default) or compact.\n");
+	printf("   --ddrbw-place compact\n");
+	printf(" -K --calibrate - record the loaded-latency curve of every "
+	       "memory domain to a file and exit.\n");
+	printf("   --calibrate=calibration.json\n");
+	printf(" -f --calibration - target the knee of the loaded-latency "
+	       "curve from a calibration file.\n");
+	printf("   --calibration calibration.json\n");
+	printf(" -H --hwcache - file caching the detected hardware between "
+	       "starts, or off.\n");
+	printf("   default " HWCACHE_FILE "\n");
+	printf("   --hwcache off\n");
+	printf(" -r --hwcache-rebuild - detect everything again and rewrite "
+	       "the hardware cache.\n");
+	printf("   --hwcache-rebuild\n");
 	printf(" -D --ddrbw-set - set DDR bandwidth target in MB/s. This should"
 	       "be the max achievable.\n");
 	printf("   --ddrbw-set 46000\n");
+	printf(" -R --rdt-group - RDT MBM RMID grouping: core, module or all"
+	       " (default core).\n");
+	printf("   --rdt-group module\n");
+	printf(" -B --rdt-bench - benchmark RDT MBM read latency per grouping "
+	       "policy and exit.\n");
+	printf("   --rdt-bench=5000\n");
 	printf("The -w or --weight argument can be used to set the priority "
 	       "level of each core.\n");
 	printf(" -w --weight - set core priorities by providing a "
@@ -293,18 +329,39 @@ void print_usage(void)
 	printf(" -i --intervall - update interval in seconds (1-60), default: "
 	       "1\n");
 	printf("   --intervall 2\n");
+	printf(" -s --sample-intervall - kernel mode PMU sampling interval in "
+	       "seconds (0.0001-60),\n");
+	printf("   default: same as --intervall. Tuning runs every "
+	       "--intervall.\n");
+	printf("   --sample-intervall 0.001\n");
 	printf(" -A --alg - set tune algorithm, default 0\n");
 	printf("   --alg 2\n");
 	printf(" -p --perf - use perf events for PMU monitoring (default: "
 		"raw PMU)\n");
 	printf("  --perf\n");
-	printf(" -a --aggr - set retune aggressiveness (0.1 - 5.0), default 1."
-		"0\n");
+	printf(" -a --aggr - set retune aggressiveness (0.1 - 5.0 in steps of "
+		"0.1), default 1.0\n");
 	printf("   --aggr 2.0\n");
 
 	printf("\n*** Misc:\n");
 	printf(" -l --log - set loglevel 1 - 5 (5=debug), default: 3\n");
 	printf("   --log 3\n");
+	printf(" -O --profile - measure the overhead of the tuning threads, "
+	       "reported at exit\n");
+	printf("   and on SIGUSR1, per thread at --log 4. User space only.\n");
+	printf("   --profile\n");
+	printf(" -b --abtest - alternate epochs of hardware default and tuned "
+	       "prefetcher settings and\n");
+	printf("   compare their instructions, IPC and DDR traffic, epoch in "
+	       "seconds, default %d. User space only.\n", ABTEST_EPOCH_S);
+	printf("   --abtest=120\n");
+	printf(" -E --abtest-order - order of the epochs, alternate (default), "
+	       "abba or random.\n");
+	printf("   --abtest-order abba\n");
+	printf(" -M --metrics - export live metrics in the Prometheus text "
+	       "format on a Unix socket,\n");
+	printf("   default " METRICS_SOCKET ". User space only.\n");
+	printf("   --metrics=/run/dpf/metrics.sock\n");
 	printf(" -h --help - lists these arguments\n");
 }
 
@@ -367,13 +424,80 @@ int kbhit(void)
 	return select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv);
 }
 
+// Marks the first core of every module (L2 cluster) in the core set, it
+// writes the module's prefetch MSRs
+static void assign_module_leaders(void)
+{
+	for (int tnum = 0; tnum < ACTIVE_THREADS; tnum++) {
+		int cluster = topology.cpu[gtinfo[tnum].core_id].cluster;
+
+		gtinfo[tnum].module_leader = 1;
+
+		for (int prev = 0; prev < tnum; prev++) {
+			if (topology.cpu[gtinfo[prev].core_id].cluster == cluster) {
+				gtinfo[tnum].module_leader = 0;
+				break;
+			}
+		}
+	}
+}
+
+// Tuned cores in kernel mode: the core set, limited to the cgroup cpuset
+// at cpuset_path if one is set
+static int kernel_tuned_cores(const char *cpuset_path, cpu_set_t *tuned)
+{
+	cpu_set_t cpuset;
+
+	*tuned = core_set;
+
+	if (cpuset_path[0] != '\0') {
+		if (coreset_read(cpuset_path, &cpuset) < 0)
+			return -1;
+		CPU_AND(tuned, tuned, &cpuset);
+	}
+
+	return 0;
+}
+
+// Sends the tuned cores to the kernel module
+static int kernel_send_cores(const cpu_set_t *tuned)
+{
+	uint64_t mask[MAX_NUM_CORES / 64];
+	char list[256];
+	int ret;
+
+	coreset_to_mask(tuned, mask, MAX_NUM_CORES);
+
+	ret = kernel_core_mask(mask, MAX_NUM_CORES);
+	if (ret < 0)
+		return -1;
+
+	logi(TAG, "Cores: %s = %d tuned\n",
+	     coreset_format(tuned, list, sizeof(list)), ret);
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int json_argc = 0;
 	char **json_argv = NULL;
 
 	char weight_string[MAX_WEIGHT_STR_LEN] = {0};
+	char cpuset_path[PATH_MAX] = {0};
+	char core_list[256];
 	float ddr_bw_auto_utilization = 0.7;
+	int probe_threads = 0;
+	int probe_placement = BWPROBE_PLACE_SPREAD;
+	char calib_path[PATH_MAX] = {0};
+	char hwcache_path[PATH_MAX] = HWCACHE_FILE;
+	int hwcache_rebuild = 0;
+	int profile = 0;
+	float abtest_epoch_s = 0.0;
+	int abtest_order = ABTEST_ORDER_ALTERNATE;
+	int rdt_bench = 0;
+	int rdt_bench_iterations = 0;
+	char metrics_path[PATH_MAX] = {0};
 
 	for (int i = 0; i < MAX_THREADS; i++)
 		core_priority[i] = MIN_PRIORITY;
@@ -383,8 +507,6 @@ int main(int argc, char *argv[])
 
 	signal(SIGINT, sigintHandler);
 
-	pcie_init();
-
 	if (argc == 1) {
 		if (json_init(&json_argv) < 0)
 			return -1;
@@ -402,10 +524,18 @@ int main(int argc, char *argv[])
 	while (1) {
 		static struct option long_options[] = {
 		    {"core", required_argument, 0, 'c'},
+		    {"cpuset", required_argument, 0, 'C'},
 		    {"ddrbw-auto", required_argument, 0, 'd'},
 		    {"ddrbw-test", no_argument, 0, 't'},
+		    {"ddrbw-threads", required_argument, 0, 'T'},
+		    {"ddrbw-place", required_argument, 0, 'L'},
+		    {"calibrate", optional_argument, 0, 'K'},
+		    {"calibration", required_argument, 0, 'f'},
+		    {"hwcache", required_argument, 0, 'H'},
+		    {"hwcache-rebuild", no_argument, 0, 'r'},
 		    {"ddrbw-set", required_argument, 0, 'D'},
 		    {"intervall", required_argument, 0, 'i'},
+		    {"sample-intervall", required_argument, 0, 's'},
 		    {"alg", required_argument, 0, 'A'},
 		    {"aggr", required_argument, 0, 'a'},
 		    {"log", required_argument, 0, 'l'},
@@ -414,6 +544,12 @@ int main(int argc, char *argv[])
 		    {"perf", no_argument, 0, 'p'},
 		    {"msr", no_argument, 0, 'm'},
 		    {"pmu", no_argument, 0, 'P'},
+		    {"profile", no_argument, 0, 'O'},
+		    {"abtest", optional_argument, 0, 'b'},
+		    {"abtest-order", required_argument, 0, 'E'},
+		    {"metrics", optional_argument, 0, 'M'},
+		    {"rdt-group", required_argument, 0, 'R'},
+		    {"rdt-bench", optional_argument, 0, 'B'},
 		    {"help", no_argument, 0, 'h'},
 		    {NULL, no_argument, 0, 0},
 		};
@@ -422,9 +558,9 @@ int main(int argc, char *argv[])
 		int c;
 
 		if (json_argc > 0) {
-			c = getopt_long(json_argc, json_argv, "c:d:tD:i:A:a:l:w:ph:kPm", long_options, &option_index);
+			c = getopt_long(json_argc, json_argv, "c:C:d:tT:L:K::f:H:rD:i:s:A:a:l:w:ph:kPmOb::E:M::R:B::", long_options, &option_index);
 		} else {
-			c = getopt_long(argc, argv, "c:d:tD:i:A:a:l:w:ph:kPm",
+			c = getopt_long(argc, argv, "c:C:d:tT:L:K::f:H:rD:i:s:A:a:l:w:ph:kPmOb::E:M::R:B::",
 					long_options, &option_index);
 		}
 
@@ -434,22 +570,30 @@ int main(int argc, char *argv[])
 
 		switch (c) {
 		case 'c': // core
-			core_first = strtol(optarg, 0, 10);
-			if (strstr(optarg, "-") == NULL)
-				core_last = core_first;
-			else
-				core_last = strtol(strstr(optarg, "-") + 1, 0, 10);
+			if (coreset_parse(optarg, &core_set) <= 0) {
+				loge(TAG, "Invalid core list '%s'\n", optarg);
+				return -1;
+			}
+
+			core_first = coreset_first(&core_set);
+			core_last = coreset_last(&core_set);
 
-			logi(TAG, "Cores: %d -> %d = %d threads\n", core_first,
-			     core_last, core_last - core_first + 1);
+			logi(TAG, "Cores: %s = %d threads\n",
+			     coreset_format(&core_set, core_list, sizeof(core_list)),
+			     CPU_COUNT(&core_set));
 
-			if (core_last - core_first > MAX_THREADS) {
+			if (CPU_COUNT(&core_set) > MAX_THREADS) {
 				loge(TAG, "Too many cores, max is %d\n",
 				     MAX_THREADS);
 				return -1;
 			}
 			break;
 
+		case 'C': // cpuset
+			strncpy(cpuset_path, optarg, PATH_MAX - 1);
+			cpuset_path[PATH_MAX - 1] = '\0';
+			break;
+
 		case 'd': // ddrbw-auto
 			// override the 70% utilization factor
 			ddr_bw_auto_utilization = strtof(optarg, NULL);
@@ -460,6 +604,39 @@ int main(int argc, char *argv[])
 			// let's auto-test this
 			break;
 
+		case 'T': // ddrbw-threads
+			probe_threads = strtol(optarg, 0, 10);
+			break;
+
+		case 'L': // ddrbw-place
+			probe_placement = bwprobe_parse_placement(optarg);
+			if (probe_placement < 0) {
+				loge(TAG, "Unknown placement '%s'\n", optarg);
+				return -1;
+			}
+			break;
+
+		case 'K': // calibrate
+			ddr_bw_target = DDR_BW_CALIBRATE;
+			strncpy(calib_path, optarg ? optarg : CALIB_FILE,
+				PATH_MAX - 1);
+			break;
+
+		case 'f': // calibration
+			strncpy(calib_path, optarg, PATH_MAX - 1);
+			break;
+
+		case 'H': // hwcache
+			if (strcmp(optarg, "off") == 0)
+				hwcache_path[0] = '\0';
+			else
+				strncpy(hwcache_path, optarg, PATH_MAX - 1);
+			break;
+
+		case 'r': // hwcache-rebuild
+			hwcache_rebuild = 1;
+			break;
+
 		case 'D': // ddrbw-set
 			ddr_bw_target = strtol(optarg, 0, 10);
 			break;
@@ -472,12 +649,26 @@ int main(int argc, char *argv[])
 				time_intervall = 60.0f;
 			break;
 
+		case 's': // sample-intervall
+			sample_intervall = strtof(optarg, NULL);
+			if (sample_intervall < 0.0001f)
+				sample_intervall = 0.0001f;
+			if (sample_intervall > 60.0f)
+				sample_intervall = 60.0f;
+			break;
+
 		case 'A': // alg
 			tunealg = strtol(optarg, 0, 10);
 			break;
 
 		case 'a': // aggr
 			aggr = strtof(optarg, 0);
+			// The tuners step in tenths, in dpf as in dpf.ko
+			if (aggr < 0.1f || aggr > 5.0f ||
+			    fabsf(aggr * 10 - lroundf(aggr * 10)) > 0.001f) {
+				loge(TAG, "--aggr takes 0.1 - 5.0 in steps of 0.1\n");
+				return -1;
+			}
 			break;
 
 		case 'k': // kernelmode
@@ -508,6 +699,43 @@ int main(int argc, char *argv[])
 			logi(TAG, "PMU logging enabled\n");
 			break;
 
+		case 'O': // profile
+			profile = 1;
+			break;
+
+		case 'b': // abtest
+			abtest_epoch_s = optarg ? strtof(optarg, NULL) :
+						  ABTEST_EPOCH_S;
+			break;
+
+		case 'E': // abtest-order
+			abtest_order = abtest_parse_order(optarg);
+			if (abtest_order < 0) {
+				loge(TAG, "Unknown A/B test order '%s'\n",
+				     optarg);
+				return -1;
+			}
+			break;
+
+		case 'M': // metrics
+			strncpy(metrics_path, optarg ? optarg : METRICS_SOCKET,
+				PATH_MAX - 1);
+			break;
+
+		case 'R': // rdt-group
+			if (rdt_mbm_set_group_policy(
+				rdt_mbm_parse_group_policy(optarg)) < 0) {
+				loge(TAG, "Unknown RDT group policy '%s'\n",
+				     optarg);
+				return -1;
+			}
+			break;
+
+		case 'B': // rdt-bench, runs after the other options are read
+			rdt_bench = 1;
+			rdt_bench_iterations = optarg ? strtol(optarg, 0, 10) : 0;
+			break;
+
 		case '?': // getopt returns unknown argument
 		case 'h': // help
 			print_usage();
@@ -523,24 +751,67 @@ int main(int argc, char *argv[])
 	if (json_argc > 0)
 		json_deinit(json_argv);
 
-	//--core has not been used, so let's autodetect
-	if (core_first == -1 || core_last == -1) {
-		// auto-detect Atom E-cores and set first/last core to max
-		//  E-cores
-		struct e_cores_layout_s e_cores;
+	if (rdt_bench)
+		return rdt_mbm_bench(rdt_bench_iterations);
+
+	// Detected hardware of an earlier start, restores the topology
+	hwcache_load(hwcache_path, hwcache_rebuild);
 
-		e_cores = get_efficient_core_ids();
-		core_first = e_cores.first_efficiency_core;
-		core_last = e_cores.last_efficiency_core;
+	// Core types and modules, read from sysfs unless cached
+	if (topology_init() < 0)
+		return -1;
+	topology_log();
 
-		if (core_first == -1 || core_last == -1) {
+	//--core has not been used, so let's autodetect
+	if (core_first == -1 || core_last == -1) {
+		// auto-detect Atom E-cores, they don't need to be contiguous
+		CPU_ZERO(&core_set);
+		for (int core = 0; core < topology.num_cpus; core++)
+			if (topology.cpu[core].online &&
+			    topology.cpu[core].type == TOPO_TYPE_ECORE)
+				CPU_SET(core, &core_set);
+
+		if (CPU_COUNT(&core_set) == 0) {
 			loge(TAG, "Error, no cores to run on! Do you have Atom "
 				  "E-cores??\n");
 
 			return -1;
 		}
+
+		core_first = coreset_first(&core_set);
+		core_last = coreset_last(&core_set);
+		logv(TAG, "Atom E-cores: %s\n",
+		     coreset_format(&core_set, core_list, sizeof(core_list)));
+	}
+
+	// User space threads are pinned to their cores once, so only cores
+	// online and in the cpuset at start are tuned. In kernel mode the
+	// module follows CPU hotplug and the main loop the cpuset.
+	if (kernel_mode == 0) {
+		cpu_set_t allowed;
+
+		// The affinity of dPF itself is its own cgroup cpuset
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+			CPU_AND(&core_set, &core_set, &allowed);
+		if (coreset_read(CORESET_SYSFS_ONLINE, &allowed) >= 0)
+			CPU_AND(&core_set, &core_set, &allowed);
+		if (cpuset_path[0] != '\0') {
+			if (coreset_read(cpuset_path, &allowed) < 0)
+				return -1;
+			CPU_AND(&core_set, &core_set, &allowed);
+		}
+
+		if (CPU_COUNT(&core_set) == 0) {
+			loge(TAG, "Error, none of the cores is available\n");
+			return -1;
+		}
+
+		core_first = coreset_first(&core_set);
+		core_last = coreset_last(&core_set);
 	}
 
+	active_threads = CPU_COUNT(&core_set);
+
 	// If weight was provided, parse the values into array
 	// core_priority[MAX_THREADS]
 	if (strlen(weight_string) != 0) {
@@ -558,7 +829,7 @@ int main(int argc, char *argv[])
 
 	//--ddrbw-set / ddrbw-test has not been used, so use ddrbw-auto
 	if (ddr_bw_target == DDR_BW_NOT_SET) {
-		ddr_bw_target = dmi_get_bandwidth() * ddr_bw_auto_utilization;
+		ddr_bw_target = hwcache_dmi_bandwidth() * ddr_bw_auto_utilization;
 		logv(TAG, "DDR BW target set to %d MB/s\n", ddr_bw_target);
 
 		if (ddr_bw_target == -1) {
@@ -568,8 +839,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	// Initialize DDR PMU
-	if (pmu_ddr_init(&ddr, kernel_mode) == DDR_NONE) {
+	// Initialize DDR PMU, one memory domain per socket or SNC node
+	if (hwcache_ddr_domain_init(kernel_mode) == 0) {
 		// lets try RDT instread
 
 		// DDR init, with RDT if supported (servers)
@@ -583,40 +854,83 @@ int main(int argc, char *argv[])
 				return ret_val;
 			}
 			rdt_enabled = 1;
+			ddr_domain_init_rdt();
 		} else {
 			loge(TAG, "Neither DDR nor RDT support was found\n");
 			return -1;	
 		}
 	}
 
-	if (kernel_mode == 1) {
-		// Auto-detect mode is not allowed in kernel mode
-		if (ddr_bw_target == DDR_BW_AUTOTEST) {
-			loge(TAG, "Auto-detect mode is not allowed in kernel mode \n");
+	// Measure the achievable bandwidth of every domain before tuning
+	if (ddr_bw_target == DDR_BW_AUTOTEST) {
+		ddr_bw_target = hwcache_ddr_domain_probe(probe_threads,
+							 probe_placement);
+		if (ddr_bw_target <= 0) {
+			loge(TAG, "Error, DDR bandwidth test failed\n");
 			return -1;
 		}
+		logv(TAG, "DDR BW target set to %d MB/s\n", ddr_bw_target);
+	} else if (ddr_bw_target == DDR_BW_CALIBRATE) {
+		hwcache_save();
+		return calib_run(calib_path, CALIB_DEFAULT_STEPS) < 0 ? -1 : 0;
+	} else {
+		ddr_domain_set_target(ddr_bw_target);
+	}
+
+	// Failing to write the cache only costs the next start its detection
+	hwcache_save();
+
+	// Target the knee of the loaded-latency curve where it is calibrated
+	if (calib_path[0] != '\0') {
+		int calibrated = calib_load(calib_path);
+
+		if (calibrated < 0)
+			return -1;
+		if (calibrated < num_ddr_domains)
+			logi(TAG, "%d of %d memory domains calibrated\n",
+			     calibrated, num_ddr_domains);
+
+		ddr_bw_target = 0;
+		for (int i = 0; i < num_ddr_domains; i++)
+			ddr_bw_target += ddr_domain[i].bw_target;
+		logv(TAG, "DDR BW target set to %d MB/s\n", ddr_bw_target);
+	}
+
+	if (kernel_mode == 1) {
+		cpu_set_t tuned, cpuset;
+
+		if (profile)
+			logi(TAG, "--profile is ignored, kernel mode tunes in "
+			     "the module\n");
+		if (abtest_epoch_s > 0.0)
+			logi(TAG, "--abtest is ignored, kernel mode tunes in "
+			     "the module\n");
+		if (metrics_path[0] != '\0')
+			logi(TAG, "--metrics is ignored, dpfctrl reads the "
+			     "module\n");
 
 		if (kernel_mode_init() < 0)
 			return -1;
 
+		// The kernel module tunes all cores as one domain
+		if (num_ddr_sockets > 1)
+			logi(TAG, "Kernel mode uses the DDR channels of socket "
+			     "%d only\n", ddr_socket[0].socket);
+
 		// Initialize DDR configuration
-		if (kernel_set_ddr_config(&ddr) < 0) {
+		if (kernel_set_ddr_config(&ddr_socket[0]) < 0) {
 			loge(TAG, "Failed to set DDR configuration in"
 				  "kernel\n");
 			return -1;
 		}
 		
-		if (core_first != -1 && core_last != -1) {
-			logi(TAG, "Cores: %d -> %d = %d threads\n", core_first,
-			     core_last, core_last - core_first + 1);
-			if (kernel_core_range(core_first, core_last) < 0) {
-				loge(TAG, "Failed to configure core range\n");
-				return -1;
-			}
+		if (kernel_tuned_cores(cpuset_path, &tuned) < 0 ||
+		    kernel_send_cores(&tuned) < 0) {
+			loge(TAG, "Failed to configure cores\n");
+			return -1;
 		}
 
-		if (ddr_bw_target != DDR_BW_NOT_SET && ddr_bw_target !=
-		DDR_BW_AUTOTEST) {
+		if (ddr_bw_target != DDR_BW_NOT_SET) {
 			if (kernel_set_ddr_bandwidth(ddr_bw_target) < 0) {
 				loge(TAG, "Failed to set DDR bandwidth\n");
 				return -1;
@@ -627,6 +941,17 @@ int main(int argc, char *argv[])
 			return -1;
 		}
 
+		// MAB runs in the kernel, configured from mab_config.json
+		if (tunealg == MAB) {
+			mab_init(&mstate, ACTIVE_THREADS);
+			if (kernel_mab_config(mstate.algorithm,
+					mstate.arm_configuration, mstate.epsilon,
+					mstate.gamma, mstate.c) < 0) {
+				loge(TAG, "Failed to configure kernel MAB\n");
+				return -1;
+			}
+		}
+
 		logi(TAG, "*** KERNEL MODE TUNING STARTED ***\n");
 		logi(TAG, "Available controls during tuning:\n");
 		logi(TAG, "  'Q' - Quit and exit tuning mode\n");
@@ -636,7 +961,12 @@ int main(int argc, char *argv[])
 		logi(TAG, "Starting kernel mode tuning with algorithm %d and aggressiveness %.1f\n", 
 		     tunealg, aggr);
 
-		if (kernel_tuning_control(1, tunealg, aggr) < 0)
+		if (sample_intervall == 0.0f || sample_intervall > time_intervall)
+			sample_intervall = time_intervall;
+
+		if (kernel_tuning_control(1, tunealg, aggr,
+				(uint64_t)llroundf(sample_intervall * 1e9f),
+				(uint64_t)llroundf(time_intervall * 1e9f)) < 0)
 			return -1;
 
 		struct termios oldt, newt;
@@ -661,8 +991,20 @@ int main(int argc, char *argv[])
 				}
 			}
 
+			// Follow cpuset changes, CPU hotplug is handled by
+			// the kernel module
+			if (cpuset_path[0] != '\0' &&
+			    kernel_tuned_cores(cpuset_path, &cpuset) == 0 &&
+			    !CPU_EQUAL(&cpuset, &tuned)) {
+				tuned = cpuset;
+				kernel_send_cores(&tuned);
+			}
+
 			for (int core_id = core_first;
 				core_id <= core_last; core_id++) {
+				if (!CPU_ISSET(core_id, &tuned))
+					continue;
+
 				if (enable_msr_msg == 1) {
 					if (kernel_log_msr_values(core_id) < 0) {
 						loge(TAG, "Error reading MSR values for core %d\n", core_id);
@@ -682,7 +1024,9 @@ int main(int argc, char *argv[])
 
 		tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
 
-		if (kernel_tuning_control(0, tunealg, aggr) < 0)
+		kernel_log_timer_stats();
+
+		if (kernel_tuning_control(0, tunealg, aggr, 0, 0) < 0)
 			return -1;
 		logi(TAG, "Leaving kernel mode tuning - exiting dPF\n");
 		pcie_deinit();
@@ -695,10 +1039,31 @@ int main(int argc, char *argv[])
 	if (tunealg == 2)
 		mab_init(&mstate, ACTIVE_THREADS);
 
+	if (profile && prof_init(ACTIVE_THREADS) < 0)
+		return -1;
+
+	if (abtest_epoch_s > 0.0 &&
+	    abtest_init(abtest_epoch_s, abtest_order) < 0)
+		return -1;
+
+	if (metrics_path[0] != '\0' &&
+	    metrics_init(metrics_path, ACTIVE_THREADS) < 0)
+		return -1;
+
 	// Initialization done - let's start running...
 
-	for (int tnum = 0; tnum <= (core_last - core_first); tnum++) {
-		gtinfo[tnum].core_id = core_first + tnum;
+	for (int core = core_first, tnum = 0; core <= core_last; core++) {
+		if (!CPU_ISSET(core, &core_set))
+			continue;
+
+		gtinfo[tnum].core_id = core;
+		gtinfo[tnum].domain = ddr_domain_of_core(core);
+		tnum++;
+	}
+
+	assign_module_leaders();
+
+	for (int tnum = 0; tnum < ACTIVE_THREADS; tnum++) {
 		pthread_create(&gtinfo[tnum].thread_id, NULL,
 			       &thread_start, &gtinfo[tnum]);
 	}
@@ -709,7 +1074,13 @@ int main(int argc, char *argv[])
 
 	pthread_join(gtinfo[0].thread_id, &ret);
 
-	close(ddr.mem_file);
+	// The other threads may still finish their last interval
+	if (profile)
+		prof_report();
+	abtest_report();
+	metrics_deinit();
+
+	ddr_domain_deinit();
 
 	rdt_mbm_reset();
 	pcie_deinit();
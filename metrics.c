@@ -0,0 +1,530 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "abtest.h"
+#include "common.h"
+#include "ddr_domain.h"
+#include "log.h"
+#include "metrics.h"
+
+#define TAG "METRICS"
+
+#define METRICS_RETRIES (1000)
+#define METRICS_POLL_MS (500)	// how often the scrape thread checks for stop
+#define METRICS_REQUEST_MS (100) // wait for an HTTP request line
+
+// Published by one tuning thread, a cache line of its own
+struct metrics_core_s {
+	uint32_t seq;		// odd while updating, 0 = never published
+	int core;
+	int has_msr;		// module leader
+	uint64_t intervals;
+	uint64_t instructions;	// since start
+	uint64_t cycles;
+	uint64_t last_instructions; // last interval
+	uint64_t last_cycles;
+	uint64_t pmu[PMU_COUNTERS];
+	uint64_t msr[HWPF_MSR_FIELDS];
+} __attribute__((aligned(64)));
+
+struct metrics_domain_s {
+	uint64_t rd_bytes;	// since start
+	uint64_t wr_bytes;
+	double rd_bps;		// last interval
+	double wr_bps;
+	int target_mbps;
+};
+
+// Published by the first core
+struct metrics_global_s {
+	uint32_t seq;
+	int arm;		// -1 if not MAB
+	int abtest_tuned;	// -1 without A/B test
+	int num_domains;	// 0 without DDR PMU
+	uint64_t intervals;
+	struct metrics_domain_s domain[MAX_DDR_DOMAINS];
+};
+
+int metrics_enabled;
+
+static struct metrics_core_s *metrics_core;
+static struct metrics_global_s metrics_global;
+static int metrics_num_threads;
+static int metrics_fd = -1;
+static char metrics_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t metrics_thread_id;
+static volatile int metrics_stop;
+
+// DDR counts of the previous interval, first core only
+static int metrics_ddr = 1;
+static uint64_t metrics_ddr_samples;
+static uint64_t metrics_last_ns;
+
+static const uint32_t metrics_msr_addr[HWPF_MSR_FIELDS] = {
+	HWPF_MSR_BASE, HWPF_MSR_BASE + 1, HWPF_MSR_BASE + 2,
+	HWPF_MSR_BASE + 3, HWPF_MSR_BASE + 4, HWPF_MSR_0X1A4,
+};
+
+static uint64_t metrics_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void metrics_write_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void metrics_write_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copies an entry starting with its sequence count, as dpf_shared_read()
+// Returns: 0, -1 if never published or updated on every try
+static int metrics_read(void *dst, const void *src, size_t size)
+{
+	const uint32_t *seq_p = src;
+	uint32_t seq;
+	int retries = METRICS_RETRIES;
+
+	do {
+		seq = __atomic_load_n(seq_p, __ATOMIC_ACQUIRE);
+		if (seq == 0)
+			return -1;
+		if (seq & 1)
+			continue;
+
+		memcpy(dst, src, size);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(seq_p, __ATOMIC_RELAXED) == seq)
+			return 0;
+	} while (--retries);
+
+	return -1;
+}
+
+// Publishes one core, see metrics.h
+void metrics_publish_core(int thread, const union msr_u *msr)
+{
+	struct metrics_core_s *c;
+	struct thread_state *t = &gtinfo[thread];
+
+	if (!metrics_enabled || thread >= metrics_num_threads)
+		return;
+
+	c = &metrics_core[thread];
+
+	metrics_write_begin(&c->seq);
+
+	c->core = t->core_id;
+	c->intervals++;
+	c->instructions += t->instructions_retired;
+	c->cycles += t->cpu_cycles;
+	c->last_instructions = t->instructions_retired;
+	c->last_cycles = t->cpu_cycles;
+	memcpy(c->pmu, t->pmu_result, sizeof(c->pmu));
+	c->has_msr = msr != NULL;
+	if (msr != NULL)
+		for (int i = 0; i < HWPF_MSR_FIELDS; i++)
+			c->msr[i] = msr[i].v;
+
+	metrics_write_end(&c->seq);
+}
+
+// Publishes the DDR traffic and tuner state, see metrics.h
+void metrics_publish(int arm)
+{
+	struct metrics_global_s *g = &metrics_global;
+	uint64_t now_ns, delta_ns;
+
+	if (!metrics_enabled)
+		return;
+
+	// Shares the samples of the basic tuners, as the A/B test
+	if (metrics_ddr && ddr_domain_update(&metrics_ddr_samples) < 0) {
+		logi(TAG, "No DDR PMU, DDR traffic is not exported\n");
+		metrics_ddr = 0;
+	}
+
+	now_ns = metrics_now_ns();
+	delta_ns = now_ns - metrics_last_ns;
+	metrics_last_ns = now_ns;
+
+	metrics_write_begin(&g->seq);
+
+	g->arm = arm;
+	g->abtest_tuned = abtest_enabled ? !abtest_baseline() : -1;
+	g->intervals++;
+	g->num_domains = metrics_ddr ? num_ddr_domains : 0;
+
+	for (int d = 0; d < g->num_domains; d++) {
+		struct metrics_domain_s *m = &g->domain[d];
+
+		if (delta_ns > 0 && g->intervals > 1) {
+			m->rd_bps = (ddr_domain[d].rd_bytes - m->rd_bytes) *
+				    1e9 / delta_ns;
+			m->wr_bps = (ddr_domain[d].wr_bytes - m->wr_bytes) *
+				    1e9 / delta_ns;
+		}
+		m->rd_bytes = ddr_domain[d].rd_bytes;
+		m->wr_bytes = ddr_domain[d].wr_bytes;
+		m->target_mbps = ddr_domain[d].bw_target;
+	}
+
+	metrics_write_end(&g->seq);
+}
+
+static double metrics_ratio(uint64_t num, uint64_t den)
+{
+	return den ? (double)num / den : NAN;
+}
+
+static void metrics_header(FILE *f, const char *name, const char *type,
+			   const char *help)
+{
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Thread CPU time of a tuning thread, the overhead of tuning its core
+static double metrics_thread_cpu(int thread)
+{
+	struct timespec ts;
+	clockid_t clock;
+
+	if (pthread_getcpuclockid(gtinfo[thread].thread_id, &clock) != 0 ||
+	    clock_gettime(clock, &ts) != 0)
+		return NAN;
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Writes all metrics from a copy of the published entries
+static void metrics_format(FILE *f, const struct metrics_core_s *core,
+			   const int *valid, const struct metrics_global_s *g,
+			   int global_valid)
+{
+	int n = metrics_num_threads;
+
+	metrics_header(f, "dpf_interval_seconds", "gauge",
+		       "Tuning interval.");
+	fprintf(f, "dpf_interval_seconds %g\n", time_intervall);
+	metrics_header(f, "dpf_tuner_algorithm", "gauge",
+		       "Tuning algorithm, --alg.");
+	fprintf(f, "dpf_tuner_algorithm %d\n", tunealg);
+
+	if (global_valid) {
+		metrics_header(f, "dpf_intervals_total", "counter",
+			       "Tuning intervals done.");
+		fprintf(f, "dpf_intervals_total %lu\n", g->intervals);
+
+		if (g->arm >= 0) {
+			metrics_header(f, "dpf_mab_arm", "gauge",
+				       "Prefetcher configuration chosen by MAB.");
+			fprintf(f, "dpf_mab_arm %d\n", g->arm);
+		}
+		if (g->abtest_tuned >= 0) {
+			metrics_header(f, "dpf_abtest_tuned", "gauge",
+				       "1 in tuned A/B test epochs, 0 in "
+				       "baseline epochs.");
+			fprintf(f, "dpf_abtest_tuned %d\n", g->abtest_tuned);
+		}
+	}
+
+	metrics_header(f, "dpf_core_ipc", "gauge",
+		       "Instructions per cycle in the last interval.");
+	for (int i = 0; i < n; i++)
+		if (valid[i])
+			fprintf(f, "dpf_core_ipc{core=\"%d\"} %g\n", core[i].core,
+				metrics_ratio(core[i].last_instructions,
+					      core[i].last_cycles));
+
+	metrics_header(f, "dpf_core_instructions_total", "counter",
+		       "Instructions retired while tuning.");
+	for (int i = 0; i < n; i++)
+		if (valid[i])
+			fprintf(f, "dpf_core_instructions_total{core=\"%d\"} "
+				"%lu\n", core[i].core, core[i].instructions);
+
+	metrics_header(f, "dpf_core_cycles_total", "counter",
+		       "Core cycles while tuning.");
+	for (int i = 0; i < n; i++)
+		if (valid[i])
+			fprintf(f, "dpf_core_cycles_total{core=\"%d\"} %lu\n",
+				core[i].core, core[i].cycles);
+
+	metrics_header(f, "dpf_core_l2_hit_ratio", "gauge",
+		       "Loads hitting L2 of those reaching L2, last interval.");
+	for (int i = 0; i < n; i++)
+		if (valid[i])
+			fprintf(f, "dpf_core_l2_hit_ratio{core=\"%d\"} %g\n",
+				core[i].core, metrics_ratio(core[i].pmu[1],
+				core[i].pmu[1] + core[i].pmu[2] +
+				core[i].pmu[3]));
+
+	metrics_header(f, "dpf_core_l3_hit_ratio", "gauge",
+		       "Loads hitting L3 of those reaching L3, last interval.");
+	for (int i = 0; i < n; i++)
+		if (valid[i])
+			fprintf(f, "dpf_core_l3_hit_ratio{core=\"%d\"} %g\n",
+				core[i].core, metrics_ratio(core[i].pmu[2],
+				core[i].pmu[2] + core[i].pmu[3]));
+
+	metrics_header(f, "dpf_core_good_prefetch_ratio", "gauge",
+		       "XQ promotions per load reaching L2, last interval.");
+	for (int i = 0; i < n; i++)
+		if (valid[i])
+			fprintf(f, "dpf_core_good_prefetch_ratio{core=\"%d\"} "
+				"%g\n", core[i].core,
+				metrics_ratio(core[i].pmu[4], core[i].pmu[1] +
+				core[i].pmu[2] + core[i].pmu[3]));
+
+	metrics_header(f, "dpf_core_tuner_cpu_seconds_total", "counter",
+		       "CPU time of the tuning thread of the core.");
+	for (int i = 0; i < n; i++)
+		if (valid[i])
+			fprintf(f, "dpf_core_tuner_cpu_seconds_total"
+				"{core=\"%d\"} %.6f\n", core[i].core,
+				metrics_thread_cpu(i));
+
+	metrics_header(f, "dpf_msr", "gauge",
+		       "Prefetcher MSRs of a module, written by its first "
+		       "core.");
+	for (int i = 0; i < n; i++) {
+		if (!valid[i] || !core[i].has_msr)
+			continue;
+		for (int m = 0; m < HWPF_MSR_FIELDS; m++)
+			fprintf(f, "dpf_msr{core=\"%d\",msr=\"0x%x\"} %lu\n",
+				core[i].core, metrics_msr_addr[m],
+				core[i].msr[m]);
+	}
+
+	if (!global_valid || g->num_domains == 0)
+		return;
+
+	metrics_header(f, "dpf_ddr_read_bytes_total", "counter",
+		       "DDR bytes read by a memory domain.");
+	for (int d = 0; d < g->num_domains; d++)
+		fprintf(f, "dpf_ddr_read_bytes_total{domain=\"%d\"} %lu\n", d,
+			g->domain[d].rd_bytes);
+
+	metrics_header(f, "dpf_ddr_write_bytes_total", "counter",
+		       "DDR bytes written by a memory domain.");
+	for (int d = 0; d < g->num_domains; d++)
+		fprintf(f, "dpf_ddr_write_bytes_total{domain=\"%d\"} %lu\n", d,
+			g->domain[d].wr_bytes);
+
+	metrics_header(f, "dpf_ddr_read_bytes_per_second", "gauge",
+		       "DDR read bandwidth in the last interval.");
+	for (int d = 0; d < g->num_domains; d++)
+		fprintf(f, "dpf_ddr_read_bytes_per_second{domain=\"%d\"} %.0f\n",
+			d, g->domain[d].rd_bps);
+
+	metrics_header(f, "dpf_ddr_write_bytes_per_second", "gauge",
+		       "DDR write bandwidth in the last interval.");
+	for (int d = 0; d < g->num_domains; d++)
+		fprintf(f, "dpf_ddr_write_bytes_per_second{domain=\"%d\"} %.0f\n",
+			d, g->domain[d].wr_bps);
+
+	metrics_header(f, "dpf_ddr_target_bytes_per_second", "gauge",
+		       "DDR bandwidth target of a memory domain.");
+	for (int d = 0; d < g->num_domains; d++)
+		fprintf(f, "dpf_ddr_target_bytes_per_second{domain=\"%d\"} "
+			"%lu\n", d,
+			(uint64_t)g->domain[d].target_mbps * 1024 * 1024);
+}
+
+static int metrics_send(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+// Answers one client, with an HTTP response if it sent a GET
+static void metrics_serve(int fd)
+{
+	struct metrics_core_s *core;
+	struct metrics_global_s global;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char request[256], header[128];
+	int *valid, global_valid, http = 0;
+	size_t len = 0;
+	char *body = NULL;
+	FILE *f;
+
+	if (poll(&pfd, 1, METRICS_REQUEST_MS) > 0) {
+		ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+
+		http = n >= 4 && strncmp(request, "GET ", 4) == 0;
+	}
+
+	core = malloc(metrics_num_threads * sizeof(*core));
+	valid = malloc(metrics_num_threads * sizeof(*valid));
+	f = open_memstream(&body, &len);
+	if (core == NULL || valid == NULL || f == NULL) {
+		loge(TAG, "Out of memory for a scrape\n");
+		if (f != NULL)
+			fclose(f);
+		free(body);
+		free(valid);
+		free(core);
+		return;
+	}
+
+	for (int i = 0; i < metrics_num_threads; i++)
+		valid[i] = metrics_read(&core[i], &metrics_core[i],
+					sizeof(core[i])) == 0;
+	global_valid = metrics_read(&global, &metrics_global,
+				    sizeof(global)) == 0;
+
+	metrics_format(f, core, valid, &global, global_valid);
+	fclose(f);
+
+	if (http) {
+		int n = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+				 "Content-Type: text/plain; version=0.0.4\r\n"
+				 "Content-Length: %zu\r\n\r\n", len);
+
+		if (metrics_send(fd, header, n) < 0)
+			len = 0;
+	}
+	if (len > 0)
+		metrics_send(fd, body, len);
+
+	free(body);
+	free(valid);
+	free(core);
+}
+
+static void *metrics_thread(void *arg)
+{
+	(void)arg;
+
+	while (!metrics_stop) {
+		struct pollfd pfd = { .fd = metrics_fd, .events = POLLIN };
+		struct timeval timeout = { .tv_sec = 1 };
+		int fd;
+
+		if (poll(&pfd, 1, METRICS_POLL_MS) <= 0)
+			continue;
+
+		fd = accept4(metrics_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		// A stuck client only delays the next scrape
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+			   sizeof(timeout));
+		metrics_serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+// Opens the socket and starts the scrape thread, see metrics.h
+int metrics_init(const char *path, int num_threads)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		loge(TAG, "Socket path '%s' is too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	// A socket left by an earlier run, never another kind of file
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			loge(TAG, "%s exists and is not a socket\n", path);
+			return -1;
+		}
+		unlink(path);
+	}
+
+	metrics_core = calloc(num_threads, sizeof(*metrics_core));
+	if (metrics_core == NULL) {
+		loge(TAG, "Out of memory for %d threads\n", num_threads);
+		return -1;
+	}
+	metrics_num_threads = num_threads;
+
+	metrics_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (metrics_fd < 0 ||
+	    bind(metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(metrics_fd, 8) < 0) {
+		loge(TAG, "Could not listen on %s: %s\n", path,
+		     strerror(errno));
+		if (metrics_fd >= 0)
+			close(metrics_fd);
+		metrics_fd = -1;
+		free(metrics_core);
+		metrics_core = NULL;
+		return -1;
+	}
+	chmod(path, 0600);
+	strcpy(metrics_path, path);
+
+	metrics_last_ns = metrics_now_ns();
+	metrics_ddr_samples = num_ddr_samples;
+	metrics_stop = 0;
+	metrics_enabled = 1;
+
+	if (pthread_create(&metrics_thread_id, NULL, metrics_thread,
+			   NULL) != 0) {
+		loge(TAG, "Could not start the scrape thread\n");
+		metrics_stop = 1;
+		metrics_deinit();
+		return -1;
+	}
+
+	logi(TAG, "Metrics on %s\n", path);
+
+	return 0;
+}
+
+void metrics_deinit(void)
+{
+	if (metrics_fd < 0)
+		return;
+
+	if (!metrics_stop) {
+		metrics_stop = 1;
+		pthread_join(metrics_thread_id, NULL);
+	}
+
+	// Tuning threads may still finish their last interval, the entries
+	// stay allocated
+	metrics_enabled = 0;
+	close(metrics_fd);
+	metrics_fd = -1;
+	unlink(metrics_path);
+}
@@ -722,3 +722,29 @@ int msr_get_mon_count(int core, uint64_t *val)
 	*val = data;
 	return 0;
 }
+
+// Last event selection written per core. Every RMID group is read on its
+// own core, so IA32_QM_EVTSEL only has to be written on the first read.
+static uint64_t mon_evtsel_cache[MAX_NUM_CORES];
+
+// Read one RDT MBM counter through the cached msr fd. evtsel selects
+// RMID + event, val receives the raw IA32_QM_CTR value (error/unavailable
+// bits are left for the caller to inspect).
+int msr_get_mon_count_sel(unsigned core, uint64_t evtsel, uint64_t *val)
+{
+	if (mon_evtsel_cache[core] != evtsel) {
+		if (msr_set_evtsel(core, evtsel) != 0) {
+			mon_evtsel_cache[core] = 0;
+			return -1;
+		}
+		mon_evtsel_cache[core] = evtsel;
+	}
+
+	return msr_get_mon_count(core, val);
+}
+
+// Forget the cached event selection of a core, e.g. after an RMID reset
+void msr_mon_evtsel_invalidate(unsigned core)
+{
+	mon_evtsel_cache[core] = 0;
+}
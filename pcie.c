@@ -8,8 +8,12 @@
 static struct pci_access *pacc;
 
 // Initialize the PCIe interface and the static/local pacc structure.
+// The bus is scanned once, only when needed, a cached start skips it.
 int pcie_init(void)
 {
+	if (pacc != NULL)
+		return 0;
+
 	pacc = pci_alloc();
 	if(pacc == NULL) {
 		loge(TAG, "PCIe init failed\n");
@@ -30,7 +34,11 @@ int pcie_init(void)
 //Cleanup the pacc structure
 void pcie_deinit(void)
 {
+	if (pacc == NULL)
+		return;
+
 	pci_cleanup(pacc);
+	pacc = NULL;
 }
 
 //returns the handle to the pci access struct
@@ -42,6 +50,6 @@ void pcie_deinit(void)
 //returns the handle to the pci device struct
 struct pci_dev* pcie_get_devices()
 {
-	return pacc->devices;
+	return pacc ? pacc->devices : NULL;
 }
 
@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdint.h>
@@ -11,18 +12,17 @@
 #include <sys/mman.h>
 #include <sys/signal.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "log.h"
 #include "msr.h"
 #include "pcie.h"
 #include "pmu_ddr.h"
+#include "topology.h"
 
 #define TAG "PMU_DDR"
 
-static int ddr_interface_type;
-int num_ddr_controllers = 0;
-
 // Initialize DDR for a Sierra Forest or Grandridge CPU
 // ddr_bar is the base address of the DDR config space
 static int pmu_ddr_init_grr_srf(struct ddr_s *ddr, uint64_t ddr_bar)
@@ -38,18 +38,21 @@ static int pmu_ddr_init_grr_srf(struct ddr_s *ddr, uint64_t ddr_bar)
 
 	ddr->mem_file = mem_file;
 
-	for (int i = 0; i < num_ddr_controllers; i++) {
+	for (int i = 0; i < ddr->num_ddr_controllers; i++) {
 		ddr->mmap[i] = (char *)mmap(NULL, GRR_SRF_DDR_RANGE, PROT_READ,
 					    MAP_SHARED, mem_file, ddr_bar + GRR_SRF_MC_ADDRESS(i));
 
 		if (ddr->mmap[i] == MAP_FAILED) {
-			loge(TAG, "Could not mmap() DDR controller %d\n", i);
+			loge(TAG, "Could not mmap() DDR controller %d of socket %d\n",
+			     i, ddr->socket);
 			return -1;
 		}
+
+		ddr->rd_cntr[i] = (volatile uint64_t *)(ddr->mmap[i] + GRR_SRF_FREE_RUN_CNTR_READ);
+		ddr->wr_cntr[i] = (volatile uint64_t *)(ddr->mmap[i] + GRR_SRF_FREE_RUN_CNTR_WRITE);
 	}
 
-	pmu_ddr(ddr, DDR_PMU_RD);
-	pmu_ddr(ddr, DDR_PMU_WR);
+	pmu_ddr_sample(ddr, NULL); // first read can be spiky, clean it
 
 	return 0;
 }
@@ -83,18 +86,96 @@ static int pmu_ddr_init_client(struct ddr_s *ddr, uint64_t ddr_bar)
 		return -1;
 	}
 
-	pmu_ddr(ddr, DDR_PMU_RD); // first read can be spiky, clean it
-	pmu_ddr(ddr, DDR_PMU_WR); // let's do another clean just to be safe
+	for (int i = 0; i < ddr->num_ddr_controllers && i < 2; i++) {
+		ddr->rd_cntr[i] = (volatile uint64_t *)(ddr->mmap[i] + CLIENT_DDR_RD_BW);
+		ddr->wr_cntr[i] = (volatile uint64_t *)(ddr->mmap[i] + CLIENT_DDR_WR_BW);
+	}
+
+	pmu_ddr_sample(ddr, NULL); // first read can be spiky, clean it
 
 	return 0;
 }
 
-// Searches and initializes the DDR PMU
-// Returns interface type, including DDR_NONE if nothing found
-int pmu_ddr_init(struct ddr_s *ddr, int kernel_mode)
+// DDR BAR of a client controller, from config register 0x48
+static uint64_t pmu_ddr_client_bar(uint32_t reg48)
+{
+	return reg48 & 0xfffffff0;
+}
+
+// Config BAR of a GRR/SRF socket, from the UBOX MMIO base (0xD0) and
+// SCF BAR (0xD4) registers
+static uint64_t pmu_ddr_grr_srf_bar(uint32_t mmio_base, uint32_t scf_bar)
 {
+	return ((uint64_t)(mmio_base & 0x1FFFFFF) << 23) |
+	       ((uint64_t)(scf_bar & 0x7FF) << 12);
+}
+
+// Physical package of a PCI device, from the NUMA node the kernel gives it
+// Returns: socket id, -1 if the device has no node
+static int pci_dev_socket(struct pci_dev *dev)
+{
+	char path[PATH_MAX];
+	int node = -1;
+	FILE *fp;
+
+	snprintf(path, sizeof(path),
+		 "/sys/bus/pci/devices/%04x:%02x:%02x.%d/numa_node",
+		 dev->domain, dev->bus, dev->dev, dev->func);
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	if (fscanf(fp, "%d", &node) != 1)
+		node = -1;
+	fclose(fp);
+
+	if (node < 0)
+		return -1;
+
+	for (int core = 0; core < topology.num_cpus; core++)
+		if (topology.cpu[core].online && topology.cpu[core].node == node)
+			return topology.cpu[core].socket;
+
+	return -1;
+}
+
+// Entry of found[] for a socket, a new one is added the first time
+// Returns: the entry, NULL if there are more than MAX_DDR_SOCKETS sockets
+static struct ddr_s *ddr_socket_entry(struct ddr_s *found, int *num_found,
+				      int socket)
+{
+	for (int i = 0; i < *num_found; i++)
+		if (found[i].socket == socket)
+			return &found[i];
+
+	if (*num_found == MAX_DDR_SOCKETS)
+		return NULL;
+
+	found[*num_found].socket = socket;
+	found[*num_found].ddr_interface_type = DDR_NONE;
+
+	return &found[(*num_found)++];
+}
+
+// Searches the DDR controllers of all sockets and initializes their PMUs
+// Every socket has its own config BAR and controllers, ddr[] gets one entry
+// per socket with DDR PMU support, lowest socket first, at most max_sockets.
+// Controllers whose socket can't be told (no NUMA) count to socket 0.
+// Returns: number of entries filled, 0 if nothing found
+int pmu_ddr_init_sockets(struct ddr_s *ddr, int max_sockets, int kernel_mode)
+{
+	struct ddr_s found[MAX_DDR_SOCKETS];
+	struct ddr_s *entry;
 	struct pci_dev *dev;
-	uint64_t ddr_bar = 0;
+	int num_found = 0;
+	int num = 0;
+
+	memset(found, 0, sizeof(found));
+
+	// Maps NUMA nodes of the PCI devices to sockets
+	if (topology_init() < 0)
+		logi(TAG, "No topology, all DDR controllers count to socket 0\n");
 
 	dev = pcie_get_devices();
 
@@ -104,151 +185,205 @@ int pmu_ddr_init(struct ddr_s *ddr, int kernel_mode)
 		     dev->domain, dev->bus, dev->dev, dev->func, dev->vendor_id, dev->device_id,
 		     dev->device_class, (long)dev->base_addr[0]);
 
-		if (dev->vendor_id == 0x8086) {
-			switch (dev->device_id) {
-			// client DDR controller
-			case 0xa700: // RPL
-			case 0x7d05: // MTL
-				ddr_bar = pci_read_long(dev, 0x48) &
-					  0xfffffff0; // get base address
-				logv(TAG, "PCIe %x: DDR BAR: %x\n",
-				     dev->device_id, ddr_bar);
-				ddr_interface_type = DDR_CLIENT;
-				num_ddr_controllers++;
-				break;
-			// GRR SRF DDR controller
-			case 0x3251: // Server platforms config / UBOX
-				uint64_t mmio_base, scf_bar;
-
-				mmio_base = pci_read_long(dev, 0xD0);
-				scf_bar = pci_read_long(dev, 0xD4);
-
-				mmio_base = mmio_base & 0x1FFFFFF;
-				mmio_base = mmio_base << 23;
-
-				scf_bar = scf_bar & 0x7FF;
-				scf_bar = scf_bar << 12;
-
-				ddr_bar = mmio_base | scf_bar;
-				ddr_interface_type = DDR_GRR_SRF;
-
-				logd(TAG, "MMIO BASE: 0X%X SCF BAR: 0X%X Result: 0X%X\n",
-				     mmio_base, scf_bar, ddr_bar);
-				break;
-			case 0x324a: // DDR controller
-				num_ddr_controllers++;
-				break;
-
-			default:
-				break;
-			}
-		} // if (0x8086)
+		if (dev->vendor_id != 0x8086) {
+			dev = dev->next;
+			continue;
+		}
+
+		int socket = pci_dev_socket(dev);
+
+		entry = ddr_socket_entry(found, &num_found, socket < 0 ? 0 : socket);
+		if (entry == NULL) {
+			dev = dev->next;
+			continue;
+		}
+
+		switch (dev->device_id) {
+		// client DDR controller
+		case 0xa700: // RPL
+		case 0x7d05: // MTL
+			entry->bar_address = pmu_ddr_client_bar(pci_read_long(dev, 0x48));
+			snprintf(entry->bar_dev, sizeof(entry->bar_dev),
+				 "%04x:%02x:%02x.%d", dev->domain, dev->bus,
+				 dev->dev, dev->func);
+			logv(TAG, "PCIe %x: DDR BAR: %lx\n",
+			     dev->device_id, entry->bar_address);
+			entry->ddr_interface_type = DDR_CLIENT;
+			entry->num_ddr_controllers++;
+			break;
+		// GRR SRF DDR controller
+		case 0x3251: // Server platforms config / UBOX, one per socket
+			uint32_t mmio_base, scf_bar;
+
+			mmio_base = pci_read_long(dev, 0xD0);
+			scf_bar = pci_read_long(dev, 0xD4);
+
+			entry->bar_address = pmu_ddr_grr_srf_bar(mmio_base, scf_bar);
+			entry->ddr_interface_type = DDR_GRR_SRF;
+			snprintf(entry->bar_dev, sizeof(entry->bar_dev),
+				 "%04x:%02x:%02x.%d", dev->domain, dev->bus,
+				 dev->dev, dev->func);
+
+			logd(TAG, "Socket %d MMIO BASE: 0X%X SCF BAR: 0X%X Result: 0X%lX\n",
+			     entry->socket, mmio_base, scf_bar, entry->bar_address);
+			break;
+		case 0x324a: // DDR controller
+			entry->num_ddr_controllers++;
+			break;
+
+		default:
+			break;
+		}
 
 		dev = dev->next;
 	}
 
-	ddr->ddr_interface_type = ddr_interface_type;
-	ddr->bar_address = ddr_bar;
-	ddr->num_ddr_controllers = num_ddr_controllers;
+	// Lowest socket first, the order of the PCI scan is not kept
+	for (int i = 1; i < num_found; i++) {
+		for (int j = i; j > 0 && found[j].socket < found[j - 1].socket; j--) {
+			struct ddr_s tmp = found[j];
 
-	// Kernel-space initialization
-	if (kernel_mode != 1) {
-		if (ddr_interface_type == DDR_CLIENT) {
-			int ret = pmu_ddr_init_client(ddr, ddr_bar);
+			found[j] = found[j - 1];
+			found[j - 1] = tmp;
+		}
+	}
 
-			if (ret < 0)
-				ddr_interface_type = DDR_NONE;
-		} else if (ddr_interface_type == DDR_GRR_SRF) {
-			int ret = pmu_ddr_init_grr_srf(ddr, ddr_bar);
+	for (int i = 0; i < num_found && num < max_sockets; i++) {
+		if (found[i].ddr_interface_type == DDR_NONE ||
+		    found[i].num_ddr_controllers == 0)
+			continue;
 
-			if (ret < 0)
-				ddr_interface_type = DDR_NONE;
-		}
+		if (found[i].num_ddr_controllers > MAX_NUM_DDR_CONTROLLERS)
+			found[i].num_ddr_controllers = MAX_NUM_DDR_CONTROLLERS;
+
+		ddr[num] = found[i];
+
+		// Kernel-space initialization
+		if (kernel_mode != 1 && pmu_ddr_map(&ddr[num]) < 0)
+			continue;
+
+		logv(TAG, "Socket %d: %d DDR controllers\n", ddr[num].socket,
+		     ddr[num].num_ddr_controllers);
+		num++;
 	}
 
-	return ddr_interface_type;
+	return num;
 }
 
-// DDR read functionality for Client CPUs
-// Currently limited to two DDR controllers
-// type is either CLIENT_DDR_RD_BW or CLIENT_DDR_WR_BW. The ddr_s struct is updated with both
-// read and write counters but only the type is returned by the function.
-static uint64_t pmu_ddr_client(struct ddr_s *ddr, int type)
+// Maps the counters of a socket whose BAR, type and controllers are known,
+// from the PCI scan or the hardware cache
+// Returns 0, -1 on failure with the interface type set to DDR_NONE
+int pmu_ddr_map(struct ddr_s *ddr)
 {
-	uint64_t total = 0; //Initialize total to avoid uninitialized warning
-	uint64_t oldvalue_rd[num_ddr_controllers];
-	uint64_t oldvalue_wr[num_ddr_controllers];
+	int ret = -1;
 
-	char *addr;
+	if (ddr->ddr_interface_type == DDR_CLIENT)
+		ret = pmu_ddr_init_client(ddr, ddr->bar_address);
+	else if (ddr->ddr_interface_type == DDR_GRR_SRF)
+		ret = pmu_ddr_init_grr_srf(ddr, ddr->bar_address);
 
-	if (type == DDR_PMU_RD) {
-		for (int i = 0; i < num_ddr_controllers; i++) {
-			oldvalue_rd[i] = ddr->rd_last_update[i];
+	if (ret < 0)
+		ddr->ddr_interface_type = DDR_NONE;
 
-			addr = ddr->mmap[i] + CLIENT_DDR_RD_BW;
-			ddr->rd_last_update[i] = *((uint64_t *)addr);
+	return ret < 0 ? -1 : 0;
+}
 
-			total += ddr->rd_last_update[i] - oldvalue_rd[i];
-		}
-	} else if (type == DDR_PMU_WR) {
-		for (int i = 0; i < num_ddr_controllers; i++) {
-			oldvalue_wr[i] = ddr->wr_last_update[i];
+// Reads the BAR of a socket again from the config space of the device it
+// was found on, through sysfs and without a PCI scan
+// Returns 0 with the BAR in *bar, -1 if the device can't be read
+int pmu_ddr_read_bar(const struct ddr_s *ddr, uint64_t *bar)
+{
+	char path[PATH_MAX];
+	uint32_t reg[2];
+	int fd, ret = -1;
 
-			addr = ddr->mmap[i] + CLIENT_DDR_WR_BW;
-			ddr->wr_last_update[i] = *((uint64_t *)addr);
+	if (ddr->bar_dev[0] == '\0')
+		return -1;
 
-			total += ddr->wr_last_update[i] - oldvalue_wr[i];
-		}
+	snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/config",
+		 ddr->bar_dev);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (ddr->ddr_interface_type == DDR_CLIENT &&
+	    pread(fd, reg, 4, 0x48) == 4) {
+		*bar = pmu_ddr_client_bar(reg[0]);
+		ret = 0;
+	} else if (ddr->ddr_interface_type == DDR_GRR_SRF &&
+		   pread(fd, reg, 8, 0xD0) == 8) {
+		*bar = pmu_ddr_grr_srf_bar(reg[0], reg[1]);
+		ret = 0;
 	}
+	close(fd);
 
-	return total * 64; // Count CAS, so multiply by 64 to get Bytes
+	return ret;
 }
 
-// DDR read functionality for Sierra Forest and Grandridge CPUs
-// The ddr_s struct is updated with both
-// read and write counters but only the type is returned by the function.
-static uint64_t pmu_ddr_grr_srf(struct ddr_s *ddr, int type)
+// Searches and initializes the DDR PMU of the first socket
+// Returns interface type, including DDR_NONE if nothing found
+int pmu_ddr_init(struct ddr_s *ddr, int kernel_mode)
 {
-	uint64_t total = 0;
-	uint64_t oldvalue_rd[MAX_NUM_DDR_CONTROLLERS];
-	uint64_t oldvalue_wr[MAX_NUM_DDR_CONTROLLERS];
-	char *addr;
+	if (pmu_ddr_init_sockets(ddr, 1, kernel_mode) == 0)
+		ddr->ddr_interface_type = DDR_NONE;
 
-	if (type == DDR_PMU_RD) {
-		// Store old values for calculations
-		for (int i = 0; i < num_ddr_controllers; i++) {
-			oldvalue_rd[i] = ddr->rd_last_update[i];
+	return ddr->ddr_interface_type;
+}
 
-			// Read from counters
-			addr = ddr->mmap[i] + GRR_SRF_FREE_RUN_CNTR_READ;
-			ddr->rd_last_update[i] = *((uint64_t *)addr);
+// Reads RD and WR counters of all DDR channels in one pass
+// Counter pointers are resolved at init, so this works for both client and
+// GRR/SRF controllers. Counters count CAS, i.e. 64 byte transfers.
+// sample may be NULL to only update the last values (e.g. at init).
+// Returns 0, -1 if DDR PMU is not initialized
+int pmu_ddr_sample(struct ddr_s *ddr, struct ddr_sample_s *sample)
+{
+	struct timespec ts;
+	uint64_t now, rd, wr;
+	int nch = ddr->num_ddr_controllers;
 
-			total += ddr->rd_last_update[i] - oldvalue_rd[i];
-		}
-	} else if (type == DDR_PMU_WR) {
-		// Store old values for calculations
-		for (int i = 0; i < num_ddr_controllers; i++) {
-			oldvalue_wr[i] = ddr->wr_last_update[i];
+	if (ddr->ddr_interface_type != DDR_CLIENT &&
+	    ddr->ddr_interface_type != DDR_GRR_SRF)
+		return -1;
 
-			addr = ddr->mmap[i] + GRR_SRF_FREE_RUN_CNTR_WRITE;
-			ddr->wr_last_update[i] = *((uint64_t *)addr);
+	if (nch > MAX_NUM_DDR_CONTROLLERS)
+		nch = MAX_NUM_DDR_CONTROLLERS;
 
-			total += ddr->wr_last_update[i] - oldvalue_wr[i];
-		}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	if (sample) {
+		sample->timestamp_ns = now;
+		sample->time_delta_ns = ddr->last_sample_ns ?
+			now - ddr->last_sample_ns : 0;
+		sample->num_channels = nch;
+		sample->rd_total = 0;
+		sample->wr_total = 0;
 	}
+	ddr->last_sample_ns = now;
+
+	for (int i = 0; i < nch; i++) {
+		// Client parts only resolve the first two controllers
+		if (ddr->rd_cntr[i] == NULL) {
+			if (sample) {
+				sample->rd_bytes[i] = 0;
+				sample->wr_bytes[i] = 0;
+			}
+			continue;
+		}
 
-	return total * 64;
-}
+		rd = *ddr->rd_cntr[i];
+		wr = *ddr->wr_cntr[i];
 
-// Reads current DDR counter values in bytes from the boot / initialization
-// type: CLIENT_DDR_RD_BW or CLIENT_DDR_WR_BW
-// returns current counter value for either RD or WR, -1 if error
-uint64_t pmu_ddr(struct ddr_s *ddr, int type)
-{
-	if (ddr_interface_type == DDR_CLIENT)
-		return pmu_ddr_client(ddr, type);
-	else if (ddr_interface_type == DDR_GRR_SRF)
-		return pmu_ddr_grr_srf(ddr, type);
+		if (sample) {
+			sample->rd_bytes[i] = (rd - ddr->rd_last_update[i]) * 64;
+			sample->wr_bytes[i] = (wr - ddr->wr_last_update[i]) * 64;
+			sample->rd_total += sample->rd_bytes[i];
+			sample->wr_total += sample->wr_bytes[i];
+		}
 
-	return -1;
+		ddr->rd_last_update[i] = rd;
+		ddr->wr_last_update[i] = wr;
+	}
+
+	return 0;
 }
@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "prof.h"
+
+#define TAG "PROF"
+
+struct prof_hist_s {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint32_t bucket[PROF_BUCKETS];
+};
+
+struct prof_thread_s {
+	pid_t tid;
+	int core;
+	uint64_t start_ns;
+	uint64_t intervals;
+	struct rusage start_usage;
+	struct rusage last_usage;	// at the end of the last interval
+	uint64_t start_syscr;
+	uint64_t start_syscw;
+	struct prof_hist_s hist[PROF_PHASES];
+};
+
+int prof_enabled;
+volatile int prof_report_requested;
+
+static struct prof_thread_s *prof_threads;
+static int prof_num_threads;
+
+static const char *prof_phase_names[PROF_PHASES] = {
+	"PMU read", "barrier", "decide", "MSR write", "active",
+};
+
+static int prof_bucket(uint64_t ns)
+{
+	int e;
+
+	if (ns < (1 << PROF_SUB_BITS))
+		return ns;
+
+	e = 63 - __builtin_clzll(ns);
+
+	return ((e - PROF_SUB_BITS + 1) << PROF_SUB_BITS) +
+	       ((ns >> (e - PROF_SUB_BITS)) & ((1 << PROF_SUB_BITS) - 1));
+}
+
+// Highest value of a bucket
+static uint64_t prof_bucket_top(int bucket)
+{
+	int e, sub;
+
+	if (bucket < (1 << PROF_SUB_BITS))
+		return bucket;
+
+	e = (bucket >> PROF_SUB_BITS) + PROF_SUB_BITS - 1;
+	sub = bucket & ((1 << PROF_SUB_BITS) - 1);
+
+	return (((uint64_t)(1 << PROF_SUB_BITS) + sub + 1) <<
+		(e - PROF_SUB_BITS)) - 1;
+}
+
+// Records one sample, see prof.h
+// Each thread only writes its own histograms, no locking
+void prof_record(int thread, int phase, uint64_t ns)
+{
+	struct prof_hist_s *h;
+
+	if (thread < 0 || thread >= prof_num_threads)
+		return;
+
+	h = &prof_threads[thread].hist[phase];
+	h->count++;
+	h->sum_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->bucket[prof_bucket(ns)]++;
+}
+
+static void prof_sigusr1(int sig_num)
+{
+	(void)sig_num;
+	prof_report_requested = 1;
+}
+
+// Enables profiling, see prof.h
+int prof_init(int num_threads)
+{
+	prof_threads = calloc(num_threads, sizeof(*prof_threads));
+	if (prof_threads == NULL) {
+		loge(TAG, "Out of memory for %d threads\n", num_threads);
+		return -1;
+	}
+
+	prof_num_threads = num_threads;
+	prof_enabled = 1;
+	signal(SIGUSR1, prof_sigusr1);
+
+	logi(TAG, "Profiling the tuner, kill -USR1 %d for a report\n",
+	     (int)getpid());
+
+	return 0;
+}
+
+// Read and write class syscalls of a thread so far: MSR preads and pwrites,
+// perf reads
+// Returns: 0, -1 without task IO accounting
+static int prof_read_syscalls(pid_t tid, uint64_t *syscr, uint64_t *syscw)
+{
+	char path[64], line[128];
+	int found = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/io", (int)tid);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "syscr: %lu", syscr) == 1)
+			found++;
+		else if (sscanf(line, "syscw: %lu", syscw) == 1)
+			found++;
+	}
+	fclose(fp);
+
+	return found == 2 ? 0 : -1;
+}
+
+void prof_thread_start(int thread, int core)
+{
+	struct prof_thread_s *t;
+
+	if (!prof_enabled || thread < 0 || thread >= prof_num_threads)
+		return;
+
+	t = &prof_threads[thread];
+	t->tid = gettid();
+	t->core = core;
+	getrusage(RUSAGE_THREAD, &t->start_usage);
+	t->last_usage = t->start_usage;
+	prof_read_syscalls(t->tid, &t->start_syscr, &t->start_syscw);
+	t->start_ns = prof_now_ns();
+}
+
+// One getrusage() per interval, the only cost the profiler adds besides
+// reading the clock
+void prof_thread_interval(int thread)
+{
+	struct prof_thread_s *t;
+
+	if (!prof_enabled || thread < 0 || thread >= prof_num_threads)
+		return;
+
+	t = &prof_threads[thread];
+	getrusage(RUSAGE_THREAD, &t->last_usage);
+	t->intervals++;
+}
+
+static uint64_t prof_percentile(const uint64_t *bucket, uint64_t count,
+				uint64_t max_ns, int percent)
+{
+	uint64_t rank = (count * percent + 99) / 100;
+	uint64_t seen = 0;
+
+	for (int i = 0; i < PROF_BUCKETS; i++) {
+		seen += bucket[i];
+		if (seen >= rank) {
+			uint64_t top = prof_bucket_top(i);
+
+			return top < max_ns ? top : max_ns;
+		}
+	}
+
+	return max_ns;
+}
+
+static double prof_tv_ms(const struct timeval *end, const struct timeval *start)
+{
+	return (end->tv_sec - start->tv_sec) * 1e3 +
+	       (end->tv_usec - start->tv_usec) / 1e3;
+}
+
+// Logs the report, see prof.h
+// Other threads may be in the middle of an interval, their last one can be
+// missing from the report.
+void prof_report(void)
+{
+	static uint64_t bucket[PROF_BUCKETS];
+	double total_cpu_ms = 0.0, max_cpu_ms = 0.0;
+	uint64_t total_intervals = 0;
+	int max_thread = -1;
+
+	if (prof_threads == NULL)
+		return;
+
+	logi(TAG, "%-10s %10s %10s %10s %10s %10s\n", "phase", "samples",
+	     "mean ns", "p50 ns", "p99 ns", "max ns");
+
+	for (int p = 0; p < PROF_PHASES; p++) {
+		uint64_t count = 0, sum = 0, max = 0;
+
+		memset(bucket, 0, sizeof(bucket));
+		for (int t = 0; t < prof_num_threads; t++) {
+			struct prof_hist_s *h = &prof_threads[t].hist[p];
+
+			count += h->count;
+			sum += h->sum_ns;
+			if (h->max_ns > max)
+				max = h->max_ns;
+			for (int i = 0; i < PROF_BUCKETS; i++)
+				bucket[i] += h->bucket[i];
+		}
+
+		if (count == 0)
+			continue;
+
+		logi(TAG, "%-10s %10lu %10lu %10lu %10lu %10lu\n",
+		     prof_phase_names[p], count, sum / count,
+		     prof_percentile(bucket, count, max, 50),
+		     prof_percentile(bucket, count, max, 99), max);
+	}
+
+	for (int i = 0; i < prof_num_threads; i++) {
+		struct prof_thread_s *t = &prof_threads[i];
+		struct rusage *u = &t->last_usage, *s = &t->start_usage;
+		uint64_t syscr = 0, syscw = 0;
+		double user_ms, sys_ms, wall_ms;
+
+		if (t->tid == 0)
+			continue;
+
+		user_ms = prof_tv_ms(&u->ru_utime, &s->ru_utime);
+		sys_ms = prof_tv_ms(&u->ru_stime, &s->ru_stime);
+		wall_ms = (prof_now_ns() - t->start_ns) / 1e6;
+
+		if (prof_read_syscalls(t->tid, &syscr, &syscw) == 0) {
+			syscr -= t->start_syscr;
+			syscw -= t->start_syscw;
+		}
+
+		logv(TAG, "Core %d: %lu intervals, user %.1f ms, sys %.1f ms "
+		     "(%.3f%% of the core), %ld voluntary and %ld involuntary "
+		     "context switches, %lu read and %lu write syscalls\n",
+		     t->core, t->intervals, user_ms, sys_ms,
+		     wall_ms > 0 ? (user_ms + sys_ms) * 100.0 / wall_ms : 0.0,
+		     u->ru_nvcsw - s->ru_nvcsw, u->ru_nivcsw - s->ru_nivcsw,
+		     syscr, syscw);
+
+		total_cpu_ms += user_ms + sys_ms;
+		total_intervals += t->intervals;
+		if (max_thread < 0 || user_ms + sys_ms > max_cpu_ms) {
+			max_cpu_ms = user_ms + sys_ms;
+			max_thread = i;
+		}
+	}
+
+	if (max_thread < 0)
+		return;
+
+	logi(TAG, "Tuning threads used %.1f ms CPU, %.1f us per interval, "
+	     "most core %d with %.1f ms\n", total_cpu_ms,
+	     total_intervals ? total_cpu_ms * 1e3 / total_intervals : 0.0,
+	     prof_threads[max_thread].core, max_cpu_ms);
+}
@@ -2,9 +2,10 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <cpuid.h>
 #if 0
-#include <string.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/signal.h>
@@ -15,6 +16,7 @@
 #endif
 #include "log.h"
 #include "rdt_mbm.h"
+#include "topology.h"
 
 #define TAG "RDT_MBM"
 
@@ -31,6 +33,18 @@ uint32_t max_rmid = 0;
 const uint32_t min_rmid = 1;
 uint32_t num_cores = 0;
 
+/* RMID monitoring groups, one counter read covers all cores of a group */
+struct mbm_group_st mbm_group[MAX_NUM_CORES];
+static unsigned core_group[MAX_NUM_CORES];
+static unsigned num_groups = 0;
+static int group_policy = RDT_GROUP_CORE;
+
+static const char *rdt_group_names[] = {
+	[RDT_GROUP_CORE] = "core",
+	[RDT_GROUP_MODULE] = "module",
+	[RDT_GROUP_ALL] = "all",
+};
+
 extern int core_first;
 extern int core_last;
 
@@ -89,18 +103,128 @@ rdt_mbm_support_check(void)
 	return 0;
 }
 
-/* Allocated RMID for each cores.
-    TODO: Update RMID allocation - refer hw_mon_start_counter() in intel-cmt-cat
-*/
+// Group key for a core under the given policy. Cores with the same key share
+// one RMID and are measured with a single counter read.
+static unsigned core2group_key(unsigned core, int policy)
+{
+	// RMID counters are kept per package, a group never spans two
+	unsigned package = topology.cpu[core].socket;
+
+	switch (policy) {
+	case RDT_GROUP_MODULE:
+		return (package << 16) | topology.cpu[core].cluster;
+	case RDT_GROUP_ALL:
+		return package << 16;
+	default:
+		return (package << 16) | core;
+	}
+}
+
+// Build the monitoring groups for cores [0, mon_cores) and assign one RMID
+// per group. RMIDs are per package, each package numbers its groups from
+// min_rmid. Falls back to a coarser policy if a package runs out of RMIDs.
+static int rdt_mbm_build_groups(int policy, unsigned mon_cores)
+{
+	unsigned keys[MAX_NUM_CORES];
+	unsigned core;
+	unsigned g, top_rmid;
+
+	for (; policy <= RDT_GROUP_ALL; policy++) {
+		num_groups = 0;
+		top_rmid = 0;
+
+		for (core = 0; core < mon_cores; core++) {
+			unsigned key = core2group_key(core, policy);
+
+			for (g = 0; g < num_groups; g++)
+				if (keys[g] == key)
+					break;
+
+			if (g == num_groups) {
+				unsigned rmid = min_rmid;
+
+				// Next free RMID of the package
+				for (unsigned i = 0; i < num_groups; i++)
+					if (keys[i] >> 16 == key >> 16)
+						rmid++;
+				if (rmid > top_rmid)
+					top_rmid = rmid;
+
+				keys[g] = key;
+				mbm_group[g].rmid = rmid;
+				mbm_group[g].read_core = core;
+				mbm_group[g].num_cores = 0;
+				mbm_group[g].delta = 0;
+				mbm_group[g].old_count = 0;
+				num_groups++;
+			}
+
+			mbm_group[g].num_cores++;
+			mbm_data[core].rmid = mbm_group[g].rmid;
+			core_group[core] = g;
+		}
+
+		if (top_rmid < max_rmid)
+			break;
+
+		logi(TAG, "RMID %u of a package exceeds max RMID %u, trying a coarser grouping\n",
+		     top_rmid, max_rmid - 1);
+	}
+
+	if (policy > RDT_GROUP_ALL) {
+		loge(TAG, "Not enough RMIDs for any grouping policy\n");
+		return -1;
+	}
+
+	group_policy = policy;
+	logv(TAG, "RMID grouping '%s': %u groups over %u cores\n",
+	     rdt_group_names[policy], num_groups, mon_cores);
 
+	return 0;
+}
+
+// IA32_QM_EVTSEL value for an RMID + event id pair
+static uint64_t rdt_mbm_evtsel(unsigned rmid, unsigned event)
+{
+	uint64_t val_evtsel;
+
+	val_evtsel = ((uint64_t)rmid) & PQOS_MSR_MON_EVTSEL_RMID_MASK;
+	val_evtsel <<= PQOS_MSR_MON_EVTSEL_RMID_SHIFT;
+	val_evtsel |= ((uint64_t)event) & PQOS_MSR_MON_EVTSEL_EVTID_MASK;
+
+	return val_evtsel;
+}
+
+// RMID assigned to a core by the active grouping policy
 unsigned core2rmid(unsigned core)
 {
-	unsigned rmid;
-	rmid = core + 1;
-	if(rmid > max_rmid)
-		rmid = min_rmid;
-	return rmid;
+	return mbm_data[core].rmid;
 }
+
+// Select the RMID grouping policy, must be called before rdt_mbm_init()
+int rdt_mbm_set_group_policy(int policy)
+{
+	if (policy < RDT_GROUP_CORE || policy > RDT_GROUP_ALL) {
+		loge(TAG, "Invalid RMID grouping policy %d\n", policy);
+		return -1;
+	}
+
+	group_policy = policy;
+
+	return 0;
+}
+
+// Map a policy name (core, module, all) to its RDT_GROUP_* value
+// Returns the policy, or -1 if the name is unknown
+int rdt_mbm_parse_group_policy(const char *name)
+{
+	for (int i = RDT_GROUP_CORE; i <= RDT_GROUP_ALL; i++)
+		if (strcmp(name, rdt_group_names[i]) == 0)
+			return i;
+
+	return -1;
+}
+
 int rdt_mbm_reset(void)
 {
         /* reset core assoc */
@@ -116,8 +240,12 @@ int rdt_mbm_reset(void)
 		retval = msr_set_rmid(core, 0);
 		if (retval != 0)
                         return -1;;
+		msr_mon_evtsel_invalidate(core);
+		mbm_data[core].rmid = 0;
 		close(msr_file_id[core]);
+		msr_file_id[core] = 0;
 	}
+	num_groups = 0;
 	printf("Resetting RDT MBM done\n");
 	return 0;
 }
@@ -142,9 +270,9 @@ get_event_id(const enum pqos_mon_event event)
 
 int rdt_mbm_init(void)
 {
-	uint32_t rmid;
 	uint32_t core;
 	uint32_t mon_count = 0;
+	unsigned g;
 	int ret;
 
 #if DDR_BW_ALL_CORES
@@ -154,28 +282,47 @@ int rdt_mbm_init(void)
 	core_last = num_cores - 1;
 #endif
 
+	// Groups follow the packages and modules of the topology
+	if (topology_init() < 0)
+		return -1;
+
 	/*
 	ToDo: Update RMID allocation - refer hw_mon_start_counter() in intel-cmt-cat
 	*/
+	if (rdt_mbm_build_groups(group_policy, (unsigned)core_last + 1) < 0)
+		return -1;
 
 	// Map rmid
 	for (core = (uint32_t)core_first; core <= (uint32_t)core_last; core++) {
-		rmid = core2rmid(core);
 		// If MSR file is not opened, open it here
 		if (msr_file_id[core] == 0)
 			msr_file_id[core] = msr_open(core);
 		ret = rdt_mbm_set_rmid(core, core2rmid(core));
 		if (ret) {
 			loge(TAG, "Warning: RDT bandwidth monitoring not possible on core %u\n", core);
+			mbm_data[core].rmid = 0;
 			continue;
 		}
-		mbm_data[core].rmid = rmid;
 		mon_count++;
 	}
 	if (!mon_count) {
 		loge(TAG, "Error: RDT bandwidth monitoring not possible on any of the cores\n");
 		return -1;
 	}
+
+	// Counter reads for a group are done on its first associated core
+	for (g = 0; g < num_groups; g++) {
+		mbm_group[g].read_core = MAX_NUM_CORES;
+		for (core = (uint32_t)core_first; core <= (uint32_t)core_last; core++) {
+			if (core_group[core] == g && mbm_data[core].rmid) {
+				mbm_group[g].read_core = core;
+				break;
+			}
+		}
+		mbm_group[g].evtsel = rdt_mbm_evtsel(mbm_group[g].rmid,
+				get_event_id(PQOS_MON_EVENT_TMEM_BW));
+	}
+
 	logd(TAG, "RMID mapping done\n\n");
 	rdt_mbm_bw_get(); //first read can be spiky, flush it.
 	rdt_mbm_bw_get(); //let's do another clean just to be safe
@@ -221,9 +368,8 @@ int rdt_mbm_bw_count(const unsigned core,
         /**
          * Set event selection register (RMID + event id)
          */
-        val_evtsel = ((uint64_t)rmid) & PQOS_MSR_MON_EVTSEL_RMID_MASK;
-        val_evtsel <<= PQOS_MSR_MON_EVTSEL_RMID_SHIFT;
-        val_evtsel |= ((uint64_t)event) & PQOS_MSR_MON_EVTSEL_EVTID_MASK;
+        val_evtsel = rdt_mbm_evtsel(rmid, event);
+        msr_mon_evtsel_invalidate(core);
 
         for (retries = 0; retries < 4; retries++) {
                 if (flag_wrt) {
@@ -272,45 +418,48 @@ int rdt_mbm_bw_count(const unsigned core,
 uint64_t rdt_mbm_bw_get(void)
 {
 	uint64_t band_width;
-	enum pqos_mon_event event = PQOS_MON_EVENT_TMEM_BW;
 	uint64_t bw_count = 0;
-	uint32_t core;
+	uint64_t val;
 	float bw_mbps;
+	unsigned g;
         int ret;
-#if DDR_BW_ALL_CORES
-	// measure all cores
-	int core_first = 0;
-	int core_last;
-	core_last = num_cores - 1;
-#endif
-
-        if((event != PQOS_MON_EVENT_LMEM_BW) &&
-               (event != PQOS_MON_EVENT_TMEM_BW))
-               loge(TAG, "Unsupported event\n");
 
 	total_mbt = 0;
 
-	logv(TAG, "Core\tBW[MB/s]\n");
-	for (core = (uint32_t)core_first; core <= (uint32_t)core_last; core++) {
-		if(!mbm_data[core].rmid) {
-			logi(TAG, "Warning: skipping DDR BW measurement on core %d\n", core);
+	logv(TAG, "Group\tRMID\tCores\tBW[MB/s]\n");
+	for (g = 0; g < num_groups; g++) {
+		struct mbm_group_st *grp = &mbm_group[g];
+
+		if (grp->read_core >= MAX_NUM_CORES) {
+			logi(TAG, "Warning: skipping DDR BW measurement on RMID %u\n",
+			     grp->rmid);
 			continue;
 		}
-		ret = rdt_mbm_bw_count(core, mbm_data[core].rmid,
-			get_event_id(event), &bw_count);
-                if (ret != RETVAL_OK)
-                        return ret;
-		mbm_data[core].delta = bw_count - mbm_data[core].old_count;
-		bw_mbps = (mbm_data[core].delta * scale_factor) / (1024.0 * 1024.0);
-
-		logd(TAG, "rdt_mbm_bw_get(): core %02u, count %lu, "
+
+		// Single QM_CTR read for the whole group, only fall back to
+		// the retrying path if the counter isn't ready
+		ret = msr_get_mon_count_sel(grp->read_core, grp->evtsel, &val);
+		if (ret == 0 && !(val & (PQOS_MSR_MON_QMC_ERROR |
+					 PQOS_MSR_MON_QMC_UNAVAILABLE))) {
+			bw_count = val & PQOS_MSR_MON_QMC_DATA_MASK;
+		} else {
+			ret = rdt_mbm_bw_count(grp->read_core, grp->rmid,
+				get_event_id(PQOS_MON_EVENT_TMEM_BW), &bw_count);
+			if (ret != RETVAL_OK)
+				return ret;
+		}
+
+		grp->delta = bw_count - grp->old_count;
+		bw_mbps = (grp->delta * scale_factor) / (1024.0 * 1024.0);
+
+		logd(TAG, "rdt_mbm_bw_get(): rmid %02u, count %lu, "
 			"old %lu, delta %lu, scale %u, BW[MB/s]: %f\n",
-			core, bw_count, mbm_data[core].old_count,
-			mbm_data[core].delta, scale_factor,
+			grp->rmid, bw_count, grp->old_count,
+			grp->delta, scale_factor,
 			bw_mbps);
-		logv(TAG, "%02u\t%.2f\n", core, bw_mbps);
-		mbm_data[core].old_count = bw_count;
-		total_mbt += mbm_data[core].delta;
+		logv(TAG, "%02u\t%u\t%u\t%.2f\n", g, grp->rmid, grp->num_cores, bw_mbps);
+		grp->old_count = bw_count;
+		total_mbt += grp->delta;
 	}
 	logv(TAG, "rdt_mbm_bw_get(): Total BW[MBps]: %f\n",
 		(float)(total_mbt * scale_factor) / (1024.0 * 1024.0));
@@ -319,3 +468,76 @@ uint64_t rdt_mbm_bw_get(void)
 
 	return band_width;
 }
+
+static uint64_t rdt_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Measure the cost of one bandwidth read for each grouping policy while
+// growing the number of monitored cores. Prints one row per core count.
+int rdt_mbm_bench(int iterations)
+{
+	unsigned mon_cores, step;
+	int policy, i;
+	int saved_policy = group_policy;
+
+	if (rdt_mbm_support_check() < 0)
+		return -1;
+
+	if (iterations <= 0)
+		iterations = 1000;
+
+	step = num_cores >= 16 ? num_cores / 8 : 1;
+
+	printf("RDT MBM read latency, %d iterations per point\n", iterations);
+	printf("Cores");
+	for (policy = RDT_GROUP_CORE; policy <= RDT_GROUP_ALL; policy++)
+		printf("\t%s[us]\tgroups", rdt_group_names[policy]);
+	printf("\n");
+
+	for (mon_cores = step; mon_cores <= num_cores; mon_cores += step) {
+		printf("%u", mon_cores);
+
+		for (policy = RDT_GROUP_CORE; policy <= RDT_GROUP_ALL; policy++) {
+			uint64_t t0, t1;
+			unsigned core;
+
+			if (rdt_mbm_build_groups(policy, mon_cores) < 0 ||
+			    group_policy != policy) {
+				printf("\t-\t-");
+				continue;
+			}
+
+			for (core = 0; core < mon_cores; core++) {
+				if (msr_file_id[core] == 0)
+					msr_file_id[core] = msr_open(core);
+				rdt_mbm_set_rmid(core, core2rmid(core));
+			}
+			for (core = 0; core < num_groups; core++)
+				mbm_group[core].evtsel = rdt_mbm_evtsel(mbm_group[core].rmid,
+					get_event_id(PQOS_MON_EVENT_TMEM_BW));
+
+			t0 = rdt_time_ns();
+			for (i = 0; i < iterations; i++)
+				rdt_mbm_bw_get();
+			t1 = rdt_time_ns();
+
+			printf("\t%.2f\t%u",
+			       (double)(t1 - t0) / iterations / 1000.0, num_groups);
+		}
+		printf("\n");
+
+		if (mon_cores < num_cores && mon_cores + step > num_cores)
+			mon_cores = num_cores - step;
+	}
+
+	group_policy = saved_policy;
+	rdt_mbm_reset();
+
+	return 0;
+}
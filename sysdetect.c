@@ -2,137 +2,34 @@
 
 #include <stdio.h>
 #include <stdint.h>
-#include <cpuid.h>
-#include <sys/sysinfo.h>
-#include <sched.h>
-#include <time.h>
 #include <stdlib.h>
 
 #include "log.h"
 #include "sysdetect.h"
+#include "topology.h"
 
 #define TAG "SYSDETECT"
 
 
-// Function to determine if a cpu core is an atom e-core type or not.
-// Arguments: Cpu core's id number.
-// Returns core_value. If 0x20, then core is an e-core.
-static int get_core_type(int core_number)
-{
-	cpu_set_t cpu_set;
-	cpu_set_t original_set;
-
-	// Get current cpu affinity.
-	if (sched_getaffinity(0, sizeof(cpu_set_t), &original_set) == -1) {
-		loge(TAG, "Error getting current CPU affinity\n");
-		return -1;
-	}
-
-	// Reset & init cpu affinity.
-	CPU_ZERO(&cpu_set);
-	CPU_SET(core_number, &cpu_set);
-
-	// Set cpu affinity for the next task.
-	if (sched_setaffinity(0, sizeof(cpu_set_t), &cpu_set) == -1) {
-		loge(TAG, "Error setting CPU affinity\n");
-		return -2;
-	}
-
-	// Get core type.
-	unsigned int values[4];
-	unsigned int leaf = 0x1a;
-	unsigned int subleaf = 0;
-
-	__cpuid_count(leaf, subleaf, values[0], values[1],
-			values[2], values[3]);
-
-	// Get core value. If 0x20, core is an e-core.
-	int core_value = (values[0] >> 24);
-
-	//Clear cpu from set
-	CPU_CLR(core_number, &cpu_set);
-
-	// Restore original cpu affinity.
-	if (sched_setaffinity(0, sizeof(cpu_set_t), &original_set) == -1) {
-		loge(TAG, "Error restoring original CPU affinity\n");
-		return -3;
-	}
-
-	return core_value;
-}
-
-
-// Function to detect the processor is a hybrid or not.
-// Arguments: No arguments.
-// Returns 1 if hybrid.
-static int get_hybridflag(void)
-{
-	unsigned int values[4];
-	unsigned int hybrid;
-
-	unsigned int leaf = 0x07;
-	unsigned int subleaf = 0;
-
-	__cpuid_count(leaf, subleaf, values[0], values[1],
-				values[2], values[3]);
-
-	//Hybrid detection.
-	hybrid = (values[3] >> 15) & 0x01;
-
-	return hybrid;
-}
-
-
 // Function to get the first and the last efficiency core id's.
+// The E-cores come from the sysfs topology, see topology.c. Sets of E-cores
+// with gaps are better handled with topology_mask().
 // Arguments: No arguments.
 // Returns a struct containing the first and last e-core id's.
 struct e_cores_layout_s get_efficient_core_ids(void)
 {
 	struct e_cores_layout_s core_locations;
 
-	//Initialise first/last e-core location values.
 	core_locations.first_efficiency_core = -1;
 	core_locations.last_efficiency_core = -1;
 
-	//E-core count.
-	int efficient_count = 0;
+	if (topology_init() < 0)
+		return core_locations;
 
-	//Get available cores from OS.
-	int total_cores = get_nprocs_conf();
-	int available_cores = get_nprocs();
+	topology_log();
 
-	//Warning (if there are unavailable cores).
-	if (total_cores > available_cores) {
-		logi(TAG, "%u core(s) might be busy or unavailable.\n",
-			total_cores - available_cores);
-	}
-
-	//If hybrid
-	if (get_hybridflag() == 1) {
-		logv(TAG, "Hybrid processor detected.\n");
-
-		for (int i = 0; i < available_cores; i++) {
-			 //If get_core_type returns 0x20, core is an e-core.
-			if (get_core_type(i) == 0x20) {
-				if (efficient_count == 0) {
-					core_locations.first_efficiency_core =
-								i;
-				}
-
-				core_locations.last_efficiency_core = i;
-				efficient_count++;
-			}
-		}
-	} else { //All Cores are of the same type.
-		logv(TAG, "Non-hybrid processor detected.\n");
-
-		if (get_core_type(0) == 0x20) {
-			//All Efficient Cores.
-			core_locations.first_efficiency_core = 0;
-			core_locations.last_efficiency_core = available_cores -
-									1;
-		}
-	}
+	core_locations.first_efficiency_core = topology_first(TOPO_TYPE_ECORE);
+	core_locations.last_efficiency_core = topology_last(TOPO_TYPE_ECORE);
 
 	//Results
 	logv(TAG, "First Atom E-Core: CPU(%d)\n",
@@ -475,109 +372,3 @@ int dmi_get_bandwidth(void) {
 
 	return total_bandwidth;
 }
-
-// MEASURE MEMORY BANDWIDTH
-
-uint64_t *parray_one;
-uint64_t *parray_two;
-
-// Allocates memory for the arrays, checks for successful allocation
-// If memory allocation fails, logs an error message and returns -1.
-// On successful initialization, returns 0.
-int ddrmembw_init(void) {
-	parray_one = (uint64_t *)malloc(sizeof(uint64_t) * BWTEST_ARRAY_SIZE);
-	if (parray_one == NULL) {
-		loge(TAG, "Memory allocation failed\n");
-		goto RETURN_ERROR;
-	}
-
-	parray_two = (uint64_t *)malloc(sizeof(uint64_t) * BWTEST_ARRAY_SIZE);
-	if (parray_two == NULL) {
-		loge(TAG, "Memory allocation failed\n");
-		goto FREE_ONE;
-	}
-
-	for (int i = 0; i < BWTEST_ARRAY_SIZE; i++) {
-		parray_one[i] = 1.0;
-		parray_two[i] = 0.0;
-	}
-
-	return 0;
-
-FREE_ONE:
-	free(parray_one);
-RETURN_ERROR:
-	return -1;
-}
-
-int ddrmembw_deinit(void) {
-	free(parray_one);
-	free(parray_two);
-
-	return 0;
-}
-
-// Copy with memory barriers to ensure proper memory access
-int ddrmembw_copy(void) {
-	for (int i = 0; i < BWTEST_ARRAY_SIZE; i++)
-		parray_two[i] = parray_one[i];
-	return 0;
-}
-
-// Identify the minimum/best execution time
-// Accepts an array of execution times
-// Returns the minimum time
-double ddrmembw_min_time(double *time_array) {
-	// Check if the array is empty
-	if (time_array[0] == 0)
-		return -1;
-
-	double min = time_array[1];
-
-	for (int i = 1; i < NTIMES; i++) {
-		if (min > time_array[i])
-			min = time_array[i];
-	}
-
-	return min;
-}
-
-// Measures DDR memory bandwidth for the copy operation. Executes the
-// copy operation multiple times, records the execution time for each run,
-// and calculates the minimum execution time. The bandwidth in megabytes
-// per second is computed based on the minimum time and the total
-// data transferred, which is logged for performance analysis.
-int ddrmembw_measurement(void) {
-	clock_t start_time, end_time;
-	double bandwidth;
-	size_t total_byte;
-	double time_taken_array[NTIMES];
-	double min_time;
-
-	// Perform copy operation by NTIMES
-	// Get the various execution times for copy and push to array
-	for (int i = 0; i < NTIMES; i++) {
-		start_time = clock();
-		ddrmembw_copy();
-		end_time = clock();
-		time_taken_array[i] = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-	}
-
-	min_time = ddrmembw_min_time(time_taken_array);
-
-	if (min_time < 0) {
-		loge(TAG, "No time data available for 'copy' operation\n");
-		return -1;
-	}
-
-	total_byte = 2 * BWTEST_ARRAY_SIZE * sizeof(uint64_t);
-	bandwidth = (total_byte / min_time) / MEGABYTE;
-	logv(TAG, "Bandwidth Measured: %f\n", bandwidth);
-
-	if (bandwidth < 1) {
-		loge(TAG, "Bandwidth is %f\n", bandwidth);
-		return 0;
-	}
-
-	return bandwidth;
-}
\ No newline at end of file
@@ -0,0 +1,225 @@
+// Checks the fixed point helpers against libm and the primitive tuner core
+// against the float logic it replaced. Run with make test.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "basicalg_core.h"
+
+#define SAMPLES (1000000)
+
+// Error bounds, in units of the last place (1 / 65536) unless noted
+#define MUL_MAX_ERR (1.0)	// truncated product
+#define DIV_MAX_ERR (1.0)	// truncated quotient
+#define SQRT_MAX_ERR (1.0)	// floor of the exact root
+#define LN_MAX_ERR (5.0)	// one truncation per squaring, then * ln2
+#define EXP_MAX_ERR (5.0)	// e^a for a < 0, Taylor terms truncate each step
+#define EXP_MAX_REL_ERR (2e-4)	// e^a for a >= 0, relative, scaled by 2^n
+
+static int failures;
+static unsigned int seed = 1;
+
+static double to_double(fp_t a)
+{
+	return (double)a / FP_ONE;
+}
+
+// Uniform fixed point value in [lo, hi)
+static fp_t random_fp(double lo, double hi)
+{
+	double r = (double)rand_r(&seed) / ((double)RAND_MAX + 1);
+
+	return (fp_t)llround((lo + r * (hi - lo)) * FP_ONE);
+}
+
+static void check_bound(const char *name, double max_err, double bound,
+			const char *unit)
+{
+	int ok = max_err <= bound;
+
+	printf("%-8s max error %10.3g %s (bound %g) %s\n", name, max_err, unit,
+	       bound, ok ? "ok" : "FAIL");
+	if (!ok)
+		failures++;
+}
+
+static void test_fixedpoint(void)
+{
+	double mul = 0, div = 0, sqr = 0, ln = 0, ex = 0, ex_rel = 0;
+
+	for (int i = 0; i < SAMPLES; i++) {
+		fp_t a = random_fp(-256, 256);
+		fp_t b = random_fp(-256, 256);
+		double err;
+
+		err = fabs(to_double(fp_mul(a, b)) - to_double(a) * to_double(b));
+		mul = fmax(mul, err * FP_ONE);
+
+		// Divisors of at least 1/16 keep the quotient within range
+		if (llabs(b) >= FP_ONE / 16) {
+			err = fabs(to_double(fp_div(a, b)) -
+				   to_double(a) / to_double(b));
+			div = fmax(div, err * FP_ONE);
+		}
+
+		a = random_fp(0, 65536);
+		err = fabs(to_double(fp_sqrt(a)) - sqrt(to_double(a)));
+		sqr = fmax(sqr, err * FP_ONE);
+
+		a = random_fp(1.0 / 1024, 32768);
+		if (a > 0) {
+			err = fabs(to_double(fp_ln(a)) - log(to_double(a)));
+			ln = fmax(ln, err * FP_ONE);
+		}
+
+		a = random_fp(-8, 16);
+		err = fabs(to_double(fp_exp(a)) - exp(to_double(a)));
+		if (a < 0)
+			ex = fmax(ex, err * FP_ONE);
+		else
+			ex_rel = fmax(ex_rel, err / exp(to_double(a)));
+	}
+
+	check_bound("fp_mul", mul, MUL_MAX_ERR, "LSB");
+	check_bound("fp_div", div, DIV_MAX_ERR, "LSB");
+	check_bound("fp_sqrt", sqr, SQRT_MAX_ERR, "LSB");
+	check_bound("fp_ln", ln, LN_MAX_ERR, "LSB");
+	check_bound("fp_exp", ex, EXP_MAX_ERR, "LSB");
+	check_bound("fp_exp", ex_rel, EXP_MAX_REL_ERR, "rel");
+
+	// Edge cases the tuners rely on
+	if (fp_div(FP_ONE, 0) != 0 || fp_sqrt(-FP_ONE) != 0 || fp_ln(0) != 0 ||
+	    fp_exp(FP_FROM_INT(64)) != FP_MAX || fp_exp(-FP_FROM_INT(64)) != 0) {
+		printf("fixedpoint edge cases FAIL\n");
+		failures++;
+	}
+}
+
+// The float step of the tuners before basicalg_core.h, for parameters that
+// shrink at low utilization (XQ); max distance uses the negated step
+static int float_step(double util, float aggr)
+{
+	if (util < 0.10)
+		return 0;	// idle system
+	else if (util < 0.20)
+		return lround(-8 * aggr);
+	else if (util < 0.30)
+		return lround(-4 * aggr);
+	else if (util < 0.40)
+		return lround(-2 * aggr);
+	else if (util < 0.80)
+		return lround(-1 * aggr);
+	else if (util < 0.90)
+		return lround(1 * aggr);
+	else if (util < 0.93)
+		return lround(2 * aggr);
+	else if (util < 0.96)
+		return lround(4 * aggr);
+
+	return lround(8 * aggr);
+}
+
+static int float_clamp(int value, int max)
+{
+	if (value <= 0)
+		value = 1;
+	if (value > max)
+		value = max;
+
+	return value;
+}
+
+// Utilization within one LSB of a threshold, where the truncated fixed
+// point threshold may decide differently from the float comparison
+static int near_threshold(fp_t util)
+{
+	for (int l = 0; l < BASICALG_LEVELS; l++)
+		if (llabs(util - basicalg_thresholds[l]) <= 1)
+			return 1;
+
+	return 0;
+}
+
+// basicalg_delta/basicalg_tune against the float logic for every
+// aggressiveness --aggr accepts (0.1 - 5.0 in steps of 0.1), every
+// utilization up to 1.2 and every start value of the tuned fields
+static void test_basicalg(void)
+{
+	long checked = 0, mismatches = 0;
+
+	for (int aggr10 = 1; aggr10 <= 50; aggr10++) {
+		float aggr = (float)aggr10 / 10;
+
+		for (fp_t util = 0; util <= FP_FROM_RATIO(12, 10); util++) {
+			int step;
+
+			if (near_threshold(util))
+				continue;
+
+			step = float_step(to_double(util), aggr);
+			checked++;
+			if (basicalg_delta(util, aggr10, 1) != step ||
+			    basicalg_delta(util, aggr10, -1) != -step) {
+				if (mismatches++ < 10)
+					printf("delta util %.6f aggr %.1f: %d, float %d\n",
+					       to_double(util), aggr,
+					       basicalg_delta(util, aggr10, 1), step);
+			}
+		}
+
+		for (int l = 0; l <= BASICALG_LEVELS; l++) {
+			// Middle of the level, the top level one past the last threshold
+			fp_t lo = l ? basicalg_thresholds[l - 1] : 0;
+			fp_t hi = l < BASICALG_LEVELS ? basicalg_thresholds[l] :
+				  lo + FP_FROM_RATIO(4, 100);
+			fp_t util = (lo + hi) / 2;
+			int step = float_step(to_double(util), aggr);
+
+			for (int v = 0; v <= 63; v++) {
+				union msr_u msr[5] = { 0 };
+				int xq = v & L2XQ_MAX;
+
+				msr[0].msr1320.L2_STREAM_AMP_XQ_THRESHOLD = xq;
+				msr[0].msr1320.LLC_STREAM_XQ_THRESHOLD = xq;
+				basicalg_tune(BASICALG_XQ, util, aggr10, msr);
+				checked++;
+				if ((int)msr[0].msr1320.L2_STREAM_AMP_XQ_THRESHOLD !=
+				    float_clamp(xq + step, L2XQ_MAX) ||
+				    (int)msr[0].msr1320.LLC_STREAM_XQ_THRESHOLD !=
+				    float_clamp(xq + step, L3XQ_MAX))
+					mismatches++;
+
+				msr[0].msr1320.L2_STREAM_MAX_DISTANCE = v & L2MAXDIST_MAX;
+				msr[0].msr1320.LLC_STREAM_MAX_DISTANCE = v;
+				basicalg_tune(BASICALG_MAXDIST, util, aggr10, msr);
+				checked++;
+				if ((int)msr[0].msr1320.L2_STREAM_MAX_DISTANCE !=
+				    float_clamp((v & L2MAXDIST_MAX) - step, L2MAXDIST_MAX) ||
+				    (int)msr[0].msr1320.LLC_STREAM_MAX_DISTANCE !=
+				    float_clamp(v - step, L3MAXDIST_MAX))
+					mismatches++;
+			}
+		}
+	}
+
+	printf("basicalg %ld cases, %ld differ from the float logic %s\n",
+	       checked, mismatches, mismatches ? "FAIL" : "ok");
+	if (mismatches)
+		failures++;
+}
+
+int main(void)
+{
+	test_fixedpoint();
+	test_basicalg();
+
+	if (failures) {
+		printf("%d test(s) failed\n", failures);
+		return 1;
+	}
+
+	printf("All tests passed\n");
+
+	return 0;
+}
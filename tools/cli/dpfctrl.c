@@ -4,36 +4,30 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <sys/types.h>
 
+#include "../../include/log.h"
 #include "../../include/user_api.h"
 #include "../../kernelmod/kernel_common.h"
 #include "dpfctrl.h"
+#include "export.h"
+#include "pmulog.h"
 
 #define VERSION "1.0.0"
 
+// Set by SIGINT/SIGTERM to end the stream command
+static volatile sig_atomic_t stream_stop;
+
 // Convert number of PMU log entries to bytes
 static size_t entries_to_bytes(size_t entries) {
     return entries * PMU_ENTRY_SIZE_BYTES;
 }
 
-// Get PMU counter name by index
-static const char *get_pmu_counter_name(int index) {
-    static const char *names[] = {
-        "cycles",
-        "instructions",
-        "mem_load_uops",
-        "l2_hit",
-        "l3_hit",
-        "drm_hit",
-        "xq_promotion"
-    };
-    return (index >= 0 && index < PMU_COUNTERS) ? names[index] : "unknown";
-}
-
 // Parse command string to command type
 static enum cmd_type parse_command(const char *cmd) {
     if (!cmd) {
@@ -51,6 +45,12 @@ static enum cmd_type parse_command(const char *cmd) {
     if (strcmp(cmd, "dump") == 0) {
         return CMD_DUMP;
     }
+    if (strcmp(cmd, "stream") == 0) {
+        return CMD_STREAM;
+    }
+    if (strcmp(cmd, "convert") == 0) {
+        return CMD_CONVERT;
+    }
 
     return CMD_UNKNOWN;
 }
@@ -60,7 +60,29 @@ static enum output_format parse_format(const char *fmt) {
     if (!fmt) {
         return FMT_RAW;
     }
-    return strcmp(fmt, "csv") == 0 ? FMT_CSV : FMT_RAW;
+    if (strcmp(fmt, "csv") == 0) {
+        return FMT_CSV;
+    }
+    if (strcmp(fmt, "pmulog") == 0) {
+        return FMT_PMULOG;
+    }
+    if (strcmp(fmt, "columns") == 0) {
+        return FMT_COLUMNS;
+    }
+    return strcmp(fmt, "raw") == 0 ? FMT_RAW : FMT_UNKNOWN;
+}
+
+static const char *format_name(enum output_format format) {
+    switch (format) {
+    case FMT_CSV:
+        return "CSV";
+    case FMT_PMULOG:
+        return "pmulog";
+    case FMT_COLUMNS:
+        return "columns";
+    default:
+        return "raw";
+    }
 }
 
 // Print version information
@@ -77,21 +99,43 @@ void print_usage(void) {
     printf("  start         Start PMU logging\n");
     printf("  stop          Stop PMU logging\n");
     printf("  dump          Dump PMU log data\n");
+    printf("  stream        Drain PMU log data continuously until interrupted\n");
+    printf("  convert       Decode a pmulog file to raw or CSV\n");
 
     printf("  help          Show this help message\n\n");
     printf("OPTIONS\n");
     printf("  For 'start' command:\n");
-    printf("    -s, --size <entries>     Buffer size in entries (default: %d)\n", DEFAULT_BUFFER_ENTRIES);
-    printf("    -m, --mode <reset|append> Logging mode (default: reset)\n\n");
+    printf("    -s, --size <entries>     Buffer size in entries per CPU (default: %d)\n", DEFAULT_BUFFER_ENTRIES);
+    printf("    -m, --mode <reset|append> Logging mode (default: reset)\n");
+    printf("    -p, --policy <drop|overwrite> When a CPU buffer is full, drop new\n");
+    printf("                             entries or overwrite the oldest (default: drop)\n\n");
     printf("  For 'dump' command:\n");
-    printf("    -f, --file <filename>    Output file (required)\n");
-    printf("    -o, --format <raw|csv>   Output format (default: raw)\n\n");
+    printf("    -f, --file <filename>    Output file, a directory for columns (required)\n");
+    printf("    -o, --format <raw|csv|pmulog|columns> Output format (default: raw)\n\n");
+    printf("  For 'stream' command:\n");
+    printf("    -f, --file <filename>    Output file (default: stdout)\n");
+    printf("    -o, --format <raw|csv|pmulog|columns> Output format (default: raw)\n");
+    printf("    -c, --chunk <entries>    Entries per read (default: %d)\n", DEFAULT_STREAM_CHUNK_ENTRIES);
+    printf("    -i, --interval <ms>      Wait when the log is drained (default: %d)\n\n", DEFAULT_STREAM_INTERVAL_MS);
+    printf("  For 'convert' command:\n");
+    printf("    -I, --input <filename>   pmulog file to decode (required)\n");
+    printf("    -f, --file <filename>    Output file (default: stdout)\n");
+    printf("    -o, --format <raw|csv|columns> Output format (default: raw)\n\n");
+    printf("  For csv and columns output:\n");
+    printf("    -d, --delta              Counter deltas to the previous sample of the\n");
+    printf("                             same core instead of absolute values\n");
+    printf("    -t, --threads <n>        CSV formatting threads (default: %d)\n\n", DEFAULT_EXPORT_THREADS);
 
     printf("EXAMPLES\n");
     printf("  sudo dpfctrl start --size 10000 --mode reset\n");
+    printf("  sudo dpfctrl start --size 4096 --policy overwrite\n");
     printf("  sudo dpfctrl start --mode append\n");
     printf("  sudo dpfctrl stop\n");
     printf("  sudo dpfctrl dump --file pmu_data.csv --format csv\n");
+    printf("  sudo dpfctrl stream --file pmu_data.csv --format csv --interval 50\n");
+    printf("  sudo dpfctrl stream --file pmu_data.pmulog --format pmulog\n");
+    printf("  dpfctrl convert --input pmu_data.pmulog --file pmu_data.csv --format csv\n");
+    printf("  dpfctrl convert --input pmu_data.pmulog --file pmu_cols --format columns --delta\n");
 
     printf("NOTE\n");
     printf("  Requires root privileges to access the kernel interface.\n");
@@ -105,8 +149,14 @@ static int process_options(int argc, char *argv[], struct options_s *opts) {
         {"version", no_argument, 0, 'v'},
         {"size", required_argument, 0, 's'},
         {"mode", required_argument, 0, 'm'},
+        {"policy", required_argument, 0, 'p'},
         {"file", required_argument, 0, 'f'},
+        {"input", required_argument, 0, 'I'},
         {"format", required_argument, 0, 'o'},
+        {"chunk", required_argument, 0, 'c'},
+        {"interval", required_argument, 0, 'i'},
+        {"delta", no_argument, 0, 'd'},
+        {"threads", required_argument, 0, 't'},
         {0, 0, 0, 0}
     };
 
@@ -129,7 +179,7 @@ static int process_options(int argc, char *argv[], struct options_s *opts) {
         return 0;
     }
 
-    while ((c = getopt_long(argc, argv, "hvs:m:f:o:e:", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "hvs:m:p:f:I:o:c:i:dt:e:", long_options, &option_index)) != -1) {
         switch (c) {
         case 'h':
             opts->command = CMD_HELP;
@@ -154,13 +204,52 @@ static int process_options(int argc, char *argv[], struct options_s *opts) {
                 return -1;
             }
             break;
+        case 'p':
+            if (strcmp(optarg, "drop") == 0) {
+                opts->policy = DPF_PMU_LOG_DROP;
+            } else if (strcmp(optarg, "overwrite") == 0) {
+                opts->policy = DPF_PMU_LOG_OVERWRITE;
+            } else {
+                fprintf(stderr, "Error: Invalid policy '%s'. Use 'drop' or 'overwrite'\n", optarg);
+                return -1;
+            }
+            break;
         case 'f':
             opts->output_file = optarg;
             break;
+        case 'I':
+            opts->input_file = optarg;
+            break;
         case 'o':
             opts->format = parse_format(optarg);
-            if (opts->format == FMT_RAW && strcmp(optarg, "raw") != 0) {
-                fprintf(stderr, "Error: Invalid format '%s'. Use 'raw' or 'csv'\n", optarg);
+            if (opts->format == FMT_UNKNOWN) {
+                fprintf(stderr, "Error: Invalid format '%s'. Use 'raw', 'csv', 'pmulog' or 'columns'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'c':
+            opts->chunk_entries = atoi(optarg);
+            if (opts->chunk_entries <= 0 ||
+                entries_to_bytes(opts->chunk_entries) > DPF_PMU_LOG_READ_MAX) {
+                fprintf(stderr, "Error: Chunk must be 1 to %zu entries\n",
+                        (size_t)(DPF_PMU_LOG_READ_MAX / PMU_ENTRY_SIZE_BYTES));
+                return -1;
+            }
+            break;
+        case 'i':
+            opts->interval_ms = atoi(optarg);
+            if (opts->interval_ms <= 0) {
+                fprintf(stderr, "Error: Interval must be a positive integer\n");
+                return -1;
+            }
+            break;
+        case 'd':
+            opts->delta = 1;
+            break;
+        case 't':
+            opts->threads = atoi(optarg);
+            if (opts->threads <= 0 || opts->threads > EXPORT_MAX_THREADS) {
+                fprintf(stderr, "Error: Threads must be 1 to %d\n", EXPORT_MAX_THREADS);
                 return -1;
             }
             break;
@@ -174,115 +263,314 @@ static int process_options(int argc, char *argv[], struct options_s *opts) {
     return 0;
 }
 
-// Write PMU data to a CSV file
-void dump_data_csv(FILE *fp, const char *buffer, uint64_t buffer_size) {
-    if (!fp) {
-        fprintf(stderr, "Error: Invalid file pointer\n");
-        return;
+// Output of dump, stream and convert. Raw and pmulog go to fp, CSV and
+// columns through the exporter.
+struct sink_s {
+    enum output_format format;
+    FILE *fp;
+    struct pmulog_writer_s *pmulog;
+    struct exporter_s *exporter;
+};
+
+// Open filename, NULL or "-" for stdout, in the format of opts
+// Returns: 0 on success, -1 on failure
+static int sink_open(struct sink_s *sink, const char *filename,
+                     const struct options_s *opts) {
+    bool to_stdout = !filename || strcmp(filename, "-") == 0;
+
+    memset(sink, 0, sizeof(*sink));
+    sink->format = opts->format;
+
+    if (opts->format == FMT_CSV || opts->format == FMT_COLUMNS) {
+        sink->exporter = exporter_open(filename,
+                                       opts->format == FMT_CSV ? EXPORT_CSV : EXPORT_COLUMNS,
+                                       opts->delta, opts->threads);
+        return sink->exporter ? 0 : -1;
     }
 
-    if (buffer_size % PMU_ENTRY_SIZE_BYTES != 0) {
-        fprintf(stderr, "Error: Invalid buffer size %zu, must be multiple of %zu\n",
-                (size_t)buffer_size, (size_t)PMU_ENTRY_SIZE_BYTES);
-        fprintf(fp, "# Note: Invalid PMU data size\n");
-        return;
+    sink->fp = to_stdout ? stdout : fopen(filename, "wb");
+    if (!sink->fp) {
+        perror("Error: Failed to open output file");
+        fprintf(stderr, "  File: %s\n", filename);
+        return -1;
     }
 
-    const dpf_pmu_log_entry_t *entries = (const dpf_pmu_log_entry_t *)buffer;
-    uint64_t num_entries = buffer_size / PMU_ENTRY_SIZE_BYTES;
-
-    if (num_entries == 0) {
-        fprintf(fp, "# Note: No PMU data available\n");
-        return;
+    if (opts->format == FMT_PMULOG) {
+        sink->pmulog = pmulog_writer_open(sink->fp);
+        if (!sink->pmulog) {
+            perror("Error: Failed to write pmulog header");
+            return -1;
+        }
+    } else {
+        fprintf(sink->fp, "# Raw PMU data stream, entry size: %zu bytes\n",
+                (size_t)PMU_ENTRY_SIZE_BYTES);
     }
 
-    // Write CSV header
-    fprintf(fp, "timestamp,core_id");
-    for (int i = 0; i < PMU_COUNTERS; i++) {
-        fprintf(fp, ",%s", get_pmu_counter_name(i));
-    }
-    fprintf(fp, "\n");
+    return 0;
+}
 
-    // Write data rows
-    for (uint64_t i = 0; i < num_entries; i++) {
-        fprintf(fp, "%llu,%u", (unsigned long long)entries[i].timestamp, entries[i].core_id);
-        for (int j = 0; j < PMU_COUNTERS; j++) {
-            fprintf(fp, ",%llu", (unsigned long long)entries[i].pmu_values[j]);
-        }
-        fprintf(fp, "\n");
+// Returns: 0 on success, -1 on failure
+static int sink_write(struct sink_s *sink, const dpf_pmu_log_entry_t *entries,
+                      size_t count) {
+    if (sink->exporter) {
+        return exporter_write(sink->exporter, entries, count);
+    }
+    if (sink->pmulog) {
+        return pmulog_write(sink->pmulog, entries, count);
     }
+    return fwrite(entries, PMU_ENTRY_SIZE_BYTES, count, sink->fp) == count ? 0 : -1;
+}
 
-    if (fflush(fp) != 0) {
-        perror("Warning: Error flushing CSV file");
+// Make everything written so far visible to readers of the output. pmulog
+// blocks are only written once full.
+static void sink_flush(struct sink_s *sink) {
+    if (sink->exporter) {
+        exporter_flush(sink->exporter);
+    } else {
+        fflush(sink->fp);
     }
 }
 
-// Handle dump command to read and write PMU data
-void handle_dump(const char *filename, enum output_format format) {
-    if (!filename) {
-        fprintf(stderr, "Error: Output file must be specified\n");
-        return;
+// Returns: 0 on success, -1 on failure
+static int sink_close(struct sink_s *sink) {
+    int ret = 0;
+
+    if (sink->exporter && exporter_close(sink->exporter) < 0) {
+        ret = -1;
+    }
+    if (sink->pmulog && pmulog_writer_close(sink->pmulog) < 0) {
+        ret = -1;
+    }
+    if (sink->fp && sink->fp != stdout && fclose(sink->fp) != 0) {
+        ret = -1;
+    }
+    if (sink->fp == stdout && fflush(stdout) != 0) {
+        ret = -1;
     }
 
-    FILE *fp = NULL;
+    memset(sink, 0, sizeof(*sink));
+    return ret;
+}
+
+// Handle dump command to read and write PMU data
+void handle_dump(const struct options_s *opts) {
+    struct sink_s sink;
     char *buffer = NULL;
     uint64_t bytes_read = 0;  // Match kernel's __u64 type
+    uint64_t lost = 0;
     size_t buffer_size = entries_to_bytes(DEFAULT_BUFFER_ENTRIES);
 
     // Allocate buffer
     buffer = malloc(buffer_size);
     if (!buffer) {
         perror("Error: Failed to allocate buffer");
-        goto cleanup;
+        return;
     }
 
     // Read PMU data from kernel
-    int ret = kernel_pmu_log_read(buffer, buffer_size, &bytes_read);
+    int ret = kernel_pmu_log_read(buffer, buffer_size, &bytes_read, &lost);
     if (ret != 0) {
         fprintf(stderr, "Error: Failed to read PMU data (error code: %d)\n", ret);
         goto cleanup;
     }
-    
+
+    if (lost)
+        fprintf(stderr, "Warning: %" PRIu64 " PMU log entries lost since start\n", lost);
+
     if (bytes_read == 0) {
         fprintf(stderr, "Warning: No PMU data available\n");
-        // Don't try to write to fp here since it hasn't been opened yet
         goto cleanup;
     }
 
-    // Open file with appropriate mode
-    const char *mode = (format == FMT_CSV) ? "w" : "wb";
-    fp = fopen(filename, mode);
-    if (!fp) {
-        perror("Error: Failed to open output file");
-        fprintf(stderr, "  File: %s\n", filename);
-        fprintf(stderr, "  Mode: %s\n", mode);
+    if (sink_open(&sink, opts->output_file, opts) < 0) {
+        sink_close(&sink);
         goto cleanup;
     }
 
-    if (format == FMT_CSV) {
-        dump_data_csv(fp, buffer, bytes_read);
-    } else {
-        fprintf(fp, "# Raw PMU data, size: %" PRIu64 " bytes\n", bytes_read);
-        if (fwrite(buffer, 1, (size_t)bytes_read, fp) != (size_t)bytes_read) {
-            perror("Warning: Incomplete write to raw file");
-        }
+    if (sink_write(&sink, (const dpf_pmu_log_entry_t *)buffer,
+                   bytes_read / PMU_ENTRY_SIZE_BYTES) < 0) {
+        perror("Warning: Incomplete write to output file");
+    }
+
+    if (sink_close(&sink) < 0) {
+        perror("Warning: Error closing output file");
     }
 
-    printf("PMU data written to %s in %s format\n", filename, format == FMT_CSV ? "CSV" : "raw");
+    printf("PMU data written to %s in %s format\n", opts->output_file,
+           format_name(opts->format));
 
 cleanup:
-    if (fp && fclose(fp) != 0) {
+    free(buffer);
+}
+
+static void stream_signal(int sig) {
+    (void)sig;
+    stream_stop = 1;
+}
+
+// Handle stream command, drains the kernel PMU log in chunks of at most
+// chunk_entries until SIGINT/SIGTERM, then reads what is left and exits.
+// Reads remove the entries from the kernel log, so its memory stays bounded
+// by the per-CPU ring size.
+void handle_stream(const struct options_s *opts) {
+    struct sigaction sa = { .sa_handler = stream_signal };
+    struct timespec wait = {
+        .tv_sec = opts->interval_ms / 1000,
+        .tv_nsec = (long)(opts->interval_ms % 1000) * 1000000L
+    };
+    size_t chunk_size = entries_to_bytes(opts->chunk_entries);
+    uint64_t bytes_read, lost = 0, lost_reported = 0, total = 0;
+    struct sink_s sink;
+    char *buffer;
+
+    buffer = malloc(chunk_size);
+    if (!buffer) {
+        perror("Error: Failed to allocate buffer");
+        return;
+    }
+
+    if (sink_open(&sink, opts->output_file, opts) < 0) {
+        sink_close(&sink);
+        free(buffer);
+        return;
+    }
+
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    for (;;) {
+        if (kernel_pmu_log_read(buffer, chunk_size, &bytes_read, &lost) != 0) {
+            fprintf(stderr, "Error: Failed to read PMU data\n");
+            break;
+        }
+
+        if (bytes_read > 0) {
+            if (sink_write(&sink, (const dpf_pmu_log_entry_t *)buffer,
+                           bytes_read / PMU_ENTRY_SIZE_BYTES) < 0) {
+                perror("Error: Incomplete write to output file");
+                break;
+            }
+            sink_flush(&sink);
+            total += bytes_read;
+        }
+
+        if (lost > lost_reported) {
+            fprintf(stderr, "Warning: %" PRIu64 " PMU log entries lost\n",
+                    lost - lost_reported);
+            lost_reported = lost;
+        }
+
+        // A short read means the log is drained
+        if (bytes_read < chunk_size) {
+            if (stream_stop) {
+                break;
+            }
+            nanosleep(&wait, NULL);
+        }
+    }
+
+    // pmulog blocks still filling and its index are written on close
+    if (sink_close(&sink) < 0) {
         perror("Warning: Error closing output file");
     }
+
+    fprintf(stderr, "Streamed %" PRIu64 " PMU log entries\n",
+            total / PMU_ENTRY_SIZE_BYTES);
+
     free(buffer);
 }
 
+// Handle convert command, decodes a pmulog file in batches of blocks. Rows
+// are ordered by block, i.e. grouped per core in runs of up to
+// PMULOG_BLOCK_ENTRIES entries.
+// Returns 0, -1 on a corrupt input or a failed write
+int handle_convert(const struct options_s *opts) {
+    struct pmulog_reader_s *r = NULL;
+    dpf_pmu_log_entry_t *entries = NULL;
+    struct sink_s sink = { 0 };
+    uint64_t total = 0;
+    size_t blocks = 0;
+    int ret = -1;
+    FILE *in;
+
+    in = fopen(opts->input_file, "rb");
+    if (!in) {
+        perror("Error: Failed to open input file");
+        fprintf(stderr, "  File: %s\n", opts->input_file);
+        return -1;
+    }
+
+    r = pmulog_reader_open(in);
+    if (!r) {
+        fprintf(stderr, "Error: %s is not a pmulog file\n", opts->input_file);
+        goto cleanup;
+    }
+
+    // Large batches let the exporter split the formatting over threads
+    entries = malloc(CONVERT_BATCH_BLOCKS * PMULOG_BLOCK_ENTRIES * sizeof(*entries));
+    if (!entries) {
+        perror("Error: Failed to allocate buffer");
+        goto cleanup;
+    }
+
+    if (sink_open(&sink, opts->output_file, opts) < 0) {
+        goto cleanup;
+    }
+
+    ret = 0;
+    blocks = pmulog_reader_blocks(r);
+    for (size_t i = 0; i < blocks && ret == 0;) {
+        size_t batch = 0;
+
+        // Blocks of other cores are often partial, only take another one
+        // while a full block still fits
+        for (; i < blocks && batch + PMULOG_BLOCK_ENTRIES <=
+                   CONVERT_BATCH_BLOCKS * PMULOG_BLOCK_ENTRIES; i++) {
+            int n = pmulog_read_block(r, i, entries + batch);
+
+            if (n < 0) {
+                fprintf(stderr, "Error: Corrupt block %zu in %s, %" PRIu64
+                        " entries before it\n", i, opts->input_file,
+                        total + batch);
+                ret = -1;
+                break;
+            }
+            batch += n;
+        }
+
+        // Entries decoded before a corrupt block are still written
+        if (sink_write(&sink, entries, batch) < 0) {
+            perror("Error: Incomplete write to output file");
+            ret = -1;
+            break;
+        }
+        total += batch;
+    }
+
+cleanup:
+    if (sink_close(&sink) < 0) {
+        perror("Error: Failed to close output file");
+        ret = -1;
+    }
+    if (ret == 0) {
+        fprintf(stderr, "Converted %" PRIu64 " PMU log entries in %zu blocks\n",
+                total, blocks);
+    }
+    free(entries);
+    pmulog_reader_close(r);
+    fclose(in);
+
+    return ret;
+}
+
 // Handle start command to initiate PMU logging
-void handle_start(size_t buffer_entries, int mode) {
-    printf("Starting PMU logging with %zu entries in %s mode...\n",
-           buffer_entries, mode == 0 ? "reset" : "append");
+void handle_start(size_t buffer_entries, int mode, int policy) {
+    printf("Starting PMU logging with %zu entries per CPU in %s mode, %s when full...\n",
+           buffer_entries, mode == 0 ? "reset" : "append",
+           policy == DPF_PMU_LOG_OVERWRITE ? "overwrite" : "drop");
 
-    if (kernel_pmu_log_start(buffer_entries, mode) != 0) {
+    if (kernel_pmu_log_start(entries_to_bytes(buffer_entries), mode, policy) != 0) {
         fprintf(stderr, "Error: Failed to start PMU logging\n");
     }
 
@@ -306,7 +594,13 @@ int main(int argc, char *argv[]) {
         .command = CMD_UNKNOWN,
         .buffer_entries = DEFAULT_BUFFER_ENTRIES,
         .mode = DEFAULT_MODE_RESET,
+        .policy = DPF_PMU_LOG_DROP,
+        .chunk_entries = DEFAULT_STREAM_CHUNK_ENTRIES,
+        .interval_ms = DEFAULT_STREAM_INTERVAL_MS,
         .output_file = NULL,
+        .input_file = NULL,
+        .delta = 0,
+        .threads = DEFAULT_EXPORT_THREADS,
         .format = FMT_RAW
     };
 
@@ -322,6 +616,30 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    // Log messages go to stdout, keep them out of a streamed capture
+    if (opts.command == CMD_STREAM &&
+        (!opts.output_file || strcmp(opts.output_file, "-") == 0)) {
+        log_setlevel(1);
+    }
+
+    if (opts.delta && opts.format != FMT_CSV && opts.format != FMT_COLUMNS) {
+        fprintf(stderr, "Error: --delta needs csv or columns output\n");
+        return -1;
+    }
+
+    // Converting only needs the input file
+    if (opts.command == CMD_CONVERT) {
+        if (!opts.input_file) {
+            fprintf(stderr, "Error: Input file required for convert command (--input)\n");
+            return -1;
+        }
+        if (opts.format == FMT_PMULOG) {
+            fprintf(stderr, "Error: convert writes 'raw', 'csv' or 'columns'\n");
+            return -1;
+        }
+        return handle_convert(&opts) < 0 ? -1 : 0;
+    }
+
     // Initialize kernel interface
     if (kernel_mode_init() != 0) {
         fprintf(stderr, "Error: Failed to initialize kernel interface\n");
@@ -332,7 +650,7 @@ int main(int argc, char *argv[]) {
     // Process commands
     switch (opts.command) {
     case CMD_START:
-        handle_start(opts.buffer_entries, opts.mode);
+        handle_start(opts.buffer_entries, opts.mode, opts.policy);
         break;
     case CMD_STOP:
         handle_stop();
@@ -342,7 +660,10 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "Error: Output file required for dump command (--file)\n");
             return -1;
         }
-        handle_dump(opts.output_file, opts.format);
+        handle_dump(&opts);
+        break;
+    case CMD_STREAM:
+        handle_stream(&opts);
         break;
 
     default:
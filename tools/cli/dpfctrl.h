@@ -14,6 +14,10 @@
 #define DEFAULT_BUFFER_ENTRIES (10000)
 #define DEFAULT_MODE_RESET (1)
 #define DEFAULT_OUTPUT_FORMAT "raw"
+#define DEFAULT_STREAM_CHUNK_ENTRIES (4096)
+#define DEFAULT_STREAM_INTERVAL_MS (100)
+#define DEFAULT_EXPORT_THREADS (1)
+#define CONVERT_BATCH_BLOCKS (64)
 
 // Command types
 enum cmd_type {
@@ -21,6 +25,8 @@ enum cmd_type {
 		CMD_START,
 		CMD_STOP,
 		CMD_DUMP,
+		CMD_STREAM,
+		CMD_CONVERT,
 		CMD_HELP
 };
 
@@ -28,7 +34,9 @@ enum cmd_type {
 enum output_format {
     FMT_UNKNOWN,
     FMT_RAW,
-    FMT_CSV
+    FMT_CSV,
+    FMT_PMULOG,
+    FMT_COLUMNS
 };
 
 // Options structure
@@ -36,8 +44,14 @@ struct options_s {
     enum cmd_type command;
     size_t buffer_entries;
     int mode;
+    int policy;
     const char *output_file;
+    const char *input_file;
     enum output_format format;
+    size_t chunk_entries;
+    int interval_ms;
+    int delta;
+    int threads;
 
 };
 
@@ -48,10 +62,11 @@ static enum cmd_type parse_command(const char *cmd);
 static enum output_format parse_format(const char *fmt);
 static void print_usage(void);
 static void print_version(void);
-static void handle_start(size_t buffer_entries, int mode);
+static void handle_start(size_t buffer_entries, int mode, int policy);
 static void handle_stop(void);
-static void handle_dump(const char *filename, enum output_format format);
+static void handle_dump(const struct options_s *opts);
+static void handle_stream(const struct options_s *opts);
+static int handle_convert(const struct options_s *opts);
 static size_t entries_to_bytes(size_t entries);
-static void dump_data_csv(FILE *fp, const char *buffer, uint64_t buffer_size);
 
 #endif // DPFCTRL_H
@@ -0,0 +1,449 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "export.h"
+
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+// Longest CSV row: a 20 digit timestamp and counters, a 10 digit core id,
+// separators and newline
+#define EXPORT_MAX_ROW ((PMU_COUNTERS + 1) * 21 + 11 + 1)
+// Smaller batches are not worth starting threads for
+#define EXPORT_MIN_ROWS_PER_THREAD (8192)
+#define EXPORT_NUM_COLUMNS (PMU_COUNTERS + 2)
+#define EXPORT_COLUMN_BATCH (4096)
+
+struct export_job_s {
+    const dpf_pmu_log_entry_t *entries;
+    size_t count;
+    char *buf;
+    size_t cap;
+    size_t len;
+};
+
+struct exporter_s {
+    int kind;
+    int delta;
+    int threads;
+    uint64_t rows;
+
+    // EXPORT_CSV
+    FILE *fp;
+    char *buf;
+    size_t len;
+    struct export_job_s jobs[EXPORT_MAX_THREADS];
+
+    // EXPORT_COLUMNS, timestamp, core_id, then the counters
+    FILE *cols[EXPORT_NUM_COLUMNS];
+
+    // Delta state, per core
+    dpf_pmu_log_entry_t *scratch;
+    size_t scratch_cap;
+    dpf_pmu_log_entry_t prev[MAX_NUM_CORES];
+    bool seen[MAX_NUM_CORES];
+};
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+const char *export_counter_name(int index) {
+    static const char *names[] = {
+        "cycles",
+        "instructions",
+        "mem_load_uops",
+        "l2_hit",
+        "l3_hit",
+        "drm_hit",
+        "xq_promotion"
+    };
+    return (index >= 0 && index < PMU_COUNTERS) ? names[index] : "unknown";
+}
+
+// Formats v in decimal at p, two digits per division
+// Returns: end of the written digits
+static char *put_u64(char *p, uint64_t v) {
+    char tmp[20];
+    char *t = tmp + sizeof(tmp);
+    size_t n;
+
+    while (v >= 100) {
+        unsigned int r = (unsigned int)(v % 100);
+
+        v /= 100;
+        t -= 2;
+        memcpy(t, digit_pairs + 2 * r, 2);
+    }
+    if (v >= 10) {
+        t -= 2;
+        memcpy(t, digit_pairs + 2 * v, 2);
+    } else {
+        *--t = (char)('0' + v);
+    }
+
+    n = (size_t)(tmp + sizeof(tmp) - t);
+    memcpy(p, t, n);
+    return p + n;
+}
+
+// Formats count CSV rows into buf, which holds count * EXPORT_MAX_ROW bytes
+// Returns: bytes written
+static size_t format_rows(const dpf_pmu_log_entry_t *entries, size_t count,
+                          char *buf) {
+    char *p = buf;
+
+    for (size_t i = 0; i < count; i++) {
+        p = put_u64(p, entries[i].timestamp);
+        *p++ = ',';
+        p = put_u64(p, entries[i].core_id);
+        for (int j = 0; j < PMU_COUNTERS; j++) {
+            *p++ = ',';
+            p = put_u64(p, entries[i].pmu_values[j]);
+        }
+        *p++ = '\n';
+    }
+
+    return (size_t)(p - buf);
+}
+
+static void *format_job(void *arg) {
+    struct export_job_s *job = arg;
+
+    job->len = format_rows(job->entries, job->count, job->buf);
+    return NULL;
+}
+
+static int flush_buffer(struct exporter_s *e) {
+    if (e->len && fwrite(e->buf, 1, e->len, e->fp) != e->len) {
+        return -1;
+    }
+    e->len = 0;
+    return 0;
+}
+
+// Splits a large batch over threads, each formats its part into its own
+// buffer, the buffers are then written in order
+static int write_csv_threaded(struct exporter_s *e, const dpf_pmu_log_entry_t *entries,
+                              size_t count, int nthreads) {
+    pthread_t tids[EXPORT_MAX_THREADS];
+    size_t per_thread = (count + nthreads - 1) / nthreads;
+    int started, i, ret = 0;
+
+    if (flush_buffer(e) < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        struct export_job_s *job = &e->jobs[i];
+        size_t first = (size_t)i * per_thread;
+
+        job->entries = entries + first;
+        job->count = first < count ? count - first : 0;
+        if (job->count > per_thread) {
+            job->count = per_thread;
+        }
+
+        if (job->cap < job->count * EXPORT_MAX_ROW) {
+            char *buf = realloc(job->buf, job->count * EXPORT_MAX_ROW);
+
+            if (!buf) {
+                return -1;
+            }
+            job->buf = buf;
+            job->cap = job->count * EXPORT_MAX_ROW;
+        }
+    }
+
+    // The calling thread formats the first part itself
+    for (started = 1; started < nthreads; started++) {
+        if (pthread_create(&tids[started], NULL, format_job, &e->jobs[started]) != 0) {
+            break;
+        }
+    }
+    format_job(&e->jobs[0]);
+    for (i = 1; i < nthreads; i++) {
+        if (i < started) {
+            pthread_join(tids[i], NULL);
+        } else {
+            format_job(&e->jobs[i]);
+        }
+    }
+
+    for (i = 0; i < nthreads && ret == 0; i++) {
+        if (fwrite(e->jobs[i].buf, 1, e->jobs[i].len, e->fp) != e->jobs[i].len) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+static int write_csv(struct exporter_s *e, const dpf_pmu_log_entry_t *entries,
+                     size_t count) {
+    size_t rows_per_buffer = EXPORT_BUFFER_SIZE / EXPORT_MAX_ROW;
+    int nthreads = e->threads;
+
+    if ((size_t)nthreads > count / EXPORT_MIN_ROWS_PER_THREAD) {
+        nthreads = (int)(count / EXPORT_MIN_ROWS_PER_THREAD);
+    }
+    if (nthreads > 1) {
+        return write_csv_threaded(e, entries, count, nthreads);
+    }
+
+    while (count > 0) {
+        size_t n = count < rows_per_buffer ? count : rows_per_buffer;
+
+        if (e->len + n * EXPORT_MAX_ROW > EXPORT_BUFFER_SIZE && flush_buffer(e) < 0) {
+            return -1;
+        }
+        e->len += format_rows(entries, n, e->buf + e->len);
+        entries += n;
+        count -= n;
+    }
+
+    return 0;
+}
+
+// Transposes entries into one array per field and appends them to the
+// column files
+static int write_columns(struct exporter_s *e, const dpf_pmu_log_entry_t *entries,
+                         size_t count) {
+    uint64_t values[EXPORT_COLUMN_BATCH];
+    uint32_t cores[EXPORT_COLUMN_BATCH];
+
+    for (size_t first = 0; first < count; first += EXPORT_COLUMN_BATCH) {
+        size_t n = count - first < EXPORT_COLUMN_BATCH ? count - first : EXPORT_COLUMN_BATCH;
+        const dpf_pmu_log_entry_t *batch = entries + first;
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+            values[i] = batch[i].timestamp;
+            cores[i] = batch[i].core_id;
+        }
+        if (fwrite(values, sizeof(values[0]), n, e->cols[0]) != n ||
+            fwrite(cores, sizeof(cores[0]), n, e->cols[1]) != n) {
+            return -1;
+        }
+
+        for (int j = 0; j < PMU_COUNTERS; j++) {
+            for (i = 0; i < n; i++) {
+                values[i] = batch[i].pmu_values[j];
+            }
+            if (fwrite(values, sizeof(values[0]), n, e->cols[2 + j]) != n) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Replaces counters with the difference to the previous entry of the same
+// core, drops the first entry of every core
+// Returns: entries to export, NULL on failure
+static const dpf_pmu_log_entry_t *apply_deltas(struct exporter_s *e,
+                                               const dpf_pmu_log_entry_t *entries,
+                                               size_t *count) {
+    size_t n = 0;
+
+    if (e->scratch_cap < *count) {
+        dpf_pmu_log_entry_t *scratch = realloc(e->scratch, *count * sizeof(*scratch));
+
+        if (!scratch) {
+            return NULL;
+        }
+        e->scratch = scratch;
+        e->scratch_cap = *count;
+    }
+
+    for (size_t i = 0; i < *count; i++) {
+        uint32_t core_id = entries[i].core_id;
+        dpf_pmu_log_entry_t *d;
+
+        if (core_id >= MAX_NUM_CORES) {
+            fprintf(stderr, "Error: Invalid core id %u in PMU log\n", core_id);
+            return NULL;
+        }
+
+        if (!e->seen[core_id]) {
+            e->seen[core_id] = true;
+            e->prev[core_id] = entries[i];
+            continue;
+        }
+
+        d = &e->scratch[n++];
+        *d = entries[i];
+        for (int j = 0; j < PMU_COUNTERS; j++) {
+            d->pmu_values[j] -= e->prev[core_id].pmu_values[j];
+        }
+        e->prev[core_id] = entries[i];
+    }
+
+    *count = n;
+    return e->scratch;
+}
+
+static int open_columns(struct exporter_s *e, const char *dir) {
+    char path[PATH_MAX];
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("Error: Failed to create column directory");
+        return -1;
+    }
+
+    for (int i = 0; i < EXPORT_NUM_COLUMNS; i++) {
+        if (i == 0) {
+            snprintf(path, sizeof(path), "%s/timestamp.u64", dir);
+        } else if (i == 1) {
+            snprintf(path, sizeof(path), "%s/core_id.u32", dir);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s.u64", dir, export_counter_name(i - 2));
+        }
+
+        e->cols[i] = fopen(path, "wb");
+        if (!e->cols[i]) {
+            perror("Error: Failed to open column file");
+            fprintf(stderr, "  File: %s\n", path);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+struct exporter_s *exporter_open(const char *path, int kind, int delta,
+                                 int threads) {
+    bool to_stdout = !path || strcmp(path, "-") == 0;
+    struct exporter_s *e;
+
+    e = calloc(1, sizeof(*e));
+    if (!e) {
+        return NULL;
+    }
+
+    e->kind = kind;
+    e->delta = delta;
+    e->threads = threads < 1 ? 1 : threads > EXPORT_MAX_THREADS ? EXPORT_MAX_THREADS : threads;
+
+    if (kind == EXPORT_COLUMNS) {
+        if (to_stdout) {
+            fprintf(stderr, "Error: Column output needs a directory (--file)\n");
+            goto fail;
+        }
+        if (open_columns(e, path) < 0) {
+            goto fail;
+        }
+        return e;
+    }
+
+    e->buf = malloc(EXPORT_BUFFER_SIZE);
+    if (!e->buf) {
+        goto fail;
+    }
+
+    e->fp = to_stdout ? stdout : fopen(path, "w");
+    if (!e->fp) {
+        perror("Error: Failed to open output file");
+        fprintf(stderr, "  File: %s\n", path);
+        goto fail;
+    }
+
+    e->len = (size_t)snprintf(e->buf, EXPORT_BUFFER_SIZE, "timestamp,core_id");
+    for (int i = 0; i < PMU_COUNTERS; i++) {
+        e->len += (size_t)snprintf(e->buf + e->len, EXPORT_BUFFER_SIZE - e->len,
+                                   ",%s", export_counter_name(i));
+    }
+    e->buf[e->len++] = '\n';
+
+    return e;
+
+fail:
+    exporter_close(e);
+    return NULL;
+}
+
+int exporter_write(struct exporter_s *e, const dpf_pmu_log_entry_t *entries,
+                   size_t count) {
+    int ret;
+
+    if (e->delta) {
+        entries = apply_deltas(e, entries, &count);
+        if (!entries) {
+            return -1;
+        }
+    }
+
+    if (e->kind == EXPORT_COLUMNS) {
+        ret = write_columns(e, entries, count);
+    } else {
+        ret = write_csv(e, entries, count);
+    }
+
+    if (ret == 0) {
+        e->rows += count;
+    }
+
+    return ret;
+}
+
+int exporter_flush(struct exporter_s *e) {
+    if (e->fp && (flush_buffer(e) < 0 || fflush(e->fp) != 0)) {
+        return -1;
+    }
+    for (int i = 0; i < EXPORT_NUM_COLUMNS; i++) {
+        if (e->cols[i] && fflush(e->cols[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint64_t exporter_rows(const struct exporter_s *e) {
+    return e->rows;
+}
+
+int exporter_close(struct exporter_s *e) {
+    int ret = 0;
+
+    if (!e) {
+        return 0;
+    }
+
+    if (e->fp) {
+        if (flush_buffer(e) < 0 || fflush(e->fp) != 0) {
+            ret = -1;
+        }
+        if (e->fp != stdout && fclose(e->fp) != 0) {
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < EXPORT_NUM_COLUMNS; i++) {
+        if (e->cols[i] && fclose(e->cols[i]) != 0) {
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; i < EXPORT_MAX_THREADS; i++) {
+        free(e->jobs[i].buf);
+    }
+    free(e->buf);
+    free(e->scratch);
+    free(e);
+
+    return ret;
+}
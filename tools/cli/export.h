@@ -0,0 +1,54 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../../kernelmod/kernel_common.h"
+
+// Fast PMU log exporter for dpfctrl
+//
+// EXPORT_CSV writes one row per entry, formatted without stdio into large
+// buffers. Big batches are split over worker threads, rows keep their order.
+//
+// EXPORT_COLUMNS writes a directory with one file per field, each a plain
+// array in host byte order: timestamp.u64, core_id.u32 and <counter>.u64
+// for every PMU counter. Row i of a capture is element i of every file, so
+// e.g. numpy.fromfile() loads a column directly.
+//
+// With delta set, counters are the difference to the previous entry of the
+// same core, the first entry seen of every core is skipped. Timestamps stay
+// absolute.
+
+#define EXPORT_CSV (0)
+#define EXPORT_COLUMNS (1)
+
+#define EXPORT_MAX_THREADS (64)
+
+struct exporter_s;
+
+// Column name of a PMU counter, also used for CSV headers
+const char *export_counter_name(int index);
+
+// Starts an export to path, NULL or "-" is stdout (CSV only). For
+// EXPORT_COLUMNS path is a directory, created if missing.
+// Returns: exporter, NULL on failure
+struct exporter_s *exporter_open(const char *path, int kind, int delta,
+                                 int threads);
+
+// Returns: 0 on success, -1 on failure
+int exporter_write(struct exporter_s *e, const dpf_pmu_log_entry_t *entries,
+                   size_t count);
+
+// Writes buffered CSV rows out, e.g. after every chunk of a stream
+// Returns: 0 on success, -1 on failure
+int exporter_flush(struct exporter_s *e);
+
+// Entries written so far, after delta filtering
+uint64_t exporter_rows(const struct exporter_s *e);
+
+// Flushes and closes the output, frees the exporter
+// Returns: 0 on success, -1 on failure
+int exporter_close(struct exporter_s *e);
+
+#endif // EXPORT_H
@@ -0,0 +1,511 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "pmulog.h"
+
+#define PMULOG_FILE_MAGIC "DPFL"
+#define PMULOG_BLOCK_MAGIC "PBLK"
+#define PMULOG_INDEX_MAGIC "PIDX"
+
+#define PMULOG_FILE_HEADER_SIZE (8)
+#define PMULOG_BLOCK_HEADER_SIZE (24 + 8 * PMU_COUNTERS)
+#define PMULOG_INDEX_ENTRY_SIZE (32)
+#define PMULOG_TRAILER_SIZE (16)
+
+// Worst case payload, 10 bytes per varint
+#define PMULOG_MAX_PAYLOAD (PMULOG_BLOCK_ENTRIES * (PMU_COUNTERS + 1) * 10)
+
+struct pmulog_core_s {
+    dpf_pmu_log_entry_t *pending;
+    uint32_t count;
+};
+
+struct pmulog_writer_s {
+    FILE *fp;
+    uint64_t offset;    // Bytes written since the file header
+    struct pmulog_core_s cores[MAX_NUM_CORES];
+    struct pmulog_index_s *index;
+    size_t index_count;
+    size_t index_cap;
+    uint8_t payload[PMULOG_MAX_PAYLOAD];
+};
+
+struct pmulog_reader_s {
+    FILE *fp;
+    struct pmulog_index_s *index;
+    size_t index_count;
+    uint8_t payload[PMULOG_MAX_PAYLOAD];
+};
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    uint32_t v = 0;
+
+    for (int i = 0; i < 4; i++) {
+        v |= (uint32_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    uint64_t v = 0;
+
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+// Appends the zigzag varint of cur - prev, returns bytes written
+static size_t put_delta(uint8_t *p, uint64_t cur, uint64_t prev) {
+    int64_t d = (int64_t)(cur - prev);
+    uint64_t v = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+
+    return n;
+}
+
+// Reads one zigzag varint and adds it to prev
+// Returns: bytes consumed, 0 if the varint runs past end
+static size_t get_delta(const uint8_t *p, const uint8_t *end, uint64_t prev,
+                        uint64_t *out) {
+    uint64_t v = 0;
+    size_t n = 0;
+    int shift = 0;
+
+    do {
+        if (p + n >= end || shift > 63) {
+            return 0;
+        }
+        v |= (uint64_t)(p[n] & 0x7f) << shift;
+        shift += 7;
+    } while (p[n++] & 0x80);
+
+    *out = prev + (uint64_t)((v >> 1) ^ (~(v & 1) + 1));
+    return n;
+}
+
+// Encodes and writes the pending entries of one core as a block
+static int pmulog_flush_core(struct pmulog_writer_s *w, uint32_t core_id) {
+    struct pmulog_core_s *c = &w->cores[core_id];
+    const dpf_pmu_log_entry_t *e = c->pending;
+    uint8_t hdr[PMULOG_BLOCK_HEADER_SIZE];
+    struct pmulog_index_s *idx;
+    size_t len = 0;
+    uint32_t i;
+
+    if (c->count == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < c->count; i++) {
+        len += put_delta(w->payload + len, e[i].timestamp,
+                         i ? e[i - 1].timestamp : e[0].timestamp);
+    }
+    for (int j = 0; j < PMU_COUNTERS; j++) {
+        for (i = 0; i < c->count; i++) {
+            len += put_delta(w->payload + len, e[i].pmu_values[j],
+                             i ? e[i - 1].pmu_values[j] : e[0].pmu_values[j]);
+        }
+    }
+
+    memcpy(hdr, PMULOG_BLOCK_MAGIC, 4);
+    put_le32(hdr + 4, core_id);
+    put_le32(hdr + 8, c->count);
+    put_le32(hdr + 12, (uint32_t)len);
+    put_le64(hdr + 16, e[0].timestamp);
+    for (int j = 0; j < PMU_COUNTERS; j++) {
+        put_le64(hdr + 24 + 8 * j, e[0].pmu_values[j]);
+    }
+
+    if (fwrite(hdr, 1, sizeof(hdr), w->fp) != sizeof(hdr) ||
+        fwrite(w->payload, 1, len, w->fp) != len) {
+        return -1;
+    }
+
+    if (w->index_count == w->index_cap) {
+        size_t cap = w->index_cap ? w->index_cap * 2 : 256;
+        struct pmulog_index_s *index = realloc(w->index, cap * sizeof(*index));
+
+        if (!index) {
+            return -1;
+        }
+        w->index = index;
+        w->index_cap = cap;
+    }
+
+    idx = &w->index[w->index_count++];
+    idx->core_id = core_id;
+    idx->count = c->count;
+    idx->offset = w->offset;
+    idx->ts_first = e[0].timestamp;
+    idx->ts_last = e[c->count - 1].timestamp;
+
+    w->offset += sizeof(hdr) + len;
+    c->count = 0;
+
+    return 0;
+}
+
+// Starts a log on fp, writes the file header
+// Returns: writer, NULL on failure
+struct pmulog_writer_s *pmulog_writer_open(FILE *fp) {
+    struct pmulog_writer_s *w;
+    uint8_t hdr[PMULOG_FILE_HEADER_SIZE];
+
+    w = calloc(1, sizeof(*w));
+    if (!w) {
+        return NULL;
+    }
+
+    memcpy(hdr, PMULOG_FILE_MAGIC, 4);
+    hdr[4] = PMULOG_VERSION & 0xff;
+    hdr[5] = PMULOG_VERSION >> 8;
+    hdr[6] = PMU_COUNTERS & 0xff;
+    hdr[7] = PMU_COUNTERS >> 8;
+
+    if (fwrite(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) {
+        free(w);
+        return NULL;
+    }
+
+    w->fp = fp;
+    w->offset = sizeof(hdr);
+
+    return w;
+}
+
+// Adds entries, blocks are written as cores fill them
+// Returns: 0 on success, -1 on failure
+int pmulog_write(struct pmulog_writer_s *w, const dpf_pmu_log_entry_t *entries,
+                 size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t core_id = entries[i].core_id;
+        struct pmulog_core_s *c;
+
+        if (core_id >= MAX_NUM_CORES) {
+            fprintf(stderr, "Error: Invalid core id %u in PMU log\n", core_id);
+            return -1;
+        }
+
+        c = &w->cores[core_id];
+        if (!c->pending) {
+            c->pending = malloc(PMULOG_BLOCK_ENTRIES * sizeof(*c->pending));
+            if (!c->pending) {
+                return -1;
+            }
+        }
+
+        c->pending[c->count++] = entries[i];
+        if (c->count == PMULOG_BLOCK_ENTRIES && pmulog_flush_core(w, core_id) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Writes the remaining blocks and the index, frees the writer
+// Returns: 0 on success, -1 on failure
+int pmulog_writer_close(struct pmulog_writer_s *w) {
+    uint8_t buf[PMULOG_INDEX_ENTRY_SIZE];
+    uint64_t index_offset;
+    int ret = 0;
+
+    for (uint32_t core_id = 0; core_id < MAX_NUM_CORES; core_id++) {
+        if (pmulog_flush_core(w, core_id) < 0) {
+            ret = -1;
+        }
+        free(w->cores[core_id].pending);
+    }
+
+    index_offset = w->offset;
+    for (size_t i = 0; i < w->index_count && ret == 0; i++) {
+        const struct pmulog_index_s *idx = &w->index[i];
+
+        put_le32(buf, idx->core_id);
+        put_le32(buf + 4, idx->count);
+        put_le64(buf + 8, idx->offset);
+        put_le64(buf + 16, idx->ts_first);
+        put_le64(buf + 24, idx->ts_last);
+        if (fwrite(buf, 1, PMULOG_INDEX_ENTRY_SIZE, w->fp) != PMULOG_INDEX_ENTRY_SIZE) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        put_le64(buf, index_offset);
+        put_le32(buf + 8, (uint32_t)w->index_count);
+        memcpy(buf + 12, PMULOG_INDEX_MAGIC, 4);
+        if (fwrite(buf, 1, PMULOG_TRAILER_SIZE, w->fp) != PMULOG_TRAILER_SIZE) {
+            ret = -1;
+        }
+    }
+
+    free(w->index);
+    free(w);
+
+    return ret;
+}
+
+// Reads and checks the block header at offset
+// Returns: payload size, -1 if there is no valid block
+static long pmulog_read_block_header(FILE *fp, uint64_t offset,
+                                     uint32_t *core_id, uint32_t *count,
+                                     uint64_t *ts_base, uint64_t base[]) {
+    uint8_t hdr[PMULOG_BLOCK_HEADER_SIZE];
+    uint32_t len;
+
+    if (fseeko(fp, (off_t)offset, SEEK_SET) != 0 ||
+        fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) ||
+        memcmp(hdr, PMULOG_BLOCK_MAGIC, 4) != 0) {
+        return -1;
+    }
+
+    *core_id = get_le32(hdr + 4);
+    *count = get_le32(hdr + 8);
+    len = get_le32(hdr + 12);
+    *ts_base = get_le64(hdr + 16);
+    for (int j = 0; j < PMU_COUNTERS; j++) {
+        base[j] = get_le64(hdr + 24 + 8 * j);
+    }
+
+    if (*count == 0 || *count > PMULOG_BLOCK_ENTRIES || len > PMULOG_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    return len;
+}
+
+// Decodes the block at offset into entries
+// Returns: number of entries, -1 on failure
+static int pmulog_decode(struct pmulog_reader_s *r, uint64_t offset,
+                         dpf_pmu_log_entry_t *entries) {
+    uint64_t base[PMU_COUNTERS], ts_base, v;
+    const uint8_t *p = r->payload, *end;
+    uint32_t core_id, count, i;
+    long len;
+    size_t n;
+
+    len = pmulog_read_block_header(r->fp, offset, &core_id, &count, &ts_base, base);
+    if (len < 0 || fread(r->payload, 1, (size_t)len, r->fp) != (size_t)len) {
+        return -1;
+    }
+    end = r->payload + len;
+
+    for (i = 0, v = ts_base; i < count; i++) {
+        n = get_delta(p, end, v, &v);
+        if (!n) {
+            return -1;
+        }
+        p += n;
+        entries[i].timestamp = v;
+        entries[i].core_id = core_id;
+    }
+
+    for (int j = 0; j < PMU_COUNTERS; j++) {
+        for (i = 0, v = base[j]; i < count; i++) {
+            n = get_delta(p, end, v, &v);
+            if (!n) {
+                return -1;
+            }
+            p += n;
+            entries[i].pmu_values[j] = v;
+        }
+    }
+
+    return (int)count;
+}
+
+static int pmulog_add_index(struct pmulog_reader_s *r, size_t *cap,
+                            const struct pmulog_index_s *idx) {
+    if (r->index_count == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 256;
+        struct pmulog_index_s *index = realloc(r->index, new_cap * sizeof(*index));
+
+        if (!index) {
+            return -1;
+        }
+        r->index = index;
+        *cap = new_cap;
+    }
+
+    r->index[r->index_count++] = *idx;
+    return 0;
+}
+
+// Loads the index written by pmulog_writer_close()
+// Returns: 0 on success, -1 if the file has no valid index
+static int pmulog_load_index(struct pmulog_reader_s *r) {
+    uint8_t buf[PMULOG_INDEX_ENTRY_SIZE];
+    uint64_t index_offset;
+    uint32_t index_count;
+    size_t cap = 0;
+    off_t size;
+
+    if (fseeko(r->fp, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    size = ftello(r->fp);
+    if (size < PMULOG_FILE_HEADER_SIZE + PMULOG_TRAILER_SIZE ||
+        fseeko(r->fp, size - PMULOG_TRAILER_SIZE, SEEK_SET) != 0 ||
+        fread(buf, 1, PMULOG_TRAILER_SIZE, r->fp) != PMULOG_TRAILER_SIZE ||
+        memcmp(buf + 12, PMULOG_INDEX_MAGIC, 4) != 0) {
+        return -1;
+    }
+
+    index_offset = get_le64(buf);
+    index_count = get_le32(buf + 8);
+    if (index_offset + (uint64_t)index_count * PMULOG_INDEX_ENTRY_SIZE !=
+        (uint64_t)size - PMULOG_TRAILER_SIZE ||
+        fseeko(r->fp, (off_t)index_offset, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < index_count; i++) {
+        struct pmulog_index_s idx;
+
+        if (fread(buf, 1, PMULOG_INDEX_ENTRY_SIZE, r->fp) != PMULOG_INDEX_ENTRY_SIZE) {
+            return -1;
+        }
+        idx.core_id = get_le32(buf);
+        idx.count = get_le32(buf + 4);
+        idx.offset = get_le64(buf + 8);
+        idx.ts_first = get_le64(buf + 16);
+        idx.ts_last = get_le64(buf + 24);
+        if (pmulog_add_index(r, &cap, &idx) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Rebuilds the index of a file without one by walking the blocks
+static int pmulog_scan_blocks(struct pmulog_reader_s *r) {
+    dpf_pmu_log_entry_t *entries;
+    uint64_t offset = PMULOG_FILE_HEADER_SIZE;
+    uint64_t base[PMU_COUNTERS], ts_base;
+    uint32_t core_id, count;
+    size_t cap = 0;
+    long len;
+    int n;
+
+    entries = malloc(PMULOG_BLOCK_ENTRIES * sizeof(*entries));
+    if (!entries) {
+        return -1;
+    }
+
+    for (;;) {
+        struct pmulog_index_s idx;
+
+        len = pmulog_read_block_header(r->fp, offset, &core_id, &count, &ts_base, base);
+        if (len < 0) {
+            break;
+        }
+
+        // A truncated last block ends the scan
+        n = pmulog_decode(r, offset, entries);
+        if (n < 0) {
+            break;
+        }
+
+        idx.core_id = core_id;
+        idx.count = count;
+        idx.offset = offset;
+        idx.ts_first = entries[0].timestamp;
+        idx.ts_last = entries[n - 1].timestamp;
+        if (pmulog_add_index(r, &cap, &idx) < 0) {
+            free(entries);
+            return -1;
+        }
+
+        offset += PMULOG_BLOCK_HEADER_SIZE + (uint64_t)len;
+    }
+
+    free(entries);
+    return 0;
+}
+
+// Opens a log for reading, fp must be seekable
+// Returns: reader, NULL if fp does not hold a PMU log
+struct pmulog_reader_s *pmulog_reader_open(FILE *fp) {
+    struct pmulog_reader_s *r;
+    uint8_t hdr[PMULOG_FILE_HEADER_SIZE];
+
+    if (fseeko(fp, 0, SEEK_SET) != 0 ||
+        fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) ||
+        memcmp(hdr, PMULOG_FILE_MAGIC, 4) != 0) {
+        return NULL;
+    }
+
+    if ((hdr[4] | hdr[5] << 8) != PMULOG_VERSION ||
+        (hdr[6] | hdr[7] << 8) != PMU_COUNTERS) {
+        fprintf(stderr, "Error: Unsupported PMU log version or counter count\n");
+        return NULL;
+    }
+
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+    r->fp = fp;
+
+    if (pmulog_load_index(r) < 0) {
+        free(r->index);
+        r->index = NULL;
+        r->index_count = 0;
+        if (pmulog_scan_blocks(r) < 0) {
+            pmulog_reader_close(r);
+            return NULL;
+        }
+    }
+
+    return r;
+}
+
+size_t pmulog_reader_blocks(const struct pmulog_reader_s *r) {
+    return r->index_count;
+}
+
+const struct pmulog_index_s *pmulog_reader_index(const struct pmulog_reader_s *r,
+                                                 size_t block) {
+    return block < r->index_count ? &r->index[block] : NULL;
+}
+
+// Decodes one block, entries must hold pmulog_reader_index()->count entries
+// Returns: number of entries decoded, -1 on failure
+int pmulog_read_block(struct pmulog_reader_s *r, size_t block,
+                      dpf_pmu_log_entry_t *entries) {
+    if (block >= r->index_count) {
+        return -1;
+    }
+
+    return pmulog_decode(r, r->index[block].offset, entries);
+}
+
+void pmulog_reader_close(struct pmulog_reader_s *r) {
+    if (!r) {
+        return;
+    }
+    free(r->index);
+    free(r);
+}
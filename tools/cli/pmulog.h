@@ -0,0 +1,70 @@
+#ifndef PMULOG_H
+#define PMULOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../../kernelmod/kernel_common.h"
+
+// Columnar PMU log file format
+//
+// file    := header block* [index trailer]
+// header  := "DPFL" u16 version u16 num_counters
+// block   := "PBLK" u32 core_id u32 count u32 payload_size
+//            u64 ts_base u64 base[num_counters] payload
+// payload := one column per field, timestamps first, then each counter.
+//            A column holds count zigzag LEB128 varints, each the delta to
+//            the previous value of the same core (the first to the base).
+// index   := per block: u32 core_id u32 count u64 offset u64 ts_first
+//            u64 ts_last
+// trailer := u64 index_offset u32 index_count "PIDX"
+//
+// All integers are little endian. Every block holds the entries of one
+// core. The index is written on close; files without one, e.g. an
+// interrupted stream, are still readable by scanning the blocks.
+
+#define PMULOG_VERSION (1)
+#define PMULOG_BLOCK_ENTRIES (1024) // Max entries per block
+
+struct pmulog_index_s {
+    uint32_t core_id;
+    uint32_t count;     // Entries in the block
+    uint64_t offset;    // File offset of the block header
+    uint64_t ts_first;
+    uint64_t ts_last;
+};
+
+struct pmulog_writer_s;
+struct pmulog_reader_s;
+
+// Starts a log on fp, writes the file header
+// Returns: writer, NULL on failure
+struct pmulog_writer_s *pmulog_writer_open(FILE *fp);
+
+// Adds entries, blocks are written as cores fill them
+// Returns: 0 on success, -1 on failure
+int pmulog_write(struct pmulog_writer_s *w, const dpf_pmu_log_entry_t *entries,
+                 size_t count);
+
+// Writes the remaining blocks and the index, frees the writer.
+// fp is not closed.
+// Returns: 0 on success, -1 on failure
+int pmulog_writer_close(struct pmulog_writer_s *w);
+
+// Opens a log for reading, fp must be seekable
+// Returns: reader, NULL if fp does not hold a PMU log
+struct pmulog_reader_s *pmulog_reader_open(FILE *fp);
+
+size_t pmulog_reader_blocks(const struct pmulog_reader_s *r);
+const struct pmulog_index_s *pmulog_reader_index(const struct pmulog_reader_s *r,
+                                                 size_t block);
+
+// Decodes one block, entries must hold pmulog_reader_index()->count entries
+// Returns: number of entries decoded, -1 on failure
+int pmulog_read_block(struct pmulog_reader_s *r, size_t block,
+                      dpf_pmu_log_entry_t *entries);
+
+void pmulog_reader_close(struct pmulog_reader_s *r);
+
+#endif // PMULOG_H
@@ -4,6 +4,7 @@
 #include "log.h"
 #include "metrics.h"
 #include "snapshot.h"
+#include "topology.h"
 #include "tuning.h"
 
 // populate the snapshot struct with all core and system metrics
@@ -38,6 +39,11 @@ int update_console_snapshot(struct dpf_console_snapshot_s *snapshot)
 			break;
 		}
 
+		// P-cores and offline cores between the E-cores are not tuned
+		if (!topology.cpu[core].online ||
+		    topology.cpu[core].type != TOPO_TYPE_ECORE)
+			continue;
+
 		// the next core_metrics struct and set core_id
 		core_data = &snapshot->cores[core_index];
 		core_data->core_id = core;
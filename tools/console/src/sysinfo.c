@@ -5,6 +5,7 @@
 #include "pmu_ddr.h"
 #include "sysdetect.h"
 #include "sysinfo.h"
+#include "topology.h"
 #include "user_api.h"
 
 // detect DDR configuration using kernel mode functions
@@ -34,26 +35,11 @@ int kernel_ddr_detect(struct ddr_s *ddr)
 	return 0;
 }
 
-// check if the processor is a hybrid architecture
-// Accepts no parameters
-// returns 1 if hybrid, 0 otherwise
-static int get_hybridflag(void)
-{
-	unsigned int values[4];
-	unsigned int leaf = CPUID_LEAF_EXT_FEATURES;
-	unsigned int subleaf = 0;
-
-	__cpuid_count(leaf, subleaf, values[0], values[1], values[2], values[3]);
-
-	return (values[3] >> CPUID_HYBRID_FLAG_BIT) & 0x01;
-}
-
 // collect system information and fill the provided struct
 // accepts a pointer to a dpf_console_sysinfo_s struct for output
 // returns 0 on success, -1 on failure
 int collect_sysinfo(struct dpf_console_sysinfo_s *out)
 {
-	struct e_cores_layout_s cores; // efficient core IDs
 	struct ddr_s ddr_config;
 	int ret;
 
@@ -73,11 +59,14 @@ int collect_sysinfo(struct dpf_console_sysinfo_s *out)
 		return -1;
 	}
 
-	out->is_hybrid = get_hybridflag();
+	if (topology_init() < 0) {
+		fprintf(stderr, "Topology detection failed\n");
+		return -1;
+	}
 
-	cores = get_efficient_core_ids();
-	out->first_core = cores.first_efficiency_core;
-	out->last_core = cores.last_efficiency_core;
+	out->is_hybrid = topology.hybrid;
+	out->first_core = topology_first(TOPO_TYPE_ECORE);
+	out->last_core = topology_last(TOPO_TYPE_ECORE);
 
 	// DDR config detection
 	memset(&ddr_config, 0, sizeof(ddr_config));
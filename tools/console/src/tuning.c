@@ -13,7 +13,7 @@ int start_tuning(int tuning_enabled)
 {
 	int ret;
 
-	ret = kernel_tuning_control(tuning_enabled, DEFAULT_TUNING_ALG, DEFAULT_AGGRESSION_FACTOR);
+	ret = kernel_tuning_control(tuning_enabled, DEFAULT_TUNING_ALG, DEFAULT_AGGRESSION_FACTOR, 0, 0);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to start tuning: %d\n", ret);
 		return -1;
@@ -29,7 +29,7 @@ int stop_tuning(int tuning_enabled)
 {
 	int ret;
 
-	ret = kernel_tuning_control(tuning_enabled, DEFAULT_TUNING_ALG, DEFAULT_AGGRESSION_FACTOR);
+	ret = kernel_tuning_control(tuning_enabled, DEFAULT_TUNING_ALG, DEFAULT_AGGRESSION_FACTOR, 0, 0);
 	if (ret < 0) {
 		fprintf(stderr, "Failed to stop tuning: %d\n", ret);
 		return -1;
@@ -9,7 +9,7 @@
 #include "console.h"
 #include "log.h"
 #include "metrics_interface.h"
-#include "sysdetect.h"
+#include "topology.h"
 #include "user_api.h"
 
 int current_view;
@@ -24,16 +24,16 @@ struct dpf_console_snapshot_s snapshot;
 struct dpf_console_sysinfo_s sysinfo;
 
 // Detect CPU core topology
-// Sets global core_first/core_last to efficient core range
+// Sets global core_first/core_last to the first and last efficient core
 // Return 0 on success, exits on failure
 int detect_cores(void)
 {
-	struct e_cores_layout_s e_cores;
+	if (topology_init() < 0)
+		return -1;
 
 	if (core_first == -1 || core_last == -1) {
-		e_cores = get_efficient_core_ids();
-		core_first = e_cores.first_efficiency_core;
-		core_last = e_cores.last_efficiency_core;
+		core_first = topology_first(TOPO_TYPE_ECORE);
+		core_last = topology_last(TOPO_TYPE_ECORE);
 
 		if (core_first == -1 || core_last == -1) {
 			fprintf(stderr,
@@ -62,6 +62,7 @@ int detect_cores(void)
 // - ↑/↓: Scroll
 int main(void)
 {
+	uint64_t core_mask[MAX_NUM_CORES / 64];
 	int rows, cols, ch, ret;
 	time_t last_update = 0;
 	time_t now;
@@ -81,8 +82,10 @@ int main(void)
 		exit(1);
 	}
 
-	ret = kernel_core_range(core_first, core_last);
-	if (ret < 0) {
+	// E-cores need not be contiguous, send the exact set
+	topology_mask(TOPO_TYPE_ECORE, core_mask, MAX_NUM_CORES);
+	ret = kernel_core_mask(core_mask, MAX_NUM_CORES);
+	if (ret <= 0) {
 		fprintf(stderr, "Error: Failed to set core range.\n");
 		exit(1);
 	}
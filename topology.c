@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+
+#include <cpuid.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coreset.h"
+#include "log.h"
+#include "topology.h"
+
+#define TAG "TOPOLOGY"
+
+// CPUID 0x1A core type of Atom cores
+#define TOPO_CPUID_ATOM (0x20)
+
+// Longest CPU list read from sysfs
+#define TOPO_MAX_LIST (8192)
+
+struct topology_s topology;
+
+// Reads a small sysfs file into buf, quietly, attributes may be missing
+// Returns: 0 on success, -1 on failure
+static int topo_read_file(const char *path, char *buf, size_t size)
+{
+	FILE *fp;
+	size_t len;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	len = fread(buf, 1, size - 1, fp);
+	fclose(fp);
+	buf[len] = '\0';
+
+	return len > 0 ? 0 : -1;
+}
+
+// Reads an integer attribute of a core
+// Returns: the value, def if the attribute is missing
+static int topo_read_int(int core, const char *attr, int def)
+{
+	char path[PATH_MAX];
+	char buf[32];
+
+	snprintf(path, sizeof(path), TOPO_SYSFS_CPU "/cpu%d/%s", core, attr);
+	if (topo_read_file(path, buf, sizeof(buf)) < 0)
+		return def;
+
+	return strtol(buf, NULL, 10);
+}
+
+// Reads a CPU list file
+// Returns: number of cores, -1 if missing or malformed
+static int topo_read_list(const char *path, cpu_set_t *set)
+{
+	char buf[TOPO_MAX_LIST];
+
+	if (topo_read_file(path, buf, sizeof(buf)) < 0)
+		return -1;
+
+	return coreset_parse(buf, set);
+}
+
+// Lowest core of a CPU list attribute of a core, -1 if missing
+static int topo_read_list_first(int core, const char *attr)
+{
+	char path[PATH_MAX];
+	cpu_set_t set;
+
+	snprintf(path, sizeof(path), TOPO_SYSFS_CPU "/cpu%d/%s", core, attr);
+	if (topo_read_list(path, &set) <= 0)
+		return -1;
+
+	return coreset_first(&set);
+}
+
+// CPUID 7 EDX bit 15, set on hybrid parts
+static int topo_cpuid_hybrid(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	__cpuid_count(0x07, 0, eax, ebx, ecx, edx);
+
+	return (edx >> 15) & 0x01;
+}
+
+// CPUID 0x1A core type of the core this runs on
+static int topo_cpuid_core_type(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	__cpuid_count(0x1a, 0, eax, ebx, ecx, edx);
+
+	return eax >> 24;
+}
+
+// Core type through CPUID on the core itself, the thread is moved there and
+// back. Only for hybrid parts on kernels without cpu_atom or cpu_capacity.
+static int topo_pinned_core_type(int core)
+{
+	cpu_set_t original, set;
+	int type;
+
+	if (sched_getaffinity(0, sizeof(original), &original) == -1)
+		return -1;
+
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) == -1)
+		return -1;
+
+	type = topo_cpuid_core_type();
+
+	if (sched_setaffinity(0, sizeof(original), &original) == -1)
+		loge(TAG, "Error restoring CPU affinity\n");
+
+	return type;
+}
+
+// Sets the type of every core
+static void topo_detect_types(void)
+{
+	int capacity[MAX_NUM_CORES];
+	int max_capacity = 0;
+	cpu_set_t atom;
+	int type;
+
+	topology.hybrid = topo_cpuid_hybrid();
+
+	if (!topology.hybrid) {
+		// All cores are alike, ask the one we run on
+		type = topo_cpuid_core_type() == TOPO_CPUID_ATOM ?
+			TOPO_TYPE_ECORE : TOPO_TYPE_PCORE;
+
+		for (int core = 0; core < topology.num_cpus; core++)
+			topology.cpu[core].type = type;
+		return;
+	}
+
+	// The hybrid PMU driver lists the Atom cores
+	if (topo_read_list(TOPO_SYSFS_ATOM_CPUS, &atom) >= 0) {
+		for (int core = 0; core < topology.num_cpus; core++)
+			topology.cpu[core].type = CPU_ISSET(core, &atom) ?
+				TOPO_TYPE_ECORE : TOPO_TYPE_PCORE;
+		return;
+	}
+
+	// Otherwise E-cores have less than the highest capacity
+	for (int core = 0; core < topology.num_cpus; core++) {
+		capacity[core] = topo_read_int(core, "cpu_capacity", -1);
+		if (capacity[core] > max_capacity)
+			max_capacity = capacity[core];
+	}
+
+	if (max_capacity > 0) {
+		for (int core = 0; core < topology.num_cpus; core++) {
+			if (capacity[core] < 0)
+				continue;
+			topology.cpu[core].type = capacity[core] < max_capacity ?
+				TOPO_TYPE_ECORE : TOPO_TYPE_PCORE;
+		}
+		return;
+	}
+
+	logi(TAG, "No core types in sysfs, probing each core\n");
+
+	for (int core = 0; core < topology.num_cpus; core++) {
+		if (!topology.cpu[core].online)
+			continue;
+
+		type = topo_pinned_core_type(core);
+		if (type >= 0)
+			topology.cpu[core].type = type == TOPO_CPUID_ATOM ?
+				TOPO_TYPE_ECORE : TOPO_TYPE_PCORE;
+	}
+}
+
+// Sets the NUMA node of every core from the node directories
+static void topo_detect_nodes(void)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	cpu_set_t set;
+	DIR *dir;
+
+	dir = opendir(TOPO_SYSFS_NODE);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		int node;
+
+		if (sscanf(entry->d_name, "node%d", &node) != 1)
+			continue;
+
+		snprintf(path, sizeof(path), TOPO_SYSFS_NODE "/node%d/cpulist",
+			 node);
+		if (topo_read_list(path, &set) < 0)
+			continue;
+
+		topology.num_nodes++;
+
+		for (int core = 0; core < topology.num_cpus; core++)
+			if (CPU_ISSET(core, &set))
+				topology.cpu[core].node = node;
+	}
+
+	closedir(dir);
+}
+
+// Counts the clusters, dies and sockets of the online cores
+static void topo_count_domains(void)
+{
+	for (int core = 0; core < topology.num_cpus; core++) {
+		struct topo_cpu_s *c = &topology.cpu[core];
+		int new_die = 1, new_socket = 1;
+
+		if (!c->online)
+			continue;
+
+		topology.num_online++;
+		if (c->type == TOPO_TYPE_ECORE)
+			topology.num_ecores++;
+		if (c->cluster == core)
+			topology.num_clusters++;
+
+		for (int prev = 0; prev < core; prev++) {
+			struct topo_cpu_s *p = &topology.cpu[prev];
+
+			if (!p->online || p->socket != c->socket)
+				continue;
+
+			new_socket = 0;
+			if (p->die == c->die) {
+				new_die = 0;
+				break;
+			}
+		}
+
+		topology.num_sockets += new_socket;
+		topology.num_dies += new_die;
+	}
+}
+
+// Fills topology, see topology.h
+int topology_init(void)
+{
+	cpu_set_t possible, online;
+	int last;
+
+	if (topology.initialized)
+		return 0;
+
+	if (topo_read_list(TOPO_SYSFS_CPU "/online", &online) <= 0) {
+		loge(TAG, "Could not read the online CPUs\n");
+		return -1;
+	}
+
+	if (topo_read_list(TOPO_SYSFS_CPU "/possible", &possible) <= 0)
+		possible = online;
+
+	last = coreset_last(&possible);
+	if (last >= MAX_NUM_CORES) {
+		logi(TAG, "Only the first %d of %d cores are used\n",
+		     MAX_NUM_CORES, last + 1);
+		last = MAX_NUM_CORES - 1;
+	}
+
+	memset(&topology, 0, sizeof(topology));
+	topology.num_cpus = last + 1;
+
+	for (int core = 0; core < topology.num_cpus; core++) {
+		struct topo_cpu_s *c = &topology.cpu[core];
+
+		c->online = CPU_ISSET(core, &online);
+		c->type = TOPO_TYPE_UNKNOWN;
+		c->node = -1;
+
+		// Offline cores keep no topology directory
+		if (!c->online) {
+			c->cluster = core;
+			continue;
+		}
+
+		c->socket = topo_read_int(core, "topology/physical_package_id", 0);
+		c->die = topo_read_int(core, "topology/die_id", 0);
+
+		c->cluster = topo_read_list_first(core, "topology/cluster_cpus_list");
+		if (c->cluster < 0)
+			c->cluster = topo_read_list_first(core,
+					"cache/index2/shared_cpu_list");
+		if (c->cluster < 0)
+			c->cluster = core;
+	}
+
+	topo_detect_types();
+	topo_detect_nodes();
+	topo_count_domains();
+
+	topology.initialized = 1;
+
+	return 0;
+}
+
+static const char *topo_type_name(int type)
+{
+	switch (type) {
+	case TOPO_TYPE_ECORE:
+		return "E-core";
+	case TOPO_TYPE_PCORE:
+		return "P-core";
+	default:
+		return "unknown";
+	}
+}
+
+// Logs the topology, see topology.h
+void topology_log(void)
+{
+	logv(TAG, "%s processor, %d of %d cores online, %d E-cores\n",
+	     topology.hybrid ? "Hybrid" : "Non-hybrid", topology.num_online,
+	     topology.num_cpus, topology.num_ecores);
+	logv(TAG, "%d modules, %d dies, %d sockets, %d NUMA nodes\n",
+	     topology.num_clusters, topology.num_dies, topology.num_sockets,
+	     topology.num_nodes);
+
+	for (int core = 0; core < topology.num_cpus; core++) {
+		struct topo_cpu_s *c = &topology.cpu[core];
+
+		if (!c->online)
+			continue;
+
+		logd(TAG, "CPU(%d) %s module %d die %d socket %d node %d\n",
+		     core, topo_type_name(c->type), c->cluster, c->die,
+		     c->socket, c->node);
+	}
+}
+
+int topology_first(int type)
+{
+	for (int core = 0; core < topology.num_cpus; core++)
+		if (topology.cpu[core].online &&
+		    (type == TOPO_TYPE_UNKNOWN || topology.cpu[core].type == type))
+			return core;
+
+	return -1;
+}
+
+int topology_last(int type)
+{
+	for (int core = topology.num_cpus - 1; core >= 0; core--)
+		if (topology.cpu[core].online &&
+		    (type == TOPO_TYPE_UNKNOWN || topology.cpu[core].type == type))
+			return core;
+
+	return -1;
+}
+
+// Online cores of a type as a bitmask, see topology.h
+int topology_mask(int type, uint64_t *mask, int num_cores)
+{
+	int count = 0;
+
+	memset(mask, 0, ((num_cores + 63) / 64) * sizeof(uint64_t));
+
+	for (int core = 0; core < num_cores && core < topology.num_cpus; core++) {
+		if (!topology.cpu[core].online ||
+		    (type != TOPO_TYPE_UNKNOWN && topology.cpu[core].type != type))
+			continue;
+
+		mask[core / 64] |= 1ULL << (core % 64);
+		count++;
+	}
+
+	return count;
+}
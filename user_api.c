@@ -3,19 +3,21 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <time.h>
 
 #include "kernelmod/kernel_api.h"
 #include "kernelmod/kernel_common.h"
+#include "fixedpoint.h"
 #include "log.h"
 #include "pcie.h"
 #include "pmu_ddr.h"
 #include "user_api.h"
 
 #define TAG "KERNEL_API"
-#define PROC_DEVICE "/proc/dynamicPrefetch"
 
 // PMU logging mode constants
 #define PMU_LOG_MODE_RESET 0
@@ -30,43 +32,154 @@ static uint64_t get_time_ms(void)
 }
 
 
-// Starts PMU event logging with the specified buffer size
-// buffer_size: Size of the buffer to allocate for logging
-// reset: If non-zero, resets the log buffer before starting
-// Returns: 0 on success, -1 on failure
-int kernel_pmu_log_start(size_t buffer_size, int reset)
+// /dev/dpf and its shared area, opened once per process
+static int dpf_fd = -1;
+static const struct dpf_shared_s *dpf_shared;
+
+// Opens /dev/dpf and maps the shared PMU/MSR area on first use
+// Returns: file descriptor, -1 if the module only provides /proc
+static int dpf_dev_open(void)
+{
+	static bool tried;
+	void *shared;
+
+	if (tried)
+		return dpf_fd;
+	tried = true;
+
+	dpf_fd = open(DPF_DEVICE, O_RDWR | O_CLOEXEC);
+	if (dpf_fd < 0) {
+		logd(TAG, "%s not available, using %s\n", DPF_DEVICE, PROC_DEVICE);
+		return -1;
+	}
+
+	shared = mmap(NULL, sizeof(struct dpf_shared_s), PROT_READ, MAP_SHARED,
+		      dpf_fd, 0);
+	if (shared == MAP_FAILED) {
+		logd(TAG, "Failed to map shared area: %s\n", strerror(errno));
+		return dpf_fd;
+	}
+
+	if (((struct dpf_shared_s *)shared)->version != DPF_SHARED_VERSION) {
+		loge(TAG, "Shared area version %u not supported\n",
+		     ((struct dpf_shared_s *)shared)->version);
+		munmap(shared, sizeof(struct dpf_shared_s));
+		return dpf_fd;
+	}
+
+	dpf_shared = shared;
+	return dpf_fd;
+}
+
+// Sends one request to the kernel module and receives its response
+// The ioctl on /dev/dpf is used when available, otherwise a write and
+// read on /proc/dynamicPrefetch
+// Returns: response size in bytes, -1 on failure. With /dev/dpf the size
+// can be larger than resp_size, the response is then truncated.
+static ssize_t dpf_request(const void *req, size_t req_size,
+			   void *resp, size_t resp_size)
 {
+	struct dpf_ioctl_s io;
+	ssize_t ret, total = 0;
 	int fd;
-	ssize_t ret;
-	struct dpf_pmu_log_control_s req;
-	struct dpf_resp_pmu_log_control_s resp;
 
-	req.header.type = DPF_MSG_PMU_LOG_CONTROL;
-	req.header.payload_size = sizeof(struct dpf_pmu_log_control_s);
-	req.buffer_size = buffer_size;
-	req.mode = reset;
+	fd = dpf_dev_open();
+	if (fd >= 0) {
+		io.req_ptr = (uintptr_t)req;
+		io.req_size = req_size;
+		io.resp_ptr = (uintptr_t)resp;
+		io.resp_size = resp_size;
+
+		if (ioctl(fd, DPF_IOC_REQUEST, &io) < 0) {
+			logd(TAG, "Request %u failed: %s\n",
+			     ((const struct dpf_msg_header_s *)req)->type, strerror(errno));
+			return -1;
+		}
+
+		return io.resp_size;
+	}
 
 	fd = open(PROC_DEVICE, O_RDWR);
 	if (fd < 0) {
-		loge(TAG, "Failed to open device file for PMU log control\n");
+		loge(TAG, "Failed to open %s\n", PROC_DEVICE);
 		return -1;
 	}
 
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write PMU log control request\n");
+	if (write(fd, req, req_size) < 0) {
 		close(fd);
 		return -1;
 	}
 
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0) {
-		loge(TAG, "Failed to read PMU log control response\n");
-		close(fd);
-		return -1;
+	while ((size_t)total < resp_size) {
+		ret = read(fd, (char *)resp + total, resp_size - total);
+		if (ret < 0) {
+			close(fd);
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		total += ret;
 	}
 
 	close(fd);
+	return total;
+}
+
+// Copies the last published values of a core from the shared area
+// pmu: true for PMU values, false for MSR values
+// Returns: 0 on success, -1 if not available (caller falls back to a request)
+static int dpf_shared_read(uint32_t core_id, bool pmu, uint64_t *values)
+{
+	const struct dpf_shared_core_s *sc;
+	uint32_t seq;
+	int retries = 1000;
+
+	if (!dpf_shared || core_id >= dpf_shared->num_cores)
+		return -1;
+
+	sc = &dpf_shared->core[core_id];
+
+	do {
+		seq = __atomic_load_n(&sc->seq, __ATOMIC_ACQUIRE);
+		if (seq == 0 || !sc->enabled)
+			return -1;
+		if (seq & 1)
+			continue;
+
+		if (pmu)
+			memcpy(values, sc->pmu_values, sizeof(sc->pmu_values));
+		else
+			memcpy(values, sc->msr_values, sizeof(sc->msr_values));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&sc->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	} while (--retries);
+
+	return -1;
+}
+
+// Starts PMU event logging with the specified buffer size
+// buffer_size: Size in bytes of the log ring of each CPU
+// reset: 0 resets the log before starting, 1 appends
+// policy: DPF_PMU_LOG_DROP or DPF_PMU_LOG_OVERWRITE when a ring is full
+// Returns: 0 on success, -1 on failure
+int kernel_pmu_log_start(size_t buffer_size, int reset, int policy)
+{
+	struct dpf_pmu_log_control_s req;
+	struct dpf_resp_pmu_log_control_s resp;
+
+	req.header.type = DPF_MSG_PMU_LOG_CONTROL;
+	req.header.payload_size = sizeof(struct dpf_pmu_log_control_s);
+	req.buffer_size = buffer_size;
+	req.mode = reset;
+	req.policy = policy;
+
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < 0) {
+		loge(TAG, "PMU log control request failed\n");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -75,111 +188,63 @@ int kernel_pmu_log_start(size_t buffer_size, int reset)
 // Returns: 0 on success, -1 on failure
 int kernel_pmu_log_stop(void)
 {
-	int fd;
-	ssize_t ret;
 	struct dpf_pmu_log_stop_s req;
 	struct dpf_resp_pmu_log_stop_s resp;
 
 	req.header.type = DPF_MSG_PMU_LOG_STOP;
 	req.header.payload_size = sizeof(struct dpf_pmu_log_stop_s);
 
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open device file for PMU log stop\n");
-		return -1;
-	}
-
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write PMU log stop request\n");
-		close(fd);
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < 0) {
+		loge(TAG, "PMU log stop request failed\n");
 		return -1;
 	}
 
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0) {
-		loge(TAG, "Failed to read PMU log stop response\n");
-		close(fd);
-		return -1;
-	}
-
-	close(fd);
 	return 0;
 }
 
 // Reads logged PMU events into the provided buffer
+// Entries read are removed from the kernel log
 // buffer: Pointer to buffer where the log data will be stored
 // max_bytes: Maximum number of bytes that can be written to the buffer
 // bytes_read: Output parameter that receives the actual number of bytes read
+// lost: Output, entries dropped or overwritten since logging started (may be NULL)
 // Returns: 0 on success, -1 on failure
 
-int kernel_pmu_log_read(char *buffer, size_t max_bytes, uint64_t *bytes_read)
+int kernel_pmu_log_read(char *buffer, size_t max_bytes, uint64_t *bytes_read,
+			uint64_t *lost)
 {
-	int fd;
-	ssize_t ret;
 	struct dpf_pmu_log_read_s req;
-	struct dpf_resp_pmu_log_read_s *resp = NULL; // Pointer to response
-	size_t resp_size;
+	struct dpf_resp_pmu_log_read_s *resp;
+	size_t resp_size = sizeof(struct dpf_resp_pmu_log_read_s) + max_bytes;
+	ssize_t ret;
 
 	req.header.type = DPF_MSG_PMU_LOG_READ;
 	req.header.payload_size = sizeof(struct dpf_pmu_log_read_s);
 	req.max_bytes = max_bytes;
 
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open device file for PMU log read\n");
-		return -1;
-	}
-
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write PMU log read request\n");
-		close(fd);
-		return -1;
-	}
-
-	// First read the header and fixed part of response
-	resp = malloc(sizeof(struct dpf_resp_pmu_log_read_s));
+	// The kernel never returns more than max_bytes, so one buffer is enough
+	resp = malloc(resp_size);
 	if (!resp) {
 		loge(TAG, "Failed to allocate response buffer\n");
-		close(fd);
 		return -1;
 	}
 
-	ret = read(fd, resp, sizeof(struct dpf_resp_pmu_log_read_s));
-	if (ret < 0) {
-		loge(TAG, "Failed to read PMU log response header\n");
+	ret = dpf_request(&req, sizeof(req), resp, resp_size);
+	if (ret < (ssize_t)sizeof(struct dpf_resp_pmu_log_read_s)) {
+		loge(TAG, "PMU log read request failed\n");
 		free(resp);
-		close(fd);
-		return -1;
-	}
-
-	// Calculate total response size including data
-	resp_size = sizeof(struct dpf_resp_pmu_log_read_s) + resp->data_size;
-
-	// Reallocate buffer to include data
-	resp = realloc(resp, resp_size);
-	if (!resp) {
-		loge(TAG, "Failed to reallocate response buffer\n");
-		close(fd);
-		return -1;
-	}
-
-	// Read the remaining data
-	ret = read(fd, resp->data, resp->data_size);
-	if (ret < 0) {
-		loge(TAG, "Failed to read PMU log data\n");
-		free(resp);
-		close(fd);
 		return -1;
 	}
 
-	// Copy data to user buffer
 	*bytes_read = resp->data_size;
-	memcpy(buffer, resp->data, resp->data_size);
+	if (*bytes_read > max_bytes)
+		*bytes_read = max_bytes;
+	memcpy(buffer, resp->data, *bytes_read);
+
+	if (lost)
+		*lost = resp->lost;
 
 	free(resp);
-	close(fd);
 	return 0;
 }
 
@@ -188,40 +253,20 @@ int kernel_pmu_log_read(char *buffer, size_t max_bytes, uint64_t *bytes_read)
 // Returns: 0 on success, -1 on failure (unable to open device, read or write)
 int kernel_mode_init(void)
 {
-	int fd;
 	struct dpf_req_init_s req;
 	struct dpf_resp_init_s resp;
-	ssize_t ret;
-
-	// Open proc interface
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open kernel device\n");
-		return -1;
-	}
 
 	// Prepare init request
 	req.header.type = DPF_MSG_INIT;
 	req.header.payload_size = sizeof(struct dpf_req_init_s);
 
-	// Send request
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write to kernel device\n");
-		close(fd);
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < (ssize_t)sizeof(resp)) {
+		loge(TAG, "Failed to initialize kernel module interface\n");
 		return -1;
 	}
 
-	// Read response
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0) {
-		loge(TAG, "Failed to read from kernel device\n");
-		close(fd);
-		return -1;
-	}
-
-	logi(TAG, "API version: %u\n", resp.version);
-	close(fd);
+	logi(TAG, "API version: %u (%s)\n", resp.version,
+	     dpf_fd >= 0 ? DPF_DEVICE : PROC_DEVICE);
 	return 0;
 }
 
@@ -230,9 +275,6 @@ int kernel_mode_init(void)
 // Returns: 0 on success, -1 on failure (device access errors)
 int kernel_core_range(uint32_t start, uint32_t end)
 {
-	int fd;
-	ssize_t ret;
-
 	struct dpf_core_range_s req;
 	struct dpf_resp_core_range_s resp;
 
@@ -241,28 +283,44 @@ int kernel_core_range(uint32_t start, uint32_t end)
 	req.core_start = start;
 	req.core_end = end;
 
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open device file\n");
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < 0) {
+		loge(TAG, "Core range request failed\n");
 		return -1;
 	}
 
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write core range request\n");
+	logd(TAG, "Thread count: %u\n", resp.thread_count);
+
+	return 0;
+}
+
+// Configures the set of CPU cores to be used for prefetching, replaces the
+// core range. Cores of the set that are offline are tuned once they come
+// online.
+// mask: bit n of word n / 64 selects core n, num_cores bits
+// Returns: number of cores tuned now, -1 on failure
+int kernel_core_mask(const uint64_t *mask, int num_cores)
+{
+	struct dpf_core_mask_s req;
+	struct dpf_resp_core_mask_s resp;
+
+	if (num_cores > MAX_NUM_CORES) {
+		loge(TAG, "Core set too large, max is %d cores\n", MAX_NUM_CORES);
 		return -1;
 	}
 
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0) {
-		loge(TAG, "Failed to read core range response\n");
+	memset(&req, 0, sizeof(req));
+	req.header.type = DPF_MSG_CORE_MASK;
+	req.header.payload_size = sizeof(req);
+	memcpy(req.mask, mask, ((num_cores + 63) / 64) * sizeof(uint64_t));
+
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < (ssize_t)sizeof(resp)) {
+		loge(TAG, "Core set request failed\n");
 		return -1;
 	}
 
-	logd(TAG, "Thread count: %u\n", resp.thread_count);
+	logd(TAG, "Cores requested: %u, tuned: %u\n", resp.requested, resp.tuned);
 
-	close(fd);
-	return 0;
+	return resp.tuned;
 }
 
 // Sets priority weights for each core
@@ -270,9 +328,6 @@ int kernel_core_range(uint32_t start, uint32_t end)
 // Returns: 0 on success, and -1 if an error occurred
 int kernel_set_core_weights(int count, int *core_priority)
 {
-	int fd;
-	ssize_t ret;
-
 	if (count <= 0) {
 		loge(TAG, "Invalid core count: %d\n", count);
 		return -1;
@@ -298,23 +353,8 @@ int kernel_set_core_weights(int count, int *core_priority)
 	for (int i = 0; i < count; i++)
 		req->weights[i] = core_priority[i];
 
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open device file\n");
-		return -1;
-	}
-
-	ret = write(fd, req, req_size);
-	if (ret < 0) {
-		loge(TAG, "Failed to write core weight message\n");
-		free(req);
-		free(resp);
-		return -1;
-	}
-
-	ret = read(fd, resp, resp_size);
-	if (ret < 0) {
-		loge(TAG, "Failed to read core weight response\n");
+	if (dpf_request(req, req_size, resp, resp_size) < 0) {
+		loge(TAG, "Core weight request failed\n");
 		free(req);
 		free(resp);
 		return -1;
@@ -325,7 +365,6 @@ int kernel_set_core_weights(int count, int *core_priority)
 		logd(TAG, "Core %u: priority %u\n", i,
 		     resp->confirmed_weights[i]);
 
-	close(fd);
 	free(req);
 	free(resp);
 
@@ -337,8 +376,6 @@ int kernel_set_core_weights(int count, int *core_priority)
 // Returns: 0 on success, and -1 on failure
 int kernel_set_ddr_bandwidth(uint32_t bandwidth)
 {
-	int fd;
-	ssize_t ret;
 	struct dpf_ddrbw_set_s req;
 	struct dpf_resp_ddrbw_set_s resp;
 
@@ -347,32 +384,13 @@ int kernel_set_ddr_bandwidth(uint32_t bandwidth)
 	req.header.payload_size = sizeof(struct dpf_ddrbw_set_s);
 	req.set_value = bandwidth;
 
-	// Open proc interface
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open device file for DDR bandwidth setting\n");
-		return -1;
-	}
-
-	// Send request
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write DDR bandwidth request\n");
-		close(fd);
-		return -1;
-	}
-
-	// Read response
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0) {
-		loge(TAG, "Failed to read DDR bandwidth response\n");
-		close(fd);
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < 0) {
+		loge(TAG, "DDR bandwidth request failed\n");
 		return -1;
 	}
 
 	logd(TAG, "DDR bandwidth confirmed: %u MB/s\n", resp.confirmed_value);
 
-	close(fd);
 	return 0;
 }
 
@@ -380,12 +398,12 @@ int kernel_set_ddr_bandwidth(uint32_t bandwidth)
 // accept tuning_status: Enable (1) or disable (0)
 // tunealg: The tuning algorithm to use
 // aggr_factor: Aggressiveness factor (0.0 to 5.0), scaled by 10 in kernel
+// sample_period_ns, decision_period_ns: PMU sampling and tuning step
+// periods, at least 100 us. 0 keeps the current period of the module.
 // Returns: 0 on success, -1 on failure (device access errors)
-int kernel_tuning_control(uint32_t tuning_status, uint32_t tunealg, float aggr_factor)
+int kernel_tuning_control(uint32_t tuning_status, uint32_t tunealg, float aggr_factor,
+			  uint64_t sample_period_ns, uint64_t decision_period_ns)
 {
-	int fd;
-	ssize_t ret;
-
 	struct dpf_req_tuning_s req;
 	struct dpf_resp_tuning_s resp;
 
@@ -398,116 +416,83 @@ int kernel_tuning_control(uint32_t tuning_status, uint32_t tunealg, float aggr_f
 	}
 
 	// Scale aggressiveness factor by 10 for kernel (0.1 -> 1, 1.0 -> 10, 5.0 -> 50)
-	aggr_scaled = (uint32_t)(aggr_factor * 10.0f);
+	// Rounded half up like the user-space tuner, see basicalg_core.h. The
+	// factor is not negative here, so no libm is needed
+	aggr_scaled = (uint32_t)(aggr_factor * 10.0f + 0.5f);
 
 	req.header.type = DPF_MSG_TUNING;
 	req.header.payload_size = sizeof(req);
 	req.enable = tuning_status;
 	req.tunealg = tunealg;
 	req.aggr = aggr_scaled;
+	req.reserved = 0;
+	req.sample_period_ns = sample_period_ns;
+	req.decision_period_ns = decision_period_ns;
 
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open device file\n");
-		return -1;
-	}
-
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write tuning control request\n");
-		return -1;
-	}
-
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0) {
-		loge(TAG, "Failed to read tuning control response\n");
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < 0) {
+		loge(TAG, "Tuning control request failed\n");
 		return -1;
 	}
 
 	logd(TAG, "Tuning status: %u, Algorithm: %u, Aggressiveness: %u\n",
 	     resp.status, resp.confirmed_tunealg, resp.confirmed_aggr);
-
-	close(fd);
+	logd(TAG, "Sampling every %llu ns, tuning every %llu ns\n",
+	     (unsigned long long)resp.confirmed_sample_period_ns,
+	     (unsigned long long)resp.confirmed_decision_period_ns);
 
 	return 0;
 }
 
 // Read MSR values
+// Served from the /dev/dpf shared area while the core is being tuned
 // accept: Specific core id and array (msr_values)
 // Returns: 0 on success, and -1 on failure
 int kernel_msr_read(uint32_t core_id, uint64_t *msr_values)
 {
-	int fd;
-	ssize_t ret;
 	struct dpf_msr_read_s req;
 	struct dpf_resp_msr_read_s resp;
 
+	// MSRs not loaded yet are read by the request path
+	if (dpf_shared_read(core_id, false, msr_values) == 0 &&
+	    msr_values[MSR_1320_INDEX] != 0)
+		return 0;
+
 	req.header.type = DPF_MSG_MSR_READ;
 	req.header.payload_size = sizeof(struct dpf_msr_read_s);
 	req.core_id = core_id;
 
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open %s for MSR read\n", PROC_DEVICE);
-		return -1;
-	}
-
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write MSR read request for core %u\n", core_id);
-		close(fd);
-		return -1;
-	}
-
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0 || ret != sizeof(resp)) {
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) != sizeof(resp)) {
 		loge(TAG, "Failed to read MSR values for core %u\n", core_id);
-		close(fd);
 		return -1;
 	}
 
 	memcpy(msr_values, resp.msr_values, NR_OF_MSR * sizeof(uint64_t));
-	close(fd);
 
 	return 0;
 }
 
 // Read PMU values
+// Served from the /dev/dpf shared area while the core is being tuned
 // accept: Specific core id and array (pmu_values)
 // Returns: 0 on success, and -1 on failure
 int kernel_pmu_read(uint32_t core_id, uint64_t *pmu_values)
 {
-	int fd;
-	ssize_t ret;
 	struct dpf_pmu_read_s req;
 	struct dpf_resp_pmu_read_s resp;
 
+	if (dpf_shared_read(core_id, true, pmu_values) == 0)
+		return 0;
+
 	req.header.type = DPF_MSG_PMU_READ;
 	req.header.payload_size = sizeof(struct dpf_pmu_read_s);
 	req.core_id = core_id;
 
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open %s for PMU read\n", PROC_DEVICE);
-		return -1;
-	}
-
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write PMU read request for core %u\n", core_id);
-		close(fd);
-		return -1;
-	}
-
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0 || ret != sizeof(resp)) {
-		loge(TAG, "Failed to read PMU values for core %u (ret = %zd, expected = %zu)\n", core_id, ret, sizeof(resp));
-		close(fd);
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) != sizeof(resp)) {
+		loge(TAG, "Failed to read PMU values for core %u\n", core_id);
 		return -1;
 	}
 
 	memcpy(pmu_values, resp.pmu_values, PMU_COUNTERS * sizeof(uint64_t));
-	close(fd);
 
 	return 0;
 }
@@ -517,39 +502,20 @@ int kernel_pmu_read(uint32_t core_id, uint64_t *pmu_values)
 // Returns: 0 on success, -1 on failure
 int kernel_ddr_bw_read(uint64_t *read_bw, uint64_t *write_bw)
 {
-	int fd;
-	ssize_t ret;
 	struct dpf_ddr_bw_read_s req;
 	struct dpf_resp_ddr_bw_read_s resp;
 
 	req.header.type = DPF_MSG_DDR_BW_READ;
 	req.header.payload_size = sizeof(struct dpf_ddr_bw_read_s);
 
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open %s for DDR bandwidth read\n", PROC_DEVICE);
-		return -1;
-	}
-
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write DDR bandwidth read request\n");
-		close(fd);
-		return -1;
-	}
-
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0 || ret != sizeof(resp)) {
-		loge(TAG, "Failed to read DDR bandwidth values (ret = %zd, expected = %zu)\n",
-		     ret, sizeof(resp));
-		close(fd);
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) != sizeof(resp)) {
+		loge(TAG, "Failed to read DDR bandwidth values\n");
 		return -1;
 	}
 
 	*read_bw = resp.read_bw;
 	*write_bw = resp.write_bw;
 
-	close(fd);
 	return 0;
 }
 
@@ -625,8 +591,6 @@ int kernel_log_ddr_bw(void)
 // Returns: 0 on success, -1 on failure (device access errors)
 int kernel_set_ddr_config(struct ddr_s *ddr)
 {
-	int fd;
-	ssize_t ret;
 	struct dpf_ddr_config_s req;
 	struct dpf_resp_ddr_config_s resp;
 
@@ -642,31 +606,85 @@ int kernel_set_ddr_config(struct ddr_s *ddr)
 	req.cpu_type = ddr->ddr_interface_type;
 	req.num_controllers = ddr->num_ddr_controllers;
 
-	// Open proc interface
-	fd = open(PROC_DEVICE, O_RDWR);
-	if (fd < 0) {
-		loge(TAG, "Failed to open device file for DDR config\n");
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < 0) {
+		loge(TAG, "DDR config request failed\n");
 		return -1;
 	}
 
-	ret = write(fd, &req, sizeof(req));
-	if (ret < 0) {
-		loge(TAG, "Failed to write DDR config request\n");
-		close(fd);
+	logd(TAG, "DDR config confirmed: BAR=0x%llx, Type=%u\n",
+	     resp.confirmed_bar, resp.confirmed_type);
+
+	return 0;
+}
+
+// Configure the kernel MAB tuner, used with tunealg 2 in kernel mode
+// algorithm: E_GREEDY, UCB, DUCB or RANDOM
+// arm_configuration: arm set, same as in mab_config.json
+// epsilon, gamma, c: hyperparameters, converted to Q16.16 for the kernel
+// Returns: 0 on success, -1 on failure
+int kernel_mab_config(uint32_t algorithm, uint32_t arm_configuration,
+		      float epsilon, float gamma, float c)
+{
+	struct dpf_mab_config_s req;
+	struct dpf_resp_mab_config_s resp;
+
+	req.header.type = DPF_MSG_MAB_CONFIG;
+	req.header.payload_size = sizeof(struct dpf_mab_config_s);
+	req.algorithm = algorithm;
+	req.arm_configuration = arm_configuration;
+	req.epsilon = (uint32_t)(epsilon * FP_ONE);
+	req.gamma = (uint32_t)(gamma * FP_ONE);
+	req.c = (uint32_t)(c * FP_ONE);
+
+	if (dpf_request(&req, sizeof(req), &resp, sizeof(resp)) < 0) {
+		loge(TAG, "MAB config request failed\n");
 		return -1;
 	}
 
-	ret = read(fd, &resp, sizeof(resp));
-	if (ret < 0) {
-		loge(TAG, "Failed to read DDR config response\n");
-		close(fd);
+	logd(TAG, "MAB config: algorithm %u, arm configuration %u\n",
+	     resp.confirmed_algorithm, resp.confirmed_arm_configuration);
+
+	return 0;
+}
+
+// Read the sampling timer statistics of the kernel module
+// stats: filled with periods, ticks, overruns and jitter
+// reset: clear the statistics in the module after reading them
+// Returns: 0 on success, -1 on failure
+int kernel_timer_stats(struct dpf_resp_timer_stats_s *stats, int reset)
+{
+	struct dpf_timer_stats_s req;
+
+	req.header.type = DPF_MSG_TIMER_STATS;
+	req.header.payload_size = sizeof(struct dpf_timer_stats_s);
+	req.reset = reset;
+
+	if (dpf_request(&req, sizeof(req), stats, sizeof(*stats)) < 0) {
+		loge(TAG, "Timer stats request failed\n");
 		return -1;
 	}
 
-	logd(TAG, "DDR config confirmed: BAR=0x%llx, Type=%u\n",
-	     resp.confirmed_bar, resp.confirmed_type);
+	return 0;
+}
 
-	close(fd);
+// Log the sampling timer statistics of the kernel module
+// Returns: 0 on success, -1 on failure
+int kernel_log_timer_stats(void)
+{
+	static const char *modes[] = { "IPI", "per-CPU timers", "PMU events" };
+	struct dpf_resp_timer_stats_s stats;
+
+	if (kernel_timer_stats(&stats, 0) < 0)
+		return -1;
+
+	logi(TAG, "Sampling every %llu us (%s), tuning every %llu us\n",
+	     (unsigned long long)stats.sample_period_ns / 1000,
+	     stats.sampling_mode <= DPF_SAMPLING_EVENT ? modes[stats.sampling_mode] : "unknown",
+	     (unsigned long long)stats.decision_period_ns / 1000);
+	logi(TAG, "Timer ticks %llu, overruns %llu, jitter avg %llu ns max %llu ns\n",
+	     (unsigned long long)stats.ticks, (unsigned long long)stats.overruns,
+	     (unsigned long long)stats.jitter_avg_ns,
+	     (unsigned long long)stats.jitter_max_ns);
 
 	return 0;
 }